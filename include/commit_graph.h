@@ -0,0 +1,40 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "gitnano.h"
+
+// The commit-graph is a chain of layer files listed base first in the chain
+// file. Each layer holds the commits added since the layers below it, so a
+// commit only writes a small layer; layers are merged when a new one grows
+// to more than half the size of the one below.
+#define COMMIT_GRAPH_DIR OBJECTS_DIR "/info/commit-graphs"
+#define COMMIT_GRAPH_CHAIN COMMIT_GRAPH_DIR "/commit-graph-chain"
+#define COMMIT_GRAPH_MERGE_FACTOR 2
+
+// Layer file layout (integers big-endian): signature, version, hash
+// algorithm, commit count and the number of commits in the layers below;
+// a 256-entry fanout on the first id byte; the sorted commit ids; one
+// record per commit; and a SHA-1 of everything before it. A commit's
+// position is its index in the layer plus the commits below the layer.
+#define COMMIT_GRAPH_SIGNATURE "CGPH"
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_HEADER_SIZE 20
+
+// Record: tree id, parent position, generation, commit time (u64)
+#define COMMIT_GRAPH_PARENT_NONE 0xffffffffu     // root commit
+#define COMMIT_GRAPH_PARENT_MISSING 0xfffffffeu  // parent is not a GitNano commit
+
+typedef struct {
+    object_id oid;
+    object_id tree_oid;
+    object_id parent_oid;  // null for a root commit or a missing parent
+    int parent_missing;    // the parent is named but not in the repository
+    uint32_t generation;   // 1 for a root commit, parent's plus one otherwise
+    uint64_t timestamp;
+} commit_graph_entry;
+
+int commit_graph_lookup(const object_id *oid, commit_graph_entry *entry_out);
+int commit_graph_add(const object_id *tip);
+void commit_graph_release(void);
+
+#endif // COMMIT_GRAPH_H
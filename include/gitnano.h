@@ -18,13 +18,88 @@
 // Max path length
 #define MAX_PATH 8192
 #define SHA1_HEX_SIZE 41
+#define SHA1_RAW_SIZE 20
+// Widest object id of any supported hash (SHA-256 and BLAKE3)
+#define OID_MAX_RAW_SIZE 32
+#define OID_MAX_HEX_SIZE 65
 
 // GitNano directory structure
 #define GITNANO_DIR ".gitnano"
 #define OBJECTS_DIR GITNANO_DIR "/objects"
+#define PACK_DIR OBJECTS_DIR "/pack"
 #define REFS_DIR GITNANO_DIR "/refs"
 #define HEAD_FILE GITNANO_DIR "/HEAD"
 #define INDEX_FILE GITNANO_DIR "/index"
+#define CONFIG_FILE GITNANO_DIR "/config"
+
+// Integrity check applied after writing an object (GITNANO_INTEGRITY / "integrity")
+typedef enum {
+    INTEGRITY_NONE,      // trust the write
+    INTEGRITY_CHECKSUM,  // re-read the file and compare a checksum of the compressed bytes
+    INTEGRITY_FULL       // re-read, inflate and check type and size
+} integrity_level;
+
+// Object hash algorithm, a per-repository property chosen at init
+// ("object_format" in the config; repositories without it use SHA-1)
+typedef enum {
+    HASH_SHA1,
+    HASH_SHA256,
+    HASH_BLAKE3,
+} hash_algo;
+
+#define HASH_ALGO_COUNT 3
+
+static inline size_t hash_algo_raw_size(hash_algo algo) {
+    return algo == HASH_SHA1 ? SHA1_RAW_SIZE : 32;
+}
+
+// Binary object id; hex names are only used at the command line and in text files.
+// Ids shorter than OID_MAX_RAW_SIZE are zero-padded.
+typedef struct {
+    unsigned char hash[OID_MAX_RAW_SIZE];
+    unsigned char algo;  // hash_algo the id was made with
+} object_id;
+
+static inline size_t oid_raw_size(const object_id *oid) {
+    return hash_algo_raw_size((hash_algo)oid->algo);
+}
+
+static inline int oid_cmp(const object_id *a, const object_id *b) {
+    return memcmp(a->hash, b->hash, oid_raw_size(a));
+}
+
+static inline int oid_equal(const object_id *a, const object_id *b) {
+    return memcmp(a->hash, b->hash, oid_raw_size(a)) == 0;
+}
+
+static inline void oid_copy(object_id *dst, const object_id *src) {
+    *dst = *src;
+}
+
+static inline void oid_clear(object_id *oid) {
+    memset(oid, 0, sizeof(*oid));
+}
+
+// Build an id from its raw bytes as stored in trees, packs and indexes
+static inline void oid_from_raw(object_id *oid, const unsigned char *raw, hash_algo algo) {
+    size_t size = hash_algo_raw_size(algo);
+    memcpy(oid->hash, raw, size);
+    memset(oid->hash + size, 0, OID_MAX_RAW_SIZE - size);
+    oid->algo = algo;
+}
+
+// The all-zero id stands for "no object" (e.g. a root commit's parent)
+static inline int oid_is_null(const object_id *oid) {
+    static const object_id null_oid;
+    return memcmp(oid->hash, null_oid.hash, OID_MAX_RAW_SIZE) == 0;
+}
+
+// Ids are uniformly distributed, so any 32 bits make a good hash
+static inline uint32_t oid_hash(const object_id *oid) {
+    uint32_t h;
+    memcpy(&h, oid->hash, sizeof(h));
+    return h;
+}
 
 // Command structure for main.c dispatch
 typedef int (*command_handler_t)(int argc, char *argv[]);
@@ -42,19 +117,57 @@ typedef struct {
     void *data;
 } gitnano_object;
 
-// Tree entry structure
-typedef struct tree_entry {
-    char mode[8];
-    char type[10];
-    char sha1[SHA1_HEX_SIZE];
-    char name[MAX_PATH];
-    struct tree_entry *next;
+// Tree entry modes, stored in binary and written as six octal digits
+#define TREE_MODE_FILE 0100644
+#define TREE_MODE_EXEC 0100755
+#define TREE_MODE_DIR  0040000
+#define TREE_MODE_IS_DIR(mode) (((mode) & 0170000) == TREE_MODE_DIR)
+
+typedef enum { TREE_ENTRY_BLOB, TREE_ENTRY_TREE } tree_entry_type;
+
+// Tree entry structure: the name lives in the owning tree's name arena
+typedef struct {
+    object_id oid;
+    uint32_t mode;
+    tree_entry_type type;
+    uint32_t name_offset;
+    uint32_t name_len;
 } tree_entry;
 
+// A tree's entries and their NUL-terminated names share one allocation
+typedef struct {
+    tree_entry *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_used;
+    size_t names_size;
+} gitnano_tree;
+
+// Cursor over a tree object's entries. Each step views the inflated
+// object directly: name points at a NUL-terminated name inside it and id
+// at the raw object id.
+typedef struct {
+    gitnano_object obj;
+    const char *ptr;
+    const char *end;
+    hash_algo algo;
+    size_t id_size;
+    uint32_t mode;
+    tree_entry_type type;
+    const char *name;
+    size_t name_len;
+    const unsigned char *id;
+} tree_iter;
+
+static inline const char *tree_entry_name(const gitnano_tree *tree, const tree_entry *entry) {
+    return tree->names + entry->name_offset;
+}
+
 // Commit structure
 typedef struct {
-    char tree_sha1[SHA1_HEX_SIZE];
-    char parent_sha1[SHA1_HEX_SIZE];
+    object_id tree_oid;
+    object_id parent_oid;  // null for a root commit
     char author[256];
     char timestamp[32];
     char message[1024];
@@ -64,7 +177,7 @@ typedef struct {
 // File entry structure for diff operations
 typedef struct file_entry {
     char *path;
-    char sha1[SHA1_HEX_SIZE];
+    object_id oid;
     struct file_entry *next;
 } file_entry;
 
@@ -82,7 +195,7 @@ typedef struct {
 typedef struct {
     int is_repo;
     int has_commits;
-    char current_commit[SHA1_HEX_SIZE];
+    char current_commit[OID_MAX_HEX_SIZE];
     char current_branch[256];
     int staged_files;
 } gitnano_status_info;
@@ -99,70 +212,221 @@ typedef struct {
 
 // Core API functions
 int gitnano_init();
+int gitnano_init_with_format(const char *object_format);
 int gitnano_add(const char *path);
 int gitnano_commit(const char *message);
 int gitnano_checkout(const char *reference, const char *path);
 int gitnano_log();
 int gitnano_diff(const char *commit1, const char *commit2);
 int gitnano_status();
+int gitnano_repack();
 void print_usage();
 
 // Reference management functions (refs.c)
 int get_head_ref(char *ref_out);
 int set_head_ref(const char *ref);
-int get_current_commit(char *sha1_out);
-int resolve_reference(const char *reference, char *sha1_out);
-void print_colored_hash(const char *sha1);
+int get_current_commit(object_id *oid_out);
+int resolve_reference(const char *reference, object_id *oid_out);
+void print_colored_oid(const object_id *oid);
 
 // Object storage functions
-int object_write(const char *type, const void *data, size_t size, char *sha1_out);
-int object_read(const char *sha1, gitnano_object *obj);
-int object_hash(const char *type, const void *data, size_t size, char *sha1_out);
+int object_write(const char *type, const void *data, size_t size, object_id *oid_out);
+int object_read(const object_id *oid, gitnano_object *obj);
+int object_hash(const char *type, const void *data, size_t size, object_id *oid_out);
+int object_hash_many(const char *type, const void *const *datas, const size_t *sizes, size_t count, object_id *oids_out);
+int object_write_hashed(const char *type, const void *data, size_t size, const object_id *oid);
 void object_free(gitnano_object *obj);
+typedef struct object_writer object_writer;
+object_writer *object_writer_begin(const char *type, size_t size);
+int object_writer_update(object_writer *writer, const void *data, size_t size);
+int object_writer_finish(object_writer *writer, object_id *oid_out);
+void object_writer_abort(object_writer *writer);
+int object_exists(const object_id *oid);
+int object_read_info(const object_id *oid, char *type_out, size_t *size_out);
+int object_read_to_file(const object_id *oid, const char *type, const char *target_path);
+
+// Loose object existence set (loose_set.c)
+int loose_set_contains(const object_id *oid);
+void loose_set_add(const object_id *oid);
+int loose_set_rebuild(void);
+
+// Object cache (cache.c)
+int object_cache_get(const object_id *oid, gitnano_object *obj);
+int object_cache_get_info(const object_id *oid, char *type_out, size_t *size_out);
+void object_cache_put(const object_id *oid, const gitnano_object *obj);
+void object_cache_clear(void);
+void object_cache_stats(size_t *hits_out, size_t *misses_out);
+
+int object_for_each_loose(int (*fn)(const object_id *oid, void *data), void *data);
+unsigned int object_store_generation(void);
+hash_algo repo_hash_algo(void);
+void object_store_lock(void);
+void object_store_unlock(void);
+void object_store_reset(void);
+integrity_level object_integrity_level(void);
+void object_bulk_begin(void);
+void object_bulk_end(void);
+void object_sync_begin(void);
+int object_sync_end(void);
 
 // Blob functions
-int blob_write(const char *data, size_t size, char *sha1_out);
-int blob_read(const char *sha1, char **data, size_t *size);
-int blob_create_from_file(const char *filepath, char *sha1_out);
-int blob_exists(const char *sha1);
+// Files from this size on are streamed through the object writer in chunks
+// rather than held in memory
+#define BLOB_STREAM_THRESHOLD (64 * 1024 * 1024)
+
+int blob_write(const char *data, size_t size, object_id *oid_out);
+int blob_read(const object_id *oid, char **data, size_t *size);
+int blob_create_from_file(const char *filepath, object_id *oid_out);
+int blob_create_from_files(const char *const *filepaths, size_t count, object_id *oids_out);
+int blob_exists(const object_id *oid);
+
+// Chunked blobs (manifest.c)
+typedef struct {
+    object_id oid;
+    size_t size;
+} manifest_chunk;
+size_t cdc_next_boundary(const unsigned char *data, size_t len);
+size_t blob_chunk_threshold(void);
+int blob_create_chunked(int fd, object_id *oid_out);
+int manifest_assemble(const gitnano_object *manifest, char **data_out, size_t *size_out);
+int manifest_extract(const gitnano_object *manifest, const char *target_path);
 
 // Tree functions
-tree_entry *tree_entry_new(const char *mode, const char *type,
-                           const char *sha1, const char *name);
-void tree_entry_add(tree_entry **entries, tree_entry *new_entry);
-int tree_build(const char *path, char *sha1_out);
-int tree_parse(const char *sha1, tree_entry **entries);
-int tree_write(tree_entry *entries, char *sha1_out);
-void tree_free(tree_entry *entries);
-tree_entry *tree_find(tree_entry *entries, const char *name);
-int tree_restore(const char *tree_sha1, const char *target_dir);
-int tree_restore_path(const char *tree_sha1, const char *tree_path, const char *target_path);
+gitnano_tree *tree_new(size_t capacity, size_t names_size);
+int tree_add(gitnano_tree *tree, uint32_t mode, const object_id *oid, const char *name, size_t name_len);
+void tree_sort(gitnano_tree *tree);
+int tree_build(const char *path, object_id *oid_out);
+int tree_parse(const object_id *oid, gitnano_tree **tree_out);
+int tree_write(const gitnano_tree *tree, object_id *oid_out);
+void tree_free(gitnano_tree *tree);
+const tree_entry *tree_find(const gitnano_tree *tree, const char *name);
+int tree_iter_open(tree_iter *iter, const object_id *oid);
+int tree_iter_next(tree_iter *iter);
+void tree_iter_oid(const tree_iter *iter, object_id *oid_out);
+void tree_iter_rewind(tree_iter *iter);
+void tree_iter_close(tree_iter *iter);
+int tree_restore(const object_id *tree_oid, const char *target_dir);
+int tree_lookup_path(const object_id *tree_oid, const char *path, uint32_t *mode_out, object_id *oid_out);
+int tree_restore_path(const object_id *tree_oid, const char *tree_path, const char *target_path);
 void free_checkout_stats(checkout_operation_stats *stats);
 void print_checkout_summary(const checkout_operation_stats *stats);
 
 // Commit functions
 void get_current_user(char *author, size_t size);
-int commit_create(const char *tree_sha1, const char *parent_sha1,
-                  const char *author, const char *message, char *sha1_out);
-int commit_parse(const char *sha1, gitnano_commit_info *commit);
-int commit_get_tree(const char *commit_sha1, char *tree_sha1_out);
-int commit_get_parent(const char *commit_sha1, char *parent_sha1_out);
-int commit_exists(const char *sha1);
+int commit_create(const object_id *tree_oid, const object_id *parent_oid,
+                  const char *author, const char *message, object_id *oid_out);
+int commit_parse(const object_id *oid, gitnano_commit_info *commit);
+int commit_get_tree(const object_id *commit_oid, object_id *tree_oid_out);
+int commit_get_parent(const object_id *commit_oid, object_id *parent_oid_out);
+int commit_exists(const object_id *oid);
+int commit_is_ancestor(const object_id *ancestor, const object_id *descendant);
 
 // Utility functions
 int sha1_file(const char *path, char *sha1_out);
 int sha1_data(const void *data, size_t size, char *sha1_out);
+typedef struct hash_ctx hash_ctx;
+hash_ctx *hash_ctx_new(hash_algo algo);
+int hash_ctx_update(hash_ctx *ctx, const void *data, size_t size);
+int hash_ctx_final(hash_ctx *ctx, unsigned char *digest_out);
+int hash_ctx_reset(hash_ctx *ctx);
+void hash_ctx_free(hash_ctx *ctx);
+
+// SHA-1 of prefix followed by data; hash_many digests a batch of such jobs,
+// interleaving messages when the SHA-NI backend is active
+typedef struct {
+    const void *prefix;
+    size_t prefix_len;
+    const void *data;
+    size_t size;
+    unsigned char *digest_out;
+} hash_job;
+int hash_data(hash_algo algo, const void *prefix, size_t prefix_len, const void *data, size_t size,
+              unsigned char *digest_out);
+int hash_many(hash_algo algo, const hash_job *jobs, size_t count);
+const char *hash_algo_name(hash_algo algo);
+int hash_algo_by_name(const char *name);
+int hash_select_backend(const char *name);
+
+// BLAKE3 (blake3.c); large updates are hashed as parallel subtrees
+typedef struct blake3_hasher blake3_hasher;
+blake3_hasher *blake3_hasher_new(void);
+void blake3_hasher_reset(blake3_hasher *self);
+void blake3_hasher_update(blake3_hasher *self, const void *data, size_t size);
+void blake3_hasher_final(const blake3_hasher *self, unsigned char digest_out[32]);
+void blake3_hasher_free(blake3_hasher *self);
+const char *hash_backend_name(void);
+
+// Hex conversion, with a table-driven or SIMD kernel picked at runtime
+void hex_encode(const unsigned char *binary, size_t size, char *hex_out);
+int hex_decode(const char *hex, size_t size, unsigned char *binary_out);
+size_t hex_span(const char *str);
+int hex_select_kernel(const char *name);
+const char *hex_kernel_name(void);
+void hex_to_binary(const char *hex, unsigned char *binary);
+void binary_to_hex(const unsigned char *binary, char *hex);
+char *oid_to_hex(const object_id *oid, char *hex_out);
+int oid_from_hex(const char *hex, object_id *oid_out);
+
 int compress_data(const void *input, size_t input_size,
                   void **output, size_t *output_size);
 int decompress_data(const void *input, size_t input_size,
                     void **output, size_t *output_size);
+typedef struct inflate_stream inflate_stream;
+inflate_stream *inflate_stream_new(const void *input, size_t input_size);
+int inflate_stream_read(inflate_stream *stream, void *output, size_t size, size_t *produced_out);
+int inflate_stream_end(inflate_stream *stream);
+void inflate_stream_free(inflate_stream *stream);
+int inflate_exact(const void *input, size_t input_size, void *output, size_t output_size);
+int inflate_prefix(const void *input, size_t input_size, void *output, size_t output_size,
+                   size_t *produced_out);
+typedef enum {
+    CODEC_ZLIB,
+    CODEC_ZSTD,
+    CODEC_NONE
+} compress_codec;
+typedef struct {
+    compress_codec codec;
+    int level;
+} compress_policy;
+int compress_looks_incompressible(const void *data, size_t size);
+compress_policy compress_policy_for(const char *type, size_t size, const void *sample, size_t sample_size);
+typedef int (*compress_sink)(const void *data, size_t size, void *sink_data);
+typedef struct compress_stream compress_stream;
+compress_stream *compress_stream_new(const char *type, size_t size, compress_sink sink, void *sink_data);
+int compress_stream_header(compress_stream *stream, const void *header, size_t size);
+int compress_stream_update(compress_stream *stream, const void *data, size_t size);
+int compress_stream_finish(compress_stream *stream);
+void compress_stream_free(compress_stream *stream);
 int mkdir_p(const char *path);
 int file_exists(const char *path);
 char *read_file(const char *path, size_t *size);
 int write_file(const char *path, const void *data, size_t size);
+typedef struct {
+    const char *data;
+    size_t size;
+    int mapped;  // data is an mmap of the file
+    int owned;   // data is a heap copy
+} mapped_file;
+int mapped_file_open(const char *path, mapped_file *file);
+void mapped_file_close(mapped_file *file);
+int write_file_atomic(const char *path, const void *data, size_t size, int sync);
+int copy_file(const char *src_path, const char *dst_path);
+int fsync_path(const char *path);
 void get_git_timestamp(char *timestamp, size_t size);
 void format_git_timestamp(const char *timestamp, char *formatted, size_t size);
-void get_object_path(const char *sha1, char *path);
+void get_object_path(const object_id *oid, char *path);
+
+// Thread pool (thread_pool.c)
+typedef struct thread_pool thread_pool;
+int thread_pool_default_size(void);
+thread_pool *thread_pool_new(int threads);
+int thread_pool_run(thread_pool *pool, size_t count, int (*fn)(size_t index, void *ctx), void *ctx);
+int thread_pool_size(const thread_pool *pool);
+void thread_pool_free(thread_pool *pool);
+
+// Configuration (config.c)
+int config_get(const char *key, char *value_out, size_t size);
+int config_get_setting(const char *env_name, const char *key, char *value_out, size_t size);
 
 // Safe memory allocation helper functions
 void *safe_malloc(size_t size);
@@ -171,20 +435,20 @@ char *safe_strdup(const char *s);
 char *safe_asprintf(const char *fmt, ...);
 
 // File system operations (moved from tree.c)
-int extract_blob(const char *sha1, const char *target_path);
-int extract_tree_recursive(const char *tree_sha1, const char *base_path);
+int extract_blob(const object_id *oid, const char *target_path);
+int extract_tree_recursive(const object_id *tree_oid, const char *base_path);
 int collect_working_files(const char *dir_path, file_entry **files);
 int file_in_target_tree(const char *path, file_entry *target_files);
 void free_file_list(file_entry *list);
 int cleanup_extra_files(const char *base_path, file_entry *target_files);
-int collect_target_files(const char *tree_sha1, const char *base_path, file_entry **files);
+int collect_target_files(const object_id *tree_oid, const char *base_path, file_entry **files);
 
 // Workspace management functions
 int get_workspace_name(char *workspace_name, size_t size);
 int get_workspace_path(char *workspace_path, size_t size);
 int get_original_path_from_workspace(const char *workspace_file_path, char *original_path, size_t size);
 int get_workspace_file_path(const char *original_file_path, char *workspace_file_path, size_t size);
-int workspace_init();
+int workspace_init(const char *object_format);
 int workspace_exists();
 int workspace_is_initialized();
 int workspace_push_file(const char *path);
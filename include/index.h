@@ -0,0 +1,83 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "gitnano.h"
+
+// Binary index layout (integers big-endian): a 12-byte header of
+// signature, version and entry count; the entries sorted by path; optional
+// extensions, each a 4-byte signature and 4-byte length; and a SHA-1 of
+// everything before it
+#define INDEX_SIGNATURE "GNIX"
+#define INDEX_VERSION 1
+#define INDEX_EXT_TREE "TREE"
+#define INDEX_EXT_LINK "LINK"
+#define INDEX_LOCK_FILE INDEX_FILE ".lock"
+
+// Split index: the entries live in a shared index named by its checksum,
+// and the index holds only the entries changed since, with mode 0 marking
+// a removed one, plus a LINK extension naming the shared index. The delta
+// is folded into a new shared index once it passes this percentage of it.
+#define INDEX_SHARED_FILE GITNANO_DIR "/sharedindex"
+#define INDEX_SPLIT_MAX_PERCENT 20
+
+// Readers that skip the index lock may still be linked to a superseded
+// shared index, so one is removed only after it has gone this many seconds
+// without being linked (two weeks, as Git's splitIndex.sharedIndexExpire)
+#define INDEX_SHARED_EXPIRE (14 * 24 * 60 * 60)
+
+// One file of the workspace as staged for the next commit. The stat data
+// is that of the working directory file when it was hashed, or zero when
+// unknown; a file whose stat data still matches is not hashed again.
+typedef struct {
+    char *path;
+    uint32_t mode;
+    object_id oid;
+    uint32_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ino;
+    uint64_t size;
+} index_entry;
+
+// Cache-tree: the tree id written for a directory, valid while nothing
+// below it has changed. Directories without a valid id have no node.
+typedef struct {
+    char *path;          // "" for the root
+    size_t entry_count;  // index entries below the directory
+    object_id oid;
+} cache_tree_node;
+
+typedef struct {
+    index_entry *entries;
+    size_t count;
+    size_t alloc;
+    cache_tree_node *trees;  // sorted by path
+    size_t tree_count;
+    size_t tree_alloc;
+    struct timespec timestamp;  // mtime of the index file when read
+    index_entry *base;          // shared index entries, when split
+    size_t base_count;
+    object_id base_oid;         // shared index checksum, or null
+    char *lock_path;            // absolute path of the held lock file, or NULL
+    int lock_fd;
+} gitnano_index;
+
+// Index functions; paths are relative to the workspace, which must be the
+// current directory
+int index_read(gitnano_index *index);
+int index_load(gitnano_index *index);
+int index_read_locked(gitnano_index *index);
+int index_load_locked(gitnano_index *index);
+int index_write(gitnano_index *index);
+void index_free(gitnano_index *index);
+const index_entry *index_find(const gitnano_index *index, const char *path);
+int index_add(gitnano_index *index, const char *path, uint32_t mode, const object_id *oid, const struct stat *st);
+int index_entry_is_current(const gitnano_index *index, const index_entry *entry, const struct stat *st);
+int index_stage_files(gitnano_index *index, const char *const *paths, const struct stat *stats, size_t count);
+int index_checkout_path(gitnano_index *index, const char *path, uint32_t mode, const object_id *oid);
+int index_read_tree(gitnano_index *index, const object_id *tree_oid);
+int index_write_tree(gitnano_index *index, object_id *oid_out);
+int index_count_changes(const gitnano_index *index, const object_id *tree_oid);
+
+#endif // INDEX_H
@@ -0,0 +1,68 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "gitnano.h"
+
+// Pack entry type codes (same numbering as Git packs)
+#define PACK_TYPE_COMMIT 1
+#define PACK_TYPE_TREE   2
+#define PACK_TYPE_BLOB   3
+// GitNano chunked-blob manifest. Type 5 is unused by Git, so manifests are
+// left loose when packing; only packs written by older versions hold them,
+// and those packs are readable here but not by Git.
+#define PACK_TYPE_MANIFEST 5
+#define PACK_TYPE_OFS_DELTA 6
+#define PACK_TYPE_REF_DELTA 7
+
+// Delta search defaults (overridable with GITNANO_PACK_WINDOW / GITNANO_PACK_DEPTH)
+#define PACK_DEFAULT_WINDOW 10
+#define PACK_DEFAULT_DEPTH 50
+
+// Loose object count above which a commit packs the repository (GITNANO_AUTO_PACK)
+#define PACK_DEFAULT_AUTO_THRESHOLD 6700
+
+// Pack and index file layout
+#define PACK_SIGNATURE "PACK"
+#define PACK_VERSION 2
+#define PACK_IDX_SIGNATURE "\377tOc"
+#define PACK_IDX_VERSION 2
+
+// A pack file with its memory-mapped index
+typedef struct packed_git {
+    char pack_path[MAX_PATH];
+    unsigned char *idx_map;
+    size_t idx_size;
+    unsigned char *pack_map;
+    size_t pack_size;
+    uint32_t object_count;
+    hash_algo algo;      // object format of the ids in the index
+    size_t id_size;      // raw id width
+    const unsigned char *fanout;
+    const unsigned char *oids;
+    const unsigned char *offsets;
+    const unsigned char *large_offsets;
+    struct packed_git *next;
+} packed_git;
+
+// Pack lookup (packs are loaded lazily for the current repository)
+int pack_has_object(const object_id *oid);
+int pack_read_object(const object_id *oid, gitnano_object *obj);
+int pack_read_info(const object_id *oid, char *type_out, size_t *size_out);
+int pack_for_each_prefix(const char *prefix, int (*fn)(const object_id *oid, void *data), void *data);
+void pack_release_all(void);
+
+// Pack writing
+int pack_repack(void);
+int pack_auto_repack(void);
+
+// Delta encoding (delta.c)
+typedef struct delta_index delta_index;
+delta_index *delta_index_create(const void *base, size_t base_size);
+void delta_index_free(delta_index *index);
+int delta_create(const delta_index *index, const void *target, size_t target_size,
+                 size_t max_size, void **delta_out, size_t *delta_size_out);
+int delta_result_size(const void *delta, size_t delta_size, size_t *size_out);
+int delta_apply(const void *base, size_t base_size, const void *delta, size_t delta_size,
+                void **result_out, size_t *result_size_out);
+
+#endif // PACK_H
@@ -14,7 +14,7 @@ int get_original_path_from_workspace(const char *workspace_file_path, char *orig
 int get_workspace_file_path(const char *original_file_path, char *workspace_file_path, size_t size);
 
 // Workspace initialization and synchronization
-int workspace_init();
+int workspace_init(const char *object_format);
 int workspace_exists();
 int workspace_is_initialized();
 int workspace_push_file(const char *path);
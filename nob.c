@@ -89,7 +89,7 @@ bool link_executable(const char *output_name, const char *flags[]) {
         }
     }
 
-    nob_cmd_append(&cmd, "-lz", "-lssl", "-lcrypto");
+    nob_cmd_append(&cmd, "-lz", "-lssl", "-lcrypto", "-pthread");
 
     bool result = nob_cmd_run(&cmd);
     nob_da_free(all_files);
@@ -163,7 +163,7 @@ bool run_tests(void) {
         nob_cmd_append(&cmd, nob_temp_sprintf("build/%s.o", *filepath + 4));
     }
 
-    nob_cmd_append(&cmd, "-lz", "-lssl", "-lcrypto");
+    nob_cmd_append(&cmd, "-lz", "-lssl", "-lcrypto", "-pthread");
 
     if (!nob_cmd_run(&cmd)) return false;
 
@@ -1,12 +1,13 @@
 #define _GNU_SOURCE
 #include "gitnano.h"
+#include "index.h"
 
 
 // Helper functions for diff functionality
-static int collect_tree_files(const char *tree_sha1, file_entry **files_out);
-static int add_file_to_list(file_entry **list, const char *path, const char *sha1);
+static int collect_tree_files(const object_id *tree_oid, file_entry **files_out);
+static int add_file_to_list(file_entry **list, const char *path, const object_id *oid);
 static file_entry *find_file(file_entry *list, const char *path);
-static int compare_trees(const char *tree1_sha1, const char *tree2_sha1, gitnano_diff_result *diff);
+static int compare_trees(const object_id *tree1_oid, const object_id *tree2_oid, gitnano_diff_result *diff);
 
 // High-level API for other applications
 
@@ -28,8 +29,9 @@ int gitnano_create_snapshot(const char *message, char *snapshot_id) {
     }
 
     // Get the created commit ID
-    if (snapshot_id) {
-        get_current_commit(snapshot_id);
+    object_id commit_oid;
+    if (snapshot_id && get_current_commit(&commit_oid) == 0) {
+        oid_to_hex(&commit_oid, snapshot_id);
     }
 
     return 0;
@@ -43,7 +45,8 @@ int gitnano_restore_snapshot(const char *snapshot_id) {
         return -1;
     }
 
-    if (!commit_exists(snapshot_id)) {
+    object_id oid;
+    if (oid_from_hex(snapshot_id, &oid) != 0 || !commit_exists(&oid)) {
         return -1;
     }
 
@@ -56,7 +59,7 @@ int gitnano_restore_snapshot(const char *snapshot_id) {
 
 
 // Add file to file list
-static int add_file_to_list(file_entry **list, const char *path, const char *sha1) {
+static int add_file_to_list(file_entry **list, const char *path, const object_id *oid) {
     file_entry *entry = safe_malloc(sizeof(file_entry));
     if (!entry) return -1;
 
@@ -65,8 +68,7 @@ static int add_file_to_list(file_entry **list, const char *path, const char *sha
         free(entry);
         return -1;
     }
-    strncpy(entry->sha1, sha1, sizeof(entry->sha1) - 1);
-    entry->sha1[sizeof(entry->sha1) - 1] = '\0';
+    oid_copy(&entry->oid, oid);
     entry->next = *list;
     *list = entry;
 
@@ -86,57 +88,57 @@ static file_entry *find_file(file_entry *list, const char *path) {
 
 
 // Recursively collect all files from a tree
-static int collect_tree_files(const char *tree_sha1, file_entry **files_out) {
+static int collect_tree_files(const object_id *tree_oid, file_entry **files_out) {
     int err;
     *files_out = NULL;
-    tree_entry *entries = NULL;
+    tree_iter iter;
 
-    if ((err = tree_parse(tree_sha1, &entries)) != 0) {
-        printf("ERROR: tree_parse: %d\n", err);
+    if ((err = tree_iter_open(&iter, tree_oid)) != 0) {
+        printf("ERROR: tree_iter_open: %d\n", err);
         return err;
     }
 
-    tree_entry *current = entries;
-    while (current) {
-        if (strcmp(current->type, "blob") == 0) {
-            if ((err = add_file_to_list(files_out, current->name, current->sha1)) != 0) {
+    while (tree_iter_next(&iter)) {
+        object_id entry_oid;
+        tree_iter_oid(&iter, &entry_oid);
+        if (iter.type == TREE_ENTRY_BLOB) {
+            if ((err = add_file_to_list(files_out, iter.name, &entry_oid)) != 0) {
                 printf("ERROR: add_file_to_list: %d\n", err);
                 goto cleanup;
             }
-        } else if (strcmp(current->type, "tree") == 0) {
+        } else {
             // For subdirectories, we would need to recursively collect files
             // For now, just note the directory
             char subdir_path[MAX_PATH];
-            int name_len = strlen(current->name);
+            size_t name_len = iter.name_len;
             if (name_len + 2 < MAX_PATH) {  // +2 for "/" and null terminator
-                strcpy(subdir_path, current->name);
+                strcpy(subdir_path, iter.name);
                 strcat(subdir_path, "/");
-                if ((err = add_file_to_list(files_out, subdir_path, current->sha1)) != 0) {
+                if ((err = add_file_to_list(files_out, subdir_path, &entry_oid)) != 0) {
                     printf("ERROR: add_file_to_list: %d\n", err);
                     goto cleanup;
                 }
             }
         }
-        current = current->next;
     }
 
-    tree_free(entries);
+    tree_iter_close(&iter);
     return 0;
 
 cleanup:
-    tree_free(entries);
+    tree_iter_close(&iter);
     free_file_list(*files_out);
     *files_out = NULL;
     return err;
 }
 
 // Compare two trees and populate diff result
-static int compare_trees(const char *tree1_sha1, const char *tree2_sha1, gitnano_diff_result *diff) {
+static int compare_trees(const object_id *tree1_oid, const object_id *tree2_oid, gitnano_diff_result *diff) {
     int err;
     file_entry *files1 = NULL, *files2 = NULL;
 
-    if ((err = collect_tree_files(tree1_sha1, &files1)) != 0) return err;
-    if ((err = collect_tree_files(tree2_sha1, &files2)) != 0) {
+    if ((err = collect_tree_files(tree1_oid, &files1)) != 0) return err;
+    if ((err = collect_tree_files(tree2_oid, &files2)) != 0) {
         free_file_list(files1);
         return err;
     }
@@ -144,17 +146,11 @@ static int compare_trees(const char *tree1_sha1, const char *tree2_sha1, gitnano
     char **added = NULL, **modified = NULL, **deleted = NULL;
     int added_count = 0, modified_count = 0, deleted_count = 0;
 
-    // Mark files from the second list to track matches
-    for (file_entry *f2 = files2; f2; f2 = f2->next) {
-        f2->sha1[0] &= 0x7F; // Use a bit to mark as not found yet
-    }
-
     // Identify deleted and modified files
     for (file_entry *f1 = files1; f1; f1 = f1->next) {
         file_entry *f2 = find_file(files2, f1->path);
         if (f2) {
-            f2->sha1[0] |= 0x80; // Mark as found
-            if (strcmp(f1->sha1, f2->sha1) != 0) {
+            if (!oid_equal(&f1->oid, &f2->oid)) {
                 modified = realloc(modified, (modified_count + 1) * sizeof(char*));
                 if (!modified) goto nomem;
                 modified[modified_count] = safe_strdup(f1->path);
@@ -170,16 +166,15 @@ static int compare_trees(const char *tree1_sha1, const char *tree2_sha1, gitnano
         }
     }
 
-    // Identify added files
+    // Identify added files (binary ids leave no spare bit to mark matches with)
     for (file_entry *f2 = files2; f2; f2 = f2->next) {
-        if ((f2->sha1[0] & 0x80) == 0) {
+        if (!find_file(files1, f2->path)) {
             added = realloc(added, (added_count + 1) * sizeof(char*));
             if (!added) goto nomem;
             added[added_count] = safe_strdup(f2->path);
             if (!added[added_count]) goto nomem;
             added_count++;
         }
-        f2->sha1[0] &= 0x7F; // Restore original SHA1
     }
 
     diff->added_files = added;
@@ -222,20 +217,24 @@ int gitnano_compare_snapshots(const char *snapshot1, const char *snapshot2,
     }
     memset(*diff, 0, sizeof(gitnano_diff_result));
 
-    char tree1_sha1[SHA1_HEX_SIZE];
-    char tree2_sha1[SHA1_HEX_SIZE];
+    object_id commit1, commit2, tree1_oid, tree2_oid;
+    if (oid_from_hex(snapshot1, &commit1) != 0 || oid_from_hex(snapshot2, &commit2) != 0) {
+        fprintf(stderr, "ERROR: gitnano_compare_snapshots: invalid snapshot id\n");
+        err = -1;
+        goto cleanup;
+    }
 
-    if ((err = commit_get_tree(snapshot1, tree1_sha1)) != 0) {
+    if ((err = commit_get_tree(&commit1, &tree1_oid)) != 0) {
         printf("ERROR: commit_get_tree: %d\n", err);
         goto cleanup;
     }
 
-    if ((err = commit_get_tree(snapshot2, tree2_sha1)) != 0) {
+    if ((err = commit_get_tree(&commit2, &tree2_oid)) != 0) {
         printf("ERROR: commit_get_tree: %d\n", err);
         goto cleanup;
     }
 
-    if ((err = compare_trees(tree1_sha1, tree2_sha1, *diff)) != 0) {
+    if ((err = compare_trees(&tree1_oid, &tree2_oid, *diff)) != 0) {
         goto cleanup;
     }
 
@@ -281,27 +280,22 @@ int gitnano_get_status(gitnano_status_info *status) {
     status->is_repo = 1;
 
     // Get current commit
-    char current_sha1[SHA1_HEX_SIZE];
-    if (get_current_commit(current_sha1) == 0) {
-        strcpy(status->current_commit, current_sha1);
+    object_id current_oid;
+    if (get_current_commit(&current_oid) == 0) {
+        oid_to_hex(&current_oid, status->current_commit);
         status->has_commits = 1;
     }
 
-    // Check for staged files (simplified)
+    // Count the files staged in the index that differ from HEAD
     status->staged_files = 0;
-    if (file_exists(INDEX_FILE)) {
-        // Count lines in index file
-        size_t size;
-        char *content = read_file(INDEX_FILE, &size);
-        if (content) {
-            for (size_t i = 0; i < size; i++) {
-                if (content[i] == '\n') {
-                    status->staged_files++;
-                }
-            }
-            free(content);
-        }
+    gitnano_index index;
+    object_id head_tree;
+    if (index_read(&index) == 0) {
+        int changes = index_count_changes(&index, status->has_commits &&
+                                          commit_get_tree(&current_oid, &head_tree) == 0 ? &head_tree : NULL);
+        status->staged_files = changes > 0 ? changes : 0;
     }
+    index_free(&index);
 
     status->current_branch[0] = '\0';
     char ref[MAX_PATH];
@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 #include "gitnano.h"
 #include "diff.h"
+#include "pack.h"
+#include "index.h"
+#include "commit_graph.h"
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -9,7 +12,8 @@
 #include <strings.h>
 
 static int check_repo_exists();
-static int auto_sync_working_files();
+static int auto_sync_working_files(const gitnano_index *index, char ***names_out, struct stat **stats_out, size_t *count_out);
+static void free_string_list(char **list, size_t count);
 
 static int check_repo_exists() {
     char workspace_path[MAX_PATH];
@@ -30,8 +34,21 @@ static int check_repo_exists() {
 
 // Initialize GitNano repository - create workspace structure only
 int gitnano_init() {
+    return gitnano_init_with_format(getenv("GITNANO_OBJECT_FORMAT"));
+}
+
+// Initialize a repository whose objects are hashed with object_format
+// (sha1, sha256 or blake3; NULL means sha1). The choice is recorded in the
+// config and cannot change afterwards.
+int gitnano_init_with_format(const char *object_format) {
+    if (!object_format || !*object_format) object_format = "sha1";
+    if (hash_algo_by_name(object_format) < 0) {
+        printf("ERROR: Unknown object format: %s (use sha1, sha256 or blake3)\n", object_format);
+        return -1;
+    }
+
     // Initialize workspace with .gitnano structure only (no file copying)
-    if (workspace_init() != 0) {
+    if (workspace_init(object_format) != 0) {
         printf("ERROR: Failed to initialize GitNano repository\n");
         return -1;
     }
@@ -63,10 +80,10 @@ int gitnano_add(const char *path) {
         return -1;
     }
 
-    // Read file from original directory
-    size_t size;
-    char *data = read_file(path, &size);
-    if (!data) {
+    // Resolve the file in the original directory before moving to the workspace
+    char source_path[MAX_PATH];
+    struct stat st;
+    if (!realpath(path, source_path) || stat(source_path, &st) != 0) {
         printf("Failed to read file: %s\n", path);
         return -1;
     }
@@ -75,52 +92,47 @@ int gitnano_add(const char *path) {
     char workspace_path[MAX_PATH];
     if (get_workspace_path(workspace_path, sizeof(workspace_path)) != 0) {
         printf("ERROR: Failed to get workspace path\n");
-        free(data);
         return -1;
     }
 
     char original_cwd[MAX_PATH];
     if (!getcwd(original_cwd, sizeof(original_cwd))) {
         printf("ERROR: Failed to get current directory\n");
-        free(data);
         return -1;
     }
 
     if (chdir(workspace_path) != 0) {
         printf("ERROR: Failed to change to workspace directory\n");
-        free(data);
         return -1;
     }
 
-    char sha1[SHA1_HEX_SIZE];
-    if ((err = blob_write(data, size, sha1)) != 0) {
-        free(data);
-        printf("ERROR: blob_write: %d\n", err);
+    // Large files are streamed in chunks rather than read whole
+    object_id oid;
+    if ((err = blob_create_from_file(source_path, &oid)) != 0) {
+        printf("ERROR: blob_create_from_file: %d\n", err);
         chdir(original_cwd);
         return err;
     }
 
-    free(data);
-
-    // Update index (simplified - just append)
-    FILE *index_fp = fopen(INDEX_FILE, "a");
-    if (!index_fp) {
-        index_fp = fopen(INDEX_FILE, "w");
-        if (!index_fp) {
-            printf("ERROR: fopen index: %d\n", -1);
-            chdir(original_cwd);
-            return -1;
-        }
+    // Stage the file in the index with the stat data of the original, so
+    // the next commit does not hash it again
+    gitnano_index index;
+    if ((err = index_load_locked(&index)) != 0 ||
+        (err = index_add(&index, path, (st.st_mode & S_IXUSR) ? TREE_MODE_EXEC : TREE_MODE_FILE,
+                         &oid, &st)) != 0 ||
+        (err = index_write(&index)) != 0) {
+        printf("ERROR: failed to update index: %d\n", err);
+        index_free(&index);
+        chdir(original_cwd);
+        return -1;
     }
-
-    fprintf(index_fp, "%s %s\n", sha1, path);
-    fclose(index_fp);
+    index_free(&index);
 
     // Change back to original directory
     chdir(original_cwd);
 
     printf("Added %s (blob: ", path);
-    print_colored_hash(sha1);
+    print_colored_oid(&oid);
     printf(")\n");
     return 0;
 }
@@ -135,13 +147,6 @@ int gitnano_commit(const char *message) {
         return -1;
     }
 
-    // Auto-sync working files to workspace before commit
-    printf("Auto-syncing working files...\n");
-    if ((err = auto_sync_working_files()) != 0) {
-        printf("WARNING: Auto-sync failed: %d, proceeding with existing workspace files\n", err);
-        // Continue anyway - user might have manually synced files
-    }
-
     // Change to workspace directory for gitnano operations
     char workspace_path[MAX_PATH];
     if (get_workspace_path(workspace_path, sizeof(workspace_path)) != 0) {
@@ -155,40 +160,87 @@ int gitnano_commit(const char *message) {
         return -1;
     }
 
+    // The index tells auto-sync which files are unchanged since last staged;
+    // it stays locked until the commit writes it
+    gitnano_index index;
+    memset(&index, 0, sizeof(index));
+    if (chdir(workspace_path) != 0 || (err = index_load_locked(&index)) != 0 ||
+        chdir(original_cwd) != 0) {
+        printf("ERROR: failed to load index\n");
+        index_free(&index);
+        chdir(original_cwd);
+        return -1;
+    }
+
+    // Auto-sync working files to workspace before commit
+    printf("Auto-syncing working files...\n");
+    char **synced = NULL;
+    struct stat *synced_stats = NULL;
+    size_t synced_count = 0;
+    if ((err = auto_sync_working_files(&index, &synced, &synced_stats, &synced_count)) != 0) {
+        printf("WARNING: Auto-sync failed: %d, proceeding with existing workspace files\n", err);
+        // Continue anyway - user might have manually synced files
+    }
+
     if (chdir(workspace_path) != 0) {
         printf("ERROR: Failed to change to workspace directory\n");
+        index_free(&index);
+        free_string_list(synced, synced_count);
+        free(synced_stats);
         return -1;
     }
 
-    char tree_sha1[SHA1_HEX_SIZE];
-    if ((err = tree_build(".", tree_sha1)) != 0) {
-        printf("ERROR: tree_build: %d\n", err);
+    // New objects are flushed together once the commit object exists
+    object_sync_begin();
+
+    // The tree comes from the index: only the synced files are hashed, and
+    // directories nothing changed in keep their cached tree ids
+    object_id tree_oid;
+    err = index_stage_files(&index, (const char *const *)synced, synced_stats, synced_count);
+    if (err == 0) err = index_write_tree(&index, &tree_oid);
+    if (err == 0) err = index_write(&index);
+    index_free(&index);
+    free_string_list(synced, synced_count);
+    free(synced_stats);
+    if (err != 0) {
+        printf("ERROR: failed to write tree from index: %d\n", err);
+        object_sync_end();
         chdir(original_cwd);
         return err;
     }
 
-    char parent_sha1[SHA1_HEX_SIZE] = {0};
-    err = get_current_commit(parent_sha1);
+    object_id parent_oid;
+    err = get_current_commit(&parent_oid);
     // Only use parent if it's a valid GitNano commit (not from .git/)
-    if (err == 0 && strlen(parent_sha1) > 0) {
+    if (err == 0 && !oid_is_null(&parent_oid)) {
         // Verify this is actually a GitNano commit object
-        if (!commit_exists(parent_sha1)) {
+        if (!commit_exists(&parent_oid)) {
             printf("WARNING: Current HEAD points to non-GitNano commit, starting new history\n");
-            parent_sha1[0] = '\0';
+            oid_clear(&parent_oid);
         }
     } else {
-        parent_sha1[0] = '\0';
+        oid_clear(&parent_oid);
     }
 
-    char commit_sha1[SHA1_HEX_SIZE];
-    if ((err = commit_create(tree_sha1, strlen(parent_sha1) > 0 ? parent_sha1 : NULL,
-                             NULL, message, commit_sha1)) != 0) {
+    object_id commit_oid;
+    if ((err = commit_create(&tree_oid, !oid_is_null(&parent_oid) ? &parent_oid : NULL,
+                             NULL, message, &commit_oid)) != 0) {
         printf("ERROR: commit_create: %d\n", err);
+        object_sync_end();
+        chdir(original_cwd);
+        return err;
+    }
+
+    // The branch may only point at the commit once all its objects are durable
+    if ((err = object_sync_end()) != 0) {
+        printf("ERROR: object_sync_end: %d\n", err);
         chdir(original_cwd);
         return err;
     }
 
     // Update HEAD
+    char commit_hex[OID_MAX_HEX_SIZE];
+    oid_to_hex(&commit_oid, commit_hex);
     char ref[MAX_PATH];
     if ((err = get_head_ref(ref)) != 0) {
         printf("ERROR: get_head_ref: %d\n", err);
@@ -206,26 +258,37 @@ int gitnano_commit(const char *message) {
             return -1;
         }
 
-        char branch_content[SHA1_HEX_SIZE + 2];
-        snprintf(branch_content, sizeof(branch_content), "%s\n", commit_sha1);
-        if ((err = write_file(full_path, branch_content, strlen(branch_content))) != 0) {
-            printf("ERROR: write_file: %d\n", err);
+        char branch_content[OID_MAX_HEX_SIZE + 1];
+        snprintf(branch_content, sizeof(branch_content), "%s\n", commit_hex);
+        if ((err = write_file_atomic(full_path, branch_content, strlen(branch_content), 1)) != 0) {
+            printf("ERROR: write_file_atomic: %d\n", err);
             chdir(original_cwd);
             return err;
         }
     } else {
-        if ((err = set_head_ref(commit_sha1)) != 0) {
+        if ((err = set_head_ref(commit_hex)) != 0) {
             printf("ERROR: set_head_ref: %d\n", err);
             chdir(original_cwd);
             return err;
         }
     }
 
+    // Record the commit in the commit-graph so history walks skip reading
+    // commit objects
+    if (commit_graph_add(&commit_oid) != 0) {
+        printf("WARNING: Failed to update commit-graph\n");
+    }
+
+    // Keep the loose object count bounded; the commit itself is already safe
+    if (pack_auto_repack() != 0) {
+        printf("WARNING: Automatic repack failed\n");
+    }
+
     // Change back to original directory
     chdir(original_cwd);
 
     printf("Committed ");
-    print_colored_hash(commit_sha1);
+    print_colored_oid(&commit_oid);
     printf("\n");
     return 0;
 }
@@ -259,16 +322,16 @@ int gitnano_checkout(const char *reference, const char *path) {
     }
 
     // Resolve reference to SHA1
-    char commit_sha1[SHA1_HEX_SIZE];
-    if ((err = resolve_reference(reference, commit_sha1)) != 0) {
+    object_id commit_oid;
+    if ((err = resolve_reference(reference, &commit_oid)) != 0) {
         printf("ERROR: Invalid reference: %s\n", reference);
         chdir(original_cwd);
         return err;
     }
 
-    if (!commit_exists(commit_sha1)) {
+    if (!commit_exists(&commit_oid)) {
         printf("Commit not found: ");
-        print_colored_hash(commit_sha1);
+        print_colored_oid(&commit_oid);
         printf("\n");
         chdir(original_cwd);
         return -1;
@@ -279,19 +342,30 @@ int gitnano_checkout(const char *reference, const char *path) {
         // Path checkout - restore specific file/directory in workspace
         printf("Restoring '%s' from %s...\n", path, reference);
 
-        char tree_sha1[SHA1_HEX_SIZE];
-        if ((err = commit_get_tree(commit_sha1, tree_sha1)) != 0) {
+        object_id tree_oid;
+        if ((err = commit_get_tree(&commit_oid, &tree_oid)) != 0) {
             printf("ERROR: commit_get_tree: %d\n", err);
             chdir(original_cwd);
             return err;
         }
 
-        if ((err = tree_restore_path(tree_sha1, path, path)) != 0) {
+        if ((err = tree_restore_path(&tree_oid, path, path)) != 0) {
             printf("ERROR: tree_restore_path: %d\n", err);
             chdir(original_cwd);
             return err;
         }
 
+        // The restored path is staged as it is in the commit
+        uint32_t mode;
+        object_id path_oid;
+        gitnano_index index;
+        memset(&index, 0, sizeof(index));
+        if (tree_lookup_path(&tree_oid, path, &mode, &path_oid) != 0 || index_load_locked(&index) != 0 ||
+            index_checkout_path(&index, path, mode, &path_oid) != 0 || index_write(&index) != 0) {
+            printf("WARNING: Failed to update index for %s\n", path);
+        }
+        index_free(&index);
+
         // Change back to original directory to sync the restored file
         chdir(original_cwd);
 
@@ -305,21 +379,30 @@ int gitnano_checkout(const char *reference, const char *path) {
         // Full checkout - restore entire tree in workspace
         printf("Checking out %s...\n", reference);
 
-        char tree_sha1[SHA1_HEX_SIZE];
-        if ((err = commit_get_tree(commit_sha1, tree_sha1)) != 0) {
+        object_id tree_oid;
+        if ((err = commit_get_tree(&commit_oid, &tree_oid)) != 0) {
             printf("ERROR: commit_get_tree: %d\n", err);
             chdir(original_cwd);
             return err;
         }
 
-        if ((err = tree_restore(tree_sha1, ".")) != 0) {
+        if ((err = tree_restore(&tree_oid, ".")) != 0) {
             printf("ERROR: tree_restore: %d\n", err);
             chdir(original_cwd);
             return err;
         }
 
+        // The workspace now holds exactly the commit's tree
+        gitnano_index index;
+        memset(&index, 0, sizeof(index));
+        if (index_read_locked(&index) < 0 || index_read_tree(&index, &tree_oid) != 0 || index_write(&index) != 0) {
+            printf("WARNING: Failed to update index after checkout\n");
+        }
+        index_free(&index);
+
         // Update HEAD to point to the checked out commit
-        if ((err = set_head_ref(commit_sha1)) != 0) {
+        char commit_hex[OID_MAX_HEX_SIZE];
+        if ((err = set_head_ref(oid_to_hex(&commit_oid, commit_hex))) != 0) {
             printf("ERROR: set_head_ref: %d\n", err);
             chdir(original_cwd);
             return err;
@@ -336,7 +419,7 @@ int gitnano_checkout(const char *reference, const char *path) {
 
         // Clean up files in original directory that don't exist in the target commit
         file_entry *target_files = NULL;
-        if ((err = collect_target_files(tree_sha1, "", &target_files)) != 0) {
+        if ((err = collect_target_files(&tree_oid, "", &target_files)) != 0) {
             printf("WARNING: Failed to collect target files for cleanup\n");
         } else {
             if ((err = cleanup_extra_files(".", target_files)) != 0) {
@@ -374,8 +457,8 @@ int gitnano_log() {
         return -1;
     }
 
-    char current_sha1[SHA1_HEX_SIZE];
-    if ((err = get_current_commit(current_sha1)) != 0) {
+    object_id current_oid;
+    if ((err = get_current_commit(&current_oid)) != 0) {
         printf("No commits found\n");
         chdir(original_cwd);
         return 0;
@@ -383,15 +466,15 @@ int gitnano_log() {
 
     printf("Commit history:\n");
 
-    while (strlen(current_sha1) > 0) {
+    while (!oid_is_null(&current_oid)) {
         gitnano_commit_info commit;
-        if ((err = commit_parse(current_sha1, &commit)) != 0) {
+        if ((err = commit_parse(&current_oid, &commit)) != 0) {
             printf("ERROR: commit_parse: %d\n", err);
             break;
         }
 
         printf("\ncommit ");
-        print_colored_hash(current_sha1);
+        print_colored_oid(&current_oid);
         printf("\n");
         printf("Author: %s\n", commit.author);
         char formatted_date[32];
@@ -400,14 +483,16 @@ int gitnano_log() {
         printf("Commit message: %s\n", commit.message);
 
         // Move to parent
-        if (commit_get_parent(current_sha1, current_sha1) != 0) {
+        if (commit_get_parent(&current_oid, &current_oid) != 0) {
             // Failed to get parent - either no parent or parent is not a GitNano commit
             break;
         }
 
         // Verify the parent commit exists in GitNano repository
-        if (!commit_exists(current_sha1)) {
-            printf("WARNING: Parent commit %s not found in GitNano repository, stopping log\n", current_sha1);
+        if (!commit_exists(&current_oid)) {
+            char hex[OID_MAX_HEX_SIZE];
+            printf("WARNING: Parent commit %s not found in GitNano repository, stopping log\n",
+                   oid_to_hex(&current_oid, hex));
             break;
         }
     }
@@ -421,8 +506,7 @@ int gitnano_log() {
 int gitnano_diff(const char *commit1, const char *commit2) {
     char workspace_path[MAX_PATH];
     char original_cwd[MAX_PATH];
-    char sha1[SHA1_HEX_SIZE] = {0};
-    char sha2[SHA1_HEX_SIZE] = {0};
+    object_id oid1, oid2;
 
     // Basic validation
     if (check_repo_exists() != 0) return -1;
@@ -447,14 +531,14 @@ int gitnano_diff(const char *commit1, const char *commit2) {
     // Handle different argument scenarios
     if (!commit1 && !commit2) {
         // Diff working directory with current commit
-        if (get_current_commit(sha1) != 0) {
+        if (get_current_commit(&oid1) != 0) {
             printf("No commits found to compare\n");
             chdir(original_cwd);
             return -1;
         }
 
         printf("Comparing working directory with commit ");
-        print_colored_hash(sha1);
+        print_colored_oid(&oid1);
         printf("\n");
 
         // Change back to original directory for working directory comparison
@@ -463,37 +547,36 @@ int gitnano_diff(const char *commit1, const char *commit2) {
             return -1;
         }
 
-        return diff_working_directory(sha1);
+        return diff_working_directory(&oid1);
     }
 
     // Handle commit-to-commit diff scenarios
     if (commit1 && !commit2) {
         // Diff specified commit with current commit
-        if (get_current_commit(sha2) != 0) {
+        if (get_current_commit(&oid2) != 0) {
             printf("No current commit found\n");
             chdir(original_cwd);
             return -1;
         }
 
-        if (strlen(commit1) != SHA1_HEX_SIZE - 1) {
+        if (strlen(commit1) != 2 * hash_algo_raw_size(repo_hash_algo()) || oid_from_hex(commit1, &oid1) != 0) {
             printf("Invalid commit SHA1: %s\n", commit1);
             chdir(original_cwd);
             return -1;
         }
-        strcpy(sha1, commit1);
     } else if (commit1 && commit2) {
         // Diff two specified commits
-        if (strlen(commit1) != SHA1_HEX_SIZE - 1 || strlen(commit2) != SHA1_HEX_SIZE - 1) {
+        size_t hex_len = 2 * hash_algo_raw_size(repo_hash_algo());
+        if (strlen(commit1) != hex_len || strlen(commit2) != hex_len ||
+            oid_from_hex(commit1, &oid1) != 0 || oid_from_hex(commit2, &oid2) != 0) {
             printf("Invalid commit SHA1 format\n");
             chdir(original_cwd);
             return -1;
         }
-        strcpy(sha1, commit1);
-        strcpy(sha2, commit2);
     }
 
     // Compare two commits using helper function
-    int result = compare_commits(sha1, sha2);
+    int result = compare_commits(&oid1, &oid2);
     chdir(original_cwd);
     return result;
 }
@@ -542,12 +625,12 @@ int gitnano_status() {
     // Change to workspace to get current commit files if there are commits
     if (file_exists(gitnano_dir)) {
         if (chdir(workspace_path) == 0) {
-            char current_sha1[SHA1_HEX_SIZE];
-            if (get_current_commit(current_sha1) == 0) {
+            object_id current_oid;
+            if (get_current_commit(&current_oid) == 0) {
                 has_commits = 1;
-                char tree_sha1[SHA1_HEX_SIZE];
-                if (commit_get_tree(current_sha1, tree_sha1) == 0) {
-                    collect_tree_files(tree_sha1, &workspace_files);
+                object_id tree_oid;
+                if (commit_get_tree(&current_oid, &tree_oid) == 0) {
+                    collect_tree_files(&tree_oid, &workspace_files);
                 }
             }
             chdir(cwd);  // Change back to original directory
@@ -591,10 +674,10 @@ int gitnano_status() {
 
         // Change to workspace directory to check repository status
         if (chdir(workspace_path) == 0) {
-            char current_sha1[SHA1_HEX_SIZE];
-            if (get_current_commit(current_sha1) == 0) {
+            object_id current_oid;
+            if (get_current_commit(&current_oid) == 0) {
                 printf("  Current commit: ");
-                print_colored_hash(current_sha1);
+                print_colored_oid(&current_oid);
                 printf("\n");
 
                 char ref[MAX_PATH];
@@ -619,8 +702,49 @@ int gitnano_status() {
     return 0;
 }
 
+// Pack all objects of the repository into a single pack file
+int gitnano_repack() {
+    int err;
+    if (check_repo_exists() != 0) return -1;
+
+    // Change to workspace directory for gitnano operations
+    char workspace_path[MAX_PATH];
+    if (get_workspace_path(workspace_path, sizeof(workspace_path)) != 0) {
+        printf("ERROR: Failed to get workspace path\n");
+        return -1;
+    }
+
+    char original_cwd[MAX_PATH];
+    if (!getcwd(original_cwd, sizeof(original_cwd))) {
+        printf("ERROR: Failed to get current directory\n");
+        return -1;
+    }
+
+    if (chdir(workspace_path) != 0) {
+        printf("ERROR: Failed to change to workspace directory\n");
+        return -1;
+    }
+
+    if ((err = pack_repack()) != 0) {
+        printf("ERROR: pack_repack: %d\n", err);
+    }
+
+    // Change back to original directory
+    chdir(original_cwd);
+    return err;
+}
+
 // Auto-sync files based on diff results - used by commit
-static int auto_sync_working_files() {
+static void free_string_list(char **list, size_t count) {
+    for (size_t i = 0; i < count; i++) free(list[i]);
+    free(list);
+}
+
+// Copy every regular file of the working directory to the workspace,
+// returning the names and stat data of those copied so the commit can
+// stage them. Files whose stat data matches their index entry are neither
+// copied nor returned.
+static int auto_sync_working_files(const gitnano_index *index, char ***names_out, struct stat **stats_out, size_t *count_out) {
     // Get current working directory
     char cwd[MAX_PATH];
     if (!getcwd(cwd, sizeof(cwd))) {
@@ -641,6 +765,10 @@ static int auto_sync_working_files() {
 
     struct dirent *entry;
     int synced_files = 0;
+    size_t names_alloc = 0;
+    *names_out = NULL;
+    *stats_out = NULL;
+    *count_out = 0;
 
     while ((entry = readdir(dir)) != NULL) {
         // Skip ., .., .gitnano directory and unsafe files
@@ -653,9 +781,21 @@ static int auto_sync_working_files() {
 
         struct stat st;
         if (stat(entry->d_name, &st) == 0 && S_ISREG(st.st_mode)) {
-            // It's a regular file, sync it
+            const index_entry *staged = index_find(index, entry->d_name);
+            if (staged && index_entry_is_current(index, staged, &st)) {
+                continue;
+            }
+
+            // It's a new or changed regular file, sync it
             if (workspace_push_file(entry->d_name) == 0) {
                 synced_files++;
+                if (*count_out == names_alloc) {
+                    names_alloc = names_alloc ? names_alloc * 2 : 16;
+                    *names_out = safe_realloc(*names_out, names_alloc * sizeof(char *));
+                    *stats_out = safe_realloc(*stats_out, names_alloc * sizeof(struct stat));
+                }
+                (*stats_out)[*count_out] = st;
+                (*names_out)[(*count_out)++] = safe_strdup(entry->d_name);
             }
         }
     }
@@ -676,6 +816,7 @@ void print_usage() {
     printf("  gitnano log                     Show commit history\n");
     printf("  gitnano diff [sha1] [sha2]      Show differences between commits\n");
     printf("  gitnano status                  Show current directory and workspace sync status\n");
+    printf("  gitnano repack                  Pack all objects into a single pack file\n");
     printf("\nHow it works:\n");
     printf("  - All files are automatically copied to workspace on init\n");
     printf("  - 'gitnano add' auto-syncs files to workspace before staging\n");
@@ -683,7 +824,7 @@ void print_usage() {
     printf("  - 'gitnano status' shows sync status between working directory and workspace\n");
     printf("  - Workspace is located at: ~/GitNano/[project-name]/ (or $GITNANO_DIR/[project-name]/)\n");
     printf("\nReferences can be:\n");
-    printf("  - Full SHA1 (40 chars)\n");
+    printf("  - Full object id (40 hex chars, 64 for sha256/blake3 repositories)\n");
     printf("  - Partial SHA1 (4-7 chars)\n");
     printf("  - Branch name (e.g., 'master')\n");
     printf("  - Relative reference (e.g., 'HEAD~1')\n");
@@ -693,12 +834,17 @@ void print_usage() {
 
 // Command handler implementations
 static int handle_init(int argc, char *argv[]) {
-    if (argc > 2) {
-        printf("Usage: gitnano init\n");
-        printf("Too many arguments: %s\n", argv[2]);
-        return 1;
+    const char *object_format = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--object-format=", 16) == 0) {
+            object_format = argv[i] + 16;
+        } else {
+            printf("Usage: gitnano init [--object-format=sha1|sha256|blake3]\n");
+            printf("Unknown argument: %s\n", argv[i]);
+            return 1;
+        }
     }
-    return gitnano_init();
+    return object_format ? gitnano_init_with_format(object_format) : gitnano_init();
 }
 
 static int handle_add(int argc, char *argv[]) {
@@ -764,6 +910,15 @@ static int handle_status(int argc, char *argv[]) {
     return gitnano_status();
 }
 
+static int handle_repack(int argc, char *argv[]) {
+    if (argc > 2) {
+        printf("Usage: gitnano repack\n");
+        printf("Too many arguments: %s\n", argv[2]);
+        return 1;
+    }
+    return gitnano_repack();
+}
+
 // Array of commands
 const command_t commands[] = {
     {"init", handle_init},
@@ -773,5 +928,6 @@ const command_t commands[] = {
     {"log", handle_log},
     {"diff", handle_diff},
     {"status", handle_status},
+    {"repack", handle_repack},
     {NULL, NULL} // Sentinel to mark the end of the array
 };
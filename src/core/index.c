@@ -0,0 +1,986 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include "index.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+
+// The index records every file of the workspace with its mode, blob id and
+// stat data, sorted by path, so a commit only hashes files whose stat data
+// changed and writes its trees without reading the workspace again. The
+// cache-tree keeps the tree id of each directory that has not changed
+// since it was last written; only directories on the path of a changed
+// file are serialized again.
+
+// Drop "./" components and empty ones, so "./a//b/" and "a/b" are one path
+static char *index_normalize_path(const char *path) {
+    char *normalized = safe_malloc(strlen(path) + 1);
+    size_t len = 0;
+    const char *p = path;
+    while (*p) {
+        const char *slash = strchr(p, '/');
+        size_t part_len = slash ? (size_t)(slash - p) : strlen(p);
+        if (part_len > 0 && !(part_len == 1 && p[0] == '.')) {
+            if (len > 0) normalized[len++] = '/';
+            memcpy(normalized + len, p, part_len);
+            len += part_len;
+        }
+        p += part_len;
+        if (*p == '/') p++;
+    }
+    normalized[len] = '\0';
+    return normalized;
+}
+
+// First entry whose path is not below key in path order
+static size_t index_lower_bound(const gitnano_index *index, const char *key) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index->entries[mid].path, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static size_t cache_tree_lower_bound(const gitnano_index *index, const char *path) {
+    size_t lo = 0, hi = index->tree_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index->trees[mid].path, path) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static cache_tree_node *cache_tree_find(gitnano_index *index, const char *path) {
+    size_t pos = cache_tree_lower_bound(index, path);
+    if (pos < index->tree_count && strcmp(index->trees[pos].path, path) == 0) {
+        return &index->trees[pos];
+    }
+    return NULL;
+}
+
+// Record the tree id of a directory
+static void cache_tree_set(gitnano_index *index, const char *path, size_t entry_count, const object_id *oid) {
+    size_t pos = cache_tree_lower_bound(index, path);
+    if (pos == index->tree_count || strcmp(index->trees[pos].path, path) != 0) {
+        if (index->tree_count == index->tree_alloc) {
+            index->tree_alloc = index->tree_alloc ? index->tree_alloc * 2 : 16;
+            index->trees = safe_realloc(index->trees, index->tree_alloc * sizeof(cache_tree_node));
+        }
+        memmove(&index->trees[pos + 1], &index->trees[pos], (index->tree_count - pos) * sizeof(cache_tree_node));
+        index->trees[pos].path = safe_strdup(path);
+        index->tree_count++;
+    }
+    index->trees[pos].entry_count = entry_count;
+    oid_copy(&index->trees[pos].oid, oid);
+}
+
+static void cache_tree_remove_at(gitnano_index *index, size_t pos) {
+    free(index->trees[pos].path);
+    memmove(&index->trees[pos], &index->trees[pos + 1], (index->tree_count - pos - 1) * sizeof(cache_tree_node));
+    index->tree_count--;
+}
+
+// Forget the tree ids of every directory containing path
+static void cache_tree_invalidate(gitnano_index *index, const char *path) {
+    char *dir = safe_strdup(path);
+    for (;;) {
+        char *slash = strrchr(dir, '/');
+        if (slash) {
+            *slash = '\0';
+        } else {
+            dir[0] = '\0';
+        }
+        size_t pos = cache_tree_lower_bound(index, dir);
+        if (pos < index->tree_count && strcmp(index->trees[pos].path, dir) == 0) {
+            cache_tree_remove_at(index, pos);
+        }
+        if (!slash) break;
+    }
+    free(dir);
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void put_be32(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void put_be64(unsigned char *p, uint64_t value) {
+    put_be32(p, value >> 32);
+    put_be32(p + 4, (uint32_t)value);
+}
+
+// Record stat data, or clear it when st is NULL
+static void index_entry_set_stat(index_entry *entry, const struct stat *st) {
+    if (!st) {
+        entry->ctime_sec = entry->ctime_nsec = entry->mtime_sec = entry->mtime_nsec = entry->ino = 0;
+        entry->size = 0;
+        return;
+    }
+    entry->ctime_sec = (uint32_t)st->st_ctim.tv_sec;
+    entry->ctime_nsec = (uint32_t)st->st_ctim.tv_nsec;
+    entry->mtime_sec = (uint32_t)st->st_mtim.tv_sec;
+    entry->mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    entry->ino = (uint32_t)st->st_ino;
+    entry->size = (uint64_t)st->st_size;
+}
+
+static uint32_t mode_from_stat(const struct stat *st) {
+    return (st->st_mode & S_IXUSR) ? TREE_MODE_EXEC : TREE_MODE_FILE;
+}
+
+// A file is current when its stat data matches the entry. Files modified
+// in the same second the index was written may have changed again without
+// moving mtime, so those are hashed anyway.
+int index_entry_is_current(const gitnano_index *index, const index_entry *entry, const struct stat *st) {
+    if (entry->mtime_sec == 0 && entry->size == 0 && entry->ino == 0) return 0;
+    if (entry->mode != mode_from_stat(st) ||
+        entry->ctime_sec != (uint32_t)st->st_ctim.tv_sec || entry->ctime_nsec != (uint32_t)st->st_ctim.tv_nsec ||
+        entry->mtime_sec != (uint32_t)st->st_mtim.tv_sec || entry->mtime_nsec != (uint32_t)st->st_mtim.tv_nsec ||
+        entry->ino != (uint32_t)st->st_ino || entry->size != (uint64_t)st->st_size) {
+        return 0;
+    }
+    return (time_t)entry->mtime_sec < index->timestamp.tv_sec;
+}
+
+static void index_insert_at(gitnano_index *index, size_t pos, char *path, uint32_t mode, const object_id *oid) {
+    if (index->count == index->alloc) {
+        index->alloc = index->alloc ? index->alloc * 2 : 64;
+        index->entries = safe_realloc(index->entries, index->alloc * sizeof(index_entry));
+    }
+    memmove(&index->entries[pos + 1], &index->entries[pos], (index->count - pos) * sizeof(index_entry));
+    index->entries[pos].path = path;
+    index->entries[pos].mode = mode;
+    oid_copy(&index->entries[pos].oid, oid);
+    index_entry_set_stat(&index->entries[pos], NULL);
+    index->count++;
+}
+
+static void index_clear(gitnano_index *index) {
+    for (size_t i = 0; i < index->count; i++) free(index->entries[i].path);
+    for (size_t i = 0; i < index->tree_count; i++) free(index->trees[i].path);
+    index->count = 0;
+    index->tree_count = 0;
+}
+
+// Create the lock file exclusively. It is named by absolute path, so the
+// lock can be released after the process changed directory.
+static int index_lock(gitnano_index *index) {
+    char cwd[MAX_PATH];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        fprintf(stderr, "ERROR: index_lock: getcwd failed\n");
+        return -1;
+    }
+    char *path = safe_asprintf("%s/%s", cwd, INDEX_LOCK_FILE);
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: index_lock: cannot create %s: %s\n", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    index->lock_path = path;
+    index->lock_fd = fd;
+    return 0;
+}
+
+// Drop a held lock without writing the index
+static void index_unlock(gitnano_index *index) {
+    if (!index->lock_path) return;
+    close(index->lock_fd);
+    unlink(index->lock_path);
+    free(index->lock_path);
+    index->lock_path = NULL;
+}
+
+void index_free(gitnano_index *index) {
+    index_unlock(index);
+    index_clear(index);
+    for (size_t i = 0; i < index->base_count; i++) free(index->base[i].path);
+    free(index->entries);
+    free(index->trees);
+    free(index->base);
+    memset(index, 0, sizeof(*index));
+}
+
+const index_entry *index_find(const gitnano_index *index, const char *path) {
+    size_t pos = index_lower_bound(index, path);
+    if (pos < index->count && strcmp(index->entries[pos].path, path) == 0) {
+        return &index->entries[pos];
+    }
+    return NULL;
+}
+
+static void index_remove_range(gitnano_index *index, size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) free(index->entries[i].path);
+    memmove(&index->entries[lo], &index->entries[hi], (index->count - hi) * sizeof(index_entry));
+    index->count -= hi - lo;
+}
+
+// Drop the entries a file or directory at path replaces: the path itself,
+// everything below it, and any file standing where one of its parent
+// directories now is
+static void index_remove_conflicts(gitnano_index *index, const char *path) {
+    size_t pos = index_lower_bound(index, path);
+    if (pos < index->count && strcmp(index->entries[pos].path, path) == 0) {
+        index_remove_range(index, pos, pos + 1);
+    }
+
+    // Entries below a directory are contiguous in path order
+    char *dir_prefix = safe_asprintf("%s/", path);
+    size_t dir_prefix_len = strlen(dir_prefix);
+    size_t lo = index_lower_bound(index, dir_prefix), hi = lo;
+    while (hi < index->count && strncmp(index->entries[hi].path, dir_prefix, dir_prefix_len) == 0) hi++;
+    index_remove_range(index, lo, hi);
+    free(dir_prefix);
+
+    char *parent = safe_strdup(path);
+    for (char *slash = strrchr(parent, '/'); slash; slash = strrchr(parent, '/')) {
+        *slash = '\0';
+        pos = index_lower_bound(index, parent);
+        if (pos < index->count && strcmp(index->entries[pos].path, parent) == 0) {
+            index_remove_range(index, pos, pos + 1);
+        }
+    }
+    free(parent);
+}
+
+// Stage one file, replacing any entry for the same path. st is the stat
+// data of the file that was hashed, if known.
+int index_add(gitnano_index *index, const char *path, uint32_t mode, const object_id *oid, const struct stat *st) {
+    char *normalized = index_normalize_path(path);
+    if (!*normalized) {
+        free(normalized);
+        fprintf(stderr, "ERROR: index_add: empty path\n");
+        return -1;
+    }
+
+    size_t pos = index_lower_bound(index, normalized);
+    if (pos < index->count && strcmp(index->entries[pos].path, normalized) == 0) {
+        index_entry *entry = &index->entries[pos];
+        if (entry->mode != mode || !oid_equal(&entry->oid, oid)) {
+            entry->mode = mode;
+            oid_copy(&entry->oid, oid);
+            cache_tree_invalidate(index, normalized);
+        }
+        index_entry_set_stat(entry, st);
+        free(normalized);
+        return 0;
+    }
+
+    index_remove_conflicts(index, normalized);
+    pos = index_lower_bound(index, normalized);
+    index_insert_at(index, pos, normalized, mode, oid);
+    index_entry_set_stat(&index->entries[pos], st);
+    cache_tree_invalidate(index, normalized);
+    return 0;
+}
+
+// Hash workspace files into blobs and stage them with the stat data of
+// the working directory files they were copied from
+int index_stage_files(gitnano_index *index, const char *const *paths, const struct stat *stats, size_t count) {
+    int err = 0;
+    object_id *oids = safe_malloc((count ? count : 1) * sizeof(object_id));
+    if (count > 0 && (err = blob_create_from_files(paths, count, oids)) != 0) {
+        printf("ERROR: blob_create_from_files: %d\n", err);
+    }
+    for (size_t i = 0; err == 0 && i < count; i++) {
+        err = index_add(index, paths[i], mode_from_stat(&stats[i]), &oids[i], &stats[i]);
+    }
+    free(oids);
+    return err;
+}
+
+static int index_compare_entries(const void *a, const void *b) {
+    return strcmp(((const index_entry *)a)->path, ((const index_entry *)b)->path);
+}
+
+// Append every file below tree_oid and record the tree ids on the way;
+// the caller sorts the entries afterwards
+static int index_walk_tree(gitnano_index *index, const object_id *tree_oid, const char *prefix, size_t *count_out) {
+    int err;
+    tree_iter iter;
+    if ((err = tree_iter_open(&iter, tree_oid)) != 0) {
+        return err;
+    }
+
+    size_t count = 0;
+    while (tree_iter_next(&iter)) {
+        char *path = *prefix ? safe_asprintf("%s/%s", prefix, iter.name) : safe_strdup(iter.name);
+        object_id entry_oid;
+        tree_iter_oid(&iter, &entry_oid);
+
+        if (iter.type == TREE_ENTRY_TREE) {
+            size_t sub_count = 0;
+            err = index_walk_tree(index, &entry_oid, path, &sub_count);
+            free(path);
+            if (err != 0) {
+                tree_iter_close(&iter);
+                return err;
+            }
+            count += sub_count;
+        } else {
+            index_insert_at(index, index->count, path, iter.mode, &entry_oid);
+            count++;
+        }
+    }
+    tree_iter_close(&iter);
+
+    cache_tree_set(index, prefix, count, tree_oid);
+    *count_out = count;
+    return 0;
+}
+
+// Replace a path, and anything below it, with the entry a checkout restored:
+// a file, or a whole directory given by its tree id
+int index_checkout_path(gitnano_index *index, const char *path, uint32_t mode, const object_id *oid) {
+    char *normalized = index_normalize_path(path);
+    if (!*normalized) {
+        free(normalized);
+        return index_read_tree(index, oid);
+    }
+    if (!TREE_MODE_IS_DIR(mode)) {
+        int err = index_add(index, normalized, mode, oid, NULL);
+        free(normalized);
+        return err;
+    }
+
+    index_remove_conflicts(index, normalized);
+    char *dir_prefix = safe_asprintf("%s/", normalized);
+    size_t pos = cache_tree_lower_bound(index, dir_prefix);
+    while (pos < index->tree_count && strncmp(index->trees[pos].path, dir_prefix, strlen(dir_prefix)) == 0) {
+        cache_tree_remove_at(index, pos);
+    }
+    cache_tree_invalidate(index, dir_prefix);
+    free(dir_prefix);
+
+    size_t added = 0;
+    int err = index_walk_tree(index, oid, normalized, &added);
+    qsort(index->entries, index->count, sizeof(index_entry), index_compare_entries);
+    free(normalized);
+    return err;
+}
+
+// Replace the whole index with the contents of a tree
+int index_read_tree(gitnano_index *index, const object_id *tree_oid) {
+    index_clear(index);
+    size_t added = 0;
+    int err = index_walk_tree(index, tree_oid, "", &added);
+    qsort(index->entries, index->count, sizeof(index_entry), index_compare_entries);
+    return err;
+}
+
+// Write the tree of the directory prefix, whose entries are [lo, hi)
+static int index_write_subtree(gitnano_index *index, const char *prefix, size_t lo, size_t hi, object_id *oid_out) {
+    cache_tree_node *node = cache_tree_find(index, prefix);
+    if (node && node->entry_count == hi - lo) {
+        oid_copy(oid_out, &node->oid);
+        return 0;
+    }
+
+    int err;
+    size_t prefix_len = *prefix ? strlen(prefix) + 1 : 0;
+    size_t item_count = 0, names_size = 0;
+    for (size_t i = lo; i < hi;) {
+        const char *name = index->entries[i].path + prefix_len;
+        const char *slash = strchr(name, '/');
+        size_t name_len = slash ? (size_t)(slash - name) : strlen(name);
+        item_count++;
+        names_size += name_len + 1;
+        for (i++; slash && i < hi && strncmp(index->entries[i].path + prefix_len, name, name_len + 1) == 0; i++) {
+        }
+    }
+
+    gitnano_tree *tree = tree_new(item_count, names_size);
+    for (size_t i = lo; i < hi;) {
+        const index_entry *entry = &index->entries[i];
+        const char *name = entry->path + prefix_len;
+        const char *slash = strchr(name, '/');
+        if (!slash) {
+            tree_add(tree, entry->mode, &entry->oid, name, strlen(name));
+            i++;
+            continue;
+        }
+
+        // Everything below this subdirectory
+        size_t name_len = (size_t)(slash - name);
+        size_t end = i + 1;
+        while (end < hi && strncmp(index->entries[end].path + prefix_len, name, name_len + 1) == 0) {
+            end++;
+        }
+        char *sub_prefix = strndup(entry->path, prefix_len + name_len);
+        object_id sub_oid;
+        err = index_write_subtree(index, sub_prefix, i, end, &sub_oid);
+        free(sub_prefix);
+        if (err != 0) {
+            tree_free(tree);
+            return err;
+        }
+        tree_add(tree, TREE_MODE_DIR, &sub_oid, name, name_len);
+        i = end;
+    }
+    tree_sort(tree);
+
+    if ((err = tree_write(tree, oid_out)) != 0) {
+        printf("ERROR: tree_write: %d\n", err);
+        tree_free(tree);
+        return err;
+    }
+    tree_free(tree);
+
+    cache_tree_set(index, prefix, hi - lo, oid_out);
+    return 0;
+}
+
+// Write the trees of the staged files, reusing every cached directory
+int index_write_tree(gitnano_index *index, object_id *oid_out) {
+    return index_write_subtree(index, "", 0, index->count, oid_out);
+}
+
+// Count the paths whose staged mode or blob differs from the tree,
+// including paths only one side has. A NULL tree counts every entry.
+int index_count_changes(const gitnano_index *index, const object_id *tree_oid) {
+    if (!tree_oid) return (int)index->count;
+
+    // An up to date root cache-tree node settles it without reading trees
+    const cache_tree_node *root = index->tree_count > 0 && index->trees[0].path[0] == '\0' ? &index->trees[0] : NULL;
+    if (root && root->entry_count == index->count && oid_equal(&root->oid, tree_oid)) return 0;
+
+    gitnano_index head;
+    memset(&head, 0, sizeof(head));
+    if (index_read_tree(&head, tree_oid) != 0) {
+        index_free(&head);
+        return -1;
+    }
+
+    int changes = 0;
+    size_t i = 0, j = 0;
+    while (i < index->count || j < head.count) {
+        int cmp = i == index->count ? 1 : j == head.count ? -1 : strcmp(index->entries[i].path, head.entries[j].path);
+        if (cmp != 0) {
+            changes++;
+            if (cmp < 0) i++; else j++;
+            continue;
+        }
+        if (index->entries[i].mode != head.entries[j].mode || !oid_equal(&index->entries[i].oid, &head.entries[j].oid)) {
+            changes++;
+        }
+        i++;
+        j++;
+    }
+    index_free(&head);
+    return changes;
+}
+
+// Parse the entries and extensions of an index file whose header and
+// checksum have been checked. A LINK extension names the shared index the
+// entries are a delta against; link_out is null when there is none.
+static int index_parse(gitnano_index *index, const unsigned char *data, size_t size, object_id *link_out) {
+    size_t id_size = hash_algo_raw_size(repo_hash_algo());
+    hash_algo algo = repo_hash_algo();
+    const unsigned char *end = data + size - SHA1_RAW_SIZE;
+    const unsigned char *ptr = data + 12;
+    uint32_t count = get_be32(data + 8);
+    oid_clear(link_out);
+
+    for (uint32_t i = 0; i < count; i++) {
+        size_t fixed = 6 * 4 + 8 + id_size + 2;
+        if ((size_t)(end - ptr) < fixed) return -1;
+        size_t path_len = ((size_t)ptr[fixed - 2] << 8) | ptr[fixed - 1];
+        size_t entry_size = (fixed + path_len + 8) & ~(size_t)7;
+        if ((size_t)(end - ptr) < entry_size || ptr[fixed + path_len] != '\0') return -1;
+
+        object_id oid;
+        oid_from_raw(&oid, ptr + 32, algo);
+        index_insert_at(index, index->count, strndup((const char *)ptr + fixed, path_len), get_be32(ptr + 20), &oid);
+        index_entry *entry = &index->entries[index->count - 1];
+        entry->ctime_sec = get_be32(ptr);
+        entry->ctime_nsec = get_be32(ptr + 4);
+        entry->mtime_sec = get_be32(ptr + 8);
+        entry->mtime_nsec = get_be32(ptr + 12);
+        entry->ino = get_be32(ptr + 16);
+        entry->size = get_be64(ptr + 24);
+        ptr += entry_size;
+
+        // Entries are written sorted; anything else is corrupt
+        if (index->count > 1 && strcmp(index->entries[index->count - 2].path, entry->path) >= 0) return -1;
+    }
+
+    while (ptr < end) {
+        if ((size_t)(end - ptr) < 8) return -1;
+        uint32_t ext_size = get_be32(ptr + 4);
+        const unsigned char *ext = ptr + 8, *ext_end = ext + ext_size;
+        if ((size_t)(end - ext) < ext_size) return -1;
+
+        // Unknown extensions are optional and skipped
+        if (memcmp(ptr, INDEX_EXT_TREE, 4) == 0) {
+            while (ext < ext_end) {
+                const unsigned char *nul = memchr(ext, '\0', ext_end - ext);
+                if (!nul || (size_t)(ext_end - nul - 1) < 4 + id_size) return -1;
+                object_id oid;
+                oid_from_raw(&oid, nul + 5, algo);
+                cache_tree_set(index, (const char *)ext, get_be32(nul + 1), &oid);
+                ext = nul + 5 + id_size;
+            }
+        } else if (memcmp(ptr, INDEX_EXT_LINK, 4) == 0) {
+            if (ext_size != SHA1_RAW_SIZE) return -1;
+            oid_from_raw(link_out, ext, HASH_SHA1);
+        }
+        ptr = ext_end;
+    }
+    return 0;
+}
+
+// Read one index file. Returns 1 when it is missing or in an older text
+// format.
+static int index_read_file(const char *path, gitnano_index *index, object_id *link_out) {
+    size_t size;
+    unsigned char *content = (unsigned char *)read_file(path, &size);
+    if (!content) {
+        if (!file_exists(path)) return 1;
+        fprintf(stderr, "ERROR: index_read: cannot read %s\n", path);
+        return -1;
+    }
+
+    if (size < 12 + SHA1_RAW_SIZE || memcmp(content, INDEX_SIGNATURE, 4) != 0) {
+        free(content);
+        return 1;
+    }
+
+    unsigned char checksum[SHA1_RAW_SIZE];
+    hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+    int err = !ctx || hash_ctx_update(ctx, content, size - SHA1_RAW_SIZE) != 0 || hash_ctx_final(ctx, checksum) != 0;
+    hash_ctx_free(ctx);
+    if (err || get_be32(content + 4) != INDEX_VERSION ||
+        memcmp(checksum, content + size - SHA1_RAW_SIZE, SHA1_RAW_SIZE) != 0 ||
+        index_parse(index, content, size, link_out) != 0) {
+        fprintf(stderr, "ERROR: index_read: %s is corrupt\n", path);
+        free(content);
+        return -1;
+    }
+    free(content);
+    return 0;
+}
+
+static char *shared_index_path(const object_id *id) {
+    char hex[OID_MAX_HEX_SIZE];
+    return safe_asprintf("%s.%s", INDEX_SHARED_FILE, oid_to_hex(id, hex));
+}
+
+// Replace the delta entries with the shared entries overlaid by the delta;
+// whiteout entries (mode 0) remove a shared entry. The shared entries are
+// kept as the base the next write diffs against.
+static void index_merge_shared(gitnano_index *index, gitnano_index *shared) {
+    index_entry *merged = safe_malloc((shared->count + index->count + 1) * sizeof(index_entry));
+    size_t n = 0, i = 0, j = 0;
+    while (i < index->count || j < shared->count) {
+        int cmp = i == index->count ? 1 : j == shared->count ? -1 : strcmp(index->entries[i].path, shared->entries[j].path);
+        if (cmp > 0) {
+            merged[n] = shared->entries[j++];
+            merged[n].path = safe_strdup(merged[n].path);
+            n++;
+            continue;
+        }
+        if (cmp == 0) j++;
+        if (index->entries[i].mode == 0) {
+            free(index->entries[i++].path);
+        } else {
+            merged[n++] = index->entries[i++];
+        }
+    }
+    free(index->entries);
+    index->alloc = shared->count + index->count + 1;
+    index->entries = merged;
+    index->count = n;
+
+    index->base = shared->entries;
+    index->base_count = shared->count;
+    shared->entries = NULL;
+    shared->count = 0;
+}
+
+// Read the index, merging in its shared index when it is split. Returns 1,
+// with an empty index, when there is no index or only one in an older
+// text format.
+int index_read(gitnano_index *index) {
+    memset(index, 0, sizeof(*index));
+    struct stat st;
+    if (stat(INDEX_FILE, &st) != 0) return 1;
+    index->timestamp = st.st_mtim;
+
+    int err = index_read_file(INDEX_FILE, index, &index->base_oid);
+    if (err == 0 && !oid_is_null(&index->base_oid)) {
+        gitnano_index shared;
+        object_id link;
+        memset(&shared, 0, sizeof(shared));
+        char *path = shared_index_path(&index->base_oid);
+        if ((err = index_read_file(path, &shared, &link)) == 0) {
+            index_merge_shared(index, &shared);
+        } else {
+            fprintf(stderr, "ERROR: index_read: missing or corrupt shared index %s\n", path);
+            err = -1;
+        }
+        free(path);
+        index_free(&shared);
+    }
+    if (err != 0) index_free(index);
+    return err;
+}
+
+// Take the index lock, then read the index. The lock is held until the
+// index is written or freed, so a concurrent read-modify-write fails
+// instead of one of them silently losing the other's changes.
+int index_read_locked(gitnano_index *index) {
+    gitnano_index lock;
+    memset(index, 0, sizeof(*index));
+    memset(&lock, 0, sizeof(lock));
+    if (index_lock(&lock) != 0) return -1;
+    int err = index_read(index);
+    if (err < 0) {
+        index_unlock(&lock);
+        return err;
+    }
+    index->lock_path = lock.lock_path;
+    index->lock_fd = lock.lock_fd;
+    return err;
+}
+
+// Read the index, rebuilding it from the workspace when there is none yet
+// or it predates this format. The rebuild writes the workspace's objects,
+// so its trees are all cached afterwards.
+int index_load(gitnano_index *index) {
+    int err = index_read(index);
+    if (err <= 0) return err;
+
+    object_id tree_oid;
+    if ((err = tree_build(".", &tree_oid)) != 0) {
+        printf("ERROR: tree_build: %d\n", err);
+        return err;
+    }
+    return index_read_tree(index, &tree_oid);
+}
+
+// index_load under the index lock, as index_read_locked
+int index_load_locked(gitnano_index *index) {
+    int err = index_read_locked(index);
+    if (err <= 0) return err;
+
+    object_id tree_oid;
+    if ((err = tree_build(".", &tree_oid)) != 0) {
+        printf("ERROR: tree_build: %d\n", err);
+        index_unlock(index);
+        return err;
+    }
+    return index_read_tree(index, &tree_oid);
+}
+
+static void buffer_append(unsigned char **buf, size_t *len, size_t *alloc, const void *data, size_t size) {
+    if (*alloc - *len < size) {
+        while (*alloc - *len < size) *alloc = *alloc ? *alloc * 2 : 4096;
+        *buf = safe_realloc(*buf, *alloc);
+    }
+    memcpy(*buf + *len, data, size);
+    *len += size;
+}
+
+static void buffer_append_be32(unsigned char **buf, size_t *len, size_t *alloc, uint32_t value) {
+    unsigned char be[4];
+    put_be32(be, value);
+    buffer_append(buf, len, alloc, be, 4);
+}
+
+static void buffer_append_entry(unsigned char **buf, size_t *len, size_t *alloc, const index_entry *entry) {
+    static const unsigned char padding[8] = {0};
+    size_t path_len = strlen(entry->path);
+    unsigned char fixed[6 * 4 + 8];
+    put_be32(fixed, entry->ctime_sec);
+    put_be32(fixed + 4, entry->ctime_nsec);
+    put_be32(fixed + 8, entry->mtime_sec);
+    put_be32(fixed + 12, entry->mtime_nsec);
+    put_be32(fixed + 16, entry->ino);
+    put_be32(fixed + 20, entry->mode);
+    put_be64(fixed + 24, entry->size);
+    buffer_append(buf, len, alloc, fixed, sizeof(fixed));
+    buffer_append(buf, len, alloc, entry->oid.hash, oid_raw_size(&entry->oid));
+    unsigned char name_len[2] = {(unsigned char)(path_len >> 8), (unsigned char)path_len};
+    buffer_append(buf, len, alloc, name_len, 2);
+    buffer_append(buf, len, alloc, entry->path, path_len);
+
+    // NUL-terminate and pad the entry to a multiple of eight bytes
+    size_t entry_size = sizeof(fixed) + oid_raw_size(&entry->oid) + 2 + path_len;
+    buffer_append(buf, len, alloc, padding, 8 - entry_size % 8);
+}
+
+// Append the SHA-1 trailer, also returned in id_out when not NULL
+static int buffer_append_checksum(unsigned char **buf, size_t *len, size_t *alloc, object_id *id_out) {
+    unsigned char checksum[SHA1_RAW_SIZE];
+    hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+    int err = !ctx || hash_ctx_update(ctx, *buf, *len) != 0 || hash_ctx_final(ctx, checksum) != 0 ? -1 : 0;
+    hash_ctx_free(ctx);
+    if (err != 0) {
+        fprintf(stderr, "ERROR: index_write: cannot checksum index\n");
+        return -1;
+    }
+    buffer_append(buf, len, alloc, checksum, SHA1_RAW_SIZE);
+    if (id_out) oid_from_raw(id_out, checksum, HASH_SHA1);
+    return 0;
+}
+
+static int index_entry_equal(const index_entry *a, const index_entry *b) {
+    return a->mode == b->mode && oid_equal(&a->oid, &b->oid) &&
+           a->ctime_sec == b->ctime_sec && a->ctime_nsec == b->ctime_nsec &&
+           a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+           a->ino == b->ino && a->size == b->size;
+}
+
+// Split index limit (GITNANO_SPLIT_INDEX or index.split, and
+// GITNANO_SPLIT_INDEX_MAX_PERCENT or index.split_max_percent): the size of
+// the delta, as a percentage of the shared index, past which the delta is
+// folded into a new shared index. -1 when the index is not split.
+static int index_split_max_percent(void) {
+    char value[32];
+    if (config_get_setting("GITNANO_SPLIT_INDEX", "index.split", value, sizeof(value)) != 0 ||
+        (strcmp(value, "true") != 0 && strcmp(value, "1") != 0)) {
+        return -1;
+    }
+    if (config_get_setting("GITNANO_SPLIT_INDEX_MAX_PERCENT", "index.split_max_percent", value, sizeof(value)) != 0) {
+        return INDEX_SPLIT_MAX_PERCENT;
+    }
+    char *end;
+    long percent = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || percent < 0 || percent > 100) {
+        fprintf(stderr, "WARNING: invalid split index percentage '%s', using %d\n", value, INDEX_SPLIT_MAX_PERCENT);
+        return INDEX_SPLIT_MAX_PERCENT;
+    }
+    return (int)percent;
+}
+
+// Shared index expiry in seconds (GITNANO_SHARED_INDEX_EXPIRE or
+// index.shared_index_expire; "now" for 0, "never" for -1)
+static long index_shared_expire(void) {
+    char value[32];
+    if (config_get_setting("GITNANO_SHARED_INDEX_EXPIRE", "index.shared_index_expire", value, sizeof(value)) != 0) {
+        return INDEX_SHARED_EXPIRE;
+    }
+    if (strcmp(value, "never") == 0) return -1;
+    if (strcmp(value, "now") == 0) return 0;
+    char *end;
+    long seconds = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || seconds < 0) {
+        fprintf(stderr, "WARNING: invalid shared index expiry '%s', using %d\n", value, INDEX_SHARED_EXPIRE);
+        return INDEX_SHARED_EXPIRE;
+    }
+    return seconds;
+}
+
+// Remove the shared indexes, other than the one in use, that have not been
+// linked from a written index for longer than the expiry
+static void index_expire_shared(const object_id *current) {
+    long expire = index_shared_expire();
+    if (expire < 0) return;
+    DIR *dir = opendir(GITNANO_DIR);
+    if (!dir) return;
+
+    char *keep = oid_is_null(current) ? NULL : shared_index_path(current);
+    const char *prefix = strrchr(INDEX_SHARED_FILE, '/') + 1;
+    size_t prefix_len = strlen(prefix);
+    time_t now = time(NULL);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefix_len) != 0 || entry->d_name[prefix_len] != '.') continue;
+        char *path = safe_asprintf("%s/%s", GITNANO_DIR, entry->d_name);
+        struct stat st;
+        if ((!keep || strcmp(path, keep) != 0) && stat(path, &st) == 0 && st.st_mtime + expire <= now) {
+            unlink(path);
+        }
+        free(path);
+    }
+    closedir(dir);
+    free(keep);
+}
+
+// Append the entries that differ from the base, with a whiteout for each
+// base entry that is gone, and return how many there are
+static size_t buffer_append_delta(unsigned char **buf, size_t *len, size_t *alloc, const gitnano_index *index) {
+    size_t changes = 0, i = 0, j = 0;
+    while (i < index->count || j < index->base_count) {
+        int cmp = i == index->count ? 1 : j == index->base_count ? -1 : strcmp(index->entries[i].path, index->base[j].path);
+        if (cmp > 0) {
+            index_entry whiteout = index->base[j++];
+            whiteout.mode = 0;
+            buffer_append_entry(buf, len, alloc, &whiteout);
+            changes++;
+            continue;
+        }
+        if (cmp < 0 || !index_entry_equal(&index->entries[i], &index->base[j])) {
+            buffer_append_entry(buf, len, alloc, &index->entries[i]);
+            changes++;
+        }
+        if (cmp == 0) j++;
+        i++;
+    }
+    return changes;
+}
+
+static void index_drop_base(gitnano_index *index) {
+    for (size_t i = 0; i < index->base_count; i++) free(index->base[i].path);
+    free(index->base);
+    index->base = NULL;
+    index->base_count = 0;
+    oid_clear(&index->base_oid);
+}
+
+// Write every entry as a new shared index and make it the base
+static int index_write_shared(gitnano_index *index) {
+    unsigned char *buf = NULL;
+    size_t len = 0, alloc = 0;
+    object_id id;
+    buffer_append(&buf, &len, &alloc, INDEX_SIGNATURE, 4);
+    buffer_append_be32(&buf, &len, &alloc, INDEX_VERSION);
+    buffer_append_be32(&buf, &len, &alloc, (uint32_t)index->count);
+    for (size_t i = 0; i < index->count; i++) {
+        buffer_append_entry(&buf, &len, &alloc, &index->entries[i]);
+    }
+    if (buffer_append_checksum(&buf, &len, &alloc, &id) != 0) {
+        free(buf);
+        return -1;
+    }
+
+    // Shared indexes are named by their checksum, so an existing one is
+    // already correct
+    char *path = shared_index_path(&id);
+    int err = file_exists(path) ? 0 : write_file_atomic(path, buf, len, 0);
+    free(path);
+    free(buf);
+    if (err != 0) {
+        fprintf(stderr, "ERROR: index_write: cannot write shared index: %d\n", err);
+        return -1;
+    }
+
+    index_drop_base(index);
+    index->base = safe_malloc((index->count + 1) * sizeof(index_entry));
+    for (size_t i = 0; i < index->count; i++) {
+        index->base[i] = index->entries[i];
+        index->base[i].path = safe_strdup(index->entries[i].path);
+    }
+    index->base_count = index->count;
+    oid_copy(&index->base_oid, &id);
+    return 0;
+}
+
+// Write the index to its lock file, then rename it over the index. An
+// index read with index_read_locked or index_load_locked already holds the
+// lock; otherwise it is taken here. A split index writes only the entries
+// that changed since its shared index, folding them into a new shared
+// index once they pass the size limit.
+int index_write(gitnano_index *index) {
+    int max_percent = index_split_max_percent();
+    object_id old_base;
+    oid_copy(&old_base, &index->base_oid);
+
+    // Measure the delta against the current shared index, folding it into
+    // a new one when it has grown too large
+    unsigned char *delta = NULL;
+    size_t delta_len = 0, delta_alloc = 0, changes = 0;
+    if (max_percent < 0) {
+        index_drop_base(index);
+    } else if (!oid_is_null(&index->base_oid)) {
+        changes = buffer_append_delta(&delta, &delta_len, &delta_alloc, index);
+        if (changes * 100 > index->base_count * (size_t)max_percent) index_drop_base(index);
+    }
+    if (max_percent >= 0 && oid_is_null(&index->base_oid)) {
+        if (index_write_shared(index) != 0) {
+            free(delta);
+            return -1;
+        }
+        changes = delta_len = 0;
+    }
+
+    unsigned char *buf = NULL;
+    size_t len = 0, alloc = 0;
+    int split = !oid_is_null(&index->base_oid);
+    buffer_append(&buf, &len, &alloc, INDEX_SIGNATURE, 4);
+    buffer_append_be32(&buf, &len, &alloc, INDEX_VERSION);
+    buffer_append_be32(&buf, &len, &alloc, (uint32_t)(split ? changes : index->count));
+    if (split) {
+        buffer_append(&buf, &len, &alloc, delta, delta_len);
+    } else {
+        for (size_t i = 0; i < index->count; i++) buffer_append_entry(&buf, &len, &alloc, &index->entries[i]);
+    }
+    free(delta);
+
+    if (index->tree_count > 0) {
+        size_t ext_start = len;
+        buffer_append(&buf, &len, &alloc, INDEX_EXT_TREE, 4);
+        buffer_append_be32(&buf, &len, &alloc, 0);
+        for (size_t i = 0; i < index->tree_count; i++) {
+            const cache_tree_node *node = &index->trees[i];
+            buffer_append(&buf, &len, &alloc, node->path, strlen(node->path) + 1);
+            buffer_append_be32(&buf, &len, &alloc, (uint32_t)node->entry_count);
+            buffer_append(&buf, &len, &alloc, node->oid.hash, oid_raw_size(&node->oid));
+        }
+        put_be32(buf + ext_start + 4, (uint32_t)(len - ext_start - 8));
+    }
+    if (split) {
+        buffer_append(&buf, &len, &alloc, INDEX_EXT_LINK, 4);
+        buffer_append_be32(&buf, &len, &alloc, SHA1_RAW_SIZE);
+        buffer_append(&buf, &len, &alloc, index->base_oid.hash, SHA1_RAW_SIZE);
+    }
+    if (buffer_append_checksum(&buf, &len, &alloc, NULL) != 0) {
+        free(buf);
+        return -1;
+    }
+
+    if (!index->lock_path && index_lock(index) != 0) {
+        free(buf);
+        return -1;
+    }
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(index->lock_fd, buf + written, len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += (size_t)n;
+    }
+    free(buf);
+
+    char *index_path = strndup(index->lock_path, strlen(index->lock_path) - strlen(".lock"));
+    int err = close(index->lock_fd) != 0 || written < len || rename(index->lock_path, index_path) != 0 ? -1 : 0;
+    if (err != 0) {
+        fprintf(stderr, "ERROR: index_write: cannot write %s: %s\n", index_path, strerror(errno));
+        unlink(index->lock_path);
+    }
+    free(index_path);
+    free(index->lock_path);
+    index->lock_path = NULL;
+    if (err != 0) return -1;
+
+    // The mtime of a shared index records when it was last linked, and a
+    // superseded one is only removed once that is past the expiry
+    if (split) {
+        char *path = shared_index_path(&index->base_oid);
+        utimensat(AT_FDCWD, path, NULL, 0);
+        free(path);
+    }
+    if (!oid_is_null(&old_base) && !oid_equal(&old_base, &index->base_oid)) {
+        index_expire_shared(&index->base_oid);
+    }
+    return 0;
+}
@@ -1,93 +1,120 @@
 #include "gitnano.h"
+#include "pack.h"
+#include <ctype.h>
 #include <dirent.h>
 
-// Helper function to find object by partial SHA1
-static int find_object_by_partial_sha1(const char *partial_sha1, char *full_sha1) {
-    if (!partial_sha1 || !full_sha1 || strlen(partial_sha1) < 4) return -1;
+// Callback for pack_for_each_prefix: stop at the first commit
+static int match_packed_commit(const object_id *oid, void *data) {
+    if (!commit_exists(oid)) return 0;
+    oid_copy(data, oid);
+    return 1;
+}
 
-    char objects_dir[MAX_PATH];
-    snprintf(objects_dir, sizeof(objects_dir), "%s", OBJECTS_DIR);
+// Partial ids are 4 to 8 hex digits
+static int is_partial_sha1(const char *reference) {
+    size_t len = strlen(reference);
+    return len >= 4 && len <= 8 && hex_span(reference) == len;
+}
 
-    DIR *dir = opendir(objects_dir);
-    if (!dir) return -1;
+// Branch and ref names follow the usual Git rules: no empty or dot-led
+// components, no "..", no control or glob characters, no ".lock" suffix
+static int is_valid_ref_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || name[0] == '/' || name[len - 1] == '/' || name[len - 1] == '.' ||
+        strstr(name, "..") || strstr(name, "//") || strstr(name, "/.") || name[0] == '.' ||
+        (len >= 5 && strcmp(name + len - 5, ".lock") == 0)) {
+        return 0;
+    }
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        if (*p < 0x20 || *p == 0x7f || strchr(" ~^:?*[\\", *p)) return 0;
+    }
+    return 1;
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strlen(entry->d_name) != 2) continue;
+// A complete hex object name in the repository's object format
+static int is_full_hex_id(const char *str) {
+    size_t hex_len = 2 * hash_algo_raw_size(repo_hash_algo());
+    return strlen(str) == hex_len && hex_span(str) == hex_len;
+}
 
-        char *subdir = safe_asprintf("%s/%s", objects_dir, entry->d_name);
+// Helper function to find object by partial SHA1
+static int find_object_by_partial_sha1(const char *partial_sha1, object_id *oid_out) {
+    if (!partial_sha1 || !oid_out || !is_partial_sha1(partial_sha1)) return -1;
+
+    // Object names on disk are lowercase
+    char prefix[OID_MAX_HEX_SIZE];
+    size_t prefix_len = strlen(partial_sha1);
+    for (size_t i = 0; i <= prefix_len; i++) {
+        prefix[i] = (char)tolower((unsigned char)partial_sha1[i]);
+    }
 
-        DIR *subdir_ptr = opendir(subdir);
-        if (!subdir_ptr) {
-            free(subdir);
-            continue;
-        }
+    // Only the fanout directory named by the first two digits can match
+    char subdir[MAX_PATH];
+    snprintf(subdir, sizeof(subdir), "%s/%.2s", OBJECTS_DIR, prefix);
 
+    size_t hex_len = 2 * hash_algo_raw_size(repo_hash_algo());
+    DIR *dir = opendir(subdir);
+    if (dir) {
         struct dirent *obj_entry;
-        while ((obj_entry = readdir(subdir_ptr)) != NULL) {
-            // Skip . and .. entries
-            if (strcmp(obj_entry->d_name, ".") == 0 || strcmp(obj_entry->d_name, "..") == 0) continue;
+        while ((obj_entry = readdir(dir)) != NULL) {
+            if (strlen(obj_entry->d_name) != hex_len - 2 ||
+                strncmp(obj_entry->d_name, prefix + 2, prefix_len - 2) != 0) {
+                continue;
+            }
 
             // Construct full SHA1
-            char *candidate_sha1 = safe_asprintf("%s%s", entry->d_name, obj_entry->d_name);
-
-            // Check if candidate SHA1 starts with partial_sha1 (proper prefix matching)
-            if (strncmp(candidate_sha1, partial_sha1, strlen(partial_sha1)) == 0) {
-                // Verify this is a valid commit object
-                if (commit_exists(candidate_sha1)) {
-                    strcpy(full_sha1, candidate_sha1);
-                    free(candidate_sha1);
-                    free(subdir);
-                    closedir(subdir_ptr);
-                    closedir(dir);
-                    return 0;
-                }
+            char candidate_sha1[OID_MAX_HEX_SIZE];
+            memcpy(candidate_sha1, prefix, 2);
+            memcpy(candidate_sha1 + 2, obj_entry->d_name, hex_len - 1);
+
+            // Verify this is a valid commit object
+            object_id candidate;
+            if (oid_from_hex(candidate_sha1, &candidate) == 0 && commit_exists(&candidate)) {
+                oid_copy(oid_out, &candidate);
+                closedir(dir);
+                return 0;
             }
-            free(candidate_sha1);
         }
-        free(subdir);
-        closedir(subdir_ptr);
+        closedir(dir);
     }
 
-    closedir(dir);
+    // Fall back to packed objects
+    if (pack_for_each_prefix(prefix, match_packed_commit, oid_out) > 0) {
+        return 0;
+    }
     return -1;
 }
 
 // Resolve reference to full SHA1
-int resolve_reference(const char *reference, char *sha1_out) {
-    if (!reference || !sha1_out) {
+int resolve_reference(const char *reference, object_id *oid_out) {
+    if (!reference || !oid_out) {
         fprintf(stderr, "ERROR: resolve_reference: invalid arguments\n");
         return -1;
     }
 
     // Handle HEAD references first (before partial SHA1 matching)
     if (strncmp(reference, "HEAD", 4) == 0) {
-        char current_sha1[SHA1_HEX_SIZE];
-        int result = get_current_commit(current_sha1);
+        object_id current_oid;
+        int result = get_current_commit(&current_oid);
         if (result == 0) {
             if (strcmp(reference, "HEAD") == 0) {
-                strcpy(sha1_out, current_sha1);
+                oid_copy(oid_out, &current_oid);
                 return 0;
             }
 
             // Parse HEAD~N
-            if (reference[4] == '~' && reference[5] >= '1' && reference[5] <= '9') {
+            if (reference[4] == '~' && reference[5] >= '1' && reference[5] <= '9' &&
+                strspn(reference + 5, "0123456789") == strlen(reference + 5)) {
                 int n = atoi(reference + 5);
-                strcpy(sha1_out, current_sha1);
+                oid_copy(oid_out, &current_oid);
 
-                for (int i = 0; i < n && strlen(sha1_out) > 0; i++) {
-                    if (commit_get_parent(sha1_out, sha1_out) != 0) {
+                for (int i = 0; i < n; i++) {
+                    if (commit_get_parent(oid_out, oid_out) != 0) {
                         fprintf(stderr, "ERROR: resolve_reference: failed to get parent commit %d for HEAD~%d\n", i+1, n);
                         return -1;
                     }
                 }
-
-                if (strlen(sha1_out) > 0) {
-                    return 0;
-                } else {
-                    fprintf(stderr, "ERROR: resolve_reference: HEAD~%d goes beyond commit history\n", n);
-                    return -1;
-                }
+                return 0;
             }
         } else {
             fprintf(stderr, "ERROR: resolve_reference: failed to get current commit for HEAD reference\n");
@@ -96,9 +123,8 @@ int resolve_reference(const char *reference, char *sha1_out) {
     }
 
     // Check if it's a full SHA1
-    if (strlen(reference) == SHA1_HEX_SIZE - 1) {
-        if (commit_exists(reference)) {
-            strcpy(sha1_out, reference);
+    if (is_full_hex_id(reference)) {
+        if (oid_from_hex(reference, oid_out) == 0 && commit_exists(oid_out)) {
             return 0;
         }
         fprintf(stderr, "ERROR: resolve_reference: commit not found for SHA1 %s\n", reference);
@@ -106,14 +132,20 @@ int resolve_reference(const char *reference, char *sha1_out) {
     }
 
     // Check if it's a partial SHA1 (4-8 characters) - before branch names
-    if (strlen(reference) >= 4 && strlen(reference) <= 8) {
-        int result = find_object_by_partial_sha1(reference, sha1_out);
+    if (is_partial_sha1(reference)) {
+        int result = find_object_by_partial_sha1(reference, oid_out);
         if (result == 0) {
             return 0;
         }
         // Don't return error here - continue to check branch names
     }
 
+    // Anything else names a file under .gitnano: keep it inside refs/
+    if (!is_valid_ref_name(reference)) {
+        fprintf(stderr, "ERROR: resolve_reference: invalid reference name '%s'\n", reference);
+        return -1;
+    }
+
     // Check if it's a branch name
     if (strncmp(reference, "refs/heads/", 11) != 0) {
         char *branch_ref = safe_asprintf("refs/heads/%s", reference);
@@ -127,8 +159,8 @@ int resolve_reference(const char *reference, char *sha1_out) {
                 char *newline = strchr(content, '\n');
                 if (newline) *newline = '\0';
 
-                if (strlen(content) == SHA1_HEX_SIZE - 1 && commit_exists(content)) {
-                    strcpy(sha1_out, content);
+                if (is_full_hex_id(content) && oid_from_hex(content, oid_out) == 0 &&
+                    commit_exists(oid_out)) {
                     free(content);
                     free(branch_ref);
                     free(full_path);
@@ -159,8 +191,8 @@ int resolve_reference(const char *reference, char *sha1_out) {
                 char *newline = strchr(content, '\n');
                 if (newline) *newline = '\0';
 
-                if (strlen(content) == SHA1_HEX_SIZE - 1 && commit_exists(content)) {
-                    strcpy(sha1_out, content);
+                if (is_full_hex_id(content) && oid_from_hex(content, oid_out) == 0 &&
+                    commit_exists(oid_out)) {
                     free(content);
                     free(full_path);
                     return 0;
@@ -182,13 +214,13 @@ int resolve_reference(const char *reference, char *sha1_out) {
     }
 
     // If we got here and it's a partial SHA1, that means the partial SHA1 check failed
-    if (strlen(reference) >= 4 && strlen(reference) <= 8) {
+    if (is_partial_sha1(reference)) {
         fprintf(stderr, "ERROR: resolve_reference: no commit found matching partial SHA1 '%s'\n", reference);
         return -1;
     }
 
     // If it's not a full reference path and not a partial SHA1, it's likely a branch name that doesn't exist
-    if (strncmp(reference, "refs/heads/", 11) != 0 && !(strlen(reference) >= 4 && strlen(reference) <= 8)) {
+    if (strncmp(reference, "refs/heads/", 11) != 0) {
         fprintf(stderr, "ERROR: resolve_reference: branch '%s' not found\n", reference);
         return -1;
     }
@@ -235,15 +267,15 @@ int get_head_ref(char *ref_out) {
 int set_head_ref(const char *ref) {
     int err;
     char content[MAX_PATH];
-    if (strlen(ref) == SHA1_HEX_SIZE - 1) {
+    if (is_full_hex_id(ref)) {
         strcpy(content, ref);
     } else {
         snprintf(content, sizeof(content), "ref: %s", ref);
     }
     strcat(content, "\n");
 
-    if ((err = write_file(HEAD_FILE, content, strlen(content))) != 0) {
-        printf("ERROR: write_file: %d\n", err);
+    if ((err = write_file_atomic(HEAD_FILE, content, strlen(content), 1)) != 0) {
+        printf("ERROR: write_file_atomic: %d\n", err);
         return err;
     }
 
@@ -256,7 +288,7 @@ static void construct_full_path(const char *ref, char *full_path) {
 }
 
 // Helper function to read and validate SHA1 from file
-static int read_sha1_from_file(const char *path, char *sha1_out) {
+static int read_oid_from_file(const char *path, object_id *oid_out) {
     size_t size;
     char *content = read_file(path, &size);
     if (!content) return -1;
@@ -264,18 +296,15 @@ static int read_sha1_from_file(const char *path, char *sha1_out) {
     char *newline = strchr(content, '\n');
     if (newline) *newline = '\0';
 
-    int result = (strlen(content) == SHA1_HEX_SIZE - 1) ? 0 : -1;
-    if (result == 0) {
-        strcpy(sha1_out, content);
-    }
+    int result = is_full_hex_id(content) ? oid_from_hex(content, oid_out) : -1;
 
     free(content);
     return result;
 }
 
 // Get current branch or commit SHA-1
-int get_current_commit(char *sha1_out) {
-    if (!sha1_out) {
+int get_current_commit(object_id *oid_out) {
+    if (!oid_out) {
         fprintf(stderr, "ERROR: get_current_commit: invalid output buffer\n");
         return -1;
     }
@@ -293,20 +322,19 @@ int get_current_commit(char *sha1_out) {
         construct_full_path(ref, full_path);
 
         if (!file_exists(full_path)) {
-            sha1_out[0] = '\0';
+            oid_clear(oid_out);
             return -1;
         }
 
-        result = read_sha1_from_file(full_path, sha1_out);
+        result = read_oid_from_file(full_path, oid_out);
         if (result != 0) {
             fprintf(stderr, "ERROR: get_current_commit: failed to read SHA1 from branch file: %s\n", full_path);
         }
         return result;
     } else {
         // Direct SHA-1 reference
-        if (strlen(ref) == SHA1_HEX_SIZE - 1) {
-            if (commit_exists(ref)) {
-                strcpy(sha1_out, ref);
+        if (is_full_hex_id(ref) && oid_from_hex(ref, oid_out) == 0) {
+            if (commit_exists(oid_out)) {
                 return 0;
             } else {
                 fprintf(stderr, "ERROR: get_current_commit: commit object not found: %s\n", ref);
@@ -314,7 +342,7 @@ int get_current_commit(char *sha1_out) {
             }
         } else {
             fprintf(stderr, "ERROR: get_current_commit: invalid SHA1 format in HEAD: %s\n", ref);
-            sha1_out[0] = '\0';
+            oid_clear(oid_out);
             return -1;
         }
     }
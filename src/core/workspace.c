@@ -161,7 +161,7 @@ int workspace_is_initialized() {
 
 
 // Initialize workspace - create directory structure only (lazy file population)
-int workspace_init() {
+int workspace_init(const char *object_format) {
     if (workspace_exists()) {
         printf("Workspace already exists\n");
         return 0;
@@ -204,11 +204,24 @@ int workspace_init() {
     // Create initial HEAD file
     char *head_file = safe_asprintf("%s/HEAD", gitnano_dir);
     const char *head_content = "ref: refs/heads/master\n";
-    if (write_file(head_file, head_content, strlen(head_content)) != 0) {
+    if (write_file_atomic(head_file, head_content, strlen(head_content), 1) != 0) {
         printf("ERROR: Failed to create HEAD file\n");
         return -1;
     }
 
+    // Record the object format; it cannot change once objects exist
+    char *config_file = safe_asprintf("%s/config", gitnano_dir);
+    char *config_content = safe_asprintf("object_format = %s\n", object_format);
+    int config_err = write_file_atomic(config_file, config_content, strlen(config_content), 1);
+    free(config_file);
+    free(config_content);
+    if (config_err != 0) {
+        printf("ERROR: Failed to create config file\n");
+        return -1;
+    }
+    // Settings cached for a repository that used to live at this path are stale
+    object_store_reset();
+
     // Create refs/heads directory
     char *heads_dir = safe_asprintf("%s/refs/heads", gitnano_dir);
     if (mkdir_p(heads_dir) != 0) {
@@ -272,17 +285,14 @@ int workspace_push_file(const char *path) {
     }
 
     // Copy the file
-    size_t size;
-    char *data = read_file(src_path, &size);
-    if (!data) {
+    if (!file_exists(src_path)) {
         printf("ERROR: Failed to read source file: %s\n", src_path);
         free(src_path);
         free(dst_path);
         return -1;
     }
 
-    int result = write_file(dst_path, data, size);
-    free(data);
+    int result = copy_file(src_path, dst_path);
 
     if (result == 0) {
         printf("Synced %s to workspace\n", path);
@@ -342,17 +352,14 @@ int workspace_pullback_file(const char *path) {
     }
 
     // Copy the file
-    size_t size;
-    char *data = read_file(src_path, &size);
-    if (!data) {
+    if (!file_exists(src_path)) {
         printf("ERROR: Failed to read workspace file: %s\n", src_path);
         free(src_path);
         free(dst_path);
         return -1;
     }
 
-    int result = write_file(dst_path, data, size);
-    free(data);
+    int result = copy_file(src_path, dst_path);
 
     if (result == 0) {
         printf("Synced %s from workspace to original directory\n", path);
@@ -486,22 +493,11 @@ static int sync_recursive(const char *src_path, const char *dst_base) {
             }
         } else {
             // Copy file from workspace to original directory
-            size_t size;
-            char *data = read_file(full_src_path, &size);
-            if (!data) {
-                printf("ERROR: Failed to read workspace file: %s\n", full_src_path);
-                result = -1;
-                continue;
-            }
-
-            if (write_file(full_dst_path, data, size) != 0) {
+            if (copy_file(full_src_path, full_dst_path) != 0) {
                 printf("ERROR: Failed to write file to original directory: %s\n", full_dst_path);
-                free(data);
                 result = -1;
                 continue;
             }
-
-            free(data);
         }
     }
 
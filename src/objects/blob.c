@@ -1,18 +1,29 @@
+#define _GNU_SOURCE
 #include "gitnano.h"
+#include <errno.h>
+#include <fcntl.h>
 
-int blob_write(const char *data, size_t size, char *sha1_out) {
-    return object_write("blob", data, size, sha1_out);
+int blob_write(const char *data, size_t size, object_id *oid_out) {
+    return object_write("blob", data, size, oid_out);
 }
 
-int blob_read(const char *sha1, char **data, size_t *size) {
+int blob_read(const object_id *oid, char **data, size_t *size) {
     int err;
     gitnano_object obj;
 
-    if ((err = object_read(sha1, &obj)) != 0) {
+    if ((err = object_read(oid, &obj)) != 0) {
         printf("ERROR: object_read: %d\n", err);
         return err;
     }
 
+    // Chunked blobs are reassembled from their manifest
+    if (strcmp(obj.type, "manifest") == 0) {
+        err = manifest_assemble(&obj, data, size);
+        object_free(&obj);
+        if (err != 0) printf("ERROR: manifest_assemble: %d\n", err);
+        return err;
+    }
+
     if (strcmp(obj.type, "blob") != 0) {
         object_free(&obj);
         printf("ERROR: object type is not blob\n");
@@ -34,28 +45,133 @@ int blob_read(const char *sha1, char **data, size_t *size) {
     return 0;
 }
 
-int blob_create_from_file(const char *filepath, char *sha1_out) {
+#define BLOB_STREAM_CHUNK (1024 * 1024)
+
+// Hash and deflate a file in one pass with a fixed-size buffer. Pages already
+// consumed are dropped from the page cache, so memory use stays flat.
+static int blob_stream_from_fd(int fd, size_t size, object_id *oid_out) {
+    object_writer *writer = object_writer_begin("blob", size);
+    if (!writer) return -1;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    char *buffer = safe_malloc(BLOB_STREAM_CHUNK);
+    size_t offset = 0;
+    while (offset < size) {
+        size_t want = size - offset < BLOB_STREAM_CHUNK ? size - offset : BLOB_STREAM_CHUNK;
+        ssize_t n = read(fd, buffer, want);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;  // file shrank: object_writer_finish reports the short write
+
+        if (object_writer_update(writer, buffer, n) != 0) break;
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(fd, offset, n, POSIX_FADV_DONTNEED);
+#endif
+        offset += n;
+    }
+    free(buffer);
+
+    return object_writer_finish(writer, oid_out);
+}
+
+int blob_create_from_file(const char *filepath, object_id *oid_out) {
     int err;
-    size_t size;
-    char *data = read_file(filepath, &size);
-    if (!data) {
-        printf("ERROR: read_file: %d\n", -1);
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        printf("ERROR: open: %d\n", -1);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        printf("ERROR: fstat: %d\n", -1);
+        close(fd);
+        return -1;
+    }
+    size_t chunk_threshold = blob_chunk_threshold();
+    if (S_ISREG(st.st_mode) && chunk_threshold > 0 && (size_t)st.st_size >= chunk_threshold) {
+        err = blob_create_chunked(fd, oid_out);
+        close(fd);
+        if (err != 0) printf("ERROR: blob_create_chunked: %d\n", err);
+        return err;
+    }
+    if (S_ISREG(st.st_mode) && (size_t)st.st_size >= BLOB_STREAM_THRESHOLD) {
+        err = blob_stream_from_fd(fd, st.st_size, oid_out);
+        close(fd);
+        if (err != 0) printf("ERROR: blob_stream_from_fd: %d\n", err);
+        return err;
+    }
+    close(fd);
+
+    mapped_file file;
+    if (mapped_file_open(filepath, &file) != 0) {
+        printf("ERROR: mapped_file_open: %d\n", -1);
         return -1;
     }
 
-    if ((err = blob_write(data, size, sha1_out)) != 0) {
+    if ((err = blob_write(file.data, file.size, oid_out)) != 0) {
         printf("ERROR: blob_write: %d\n", err);
-        free(data);
+        mapped_file_close(&file);
         return err;
     }
-    free(data);
+    mapped_file_close(&file);
     return 0;
 }
 
-int blob_exists(const char *sha1) {
-    char path[MAX_PATH];
-    get_object_path(sha1, path);
-    return file_exists(path);
+// Files up to this size are hashed together by blob_create_from_files
+#define BLOB_BATCH_MAX_SIZE (64 * 1024)
+
+// Create the blobs of several files. Small files are mapped and hashed in one
+// object_hash_many call, so the hash backend can interleave them; larger ones
+// take the blob_create_from_file path.
+int blob_create_from_files(const char *const *filepaths, size_t count, object_id *oids_out) {
+    mapped_file *files = safe_malloc(count * sizeof(mapped_file));
+    const void **datas = safe_malloc(count * sizeof(void *));
+    size_t *sizes = safe_malloc(count * sizeof(size_t));
+    size_t *batched = safe_malloc(count * sizeof(size_t));
+    object_id *oids = safe_malloc(count * sizeof(object_id));
+    size_t batch_count = 0;
+    int err = 0;
+
+    size_t batch_limit = BLOB_BATCH_MAX_SIZE;
+    size_t chunk_threshold = blob_chunk_threshold();
+    if (chunk_threshold > 0 && chunk_threshold <= batch_limit) batch_limit = chunk_threshold - 1;
+
+    for (size_t i = 0; i < count && err == 0; i++) {
+        struct stat st;
+        if (stat(filepaths[i], &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size <= batch_limit &&
+            mapped_file_open(filepaths[i], &files[batch_count]) == 0) {
+            datas[batch_count] = files[batch_count].data;
+            sizes[batch_count] = files[batch_count].size;
+            batched[batch_count++] = i;
+            continue;
+        }
+        err = blob_create_from_file(filepaths[i], &oids_out[i]);
+    }
+
+    if (err == 0 && (err = object_hash_many("blob", datas, sizes, batch_count, oids)) != 0) {
+        printf("ERROR: object_hash_many: %d\n", err);
+    }
+    for (size_t i = 0; i < batch_count; i++) {
+        if (err == 0 && (err = object_write_hashed("blob", datas[i], sizes[i], &oids[i])) != 0) {
+            printf("ERROR: object_write_hashed: %d\n", err);
+        }
+        if (err == 0) oid_copy(&oids_out[batched[i]], &oids[i]);
+        mapped_file_close(&files[i]);
+    }
+
+    free(files);
+    free(datas);
+    free(sizes);
+    free(batched);
+    free(oids);
+    return err;
+}
+
+int blob_exists(const object_id *oid) {
+    return object_exists(oid);
 }
 
 
@@ -0,0 +1,210 @@
+#include "gitnano.h"
+
+// Size-bounded LRU cache of inflated objects, shared by the whole process.
+// Entries are keyed by binary object id and dropped when the repository changes.
+
+#define OBJECT_CACHE_DEFAULT_MB 32
+
+typedef struct cache_entry {
+    object_id oid;
+    char type[10];
+    size_t size;
+    void *data;
+    struct cache_entry *hash_next;
+    struct cache_entry *lru_prev;
+    struct cache_entry *lru_next;
+} cache_entry;
+
+static cache_entry **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+static size_t cached_bytes = 0;
+static size_t cache_limit = 0;
+static cache_entry *lru_head = NULL;  // most recently used
+static cache_entry *lru_tail = NULL;
+static unsigned int cache_generation = 0;
+static size_t cache_hits = 0;
+static size_t cache_misses = 0;
+
+static size_t bucket_of(const object_id *oid, size_t count) {
+    return oid_hash(oid) & (count - 1);
+}
+
+static void lru_unlink(cache_entry *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(cache_entry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+static void cache_remove(cache_entry *entry) {
+    cache_entry **slot = &buckets[bucket_of(&entry->oid, bucket_count)];
+    while (*slot != entry) slot = &(*slot)->hash_next;
+    *slot = entry->hash_next;
+
+    lru_unlink(entry);
+    cached_bytes -= entry->size;
+    entry_count--;
+    free(entry->data);
+    free(entry);
+}
+
+// Drop every cached object
+static void cache_clear(void) {
+    while (lru_head) {
+        cache_remove(lru_head);
+    }
+}
+
+// Clear the cache when the process has moved to another repository
+static int cache_prepare(void) {
+    unsigned int generation = object_store_generation();
+    if (generation != cache_generation) {
+        cache_clear();
+        cache_generation = generation;
+    }
+
+    if (cache_limit == 0) {
+        const char *value = getenv("GITNANO_OBJECT_CACHE_MB");
+        long mb = value && *value ? atol(value) : OBJECT_CACHE_DEFAULT_MB;
+        cache_limit = mb > 0 ? (size_t)mb << 20 : 1;
+    }
+    return cache_limit > 1;
+}
+
+static cache_entry *cache_find(const object_id *oid) {
+    if (!buckets) return NULL;
+    for (cache_entry *entry = buckets[bucket_of(oid, bucket_count)]; entry; entry = entry->hash_next) {
+        if (oid_equal(&entry->oid, oid)) return entry;
+    }
+    return NULL;
+}
+
+static void cache_grow(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : 256;
+    cache_entry **new_buckets = safe_malloc(new_count * sizeof(cache_entry *));
+    memset(new_buckets, 0, new_count * sizeof(cache_entry *));
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        cache_entry *entry = buckets[i];
+        while (entry) {
+            cache_entry *next = entry->hash_next;
+            size_t slot = bucket_of(&entry->oid, new_count);
+            entry->hash_next = new_buckets[slot];
+            new_buckets[slot] = entry;
+            entry = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+}
+
+// Copy a cached object into obj; returns 0 on a hit
+static int cache_get(const object_id *oid, gitnano_object *obj) {
+    if (!cache_prepare()) return -1;
+
+    cache_entry *entry = cache_find(oid);
+    if (!entry) {
+        cache_misses++;
+        return -1;
+    }
+
+    cache_hits++;
+    lru_unlink(entry);
+    lru_push_front(entry);
+
+    strcpy(obj->type, entry->type);
+    obj->size = entry->size;
+    obj->data = safe_malloc(entry->size + 1);
+    memcpy(obj->data, entry->data, entry->size + 1);
+    return 0;
+}
+
+// Type and size of a cached object, without copying its data
+static int cache_get_info(const object_id *oid, char *type_out, size_t *size_out) {
+    if (!cache_prepare()) return -1;
+
+    cache_entry *entry = cache_find(oid);
+    if (!entry) return -1;
+
+    strcpy(type_out, entry->type);
+    *size_out = entry->size;
+    return 0;
+}
+
+// Remember an object just read; large objects are not cached
+static void cache_put(const object_id *oid, const gitnano_object *obj) {
+    if (!cache_prepare() || obj->size > cache_limit / 8) return;
+
+    if (cache_find(oid)) return;
+
+    while (lru_tail && cached_bytes + obj->size > cache_limit) {
+        cache_remove(lru_tail);
+    }
+
+    if (entry_count >= bucket_count) {
+        cache_grow();
+    }
+
+    cache_entry *entry = safe_malloc(sizeof(cache_entry));
+    memset(entry, 0, sizeof(cache_entry));
+    oid_copy(&entry->oid, oid);
+    strcpy(entry->type, obj->type);
+    entry->size = obj->size;
+    entry->data = safe_malloc(obj->size + 1);
+    if (obj->size > 0) memcpy(entry->data, obj->data, obj->size);
+    ((char *)entry->data)[obj->size] = '\0';
+
+    size_t slot = bucket_of(oid, bucket_count);
+    entry->hash_next = buckets[slot];
+    buckets[slot] = entry;
+    lru_push_front(entry);
+    cached_bytes += obj->size;
+    entry_count++;
+}
+
+// Public entry points take the object store lock around the cache state
+
+void object_cache_clear(void) {
+    object_store_lock();
+    cache_clear();
+    object_store_unlock();
+}
+
+int object_cache_get(const object_id *oid, gitnano_object *obj) {
+    object_store_lock();
+    int result = cache_get(oid, obj);
+    object_store_unlock();
+    return result;
+}
+
+int object_cache_get_info(const object_id *oid, char *type_out, size_t *size_out) {
+    object_store_lock();
+    int result = cache_get_info(oid, type_out, size_out);
+    object_store_unlock();
+    return result;
+}
+
+void object_cache_put(const object_id *oid, const gitnano_object *obj) {
+    object_store_lock();
+    cache_put(oid, obj);
+    object_store_unlock();
+}
+
+void object_cache_stats(size_t *hits_out, size_t *misses_out) {
+    object_store_lock();
+    if (hits_out) *hits_out = cache_hits;
+    if (misses_out) *misses_out = cache_misses;
+    object_store_unlock();
+}
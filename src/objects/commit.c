@@ -1,4 +1,5 @@
 #include "gitnano.h"
+#include "commit_graph.h"
 #include <pwd.h>
 
 // Get current user information
@@ -23,20 +24,17 @@ void get_current_user(char *author, size_t size) {
 }
 
 // Create commit object
-int commit_create(const char *tree_sha1, const char *parent_sha1,
-                  const char *author, const char *message, char *sha1_out) {
+int commit_create(const object_id *tree_oid, const object_id *parent_oid,
+                  const char *author, const char *message, object_id *oid_out) {
     int err;
-    if (!tree_sha1 || !message) return -1;
+    if (!tree_oid || !message) return -1;
 
     gitnano_commit_info commit;
-    strncpy(commit.tree_sha1, tree_sha1, sizeof(commit.tree_sha1) - 1);
-    commit.tree_sha1[sizeof(commit.tree_sha1) - 1] = '\0';
-
-    if (parent_sha1) {
-        strncpy(commit.parent_sha1, parent_sha1, sizeof(commit.parent_sha1) - 1);
-        commit.parent_sha1[sizeof(commit.parent_sha1) - 1] = '\0';
+    oid_copy(&commit.tree_oid, tree_oid);
+    if (parent_oid) {
+        oid_copy(&commit.parent_oid, parent_oid);
     } else {
-        commit.parent_sha1[0] = '\0';
+        oid_clear(&commit.parent_oid);
     }
 
     if (author) {
@@ -51,16 +49,17 @@ int commit_create(const char *tree_sha1, const char *parent_sha1,
     commit.message[sizeof(commit.message) - 1] = '\0';
 
     char commit_content[2048];
+    char hex[OID_MAX_HEX_SIZE];
     int len = 0;
-    len += sprintf(commit_content + len, "tree %s\n", commit.tree_sha1);
-    if (parent_sha1) {
-        len += sprintf(commit_content + len, "parent %s\n", commit.parent_sha1);
+    len += sprintf(commit_content + len, "tree %s\n", oid_to_hex(&commit.tree_oid, hex));
+    if (parent_oid) {
+        len += sprintf(commit_content + len, "parent %s\n", oid_to_hex(&commit.parent_oid, hex));
     }
     len += sprintf(commit_content + len, "author %s %s\n", commit.author, commit.timestamp);
     len += sprintf(commit_content + len, "committer %s %s\n", commit.author, commit.timestamp);
     len += sprintf(commit_content + len, "\n%s\n", commit.message);
 
-    if ((err = object_write("commit", commit_content, len, sha1_out)) != 0) {
+    if ((err = object_write("commit", commit_content, len, oid_out)) != 0) {
         printf("ERROR: object_write: %d\n", err);
         return err;
     }
@@ -68,11 +67,24 @@ int commit_create(const char *tree_sha1, const char *parent_sha1,
     return 0;
 }
 
+// Find a header field at the start of a line, before the blank line that
+// starts the message
+static const char *commit_header_field(const char *data, const char *name) {
+    size_t name_len = strlen(name);
+    for (const char *line = data; *line && *line != '\n';) {
+        if (strncmp(line, name, name_len) == 0) return line + name_len;
+        const char *next = strchr(line, '\n');
+        if (!next) break;
+        line = next + 1;
+    }
+    return NULL;
+}
+
 // Parse commit object
-int commit_parse(const char *sha1, gitnano_commit_info *commit) {
+int commit_parse(const object_id *oid, gitnano_commit_info *commit) {
     int err;
     gitnano_object obj;
-    if ((err = object_read(sha1, &obj)) != 0 || strcmp(obj.type, "commit") != 0) {
+    if ((err = object_read(oid, &obj)) != 0 || strcmp(obj.type, "commit") != 0) {
         object_free(&obj);
         printf("ERROR: object_read or type check: %d\n", err);
         return err ? err : -1;
@@ -81,22 +93,24 @@ int commit_parse(const char *sha1, gitnano_commit_info *commit) {
     memset(commit, 0, sizeof(gitnano_commit_info));
     const char *data = (const char *)obj.data;
 
-    const char *tree = strstr(data, "tree ");
-    if (tree) {
-        tree += strlen("tree ");
-        sscanf(tree, "%40s", commit->tree_sha1);
+    // Ids are followed by a newline, which oid_from_hex accepts as the end
+    const char *tree = commit_header_field(data, "tree ");
+    if (tree && oid_from_hex(tree, &commit->tree_oid) != 0) {
+        fprintf(stderr, "ERROR: commit_parse: malformed tree line\n");
+        object_free(&obj);
+        return -1;
     }
 
-    const char *parent = strstr(data, "parent ");
-    if (parent) {
-        parent += strlen("parent ");
-        sscanf(parent, "%40s", commit->parent_sha1);
+    const char *parent = commit_header_field(data, "parent ");
+    if (parent && oid_from_hex(parent, &commit->parent_oid) != 0) {
+        fprintf(stderr, "ERROR: commit_parse: malformed parent line\n");
+        object_free(&obj);
+        return -1;
     }
 
     // Parse author line (format: "author <username> <timestamp>")
-    const char *author = strstr(data, "author ");
+    const char *author = commit_header_field(data, "author ");
     if (author) {
-        author += strlen("author ");
 
         // Use sscanf to parse author and timestamp
         char temp_author[256];
@@ -147,57 +161,90 @@ int commit_parse(const char *sha1, gitnano_commit_info *commit) {
     return 0;
 }
 
-// Get commit tree
-int commit_get_tree(const char *commit_sha1, char *tree_sha1_out) {
+// Get commit tree, from the commit-graph when the commit is in it
+int commit_get_tree(const object_id *commit_oid, object_id *tree_oid_out) {
     int err;
+    commit_graph_entry entry;
+    if (commit_graph_lookup(commit_oid, &entry) == 0) {
+        oid_copy(tree_oid_out, &entry.tree_oid);
+        return 0;
+    }
+
     gitnano_commit_info commit;
-    if ((err = commit_parse(commit_sha1, &commit)) != 0) {
+    if ((err = commit_parse(commit_oid, &commit)) != 0) {
         printf("ERROR: commit_parse: %d\n", err);
         return err;
     }
 
-    strcpy(tree_sha1_out, commit.tree_sha1);
+    oid_copy(tree_oid_out, &commit.tree_oid);
     return 0;
 }
 
-// Get commit parent
-int commit_get_parent(const char *commit_sha1, char *parent_sha1_out) {
+// Get commit parent. Parents recorded in the commit-graph are known to be
+// commits, so only commits outside it are read and their parent checked.
+int commit_get_parent(const object_id *commit_oid, object_id *parent_oid_out) {
     int err;
+    commit_graph_entry entry;
+    if (commit_graph_lookup(commit_oid, &entry) == 0 && !entry.parent_missing) {
+        if (oid_is_null(&entry.parent_oid)) return -1; // No parent
+        oid_copy(parent_oid_out, &entry.parent_oid);
+        return 0;
+    }
+
     gitnano_commit_info commit;
-    if ((err = commit_parse(commit_sha1, &commit)) != 0) {
+    if ((err = commit_parse(commit_oid, &commit)) != 0) {
         printf("ERROR: commit_parse: %d\n", err);
         return err;
     }
 
-    if (strlen(commit.parent_sha1) == 0) {
+    if (oid_is_null(&commit.parent_oid)) {
         return -1; // No parent
     }
 
     // Verify parent commit exists in GitNano repository before returning
-    if (!commit_exists(commit.parent_sha1)) {
-        fprintf(stderr, "WARNING: Parent commit %s not found in GitNano repository (may be a Git commit)\n", commit.parent_sha1);
+    if (!commit_exists(&commit.parent_oid)) {
+        char hex[OID_MAX_HEX_SIZE];
+        fprintf(stderr, "WARNING: Parent commit %s not found in GitNano repository (may be a Git commit)\n",
+                oid_to_hex(&commit.parent_oid, hex));
         return -1; // Parent not found in GitNano repo
     }
 
-    strcpy(parent_sha1_out, commit.parent_sha1);
+    oid_copy(parent_oid_out, &commit.parent_oid);
     return 0;
 }
 
 // Check if commit exists
-int commit_exists(const char *sha1) {
-    int err;
-    char path[MAX_PATH];
-    get_object_path(sha1, path);
-
-    if (!file_exists(path)) return 0;
-
-    gitnano_object obj;
-    if ((err = object_read(sha1, &obj)) != 0) {
+int commit_exists(const object_id *oid) {
+    commit_graph_entry entry;
+    if (commit_graph_lookup(oid, &entry) == 0) return 1;
+    if (!object_exists(oid)) return 0;
+
+    // Only the type is needed, not the commit data
+    char type[16];
+    size_t size;
+    if (object_read_info(oid, type, &size) != 0) {
         return 0;
     }
 
-    int is_commit = (strcmp(obj.type, "commit") == 0);
-    object_free(&obj);
+    return strcmp(type, "commit") == 0;
+}
 
-    return is_commit;
-}
\ No newline at end of file
+// Check whether ancestor is descendant or one of its ancestors: 1 if so,
+// 0 if not. History is linear, so this walks descendant's parents, and the
+// walk stops early once the commit-graph shows a generation no higher than
+// the ancestor's.
+int commit_is_ancestor(const object_id *ancestor, const object_id *descendant) {
+    commit_graph_entry target, entry;
+    uint32_t target_generation = commit_graph_lookup(ancestor, &target) == 0 ? target.generation : 0;
+
+    object_id current;
+    oid_copy(&current, descendant);
+    while (1) {
+        if (oid_equal(&current, ancestor)) return 1;
+        if (target_generation && commit_graph_lookup(&current, &entry) == 0 &&
+            entry.generation <= target_generation) {
+            return 0;
+        }
+        if (commit_get_parent(&current, &current) != 0) return 0;
+    }
+}
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include "commit_graph.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// One mapped layer of the chain
+typedef struct {
+    char hex[OID_MAX_HEX_SIZE];  // checksum naming the layer file
+    unsigned char *map;
+    size_t size;
+    uint32_t count;
+    uint32_t base;  // commits in the layers below
+    const unsigned char *fanout;
+    const unsigned char *oids;
+    const unsigned char *records;
+} graph_layer;
+
+// Layers of the current repository, reloaded when the repository changes
+static graph_layer *layers = NULL;
+static size_t layer_count = 0;
+static int graph_loaded = 0;
+static unsigned int graph_generation = 0;
+static size_t graph_id_size = SHA1_RAW_SIZE;
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t get_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void put_be32(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void put_be64(unsigned char *p, uint64_t value) {
+    put_be32(p, value >> 32);
+    put_be32(p + 4, (uint32_t)value);
+}
+
+static size_t record_size(void) {
+    return graph_id_size + 4 + 4 + 8;
+}
+
+// Map a whole file read-only
+static void *map_whole_file(const char *path, size_t *size_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    *size_out = st.st_size;
+    return map;
+}
+
+static char *layer_path(const char *hex) {
+    return safe_asprintf("%s/graph-%s.graph", COMMIT_GRAPH_DIR, hex);
+}
+
+// Map a layer and validate its layout against the layers below it
+static int layer_open(graph_layer *layer, const char *hex, hash_algo algo, uint32_t base) {
+    memset(layer, 0, sizeof(*layer));
+    snprintf(layer->hex, sizeof(layer->hex), "%s", hex);
+    char *path = layer_path(hex);
+    layer->map = map_whole_file(path, &layer->size);
+    free(path);
+    if (!layer->map) return -1;
+
+    size_t header_size = COMMIT_GRAPH_HEADER_SIZE + 256 * 4;
+    if (layer->size < header_size + SHA1_RAW_SIZE || memcmp(layer->map, COMMIT_GRAPH_SIGNATURE, 4) != 0 ||
+        get_be32(layer->map + 4) != COMMIT_GRAPH_VERSION || get_be32(layer->map + 8) != (uint32_t)algo ||
+        get_be32(layer->map + 16) != base) {
+        return -1;
+    }
+    layer->count = get_be32(layer->map + 12);
+    layer->base = base;
+    if (layer->size != header_size + (size_t)layer->count * (graph_id_size + record_size()) + SHA1_RAW_SIZE ||
+        get_be32(layer->map + COMMIT_GRAPH_HEADER_SIZE + 255 * 4) != layer->count) {
+        return -1;
+    }
+    layer->fanout = layer->map + COMMIT_GRAPH_HEADER_SIZE;
+    layer->oids = layer->fanout + 256 * 4;
+    layer->records = layer->oids + (size_t)layer->count * graph_id_size;
+
+    // Lookups trust the fanout bounds, so they must rise to count
+    uint32_t prev = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t next = get_be32(layer->fanout + i * 4);
+        if (next < prev || next > layer->count) return -1;
+        prev = next;
+    }
+
+    // The layer is read once per load, so check its trailing checksum here
+    size_t len = layer->size - SHA1_RAW_SIZE;
+    unsigned char checksum[SHA1_RAW_SIZE];
+    hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+    int err = !ctx || hash_ctx_update(ctx, layer->map, len) != 0 || hash_ctx_final(ctx, checksum) != 0 ? -1 : 0;
+    hash_ctx_free(ctx);
+    if (err != 0 || memcmp(checksum, layer->map + len, SHA1_RAW_SIZE) != 0) return -1;
+    return 0;
+}
+
+// Unmap all layers; called with graph_lock held
+static void graph_release_locked(void) {
+    for (size_t i = 0; i < layer_count; i++) {
+        if (layers[i].map) munmap(layers[i].map, layers[i].size);
+    }
+    free(layers);
+    layers = NULL;
+    layer_count = 0;
+    graph_loaded = 0;
+}
+
+void commit_graph_release(void) {
+    pthread_mutex_lock(&graph_lock);
+    graph_release_locked();
+    pthread_mutex_unlock(&graph_lock);
+}
+
+// Load the chain of the current repository; a broken chain is ignored, so
+// lookups fall back to reading commit objects
+static void prepare_graph(void) {
+    unsigned int generation = object_store_generation();
+    if (graph_loaded && generation == graph_generation) return;
+
+    graph_release_locked();
+    graph_loaded = 1;
+    graph_generation = generation;
+
+    size_t size;
+    char *chain = read_file(COMMIT_GRAPH_CHAIN, &size);
+    if (!chain) return;
+
+    hash_algo algo = repo_hash_algo();
+    graph_id_size = hash_algo_raw_size(algo);
+    uint32_t base = 0;
+    for (char *line = chain, *next; *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0'; else next = line + strlen(line);
+        if (!*line) continue;
+
+        layers = safe_realloc(layers, (layer_count + 1) * sizeof(graph_layer));
+        graph_layer *layer = &layers[layer_count++];
+        if (layer_open(layer, line, algo, base) != 0) {
+            fprintf(stderr, "WARNING: commit-graph layer %s is missing or invalid, ignoring the commit-graph\n", line);
+            graph_release_locked();
+            graph_loaded = 1;
+            break;
+        }
+        base += layer->count;
+    }
+    free(chain);
+}
+
+// Binary search the layers, newest first, within the fanout range of the
+// first id byte; the position is global across the chain
+static int graph_find(const object_id *oid, uint32_t *pos_out) {
+    unsigned char first = oid->hash[0];
+    for (size_t i = layer_count; i-- > 0;) {
+        const graph_layer *layer = &layers[i];
+        uint32_t lo = first ? get_be32(layer->fanout + (first - 1) * 4) : 0;
+        uint32_t hi = get_be32(layer->fanout + first * 4);
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            int cmp = memcmp(layer->oids + (size_t)mid * graph_id_size, oid->hash, graph_id_size);
+            if (cmp == 0) {
+                *pos_out = layer->base + mid;
+                return 0;
+            }
+            if (cmp < 0) lo = mid + 1; else hi = mid;
+        }
+    }
+    return -1;
+}
+
+static const graph_layer *graph_layer_of(uint32_t pos) {
+    for (size_t i = 0; i < layer_count; i++) {
+        if (pos < layers[i].base + layers[i].count) return &layers[i];
+    }
+    return NULL;
+}
+
+static int graph_entry_at(uint32_t pos, commit_graph_entry *entry) {
+    const graph_layer *layer = graph_layer_of(pos);
+    if (!layer) return -1;
+
+    hash_algo algo = repo_hash_algo();
+    uint32_t index = pos - layer->base;
+    const unsigned char *record = layer->records + (size_t)index * record_size();
+    oid_from_raw(&entry->oid, layer->oids + (size_t)index * graph_id_size, algo);
+    oid_from_raw(&entry->tree_oid, record, algo);
+    uint32_t parent = get_be32(record + graph_id_size);
+    entry->generation = get_be32(record + graph_id_size + 4);
+    entry->timestamp = get_be64(record + graph_id_size + 8);
+    entry->parent_missing = parent == COMMIT_GRAPH_PARENT_MISSING;
+    oid_clear(&entry->parent_oid);
+    if (parent != COMMIT_GRAPH_PARENT_NONE && parent != COMMIT_GRAPH_PARENT_MISSING) {
+        const graph_layer *parent_layer = graph_layer_of(parent);
+        if (!parent_layer) return -1;
+        oid_from_raw(&entry->parent_oid, parent_layer->oids + (size_t)(parent - parent_layer->base) * graph_id_size,
+                     algo);
+    }
+    return 0;
+}
+
+// Look up a commit in the commit-graph; -1 when it is not there
+int commit_graph_lookup(const object_id *oid, commit_graph_entry *entry_out) {
+    uint32_t pos;
+    int err = -1;
+    pthread_mutex_lock(&graph_lock);
+    prepare_graph();
+    if (graph_find(oid, &pos) == 0) err = graph_entry_at(pos, entry_out);
+    pthread_mutex_unlock(&graph_lock);
+    return err;
+}
+
+// Same check as commit_exists, which itself consults the graph
+static int object_is_commit(const object_id *oid) {
+    char type[16];
+    size_t size;
+    return object_exists(oid) && object_read_info(oid, type, &size) == 0 && strcmp(type, "commit") == 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const commit_graph_entry *ea = a, *eb = b;
+    return memcmp(ea->oid.hash, eb->oid.hash, graph_id_size);
+}
+
+// Write entries, sorted by id, as a layer above the first keep layers;
+// the layer's name is returned in hex_out
+static int graph_write_layer(commit_graph_entry *entries, size_t count, size_t keep, char *hex_out) {
+    hash_algo algo = repo_hash_algo();
+    uint32_t base = keep > 0 ? layers[keep - 1].base + layers[keep - 1].count : 0;
+    qsort(entries, count, sizeof(commit_graph_entry), compare_entries);
+
+    size_t len = COMMIT_GRAPH_HEADER_SIZE + 256 * 4 + count * (graph_id_size + record_size());
+    unsigned char *buf = safe_malloc(len + SHA1_RAW_SIZE);
+    memcpy(buf, COMMIT_GRAPH_SIGNATURE, 4);
+    put_be32(buf + 4, COMMIT_GRAPH_VERSION);
+    put_be32(buf + 8, (uint32_t)algo);
+    put_be32(buf + 12, (uint32_t)count);
+    put_be32(buf + 16, base);
+
+    unsigned char *fanout = buf + COMMIT_GRAPH_HEADER_SIZE;
+    unsigned char *oids = fanout + 256 * 4;
+    unsigned char *records = oids + count * graph_id_size;
+    uint32_t counts[256] = {0};
+    for (size_t i = 0; i < count; i++) counts[entries[i].oid.hash[0]]++;
+    for (uint32_t i = 0, total = 0; i < 256; i++) {
+        total += counts[i];
+        put_be32(fanout + i * 4, total);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const commit_graph_entry *entry = &entries[i];
+        unsigned char *record = records + i * record_size();
+        uint32_t parent = entry->parent_missing ? COMMIT_GRAPH_PARENT_MISSING : COMMIT_GRAPH_PARENT_NONE;
+        if (!oid_is_null(&entry->parent_oid)) {
+            // Parents are in this layer or in one that is kept below it
+            commit_graph_entry key;
+            oid_copy(&key.oid, &entry->parent_oid);
+            commit_graph_entry *found = bsearch(&key, entries, count, sizeof(commit_graph_entry), compare_entries);
+            if (found) {
+                parent = base + (uint32_t)(found - entries);
+            } else if (graph_find(&entry->parent_oid, &parent) != 0 || parent >= base) {
+                free(buf);
+                return -1;
+            }
+        }
+        memcpy(oids + i * graph_id_size, entry->oid.hash, graph_id_size);
+        memcpy(record, entry->tree_oid.hash, graph_id_size);
+        put_be32(record + graph_id_size, parent);
+        put_be32(record + graph_id_size + 4, entry->generation);
+        put_be64(record + graph_id_size + 8, entry->timestamp);
+    }
+
+    hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+    int err = !ctx || hash_ctx_update(ctx, buf, len) != 0 || hash_ctx_final(ctx, buf + len) != 0 ? -1 : 0;
+    hash_ctx_free(ctx);
+    if (err == 0) {
+        object_id checksum;
+        oid_from_raw(&checksum, buf + len, HASH_SHA1);
+        oid_to_hex(&checksum, hex_out);
+        char *path = layer_path(hex_out);
+        err = write_file_atomic(path, buf, len + SHA1_RAW_SIZE, 0);
+        free(path);
+    }
+    free(buf);
+    return err;
+}
+
+// Add tip and its ancestors not yet in the commit-graph as a new layer,
+// merging it with the layers above that are not much larger
+int commit_graph_add(const object_id *tip) {
+    uint32_t pos;
+    pthread_mutex_lock(&graph_lock);
+    prepare_graph();
+    graph_id_size = hash_algo_raw_size(repo_hash_algo());
+    if (graph_find(tip, &pos) == 0) {
+        pthread_mutex_unlock(&graph_lock);
+        return 0;
+    }
+
+    // Collect the new commits, newest first
+    commit_graph_entry *entries = NULL;
+    size_t count = 0, alloc = 0;
+    object_id current;
+    oid_copy(&current, tip);
+    int err = 0;
+    while (err == 0) {
+        gitnano_commit_info info;
+        if ((err = commit_parse(&current, &info)) != 0) break;
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 16;
+            entries = safe_realloc(entries, alloc * sizeof(commit_graph_entry));
+        }
+        commit_graph_entry *entry = &entries[count++];
+        memset(entry, 0, sizeof(*entry));
+        oid_copy(&entry->oid, &current);
+        oid_copy(&entry->tree_oid, &info.tree_oid);
+        oid_copy(&entry->parent_oid, &info.parent_oid);
+        entry->timestamp = strtoull(info.timestamp, NULL, 10);
+
+        if (oid_is_null(&info.parent_oid) || graph_find(&info.parent_oid, &pos) == 0) break;
+        if (!object_is_commit(&info.parent_oid)) {
+            oid_clear(&entry->parent_oid);
+            entry->parent_missing = 1;
+            break;
+        }
+        oid_copy(&current, &info.parent_oid);
+    }
+    if (err != 0) {
+        fprintf(stderr, "ERROR: commit_graph_add: cannot read commit history: %d\n", err);
+        free(entries);
+        pthread_mutex_unlock(&graph_lock);
+        return err;
+    }
+
+    // Generations, oldest first
+    for (size_t i = count; i-- > 0;) {
+        commit_graph_entry parent;
+        if (i + 1 < count) {
+            entries[i].generation = entries[i + 1].generation + 1;
+        } else if (!oid_is_null(&entries[i].parent_oid) && graph_find(&entries[i].parent_oid, &pos) == 0 &&
+                   graph_entry_at(pos, &parent) == 0) {
+            entries[i].generation = parent.generation + 1;
+        } else {
+            entries[i].generation = 1;
+        }
+    }
+
+    // Fold in the layers that are less than COMMIT_GRAPH_MERGE_FACTOR times
+    // the size of the new one
+    size_t keep = layer_count;
+    while (keep > 0 && layers[keep - 1].count < COMMIT_GRAPH_MERGE_FACTOR * count) {
+        const graph_layer *layer = &layers[--keep];
+        entries = safe_realloc(entries, (count + layer->count) * sizeof(commit_graph_entry));
+        for (uint32_t i = 0; err == 0 && i < layer->count; i++) {
+            err = graph_entry_at(layer->base + i, &entries[count++]);
+        }
+    }
+
+    char hex[OID_MAX_HEX_SIZE];
+    if (err == 0 && (err = mkdir_p(COMMIT_GRAPH_DIR)) == 0) {
+        err = graph_write_layer(entries, count, keep, hex);
+    }
+    free(entries);
+
+    // The chain names the kept layers and the new one, base first
+    if (err == 0) {
+        char *chain = safe_malloc((keep + 1) * (OID_MAX_HEX_SIZE + 1) + 1);
+        size_t len = 0;
+        for (size_t i = 0; i < keep; i++) len += sprintf(chain + len, "%s\n", layers[i].hex);
+        len += sprintf(chain + len, "%s\n", hex);
+        err = write_file_atomic(COMMIT_GRAPH_CHAIN, chain, len, 0);
+        free(chain);
+    }
+    if (err != 0) {
+        fprintf(stderr, "ERROR: commit_graph_add: cannot write commit-graph: %d\n", err);
+    } else {
+        for (size_t i = keep; i < layer_count; i++) {
+            char *path = layer_path(layers[i].hex);
+            unlink(path);
+            free(path);
+        }
+    }
+    graph_release_locked();
+    pthread_mutex_unlock(&graph_lock);
+    return err;
+}
@@ -0,0 +1,291 @@
+#include "gitnano.h"
+#include "pack.h"
+
+// Delta encoding between objects, using Git's copy/insert instruction format:
+//   <base size varint> <result size varint> <instructions...>
+// A copy instruction (high bit set) copies a range of the base, an insert
+// instruction (1-127) copies that many literal bytes that follow it.
+
+#define DELTA_BLOCK 16
+#define DELTA_MAX_CHAIN 64
+#define DELTA_MAX_COPY 0x10000
+#define DELTA_MAX_INSERT 127
+
+struct delta_index {
+    const unsigned char *base;
+    size_t base_size;
+    uint32_t mask;
+    uint32_t *heads;
+    uint32_t *next;
+};
+
+static uint32_t block_hash(const unsigned char *p) {
+    uint64_t a, b;
+    memcpy(&a, p, 8);
+    memcpy(&b, p + 8, 8);
+    uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ull)) * 0xC2B2AE3D27D4EB4Full;
+    return (uint32_t)(h >> 32);
+}
+
+// Index the base in non-overlapping blocks so matches can be found by hash
+delta_index *delta_index_create(const void *base, size_t base_size) {
+    if (base_size < DELTA_BLOCK || base_size > 0xffffffffu) return NULL;
+
+    uint32_t blocks = (uint32_t)(base_size / DELTA_BLOCK);
+    uint32_t table_size = 1;
+    while (table_size < blocks) table_size <<= 1;
+
+    delta_index *index = safe_malloc(sizeof(delta_index));
+    index->base = base;
+    index->base_size = base_size;
+    index->mask = table_size - 1;
+    index->heads = safe_malloc(table_size * sizeof(uint32_t));
+    index->next = safe_malloc(blocks * sizeof(uint32_t));
+    memset(index->heads, 0xff, table_size * sizeof(uint32_t));
+
+    // Insert back to front so chains yield earlier blocks first
+    for (uint32_t i = blocks; i-- > 0;) {
+        uint32_t slot = block_hash(index->base + (size_t)i * DELTA_BLOCK) & index->mask;
+        index->next[i] = index->heads[slot];
+        index->heads[slot] = i;
+    }
+    return index;
+}
+
+void delta_index_free(delta_index *index) {
+    if (index) {
+        free(index->heads);
+        free(index->next);
+        free(index);
+    }
+}
+
+// Output buffer that refuses to grow past the caller's size limit
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t alloc;
+    size_t limit;
+} delta_buffer;
+
+static int delta_put(delta_buffer *out, const void *data, size_t size) {
+    if (out->size + size > out->limit) return -1;
+    if (out->size + size > out->alloc) {
+        while (out->size + size > out->alloc) out->alloc *= 2;
+        out->data = safe_realloc(out->data, out->alloc);
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+    return 0;
+}
+
+static int delta_put_varint(delta_buffer *out, size_t value) {
+    unsigned char buf[10];
+    size_t len = 0;
+    do {
+        buf[len] = value & 0x7f;
+        value >>= 7;
+        if (value) buf[len] |= 0x80;
+        len++;
+    } while (value);
+    return delta_put(out, buf, len);
+}
+
+static int delta_put_insert(delta_buffer *out, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        unsigned char len = size > DELTA_MAX_INSERT ? DELTA_MAX_INSERT : (unsigned char)size;
+        if (delta_put(out, &len, 1) != 0 || delta_put(out, data, len) != 0) return -1;
+        data += len;
+        size -= len;
+    }
+    return 0;
+}
+
+static int delta_put_copy(delta_buffer *out, size_t offset, size_t size) {
+    while (size > 0) {
+        size_t len = size > DELTA_MAX_COPY ? DELTA_MAX_COPY : size;
+        unsigned char op[8];
+        size_t used = 1;
+        op[0] = 0x80;
+        for (int i = 0; i < 4; i++) {
+            unsigned char byte = (offset >> (i * 8)) & 0xff;
+            if (byte) {
+                op[0] |= 1 << i;
+                op[used++] = byte;
+            }
+        }
+        // A size of 0x10000 is encoded as zero
+        size_t encoded = len == DELTA_MAX_COPY ? 0 : len;
+        for (int i = 0; i < 3; i++) {
+            unsigned char byte = (encoded >> (i * 8)) & 0xff;
+            if (byte) {
+                op[0] |= 0x10 << i;
+                op[used++] = byte;
+            }
+        }
+        if (delta_put(out, op, used) != 0) return -1;
+        offset += len;
+        size -= len;
+    }
+    return 0;
+}
+
+// Encode target against an indexed base; fails if the delta would exceed max_size
+int delta_create(const delta_index *index, const void *target, size_t target_size,
+                 size_t max_size, void **delta_out, size_t *delta_size_out) {
+    const unsigned char *base = index->base;
+    const unsigned char *trg = target;
+
+    delta_buffer out = {0};
+    out.alloc = 64;
+    out.limit = max_size;
+    out.data = safe_malloc(out.alloc);
+
+    if (delta_put_varint(&out, index->base_size) != 0 ||
+        delta_put_varint(&out, target_size) != 0) {
+        free(out.data);
+        return -1;
+    }
+
+    size_t pos = 0;
+    size_t literal_start = 0;
+    while (pos + DELTA_BLOCK <= target_size) {
+        size_t best_len = 0, best_offset = 0;
+        uint32_t slot = block_hash(trg + pos) & index->mask;
+
+        int chain = 0;
+        for (uint32_t block = index->heads[slot]; block != UINT32_MAX && chain < DELTA_MAX_CHAIN;
+             block = index->next[block], chain++) {
+            size_t offset = (size_t)block * DELTA_BLOCK;
+            if (memcmp(base + offset, trg + pos, DELTA_BLOCK) != 0) continue;
+
+            size_t len = DELTA_BLOCK;
+            while (offset + len < index->base_size && pos + len < target_size &&
+                   base[offset + len] == trg[pos + len]) {
+                len++;
+            }
+            if (len > best_len) {
+                best_len = len;
+                best_offset = offset;
+            }
+        }
+
+        if (best_len < DELTA_BLOCK) {
+            pos++;
+            continue;
+        }
+
+        // Grow the match backwards over bytes that would otherwise be literals
+        while (pos > literal_start && best_offset > 0 && base[best_offset - 1] == trg[pos - 1]) {
+            pos--;
+            best_offset--;
+            best_len++;
+        }
+
+        if (delta_put_insert(&out, trg + literal_start, pos - literal_start) != 0 ||
+            delta_put_copy(&out, best_offset, best_len) != 0) {
+            free(out.data);
+            return -1;
+        }
+
+        pos += best_len;
+        literal_start = pos;
+    }
+
+    if (delta_put_insert(&out, trg + literal_start, target_size - literal_start) != 0) {
+        free(out.data);
+        return -1;
+    }
+
+    *delta_out = out.data;
+    *delta_size_out = out.size;
+    return 0;
+}
+
+static int delta_get_varint(const unsigned char **p, const unsigned char *end, size_t *value_out) {
+    size_t value = 0;
+    int shift = 0;
+    unsigned char c;
+    do {
+        if (*p >= end || shift > 63) return -1;
+        c = *(*p)++;
+        value |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *value_out = value;
+    return 0;
+}
+
+// Read the result size recorded in a delta header
+int delta_result_size(const void *delta, size_t delta_size, size_t *size_out) {
+    const unsigned char *p = delta;
+    const unsigned char *end = p + delta_size;
+    size_t base_size;
+    if (delta_get_varint(&p, end, &base_size) != 0) return -1;
+    return delta_get_varint(&p, end, size_out);
+}
+
+// Rebuild the target object from its base and a delta (result is NUL-terminated)
+int delta_apply(const void *base, size_t base_size, const void *delta, size_t delta_size,
+                void **result_out, size_t *result_size_out) {
+    const unsigned char *p = delta;
+    const unsigned char *end = p + delta_size;
+
+    size_t expected_base, result_size;
+    if (delta_get_varint(&p, end, &expected_base) != 0 ||
+        delta_get_varint(&p, end, &result_size) != 0) {
+        fprintf(stderr, "ERROR: delta_apply: truncated delta header\n");
+        return -1;
+    }
+
+    if (expected_base != base_size) {
+        fprintf(stderr, "ERROR: delta_apply: base size mismatch (%zu != %zu)\n", expected_base, base_size);
+        return -1;
+    }
+
+    unsigned char *result = safe_malloc(result_size + 1);
+    size_t written = 0;
+
+    while (p < end) {
+        unsigned char op = *p++;
+        if (op & 0x80) {
+            size_t offset = 0, size = 0;
+            for (int i = 0; i < 4; i++) {
+                if (op & (1 << i)) {
+                    if (p >= end) goto corrupt;
+                    offset |= (size_t)*p++ << (i * 8);
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                if (op & (0x10 << i)) {
+                    if (p >= end) goto corrupt;
+                    size |= (size_t)*p++ << (i * 8);
+                }
+            }
+            if (size == 0) size = DELTA_MAX_COPY;
+
+            if (offset > base_size || size > base_size - offset || size > result_size - written) goto corrupt;
+            memcpy(result + written, (const unsigned char *)base + offset, size);
+            written += size;
+        } else if (op) {
+            if (op > (size_t)(end - p) || op > result_size - written) goto corrupt;
+            memcpy(result + written, p, op);
+            p += op;
+            written += op;
+        } else {
+            goto corrupt;
+        }
+    }
+
+    if (written != result_size) goto corrupt;
+
+    result[result_size] = '\0';
+    *result_out = result;
+    *result_size_out = result_size;
+    return 0;
+
+corrupt:
+    fprintf(stderr, "ERROR: delta_apply: corrupt delta\n");
+    free(result);
+    return -1;
+}
@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include <fcntl.h>
+
+// Set of loose object ids, so existence checks do not probe the filesystem.
+//
+// The set is persisted as a list of raw ids in LOOSE_SET_FILE: a
+// rebuild writes it sorted, and every object written afterwards is appended
+// once its file has been renamed into place. Because of that ordering the
+// file is never older than the last object it knows about. A fanout
+// directory with a newer mtime means an object was added or removed without
+// the set seeing it, and the set is rebuilt from a directory scan. Equal
+// mtimes count as newer: with coarse timestamps a change made in the same
+// tick as the last append (by another process, or by a writer that died
+// between its rename and the append) cannot be told apart.
+
+#define LOOSE_SET_FILE OBJECTS_DIR "/info/loose-set"
+
+static unsigned char *slots = NULL;  // open addressing table of ids
+static unsigned char *used = NULL;
+static size_t slot_count = 0;
+static size_t id_size = SHA1_RAW_SIZE;  // raw id width of the repository
+static size_t set_count = 0;
+static int set_state = 0;  // 0: not loaded, 1: loaded, -1: unavailable
+static unsigned int set_generation = 0;
+
+static size_t slot_of(const unsigned char *oid) {
+    uint64_t h;
+    memcpy(&h, oid, sizeof(h));
+    return h & (slot_count - 1);
+}
+
+static void set_free(void) {
+    free(slots);
+    free(used);
+    slots = used = NULL;
+    slot_count = set_count = 0;
+}
+
+static void set_insert(const unsigned char *oid);
+
+static void set_grow(void) {
+    unsigned char *old_slots = slots, *old_used = used;
+    size_t old_count = slot_count;
+
+    slot_count = slot_count ? slot_count * 2 : 1024;
+    slots = safe_malloc(slot_count * id_size);
+    used = safe_malloc(slot_count);
+    memset(used, 0, slot_count);
+    set_count = 0;
+
+    for (size_t i = 0; i < old_count; i++) {
+        if (old_used[i]) set_insert(old_slots + i * id_size);
+    }
+    free(old_slots);
+    free(old_used);
+}
+
+static void set_insert(const unsigned char *oid) {
+    if ((set_count + 1) * 2 > slot_count) set_grow();
+
+    size_t i = slot_of(oid);
+    while (used[i]) {
+        if (memcmp(slots + i * id_size, oid, id_size) == 0) return;
+        i = (i + 1) & (slot_count - 1);
+    }
+    memcpy(slots + i * id_size, oid, id_size);
+    used[i] = 1;
+    set_count++;
+}
+
+static int set_lookup(const unsigned char *oid) {
+    if (slot_count == 0) return 0;
+    size_t i = slot_of(oid);
+    while (used[i]) {
+        if (memcmp(slots + i * id_size, oid, id_size) == 0) return 1;
+        i = (i + 1) & (slot_count - 1);
+    }
+    return 0;
+}
+
+static int timespec_not_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec >= b->tv_nsec);
+}
+
+// The set file is stale if any fanout directory changed after it, or in
+// the same timestamp tick
+static int loose_set_is_fresh(void) {
+    struct stat set_st;
+    if (stat(LOOSE_SET_FILE, &set_st) != 0) return 0;
+
+    struct stat st;
+    if (stat(OBJECTS_DIR, &st) == 0 && timespec_not_before(&st.st_mtim, &set_st.st_mtim)) return 0;
+
+    for (int i = 0; i < 256; i++) {
+        char dir_path[MAX_PATH];
+        snprintf(dir_path, sizeof(dir_path), "%s/%02x", OBJECTS_DIR, i);
+        if (stat(dir_path, &st) == 0 && timespec_not_before(&st.st_mtim, &set_st.st_mtim)) return 0;
+    }
+    return 1;
+}
+
+static int collect_loose_id(const object_id *oid, void *data) {
+    (void)data;
+    set_insert(oid->hash);
+    return 0;
+}
+
+static int compare_oids(const void *a, const void *b) {
+    return memcmp(a, b, id_size);
+}
+
+// Rescan the loose objects and rewrite the persisted set
+static int set_rebuild(void) {
+    set_free();
+    set_generation = object_store_generation();
+    id_size = hash_algo_raw_size(repo_hash_algo());
+    set_state = -1;
+
+    if (!file_exists(OBJECTS_DIR)) return -1;
+    if (object_for_each_loose(collect_loose_id, NULL) != 0) return -1;
+
+    // Persist sorted so the file diffs and compresses well
+    unsigned char *list = safe_malloc(set_count * id_size + 1);
+    size_t n = 0;
+    for (size_t i = 0; i < slot_count; i++) {
+        if (used[i]) memcpy(list + (n++) * id_size, slots + i * id_size, id_size);
+    }
+    qsort(list, n, id_size, compare_oids);
+
+    // The set is only a cache of the directory scan: no need to fsync it
+    int err = mkdir_p(OBJECTS_DIR "/info");
+    if (err == 0) err = write_file_atomic(LOOSE_SET_FILE, list, n * id_size, 0);
+    free(list);
+
+    if (err != 0) {
+        set_free();
+        return -1;
+    }
+
+    set_state = 1;
+    return 0;
+}
+
+// Load the set for the current repository, rebuilding it when stale
+static int loose_set_prepare(void) {
+    unsigned int generation = object_store_generation();
+    if (set_state != 0 && generation == set_generation) {
+        return set_state;
+    }
+
+    set_free();
+    set_generation = generation;
+    set_state = 0;
+    id_size = hash_algo_raw_size(repo_hash_algo());
+
+    // Not a repository (yet): check again on the next call
+    if (!file_exists(OBJECTS_DIR)) return -1;
+
+    set_state = -1;
+    if (!loose_set_is_fresh()) {
+        set_rebuild();
+        return set_state;
+    }
+
+    size_t size;
+    unsigned char *data = (unsigned char *)read_file(LOOSE_SET_FILE, &size);
+    if (!data || size % id_size != 0) {
+        free(data);
+        set_rebuild();
+        return set_state;
+    }
+
+    for (size_t pos = 0; pos < size; pos += id_size) {
+        set_insert(data + pos);
+    }
+    free(data);
+
+    set_state = 1;
+    return set_state;
+}
+
+// 1 if the object is loose, 0 if not, -1 if the set is unavailable
+int loose_set_contains(const object_id *oid) {
+    object_store_lock();
+    int result = loose_set_prepare() == 1 ? set_lookup(oid->hash) : -1;
+    object_store_unlock();
+    return result;
+}
+
+// Record an object whose file has just been moved into place
+void loose_set_add(const object_id *oid) {
+    object_store_lock();
+    if (loose_set_prepare() != 1 || set_lookup(oid->hash)) {
+        object_store_unlock();
+        return;
+    }
+    set_insert(oid->hash);
+
+    // O_APPEND keeps concurrent records whole
+    int fd = open(LOOSE_SET_FILE, O_WRONLY | O_APPEND);
+    if (fd < 0 || write(fd, oid->hash, id_size) != (ssize_t)id_size) {
+        // A set that missed a write must not answer lookups on disk any more
+        unlink(LOOSE_SET_FILE);
+    }
+    if (fd >= 0) close(fd);
+    object_store_unlock();
+}
+
+int loose_set_rebuild(void) {
+    object_store_lock();
+    int err = set_rebuild();
+    object_store_unlock();
+    return err;
+}
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include <errno.h>
+#include <pthread.h>
+
+// Chunked blobs: a large file is cut into content-defined chunks, each stored
+// as an ordinary blob, and described by a "manifest" object listing the chunks
+// in order as "<sha1> <size>\n" lines. Tree entries point at the manifest.
+//
+// Boundaries come from a FastCDC-style gear hash, so an edit only changes the
+// chunks around it and the rest of the file deduplicates against earlier
+// versions. The gear table and the parameters below decide every boundary:
+// changing them changes the ids of all chunked files.
+
+#define CDC_MIN_SIZE (256 * 1024)
+#define CDC_AVG_SIZE (1024 * 1024)
+#define CDC_MAX_SIZE (4 * 1024 * 1024)
+
+// Normalized chunking: a stricter mask before the average size, a looser one after
+#define CDC_MASK_SMALL 0xFFFFFC0000000000ULL  // 22 bits
+#define CDC_MASK_LARGE 0xFFFFC00000000000ULL  // 18 bits
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// Fill the gear table from a fixed splitmix64 sequence
+static void gear_init(void) {
+    uint64_t state = 0x6769746e616e6f31ULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+// Length of the next chunk at the start of data (len is all data available)
+size_t cdc_next_boundary(const unsigned char *data, size_t len) {
+    pthread_once(&gear_once, gear_init);
+    if (len <= CDC_MIN_SIZE) return len;
+
+    size_t normal = len < CDC_AVG_SIZE ? len : CDC_AVG_SIZE;
+    size_t max = len < CDC_MAX_SIZE ? len : CDC_MAX_SIZE;
+    uint64_t hash = 0;
+    size_t i = CDC_MIN_SIZE;
+
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CDC_MASK_SMALL)) return i + 1;
+    }
+    for (; i < max; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CDC_MASK_LARGE)) return i + 1;
+    }
+    return max;
+}
+
+// Size from which files are chunked (GITNANO_CHUNK_THRESHOLD or chunking.threshold,
+// with an optional K/M/G suffix); 0 means chunking is off
+size_t blob_chunk_threshold(void) {
+    char value[32];
+    if (config_get_setting("GITNANO_CHUNK_THRESHOLD", "chunking.threshold", value, sizeof(value)) != 0) {
+        return 0;
+    }
+
+    char *end;
+    unsigned long long threshold = strtoull(value, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': threshold <<= 10; end++; break;
+        case 'm': case 'M': threshold <<= 20; end++; break;
+        case 'g': case 'G': threshold <<= 30; end++; break;
+    }
+    if (end == value || *end != '\0') {
+        fprintf(stderr, "WARNING: invalid chunking threshold '%s', chunking disabled\n", value);
+        return 0;
+    }
+    // Anything below one chunk would only add a manifest
+    if (threshold > 0 && threshold < CDC_MIN_SIZE) threshold = CDC_MIN_SIZE;
+    return (size_t)threshold;
+}
+
+// Read a file from fd in content-defined chunks, store each chunk as a blob
+// and write the manifest. Memory use is bounded by two maximum-size chunks.
+int blob_create_chunked(int fd, object_id *oid_out) {
+    size_t buffer_size = 2 * CDC_MAX_SIZE;
+    unsigned char *buffer = safe_malloc(buffer_size);
+    size_t start = 0, end = 0;
+    int eof = 0, err = 0;
+
+    char *manifest = NULL;
+    size_t manifest_len = 0, manifest_alloc = 0;
+    off_t offset = 0;
+
+    while (err == 0) {
+        // Keep at least one maximum chunk in view so boundaries never depend on reads
+        if (!eof && end - start < CDC_MAX_SIZE) {
+            memmove(buffer, buffer + start, end - start);
+            end -= start;
+            start = 0;
+            while (!eof && end < buffer_size) {
+                ssize_t n = read(fd, buffer + end, buffer_size - end);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    fprintf(stderr, "ERROR: blob_create_chunked: read failed: %s\n", strerror(errno));
+                    err = -1;
+                    break;
+                }
+                if (n == 0) eof = 1;
+                end += n;
+            }
+#ifdef POSIX_FADV_DONTNEED
+            // A length of 0 would mean the whole file, so only advise once
+            // something has been consumed
+            if (offset > 0) posix_fadvise(fd, 0, offset, POSIX_FADV_DONTNEED);
+#endif
+            if (err != 0) break;
+        }
+        if (start == end) break;
+
+        size_t len = cdc_next_boundary(buffer + start, end - start);
+        object_id chunk_oid;
+        if ((err = object_write("blob", buffer + start, len, &chunk_oid)) != 0) {
+            printf("ERROR: object_write: %d\n", err);
+            break;
+        }
+
+        if (manifest_len + OID_MAX_HEX_SIZE + 24 > manifest_alloc) {
+            manifest_alloc = manifest_alloc ? manifest_alloc * 2 : 4096;
+            manifest = safe_realloc(manifest, manifest_alloc);
+        }
+        char chunk_hex[OID_MAX_HEX_SIZE];
+        manifest_len += sprintf(manifest + manifest_len, "%s %zu\n", oid_to_hex(&chunk_oid, chunk_hex), len);
+        start += len;
+        offset += len;
+    }
+    free(buffer);
+
+    if (err == 0) {
+        err = object_write("manifest", manifest ? manifest : "", manifest_len, oid_out);
+        if (err != 0) printf("ERROR: object_write: %d\n", err);
+    }
+    free(manifest);
+    return err;
+}
+
+// Parse the chunk list of a manifest object
+static int manifest_parse(const gitnano_object *obj, manifest_chunk **chunks_out, size_t *count_out,
+                          size_t *total_out) {
+    size_t count = 0, alloc = 0, total = 0;
+    manifest_chunk *chunks = NULL;
+
+    const char *ptr = obj->data;
+    const char *data_end = ptr + obj->size;
+    size_t hex_len = 2 * hash_algo_raw_size(repo_hash_algo());
+    while (ptr < data_end) {
+        object_id oid;
+        const char *newline = memchr(ptr, '\n', data_end - ptr);
+        if (!newline || (size_t)(newline - ptr) < hex_len + 2 || ptr[hex_len] != ' ' ||
+            oid_from_hex(ptr, &oid) != 0) {
+            fprintf(stderr, "ERROR: manifest_parse: malformed manifest line\n");
+            free(chunks);
+            return -1;
+        }
+
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            chunks = safe_realloc(chunks, alloc * sizeof(manifest_chunk));
+        }
+        oid_copy(&chunks[count].oid, &oid);
+        chunks[count].size = strtoull(ptr + hex_len + 1, NULL, 10);
+        total += chunks[count].size;
+        count++;
+        ptr = newline + 1;
+    }
+
+    *chunks_out = chunks;
+    *count_out = count;
+    *total_out = total;
+    return 0;
+}
+
+// Read one chunk and check it has the size the manifest promises
+static int manifest_read_chunk(const manifest_chunk *chunk, gitnano_object *obj) {
+    if (object_read(&chunk->oid, obj) != 0) return -1;
+    if (strcmp(obj->type, "blob") != 0 || obj->size != chunk->size) {
+        char hex[OID_MAX_HEX_SIZE];
+        fprintf(stderr, "ERROR: manifest chunk %s does not match the manifest\n", oid_to_hex(&chunk->oid, hex));
+        object_free(obj);
+        return -1;
+    }
+    return 0;
+}
+
+// Reassemble the content of a chunked blob in memory
+int manifest_assemble(const gitnano_object *manifest, char **data_out, size_t *size_out) {
+    manifest_chunk *chunks;
+    size_t count, total;
+    if (manifest_parse(manifest, &chunks, &count, &total) != 0) return -1;
+
+    char *data = safe_malloc(total + 1);
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        gitnano_object chunk;
+        if (manifest_read_chunk(&chunks[i], &chunk) != 0) {
+            free(data);
+            free(chunks);
+            return -1;
+        }
+        memcpy(data + pos, chunk.data, chunk.size);
+        pos += chunk.size;
+        object_free(&chunk);
+    }
+    data[total] = '\0';
+    free(chunks);
+
+    *data_out = data;
+    *size_out = total;
+    return 0;
+}
+
+// Write the content of a chunked blob to a file, one chunk at a time
+int manifest_extract(const gitnano_object *manifest, const char *target_path) {
+    manifest_chunk *chunks;
+    size_t count, total;
+    if (manifest_parse(manifest, &chunks, &count, &total) != 0) return -1;
+
+    FILE *fp = fopen(target_path, "wb");
+    if (!fp) {
+        fprintf(stderr, "ERROR: fopen failed for path '%s': %s\n", target_path, strerror(errno));
+        free(chunks);
+        return -1;
+    }
+
+    int err = 0;
+    for (size_t i = 0; i < count && err == 0; i++) {
+        gitnano_object chunk;
+        if ((err = manifest_read_chunk(&chunks[i], &chunk)) != 0) break;
+        if (fwrite(chunk.data, 1, chunk.size, fp) != chunk.size) {
+            fprintf(stderr, "ERROR: fwrite incomplete for path '%s'\n", target_path);
+            err = -1;
+        }
+        object_free(&chunk);
+    }
+    if (fclose(fp) != 0) err = -1;
+    free(chunks);
+    return err;
+}
@@ -1,161 +1,577 @@
+#define _GNU_SOURCE
 #include "gitnano.h"
+#include "pack.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+
+// Bumped whenever the process moves to another repository (or the store is
+// rewritten). The repository is told apart by the dev/ino of its .gitnano
+// directory, which is kept open so the inode cannot be reused by a
+// repository created later; a lookup costs one stat.
+static unsigned int store_generation = 0;
+static int store_root_fd = -1;
+static dev_t store_root_dev = 0;
+static ino_t store_root_ino = 0;
+
+// Guards the process-wide object store state (packs, loose set, caches).
+// Recursive, since pack reads resolve delta bases through object_read.
+static pthread_mutex_t store_lock;
+static pthread_once_t store_lock_once = PTHREAD_ONCE_INIT;
+
+static void store_lock_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&store_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
 
-// Helper function to create object header
-static char* create_object_header(const char *type, size_t size, size_t *header_len_out) {
-    *header_len_out = strlen(type) + 1 + 20 + 1; // type + space + size + null
-    char *header = safe_malloc(*header_len_out);
-    if (!header) return NULL;
+void object_store_lock(void) {
+    pthread_once(&store_lock_once, store_lock_init);
+    pthread_mutex_lock(&store_lock);
+}
 
-    snprintf(header, *header_len_out, "%s %zu", type, size);
-    return header;
+void object_store_unlock(void) {
+    pthread_mutex_unlock(&store_lock);
 }
 
-// Helper function to combine header and data
-static char* combine_header_data(const char *header, const void *data, size_t size, size_t *total_size_out) {
-    size_t header_len = strlen(header);
-    *total_size_out = header_len + 1 + size;
+// Generation number used by the object store caches to detect a repository switch
+unsigned int object_store_generation(void) {
+    struct stat st;
+    // Outside a repository the store keeps serving the last one
+    if (stat(GITNANO_DIR, &st) == 0 &&
+        (st.st_ino != __atomic_load_n(&store_root_ino, __ATOMIC_ACQUIRE) ||
+         st.st_dev != __atomic_load_n(&store_root_dev, __ATOMIC_ACQUIRE))) {
+        object_store_lock();
+        int fd = open(GITNANO_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0 && fstat(fd, &st) == 0 && (st.st_ino != store_root_ino || st.st_dev != store_root_dev)) {
+            if (store_root_fd >= 0) close(store_root_fd);
+            store_root_fd = fd;
+            __atomic_store_n(&store_root_dev, st.st_dev, __ATOMIC_RELEASE);
+            __atomic_store_n(&store_root_ino, st.st_ino, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&store_generation, 1, __ATOMIC_RELEASE);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        object_store_unlock();
+    }
+    return __atomic_load_n(&store_generation, __ATOMIC_ACQUIRE);
+}
 
-    char *combined = safe_malloc(*total_size_out);
-    if (!combined) return NULL;
+// Hash algorithm of the current repository, from "object_format" in its config
+static hash_algo store_algo = HASH_SHA1;
+static unsigned int algo_generation = 0;
+static int algo_loaded = 0;
+
+hash_algo repo_hash_algo(void) {
+    object_store_lock();
+    unsigned int generation = object_store_generation();
+    if (!algo_loaded || algo_generation != generation) {
+        char value[32];
+        store_algo = HASH_SHA1;
+        if (config_get("object_format", value, sizeof(value)) == 0) {
+            int algo = hash_algo_by_name(value);
+            if (algo < 0) {
+                // Guessing would mint ids the repository cannot find
+                fprintf(stderr, "ERROR: unknown object_format '%s' in %s\n", value, CONFIG_FILE);
+                exit(1);
+            }
+            store_algo = algo;
+        }
+        algo_generation = generation;
+        algo_loaded = 1;
+    }
+    hash_algo algo = store_algo;
+    object_store_unlock();
+    return algo;
+}
 
-    memcpy(combined, header, header_len + 1);
-    memcpy(combined + header_len + 1, data, size);
-    return combined;
+// Invalidate cached object store state after packs or loose objects were rewritten
+void object_store_reset(void) {
+    __atomic_add_fetch(&store_generation, 1, __ATOMIC_RELEASE);
+}
+
+// Format the "type size\0" object header, returns its length including the NUL
+static size_t format_object_header(const char *type, size_t size, char *header, size_t header_size) {
+    return snprintf(header, header_size, "%s %zu", type, size) + 1;
 }
 
 // Calculate hash of object data
-int object_hash(const char *type, const void *data, size_t size, char *sha1_out) {
-    size_t header_len, total_size;
-    char *header = create_object_header(type, size, &header_len);
-    if (!header) return -1;
-
-    char *combined = combine_header_data(header, data, size, &total_size);
-    if (!combined) {
-        free(header);
-        return -1;
+int object_hash(const char *type, const void *data, size_t size, object_id *oid_out) {
+    char header[64];
+    size_t header_len = format_object_header(type, size, header, sizeof(header));
+    hash_algo algo = repo_hash_algo();
+    oid_clear(oid_out);
+    oid_out->algo = algo;
+    return hash_data(algo, header, header_len, data, size, oid_out->hash);
+}
+
+#define OBJECT_HASH_BATCH 32
+
+// Hash count objects of one type in a single hash_many call per batch
+int object_hash_many(const char *type, const void *const *datas, const size_t *sizes, size_t count, object_id *oids_out) {
+    char headers[OBJECT_HASH_BATCH][64];
+    hash_job jobs[OBJECT_HASH_BATCH];
+    hash_algo algo = repo_hash_algo();
+
+    for (size_t start = 0; start < count; start += OBJECT_HASH_BATCH) {
+        size_t n = count - start < OBJECT_HASH_BATCH ? count - start : OBJECT_HASH_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            jobs[i].prefix = headers[i];
+            jobs[i].prefix_len = format_object_header(type, sizes[start + i], headers[i], sizeof(headers[i]));
+            jobs[i].data = datas[start + i];
+            jobs[i].size = sizes[start + i];
+            oid_clear(&oids_out[start + i]);
+            oids_out[start + i].algo = algo;
+            jobs[i].digest_out = oids_out[start + i].hash;
+        }
+        if (hash_many(algo, jobs, n) != 0) return -1;
     }
+    return 0;
+}
 
-    int err = sha1_data(combined, total_size, sha1_out);
+// Integrity level resolved for the current repository
+static int integrity_configured = -1;
+static unsigned int integrity_generation = 0;
+static int bulk_depth = 0;
+
+static int parse_integrity_level(const char *value) {
+    if (strcmp(value, "none") == 0) return INTEGRITY_NONE;
+    if (strcmp(value, "checksum") == 0) return INTEGRITY_CHECKSUM;
+    if (strcmp(value, "full") == 0) return INTEGRITY_FULL;
+    fprintf(stderr, "WARNING: unknown integrity level '%s', using default\n", value);
+    return -1;
+}
 
-    free(header);
-    free(combined);
+// Integrity level for the next write: an explicit setting wins, otherwise
+// single writes are checksummed and bulk writes are trusted
+integrity_level object_integrity_level(void) {
+    int level = -1;
+    const char *env = getenv("GITNANO_INTEGRITY");
+    if (env && *env) {
+        level = parse_integrity_level(env);
+    } else {
+        // The config file is only re-read when the repository changes
+        object_store_lock();
+        unsigned int generation = object_store_generation();
+        if (integrity_generation != generation) {
+            char value[32];
+            integrity_configured = -1;
+            if (config_get("integrity", value, sizeof(value)) == 0) {
+                integrity_configured = parse_integrity_level(value);
+            }
+            integrity_generation = generation;
+        }
+        level = integrity_configured;
+        object_store_unlock();
+    }
+
+    if (level >= 0) return level;
+    return bulk_depth > 0 ? INTEGRITY_NONE : INTEGRITY_CHECKSUM;
+}
+
+// Bulk writers such as tree_build bracket their writes with these
+void object_bulk_begin(void) {
+    bulk_depth++;
+}
+
+void object_bulk_end(void) {
+    if (bulk_depth > 0) bulk_depth--;
+}
+
+// Group commit: objects written between object_sync_begin and object_sync_end
+// are renamed into place without an fsync each, and flushed together at the end
+#define OBJECT_SYNCFS_THRESHOLD 256
+
+static int sync_depth = 0;
+static object_id *sync_oids = NULL;
+static size_t sync_count = 0;
+static size_t sync_alloc = 0;
+
+void object_sync_begin(void) {
+    object_store_lock();
+    sync_depth++;
+    object_store_unlock();
+}
+
+// Remember a new object for the next group flush (called under the store lock)
+static void object_sync_track(const object_id *oid) {
+    if (sync_depth == 0) return;
+    if (sync_count == sync_alloc) {
+        sync_alloc = sync_alloc ? sync_alloc * 2 : 256;
+        sync_oids = safe_realloc(sync_oids, sync_alloc * sizeof(object_id));
+    }
+    oid_copy(&sync_oids[sync_count++], oid);
+}
+
+static int flush_objects(const object_id *oids, size_t count) {
+#ifdef __linux__
+    // One filesystem-wide flush beats thousands of small ones
+    if (count >= OBJECT_SYNCFS_THRESHOLD) {
+        int fd = open(OBJECTS_DIR, O_RDONLY);
+        int err = fd >= 0 && syncfs(fd) == 0 ? 0 : -1;
+        if (fd >= 0) close(fd);
+        if (err == 0) return 0;
+    }
+#endif
+
+    int err = 0;
+    unsigned char fanout_seen[256] = {0};
+    for (size_t i = 0; i < count && err == 0; i++) {
+        char path[MAX_PATH];
+        get_object_path(&oids[i], path);
+        err = fsync_path(path);
+        fanout_seen[oids[i].hash[0]] = 1;
+    }
+
+    // New names live in the fanout directories, new fanouts in OBJECTS_DIR
+    for (int i = 0; i < 256 && err == 0; i++) {
+        if (!fanout_seen[i]) continue;
+        char dir_path[MAX_PATH];
+        snprintf(dir_path, sizeof(dir_path), "%s/%02x", OBJECTS_DIR, i);
+        err = fsync_path(dir_path);
+    }
+    if (err == 0 && count > 0) err = fsync_path(OBJECTS_DIR);
     return err;
 }
 
-// Simple object integrity check (only basic verification)
-static int verify_object_integrity(const char *sha1, const char *expected_type, size_t expected_size) {
-    gitnano_object obj;
-    int err = object_read(sha1, &obj);
-    if (err != 0) {
-        return -1;
+// Flush the objects of the batch; GITNANO_FSYNC=none (or fsync = none) skips it
+int object_sync_end(void) {
+    object_store_lock();
+    if (sync_depth == 0 || --sync_depth > 0) {
+        object_store_unlock();
+        return 0;
     }
+    object_id *oids = sync_oids;
+    size_t count = sync_count;
+    sync_oids = NULL;
+    sync_count = sync_alloc = 0;
+    object_store_unlock();
+
+    char mode[16];
+    int err = 0;
+    if (config_get_setting("GITNANO_FSYNC", "fsync", mode, sizeof(mode)) != 0 || strcmp(mode, "none") != 0) {
+        err = flush_objects(oids, count);
+        if (err != 0) fprintf(stderr, "ERROR: object_sync_end: failed to flush %zu new objects\n", count);
+    }
+    free(oids);
+    return err;
+}
+
+static int read_loose_header(inflate_stream *stream, const object_id *oid, char *type_out, size_t *size_out);
+
+// CRC of a whole file, read through a fixed-size buffer
+static int crc_file(const char *path, uLong *crc_out, size_t *size_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    unsigned char buffer[65536];
+    uLong crc = crc32_z(0L, Z_NULL, 0);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        crc = crc32_z(crc, buffer, n);
+        total += n;
+    }
+    close(fd);
 
-    // Simple type and size check only
-    int is_valid = (strcmp(obj.type, expected_type) == 0 && obj.size == expected_size);
-    object_free(&obj);
+    *crc_out = crc;
+    *size_out = total;
+    return 0;
+}
+
+// Check a freshly written object file at the requested level. Neither level
+// copies the object into memory: the checksum is computed through a small
+// buffer and a full check inflates the mapped file in chunks.
+static int verify_object_integrity(const object_id *oid, const char *path, const char *expected_type,
+                                   size_t expected_size, uLong compressed_crc, size_t compressed_size,
+                                   integrity_level level) {
+    if (level == INTEGRITY_CHECKSUM) {
+        uLong crc;
+        size_t size;
+        if (crc_file(path, &crc, &size) != 0) return -1;
+        return size == compressed_size && crc == compressed_crc ? 0 : -1;
+    }
+    if (level != INTEGRITY_FULL) return 0;
+
+    mapped_file written;
+    if (mapped_file_open(path, &written) != 0) return -1;
+
+    int is_valid = 0;
+    inflate_stream *stream = inflate_stream_new(written.data, written.size);
+    char type[10];
+    size_t size;
+    if (stream && read_loose_header(stream, oid, type, &size) == 0 &&
+        strcmp(type, expected_type) == 0 && size == expected_size) {
+        char buffer[65536];
+        size_t total = 0, produced;
+        while (inflate_stream_read(stream, buffer, sizeof(buffer), &produced) == 0 && produced > 0) {
+            total += produced;
+        }
+        is_valid = total == expected_size && inflate_stream_end(stream) == 0;
+    }
+    inflate_stream_free(stream);
+
+    mapped_file_close(&written);
     return is_valid ? 0 : -1;
 }
 
-// Write object to object store
-int object_write(const char *type, const void *data, size_t size, char *sha1_out) {
-    char sha1[SHA1_HEX_SIZE];
-    int err = object_hash(type, data, size, sha1);
-    if (err != 0) {
-        printf("ERROR: object_hash: %d\n", err);
-        return err;
+// Temporary files are kept out of the objects directory itself, so only real
+// object changes touch the directory mtimes the loose set relies on
+#define OBJECT_TMP_DIR OBJECTS_DIR "/tmp"
+
+// Streaming object writer: the header and data are hashed and deflated in a
+// single pass into a temporary file that is renamed into place at the end
+struct object_writer {
+    char type[10];
+    size_t size;
+    size_t written;
+    hash_ctx *hash;        // NULL when the id is known up front
+    object_id oid;
+    compress_stream *stream;
+    FILE *fp;
+    char tmp_path[MAX_PATH];
+    uLong compressed_crc;
+    size_t compressed_size;
+    int failed;
+};
+
+static int object_writer_sink(const void *data, size_t size, void *sink_data) {
+    object_writer *writer = sink_data;
+    if (fwrite(data, 1, size, writer->fp) != size) {
+        fprintf(stderr, "ERROR: object_writer: short write to %s\n", writer->tmp_path);
+        return -1;
     }
+    writer->compressed_crc = crc32_z(writer->compressed_crc, data, size);
+    writer->compressed_size += size;
+    return 0;
+}
 
-    char path[MAX_PATH];
-    get_object_path(sha1, path);
+static object_writer *writer_begin(const char *type, size_t size, const object_id *known_oid) {
+    if (!type || strlen(type) >= sizeof(((object_writer *)0)->type)) {
+        fprintf(stderr, "ERROR: object_writer_begin: invalid object type\n");
+        return NULL;
+    }
 
-    if (file_exists(path)) {
-        if (sha1_out) {
-            strcpy(sha1_out, sha1);
+    if (mkdir_p(OBJECT_TMP_DIR) != 0) return NULL;
+
+    object_writer *writer = safe_malloc(sizeof(object_writer));
+    memset(writer, 0, sizeof(object_writer));
+    strcpy(writer->type, type);
+    writer->size = size;
+    writer->compressed_crc = crc32_z(0L, Z_NULL, 0);
+
+    snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s/tmp_obj_XXXXXX", OBJECT_TMP_DIR);
+    int fd = mkstemp(writer->tmp_path);
+    // Objects are immutable once written
+    if (fd >= 0) fchmod(fd, 0444);
+    if (fd < 0 || !(writer->fp = fdopen(fd, "wb"))) {
+        fprintf(stderr, "ERROR: object_writer_begin: cannot create temporary object file\n");
+        if (fd >= 0) {
+            close(fd);
+            unlink(writer->tmp_path);
         }
-        return 0;
+        free(writer);
+        return NULL;
     }
 
-    // Create object directory
-    char dir_path[MAX_PATH];
-    snprintf(dir_path, sizeof(dir_path), "%s/%.2s", OBJECTS_DIR, sha1);
-    if ((err = mkdir_p(dir_path)) != 0) {
-        printf("ERROR: mkdir_p: %d\n", err);
-        return err;
+    if (known_oid) oid_copy(&writer->oid, known_oid);
+    else writer->hash = hash_ctx_new(repo_hash_algo());
+    writer->stream = compress_stream_new(type, size, object_writer_sink, writer);
+    if ((!known_oid && !writer->hash) || !writer->stream) {
+        object_writer_abort(writer);
+        return NULL;
     }
 
-    // Create object content using helper functions
-    size_t header_len, content_size;
-    char *header = create_object_header(type, size, &header_len);
-    if (!header) return -1;
+    char header[64];
+    size_t header_len = format_object_header(type, size, header, sizeof(header));
+    if ((writer->hash && hash_ctx_update(writer->hash, header, header_len) != 0) ||
+        compress_stream_header(writer->stream, header, header_len) != 0) {
+        object_writer_abort(writer);
+        return NULL;
+    }
+    return writer;
+}
 
-    char *content = combine_header_data(header, data, size, &content_size);
-    if (!content) {
-        free(header);
+object_writer *object_writer_begin(const char *type, size_t size) {
+    return writer_begin(type, size, NULL);
+}
+
+int object_writer_update(object_writer *writer, const void *data, size_t size) {
+    if (writer->failed) return -1;
+    if (size > writer->size - writer->written) {
+        fprintf(stderr, "ERROR: object_writer_update: more data than the declared %zu bytes\n", writer->size);
+        writer->failed = 1;
         return -1;
     }
+    if (size == 0) return 0;
 
-    // Compress content
-    void *compressed = NULL;
-    size_t compressed_size = 0;
-    if ((err = compress_data(content, content_size, &compressed, &compressed_size)) != 0) {
-        fprintf(stderr, "ERROR: compress_data: %d\n", err);
-        free(header);
-        free(content);
-        return err;
+    if ((writer->hash && hash_ctx_update(writer->hash, data, size) != 0) ||
+        compress_stream_update(writer->stream, data, size) != 0) {
+        writer->failed = 1;
+        return -1;
     }
+    writer->written += size;
+    return 0;
+}
 
-    // Write compressed data to file
-    if ((err = write_file(path, compressed, compressed_size)) != 0) {
-        fprintf(stderr, "ERROR: write_file: %d\n", err);
-        free(header);
-        free(content);
-        free(compressed);
+// Finish the object and move it into the store; the writer is freed either way
+int object_writer_finish(object_writer *writer, object_id *oid_out) {
+    if (writer->failed || writer->written != writer->size) {
+        fprintf(stderr, "ERROR: object_writer_finish: wrote %zu of %zu bytes\n", writer->written, writer->size);
+        object_writer_abort(writer);
+        return -1;
+    }
+
+    object_id oid;
+    int err = compress_stream_finish(writer->stream);
+    if (err == 0 && writer->hash) {
+        oid_clear(&oid);
+        oid.algo = repo_hash_algo();
+        err = hash_ctx_final(writer->hash, oid.hash);
+    }
+    if (!writer->hash) oid_copy(&oid, &writer->oid);
+    if (fclose(writer->fp) != 0) err = -1;
+    writer->fp = NULL;
+    if (err != 0) {
+        object_writer_abort(writer);
         return err;
     }
 
-    // Quick integrity check (only if verification fails, remove object)
-    if (verify_object_integrity(sha1, type, size) != 0) {
-        // Remove corrupted object file
-        unlink(path);
-        free(header);
-        free(content);
-        free(compressed);
-        return -1;
+    // Concurrent writers of the same object settle here: the first one installs it
+    object_store_lock();
+    int exists = object_exists(&oid);
+    if (exists) {
+        object_store_unlock();
+        unlink(writer->tmp_path);
+    } else {
+        char path[MAX_PATH], dir_path[MAX_PATH], hex[OID_MAX_HEX_SIZE];
+        get_object_path(&oid, path);
+        snprintf(dir_path, sizeof(dir_path), "%s/%02x", OBJECTS_DIR, oid.hash[0]);
+        err = mkdir_p(dir_path);
+        if (err == 0 && rename(writer->tmp_path, path) != 0) err = -1;
+        object_store_unlock();
+        if (err != 0) {
+            fprintf(stderr, "ERROR: object_writer_finish: cannot move object %s into place\n", oid_to_hex(&oid, hex));
+            object_writer_abort(writer);
+            return -1;
+        }
+
+        // Integrity check (if verification fails, remove object)
+        integrity_level level = object_integrity_level();
+        if (level != INTEGRITY_NONE &&
+            verify_object_integrity(&oid, path, writer->type, writer->size,
+                                    writer->compressed_crc, writer->compressed_size, level) != 0) {
+            fprintf(stderr, "ERROR: object_write: integrity check failed for object %s\n", oid_to_hex(&oid, hex));
+            unlink(path);
+            object_writer_abort(writer);
+            return -1;
+        }
+        loose_set_add(&oid);
+
+        object_store_lock();
+        object_sync_track(&oid);
+        object_store_unlock();
     }
 
-    free(header);
-    free(content);
-    free(compressed);
+    hash_ctx_free(writer->hash);
+    compress_stream_free(writer->stream);
+    free(writer);
+
+    if (oid_out) {
+        oid_copy(oid_out, &oid);
+    }
+    return 0;
+}
 
-    if (sha1_out) {
-        strcpy(sha1_out, sha1);
+// Drop a writer and its temporary file
+void object_writer_abort(object_writer *writer) {
+    if (!writer) return;
+    if (writer->fp) fclose(writer->fp);
+    unlink(writer->tmp_path);
+    hash_ctx_free(writer->hash);
+    compress_stream_free(writer->stream);
+    free(writer);
+}
+
+// Write an object whose id the caller has already computed with object_hash
+int object_write_hashed(const char *type, const void *data, size_t size, const object_id *oid) {
+    // Hashing is cheap next to deflate, so skip the write for known objects
+    if (object_exists(oid)) return 0;
+
+    object_writer *writer = writer_begin(type, size, oid);
+    if (!writer) return -1;
+
+    int err;
+    if ((err = object_writer_update(writer, data, size)) != 0) {
+        object_writer_abort(writer);
+        return err;
     }
+    return object_writer_finish(writer, NULL);
+}
 
+// Write object to object store
+int object_write(const char *type, const void *data, size_t size, object_id *oid_out) {
+    object_id oid;
+    int err = object_hash(type, data, size, &oid);
+    if (err != 0) {
+        printf("ERROR: object_hash: %d\n", err);
+        return err;
+    }
+
+    if ((err = object_write_hashed(type, data, size, &oid)) != 0) return err;
+    if (oid_out) {
+        oid_copy(oid_out, &oid);
+    }
     return 0;
 }
 
-// Helper function to parse object header
-static int parse_object_header(const char *header, char *type_out, size_t *size_out) {
-    char *header_copy = safe_strdup(header);
-    if (!header_copy) return -1;
+// Inflate the "type size\0" header at the start of a loose object
+static int read_loose_header(inflate_stream *stream, const object_id *oid, char *type_out, size_t *size_out) {
+    // Longest valid header: "commit " + 20 digits + NUL
+    char header[32], hex[OID_MAX_HEX_SIZE];
+    size_t len = 0;
+    for (;;) {
+        size_t produced;
+        if (len == sizeof(header) || inflate_stream_read(stream, header + len, 1, &produced) != 0 || produced == 0) {
+            fprintf(stderr, "ERROR: object_read: could not find object header (object %s may be corrupted)\n",
+                    oid_to_hex(oid, hex));
+            return -1;
+        }
+        if (header[len++] == '\0') break;
+    }
 
-    char *space_pos = strchr(header_copy, ' ');
-    if (!space_pos) {
-        free(header_copy);
+    char *space_pos = strchr(header, ' ');
+    char *end = NULL;
+    if (!space_pos || space_pos == header || space_pos - header >= 10) {
+        fprintf(stderr, "ERROR: object_read: invalid object header '%s' (object %s may be corrupted)\n",
+                header, oid_to_hex(oid, hex));
         return -1;
     }
 
-    *space_pos = '\0';
-    strcpy(type_out, header_copy);
-    *size_out = atol(space_pos + 1);
+    unsigned long long size = strtoull(space_pos + 1, &end, 10);
+    if (end == space_pos + 1 || *end != '\0') {
+        fprintf(stderr, "ERROR: object_read: invalid object size in header '%s'\n", header);
+        return -1;
+    }
 
-    free(header_copy);
+    memcpy(type_out, header, space_pos - header);
+    type_out[space_pos - header] = '\0';
+    *size_out = (size_t)size;
     return 0;
 }
 
 // Read object from object store
-int object_read(const char *sha1, gitnano_object *obj) {
-    if (!sha1 || !obj) {
+int object_read(const object_id *oid, gitnano_object *obj) {
+    if (!oid || !obj) {
         fprintf(stderr, "ERROR: object_read: invalid arguments\n");
         return -1;
     }
@@ -163,118 +579,162 @@ int object_read(const char *sha1, gitnano_object *obj) {
     // Initialize object
     memset(obj, 0, sizeof(gitnano_object));
 
-    char path[MAX_PATH];
-    get_object_path(sha1, path);
+    // Objects read earlier in this process are served from memory
+    if (object_cache_get(oid, obj) == 0) {
+        return 0;
+    }
 
-    if (!file_exists(path)) {
-        fprintf(stderr, "ERROR: object_read: object file not found at %s\n", path);
-        return -1;
+    // Packed objects take precedence over loose files
+    object_store_lock();
+    if (pack_has_object(oid)) {
+        int err = pack_read_object(oid, obj);
+        object_store_unlock();
+        if (err == 0) object_cache_put(oid, obj);
+        return err;
     }
+    object_store_unlock();
 
-    // Read compressed data
+    char path[MAX_PATH];
+    get_object_path(oid, path);
+
+    // Read compressed data (a missing file is reported here, without a separate probe)
     size_t compressed_size;
     char *compressed = read_file(path, &compressed_size);
     if (!compressed) {
-        fprintf(stderr, "ERROR: object_read: failed to read object file %s\n", path);
+        fprintf(stderr, "ERROR: object_read: object file not found at %s\n", path);
         return -1;
     }
 
-    // Check if file is empty
-    if (compressed_size == 0) {
-        fprintf(stderr, "ERROR: object_read: object file %s is empty\n", path);
+    inflate_stream *stream = inflate_stream_new(compressed, compressed_size);
+    if (!stream) {
         free(compressed);
         return -1;
     }
 
-    // Decompress data
-    void *decompressed = NULL;
-    size_t decompressed_size = 0;
-    int err = decompress_data(compressed, compressed_size, &decompressed, &decompressed_size);
-    if (err != 0) {
-        fprintf(stderr, "ERROR: object_read: decompress_data failed with code %d (object %s may be corrupted)\n", err, sha1);
-        free(compressed);
-        return err;
+    // The header gives the exact size, so the data is inflated straight into place
+    int err = read_loose_header(stream, oid, obj->type, &obj->size);
+    if (err == 0) {
+        size_t produced = 0;
+        obj->data = safe_malloc(obj->size + 1);
+        err = inflate_stream_read(stream, obj->data, obj->size, &produced);
+        if (err == 0 && (produced != obj->size || inflate_stream_end(stream) != 0)) {
+            char hex[OID_MAX_HEX_SIZE];
+            fprintf(stderr, "ERROR: object_read: size mismatch for object %s - inflated %zu of %zu bytes\n",
+                    oid_to_hex(oid, hex), produced, obj->size);
+            err = -1;
+        }
     }
 
+    inflate_stream_free(stream);
     free(compressed);
 
-    // Check for minimum object size (type + space + size + null + at least 0 bytes data)
-    if (decompressed_size < 4) {
-        fprintf(stderr, "ERROR: object_read: decompressed data too small for valid object (%zu bytes)\n", decompressed_size);
-        free(decompressed);
+    if (err != 0) {
+        object_free(obj);
         return -1;
     }
 
-    // Parse header: "type size\0"
-    char *null_pos = memchr(decompressed, '\0', decompressed_size);
-    if (!null_pos) {
-        fprintf(stderr, "ERROR: object_read: could not find null terminator in object header (object %s may be corrupted)\n", sha1);
-        free(decompressed);
-        return -1;
+    ((char *)obj->data)[obj->size] = '\0';
+    object_cache_put(oid, obj);
+    return 0;
+}
+
+// Read only the type and size of an object (inflates just the header)
+int object_read_info(const object_id *oid, char *type_out, size_t *size_out) {
+    if (object_cache_get_info(oid, type_out, size_out) == 0) {
+        return 0;
     }
 
-    size_t header_len = null_pos - (char*)decompressed;
-    if (header_len == 0) {
-        fprintf(stderr, "ERROR: object_read: empty object header (object %s may be corrupted)\n", sha1);
-        free(decompressed);
-        return -1;
+    object_store_lock();
+    if (pack_has_object(oid)) {
+        int err = pack_read_info(oid, type_out, size_out);
+        object_store_unlock();
+        return err;
     }
+    object_store_unlock();
+
+    char path[MAX_PATH];
+    get_object_path(oid, path);
 
-    char *header = safe_malloc(header_len + 1);
-    if (!header) {
-        free(decompressed);
+    // Only the header is inflated, so a large object is mapped, not copied
+    mapped_file compressed;
+    if (mapped_file_open(path, &compressed) != 0) {
+        fprintf(stderr, "ERROR: object_read_info: failed to read object file %s\n", path);
         return -1;
     }
 
-    memcpy(header, decompressed, header_len);
-    header[header_len] = '\0';
+    inflate_stream *stream = inflate_stream_new(compressed.data, compressed.size);
+    int err = stream ? read_loose_header(stream, oid, type_out, size_out) : -1;
+    inflate_stream_free(stream);
+    mapped_file_close(&compressed);
+    return err;
+}
 
-    // Parse type and size using helper function
-    err = parse_object_header(header, obj->type, &obj->size);
-    if (err != 0) {
-        fprintf(stderr, "ERROR: object_read: parse_object_header failed for object %s (header: '%s')\n", sha1, header);
-        free(header);
-        free(decompressed);
-        return -1;
+// Write the data of an object of the given type to target_path. A loose
+// object is inflated from its mapped file straight to the target through a
+// fixed buffer, so neither the object nor its compressed form is held in
+// memory; packed objects are small enough to be read whole.
+int object_read_to_file(const object_id *oid, const char *type, const char *target_path) {
+    char hex[OID_MAX_HEX_SIZE];
+    object_store_lock();
+    int packed = pack_has_object(oid);
+    object_store_unlock();
+    if (packed) {
+        gitnano_object obj;
+        if (object_read(oid, &obj) != 0) return -1;
+        int err;
+        if (strcmp(obj.type, type) != 0) {
+            fprintf(stderr, "ERROR: object_read_to_file: %s is a %s, not a %s\n", oid_to_hex(oid, hex), obj.type, type);
+            err = -1;
+        } else {
+            err = write_file(target_path, obj.data, obj.size);
+        }
+        object_free(&obj);
+        return err;
     }
 
-    // Verify data size matches expected total size
-    size_t expected_total_size = header_len + 1 + obj->size;
-    if (decompressed_size != expected_total_size) {
-        fprintf(stderr, "ERROR: object_read: size mismatch for object %s - decompressed: %zu, expected: %zu (header: %zu, data: %zu)\n",
-                sha1, decompressed_size, expected_total_size, header_len + 1, obj->size);
-        free(header);
-        free(decompressed);
+    char path[MAX_PATH];
+    get_object_path(oid, path);
+    mapped_file compressed;
+    if (mapped_file_open(path, &compressed) != 0) {
+        fprintf(stderr, "ERROR: object_read_to_file: object file not found at %s\n", path);
         return -1;
     }
 
-    // Validate object type
-    if (strlen(obj->type) == 0 || strlen(obj->type) >= sizeof(obj->type)) {
-        fprintf(stderr, "ERROR: object_read: invalid object type '%s' for object %s\n", obj->type, sha1);
-        free(header);
-        free(decompressed);
-        return -1;
+    inflate_stream *stream = inflate_stream_new(compressed.data, compressed.size);
+    char obj_type[10];
+    size_t size = 0;
+    int err = stream ? read_loose_header(stream, oid, obj_type, &size) : -1;
+    if (err == 0 && strcmp(obj_type, type) != 0) {
+        fprintf(stderr, "ERROR: object_read_to_file: %s is a %s, not a %s\n", oid_to_hex(oid, hex), obj_type, type);
+        err = -1;
     }
 
-    // Allocate and copy data
-    if (obj->size > 0) {
-        obj->data = safe_malloc(obj->size);
-        if (!obj->data) {
-            fprintf(stderr, "ERROR: object_read: failed to allocate %zu bytes for object data\n", obj->size);
-            free(header);
-            free(decompressed);
-            return -1;
+    FILE *fp = err == 0 ? fopen(target_path, "wb") : NULL;
+    if (err == 0 && !fp) {
+        fprintf(stderr, "ERROR: fopen failed for path '%s': %s\n", target_path, strerror(errno));
+        err = -1;
+    }
+    size_t total = 0;
+    while (err == 0) {
+        unsigned char buffer[65536];
+        size_t produced = 0;
+        if ((err = inflate_stream_read(stream, buffer, sizeof(buffer), &produced)) != 0 || produced == 0) break;
+        if (fwrite(buffer, 1, produced, fp) != produced) {
+            fprintf(stderr, "ERROR: fwrite incomplete for path '%s'\n", target_path);
+            err = -1;
         }
-
-        memcpy(obj->data, (char*)decompressed + header_len + 1, obj->size);
-    } else {
-        obj->data = NULL;
+        total += produced;
     }
+    if (err == 0 && (total != size || inflate_stream_end(stream) != 0)) {
+        fprintf(stderr, "ERROR: object_read_to_file: size mismatch for object %s - inflated %zu of %zu bytes\n",
+                oid_to_hex(oid, hex), total, size);
+        err = -1;
+    }
+    if (fp && fclose(fp) != 0) err = -1;
 
-    free(header);
-    free(decompressed);
-
-    return 0;
+    inflate_stream_free(stream);
+    mapped_file_close(&compressed);
+    return err;
 }
 
 // Free object memory
@@ -285,3 +745,53 @@ void object_free(gitnano_object *obj) {
         obj->size = 0;
     }
 }
+
+// Check whether an object is present in a pack or as a loose file
+int object_exists(const object_id *oid) {
+    object_store_lock();
+    int known = pack_has_object(oid) ? 1 : loose_set_contains(oid);
+    object_store_unlock();
+    if (known >= 0) {
+        return known;
+    }
+
+    char path[MAX_PATH];
+    get_object_path(oid, path);
+    return file_exists(path);
+}
+
+// Call fn for every loose object in the object store
+int object_for_each_loose(int (*fn)(const object_id *oid, void *data), void *data) {
+    DIR *dir = opendir(OBJECTS_DIR);
+    if (!dir) return 0;
+
+    // File names are the hex id minus the two fanout digits
+    size_t name_len = 2 * hash_algo_raw_size(repo_hash_algo()) - 2;
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) != 2 || entry->d_name[0] == '.') continue;
+
+        char subdir_path[MAX_PATH];
+        snprintf(subdir_path, sizeof(subdir_path), "%s/%s", OBJECTS_DIR, entry->d_name);
+
+        DIR *subdir = opendir(subdir_path);
+        if (!subdir) continue;
+
+        struct dirent *obj_entry;
+        while (result == 0 && (obj_entry = readdir(subdir)) != NULL) {
+            if (strlen(obj_entry->d_name) != name_len) continue;
+
+            char hex[OID_MAX_HEX_SIZE];
+            object_id oid;
+            snprintf(hex, sizeof(hex), "%s%s", entry->d_name, obj_entry->d_name);
+            if (oid_from_hex(hex, &oid) != 0) continue;
+            result = fn(&oid, data);
+        }
+        closedir(subdir);
+    }
+
+    closedir(dir);
+    return result;
+}
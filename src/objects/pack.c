@@ -0,0 +1,1101 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include "pack.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+// Packs of the current repository, reloaded when the repository changes
+static packed_git *packs = NULL;
+static int packs_loaded = 0;
+static unsigned int packs_generation = 0;
+
+static const char *pack_type_names[] = {NULL, "commit", "tree", "blob", NULL, "manifest"};
+
+static uint32_t get_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void put_be32(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void put_be64(unsigned char *p, uint64_t value) {
+    put_be32(p, value >> 32);
+    put_be32(p + 4, (uint32_t)value);
+}
+
+static int pack_type_from_name(const char *type) {
+    for (int i = PACK_TYPE_COMMIT; i <= PACK_TYPE_MANIFEST; i++) {
+        if (pack_type_names[i] && strcmp(type, pack_type_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Map a whole file read-only
+static void *map_whole_file(const char *path, size_t *size_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    *size_out = st.st_size;
+    return map;
+}
+
+// Open a pack index and validate its layout. Ids are stored at the width of
+// the repository's object format; the pack and index checksums stay SHA-1.
+static packed_git *pack_open(const char *idx_path, hash_algo algo) {
+    size_t id_size = hash_algo_raw_size(algo);
+    size_t idx_size = 0;
+    unsigned char *map = map_whole_file(idx_path, &idx_size);
+    if (!map) {
+        fprintf(stderr, "ERROR: pack_open: cannot map %s\n", idx_path);
+        return NULL;
+    }
+
+    size_t header_size = 8 + 256 * 4;
+    if (idx_size < header_size + 2 * SHA1_RAW_SIZE ||
+        memcmp(map, PACK_IDX_SIGNATURE, 4) != 0 ||
+        get_be32(map + 4) != PACK_IDX_VERSION) {
+        fprintf(stderr, "ERROR: pack_open: %s is not a valid pack index\n", idx_path);
+        munmap(map, idx_size);
+        return NULL;
+    }
+
+    uint32_t count = get_be32(map + 8 + 255 * 4);
+    size_t min_size = header_size + (size_t)count * (id_size + 4 + 4) + 2 * SHA1_RAW_SIZE;
+    if (idx_size < min_size || (idx_size - min_size) % 8 != 0) {
+        fprintf(stderr, "ERROR: pack_open: pack index %s is truncated\n", idx_path);
+        munmap(map, idx_size);
+        return NULL;
+    }
+
+    packed_git *pack = safe_malloc(sizeof(packed_git));
+    memset(pack, 0, sizeof(packed_git));
+
+    size_t base_len = strlen(idx_path) - strlen(".idx");
+    snprintf(pack->pack_path, sizeof(pack->pack_path), "%.*s.pack", (int)base_len, idx_path);
+
+    pack->idx_map = map;
+    pack->idx_size = idx_size;
+    pack->object_count = count;
+    pack->algo = algo;
+    pack->id_size = id_size;
+    pack->fanout = map + 8;
+    pack->oids = pack->fanout + 256 * 4;
+    pack->offsets = pack->oids + (size_t)count * (id_size + 4);
+    pack->large_offsets = pack->offsets + (size_t)count * 4;
+    return pack;
+}
+
+static void pack_close(packed_git *pack) {
+    if (pack->idx_map) munmap(pack->idx_map, pack->idx_size);
+    if (pack->pack_map) munmap(pack->pack_map, pack->pack_size);
+    free(pack);
+}
+
+// Drop all mapped packs
+void pack_release_all(void) {
+    while (packs) {
+        packed_git *next = packs->next;
+        pack_close(packs);
+        packs = next;
+    }
+    packs_loaded = 0;
+}
+
+// Load the pack indexes of the current repository
+static void prepare_packs(void) {
+    unsigned int generation = object_store_generation();
+    if (packs_loaded && generation == packs_generation) {
+        return;
+    }
+
+    pack_release_all();
+    packs_loaded = 1;
+    packs_generation = generation;
+
+    DIR *dir = opendir(PACK_DIR);
+    if (!dir) return;
+
+    hash_algo algo = repo_hash_algo();
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || strcmp(entry->d_name + len - 4, ".idx") != 0) continue;
+
+        char idx_path[MAX_PATH];
+        snprintf(idx_path, sizeof(idx_path), "%s/%s", PACK_DIR, entry->d_name);
+
+        packed_git *pack = pack_open(idx_path, algo);
+        if (!pack) continue;
+
+        if (!file_exists(pack->pack_path)) {
+            pack_close(pack);
+            continue;
+        }
+
+        pack->next = packs;
+        packs = pack;
+    }
+
+    closedir(dir);
+}
+
+// Binary search the index within the fanout range of the first byte
+static int pack_find_position(packed_git *pack, const object_id *oid, uint32_t *pos_out) {
+    unsigned char first = oid->hash[0];
+    uint32_t lo = first ? get_be32(pack->fanout + (first - 1) * 4) : 0;
+    uint32_t hi = get_be32(pack->fanout + first * 4);
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(pack->oids + (size_t)mid * pack->id_size, oid->hash, pack->id_size);
+        if (cmp == 0) {
+            *pos_out = mid;
+            return 0;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+static uint64_t pack_entry_offset(packed_git *pack, uint32_t pos) {
+    uint32_t offset = get_be32(pack->offsets + (size_t)pos * 4);
+    if (offset & 0x80000000u) {
+        return get_be64(pack->large_offsets + (size_t)(offset & 0x7fffffffu) * 8);
+    }
+    return offset;
+}
+
+// Id stored at a position of the index
+static void pack_oid_at(packed_git *pack, uint32_t pos, object_id *oid_out) {
+    oid_from_raw(oid_out, pack->oids + (size_t)pos * pack->id_size, pack->algo);
+}
+
+static packed_git *pack_find(const object_id *oid, uint32_t *pos_out) {
+    prepare_packs();
+    for (packed_git *pack = packs; pack; pack = pack->next) {
+        if (pack_find_position(pack, oid, pos_out) == 0) {
+            return pack;
+        }
+    }
+    return NULL;
+}
+
+int pack_has_object(const object_id *oid) {
+    uint32_t pos;
+    return pack_find(oid, &pos) != NULL;
+}
+
+// Map the pack data on first use
+static int pack_map_data(packed_git *pack) {
+    if (pack->pack_map) return 0;
+
+    pack->pack_map = map_whole_file(pack->pack_path, &pack->pack_size);
+    if (!pack->pack_map) {
+        fprintf(stderr, "ERROR: pack_map_data: cannot map %s\n", pack->pack_path);
+        return -1;
+    }
+
+    if (pack->pack_size < 12 + SHA1_RAW_SIZE ||
+        memcmp(pack->pack_map, PACK_SIGNATURE, 4) != 0 ||
+        get_be32(pack->pack_map + 4) != PACK_VERSION ||
+        get_be32(pack->pack_map + 8) != pack->object_count) {
+        fprintf(stderr, "ERROR: pack_map_data: %s does not match its index\n", pack->pack_path);
+        munmap(pack->pack_map, pack->pack_size);
+        pack->pack_map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the variable-length type and size header of a pack entry
+static int unpack_entry_header(const unsigned char *buf, size_t len,
+                               int *type_out, size_t *size_out, size_t *used_out) {
+    if (len == 0) return -1;
+
+    size_t used = 0;
+    unsigned char c = buf[used++];
+    *type_out = (c >> 4) & 7;
+    size_t size = c & 15;
+    int shift = 4;
+
+    while (c & 0x80) {
+        if (used >= len || shift > 57) return -1;
+        c = buf[used++];
+        size |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    }
+
+    *size_out = size;
+    *used_out = used;
+    return 0;
+}
+
+static size_t encode_entry_header(unsigned char *buf, int type, size_t size) {
+    size_t used = 0;
+    unsigned char c = (type << 4) | (size & 15);
+    size >>= 4;
+    while (size) {
+        buf[used++] = c | 0x80;
+        c = size & 0x7f;
+        size >>= 7;
+    }
+    buf[used++] = c;
+    return used;
+}
+
+// Decode the base distance of an OFS_DELTA entry
+static int unpack_delta_offset(const unsigned char *buf, size_t len, uint64_t *offset_out, size_t *used_out) {
+    size_t used = 0;
+    if (len == 0) return -1;
+
+    unsigned char c = buf[used++];
+    uint64_t offset = c & 0x7f;
+    while (c & 0x80) {
+        if (used >= len || offset >= (UINT64_MAX >> 7)) return -1;
+        c = buf[used++];
+        offset = ((offset + 1) << 7) | (c & 0x7f);
+    }
+
+    *offset_out = offset;
+    *used_out = used;
+    return 0;
+}
+
+static size_t encode_delta_offset(unsigned char *buf, uint64_t offset) {
+    unsigned char tmp[16];
+    size_t pos = sizeof(tmp) - 1;
+    tmp[pos] = offset & 0x7f;
+    while (offset >>= 7) {
+        tmp[--pos] = 0x80 | (--offset & 0x7f);
+    }
+    memcpy(buf, tmp + pos, sizeof(tmp) - pos);
+    return sizeof(tmp) - pos;
+}
+
+// Pack entry located at an offset, with its base reference decoded
+typedef struct {
+    int type;
+    size_t size;
+    const unsigned char *data;
+    size_t data_len;
+    uint64_t base_offset;
+    object_id base_oid;
+} pack_entry;
+
+static int parse_pack_entry(packed_git *pack, uint64_t offset, pack_entry *entry) {
+    size_t data_end = pack->pack_size - SHA1_RAW_SIZE;
+    if (offset < 12 || offset >= data_end) {
+        fprintf(stderr, "ERROR: parse_pack_entry: bad offset %llu in %s\n",
+                (unsigned long long)offset, pack->pack_path);
+        return -1;
+    }
+
+    const unsigned char *buf = pack->pack_map + offset;
+    size_t avail = data_end - offset;
+    size_t used;
+    memset(entry, 0, sizeof(pack_entry));
+    if (unpack_entry_header(buf, avail, &entry->type, &entry->size, &used) != 0) {
+        fprintf(stderr, "ERROR: parse_pack_entry: corrupt entry header in %s\n", pack->pack_path);
+        return -1;
+    }
+
+    if (entry->type == PACK_TYPE_OFS_DELTA) {
+        uint64_t distance;
+        size_t distance_len;
+        if (unpack_delta_offset(buf + used, avail - used, &distance, &distance_len) != 0 ||
+            distance == 0 || distance > offset) {
+            fprintf(stderr, "ERROR: parse_pack_entry: corrupt delta base offset in %s\n", pack->pack_path);
+            return -1;
+        }
+        entry->base_offset = offset - distance;
+        used += distance_len;
+    } else if (entry->type == PACK_TYPE_REF_DELTA) {
+        if (avail - used < pack->id_size) return -1;
+        oid_from_raw(&entry->base_oid, buf + used, pack->algo);
+        used += pack->id_size;
+    } else if (entry->type < PACK_TYPE_COMMIT || entry->type > PACK_TYPE_MANIFEST || !pack_type_names[entry->type]) {
+        fprintf(stderr, "ERROR: parse_pack_entry: unknown entry type %d in %s\n", entry->type, pack->pack_path);
+        return -1;
+    }
+
+    entry->data = buf + used;
+    entry->data_len = avail - used;
+    return 0;
+}
+
+// Upper bound on delta chains followed while reading, guards against cycles
+#define PACK_MAX_CHAIN_DEPTH 4096
+
+// Inflate the entry at offset, resolving delta chains back to a full object
+static int unpack_entry(packed_git *pack, uint64_t offset, int depth,
+                        int *type_out, unsigned char **data_out, size_t *size_out) {
+    pack_entry entry;
+    if (parse_pack_entry(pack, offset, &entry) != 0) return -1;
+
+    // Keep a terminator after the payload so text objects can be scanned safely
+    unsigned char *data = safe_malloc(entry.size + 1);
+    if (inflate_exact(entry.data, entry.data_len, data, entry.size) != 0) {
+        fprintf(stderr, "ERROR: unpack_entry: failed to inflate entry at offset %llu\n",
+                (unsigned long long)offset);
+        free(data);
+        return -1;
+    }
+    data[entry.size] = '\0';
+
+    if (entry.type != PACK_TYPE_OFS_DELTA && entry.type != PACK_TYPE_REF_DELTA) {
+        *type_out = entry.type;
+        *data_out = data;
+        *size_out = entry.size;
+        return 0;
+    }
+
+    if (depth >= PACK_MAX_CHAIN_DEPTH) {
+        fprintf(stderr, "ERROR: unpack_entry: delta chain too deep in %s\n", pack->pack_path);
+        free(data);
+        return -1;
+    }
+
+    int base_type;
+    unsigned char *base = NULL;
+    size_t base_size = 0;
+    int err;
+    if (entry.type == PACK_TYPE_OFS_DELTA) {
+        err = unpack_entry(pack, entry.base_offset, depth + 1, &base_type, &base, &base_size);
+    } else {
+        gitnano_object base_obj;
+        err = object_read(&entry.base_oid, &base_obj);
+        if (err == 0) {
+            base_type = pack_type_from_name(base_obj.type);
+            base = base_obj.data;
+            base_size = base_obj.size;
+            err = base_type < 0 ? -1 : 0;
+        }
+    }
+
+    if (err != 0) {
+        free(base);
+        free(data);
+        return -1;
+    }
+
+    void *result;
+    size_t result_size;
+    err = delta_apply(base, base_size, data, entry.size, &result, &result_size);
+    free(base);
+    free(data);
+    if (err != 0) return err;
+
+    *type_out = base_type;
+    *data_out = result;
+    *size_out = result_size;
+    return 0;
+}
+
+// Read object from pack storage
+int pack_read_object(const object_id *oid, gitnano_object *obj) {
+    memset(obj, 0, sizeof(gitnano_object));
+
+    char hex[OID_MAX_HEX_SIZE];
+    uint32_t pos;
+    packed_git *pack = pack_find(oid, &pos);
+    if (!pack) {
+        fprintf(stderr, "ERROR: pack_read_object: object %s not found in packs\n", oid_to_hex(oid, hex));
+        return -1;
+    }
+
+    if (pack_map_data(pack) != 0) return -1;
+
+    int type;
+    unsigned char *data;
+    size_t size;
+    if (unpack_entry(pack, pack_entry_offset(pack, pos), 0, &type, &data, &size) != 0) {
+        fprintf(stderr, "ERROR: pack_read_object: failed to read object %s\n", oid_to_hex(oid, hex));
+        return -1;
+    }
+
+    strcpy(obj->type, pack_type_names[type]);
+    obj->size = size;
+    obj->data = data;
+    return 0;
+}
+
+// Find the type and size of a packed object without inflating its data
+int pack_read_info(const object_id *oid, char *type_out, size_t *size_out) {
+    uint32_t pos;
+    packed_git *pack = pack_find(oid, &pos);
+    if (!pack || pack_map_data(pack) != 0) return -1;
+
+    pack_entry entry;
+    uint64_t offset = pack_entry_offset(pack, pos);
+    if (parse_pack_entry(pack, offset, &entry) != 0) return -1;
+
+    size_t size = entry.size;
+    if (entry.type == PACK_TYPE_OFS_DELTA || entry.type == PACK_TYPE_REF_DELTA) {
+        // The result size sits in the first bytes of the delta
+        unsigned char header[20];
+        size_t produced;
+        if (inflate_prefix(entry.data, entry.data_len, header, sizeof(header), &produced) != 0 ||
+            delta_result_size(header, produced, &size) != 0) {
+            return -1;
+        }
+
+        // The type comes from the end of the chain
+        for (int depth = 0; entry.type == PACK_TYPE_OFS_DELTA; depth++) {
+            if (depth >= PACK_MAX_CHAIN_DEPTH || parse_pack_entry(pack, entry.base_offset, &entry) != 0) {
+                return -1;
+            }
+        }
+        if (entry.type == PACK_TYPE_REF_DELTA) {
+            size_t base_size;
+            if (object_read_info(&entry.base_oid, type_out, &base_size) != 0) return -1;
+            *size_out = size;
+            return 0;
+        }
+    }
+
+    strcpy(type_out, pack_type_names[entry.type]);
+    *size_out = size;
+    return 0;
+}
+
+// Call fn for every packed object whose hex name starts with prefix
+int pack_for_each_prefix(const char *prefix, int (*fn)(const object_id *oid, void *data), void *data) {
+    size_t prefix_len = strlen(prefix);
+    if (prefix_len > 2 * hash_algo_raw_size(repo_hash_algo()) || hex_span(prefix) != prefix_len) return 0;
+
+    // Compare whole bytes, then the high nibble of an odd trailing digit
+    unsigned char want[OID_MAX_RAW_SIZE];
+    size_t full = prefix_len / 2;
+    hex_decode(prefix, full, want);
+    unsigned char last = 0;
+    if (prefix_len % 2) {
+        char pair[2] = {prefix[prefix_len - 1], '0'};
+        hex_decode(pair, 1, &last);
+    }
+
+    prepare_packs();
+    for (packed_git *pack = packs; pack; pack = pack->next) {
+        uint32_t lo = 0, hi = pack->object_count;
+        if (full > 0) {
+            lo = want[0] ? get_be32(pack->fanout + (want[0] - 1) * 4) : 0;
+            hi = get_be32(pack->fanout + want[0] * 4);
+        }
+
+        for (uint32_t i = lo; i < hi; i++) {
+            const unsigned char *raw = pack->oids + (size_t)i * pack->id_size;
+            if (memcmp(raw, want, full) != 0) continue;
+            if (prefix_len % 2 && (raw[full] & 0xf0) != last) continue;
+
+            object_id oid;
+            pack_oid_at(pack, i, &oid);
+            int result = fn(&oid, data);
+            if (result != 0) return result;
+        }
+    }
+    return 0;
+}
+
+// Object collected for a new pack
+typedef struct {
+    object_id oid;
+    uint64_t offset;
+    uint32_t crc;
+    int type;
+    size_t size;
+    uint32_t name_hash;
+    int depth;
+    int walked;
+} pack_write_entry;
+
+typedef struct {
+    pack_write_entry *entries;
+    size_t count;
+    size_t alloc;
+} pack_entry_list;
+
+static int collect_object(const object_id *oid, void *data) {
+    pack_entry_list *list = data;
+    if (list->count == list->alloc) {
+        list->alloc = list->alloc ? list->alloc * 2 : 256;
+        list->entries = safe_realloc(list->entries, list->alloc * sizeof(pack_write_entry));
+    }
+
+    pack_write_entry *entry = &list->entries[list->count++];
+    memset(entry, 0, sizeof(pack_write_entry));
+    oid_copy(&entry->oid, oid);
+    return 0;
+}
+
+static int compare_entry_oids(const void *a, const void *b) {
+    return oid_cmp(&((const pack_write_entry *)a)->oid, &((const pack_write_entry *)b)->oid);
+}
+
+static pack_write_entry *find_write_entry(pack_entry_list *list, const object_id *oid) {
+    pack_write_entry key;
+    oid_copy(&key.oid, oid);
+    return bsearch(&key, list->entries, list->count, sizeof(pack_write_entry), compare_entry_oids);
+}
+
+// Hash of a file name, weighted towards its last characters (same as Git)
+static uint32_t pack_name_hash(const char *name) {
+    uint32_t hash = 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        if (*p == ' ' || *p == '\t' || *p == '\n') continue;
+        hash = (hash >> 2) + ((uint32_t)*p << 24);
+    }
+    return hash;
+}
+
+// Record the file name of every blob and tree reachable from a tree
+static void name_tree_entries(pack_entry_list *list, const object_id *tree_oid) {
+    pack_write_entry *tree = find_write_entry(list, tree_oid);
+    if (!tree || tree->walked) return;
+    tree->walked = 1;
+
+    tree_iter iter;
+    if (tree_iter_open(&iter, tree_oid) != 0) return;
+
+    while (tree_iter_next(&iter)) {
+        object_id entry_oid;
+        tree_iter_oid(&iter, &entry_oid);
+        pack_write_entry *object = find_write_entry(list, &entry_oid);
+        if (!object) continue;
+        if (object->name_hash == 0) {
+            object->name_hash = pack_name_hash(iter.name);
+        }
+        if (iter.type == TREE_ENTRY_TREE) {
+            name_tree_entries(list, &entry_oid);
+        }
+    }
+    tree_iter_close(&iter);
+}
+
+static void name_commit_history(pack_entry_list *list, const object_id *commit_oid) {
+    object_id oid;
+    oid_copy(&oid, commit_oid);
+
+    while (!oid_is_null(&oid)) {
+        pack_write_entry *commit = find_write_entry(list, &oid);
+        if (!commit || commit->walked) return;
+        commit->walked = 1;
+
+        gitnano_commit_info info;
+        if (commit_parse(&oid, &info) != 0) return;
+        name_tree_entries(list, &info.tree_oid);
+        oid_copy(&oid, &info.parent_oid);
+    }
+}
+
+// Walk HEAD and every branch so objects can be grouped by file name
+static void name_reachable_objects(pack_entry_list *list) {
+    object_id oid;
+    char ref[MAX_PATH];
+    if (get_head_ref(ref) == 0 && oid_from_hex(ref, &oid) == 0) {
+        name_commit_history(list, &oid);
+    }
+
+    char heads_dir[MAX_PATH];
+    snprintf(heads_dir, sizeof(heads_dir), "%s/heads", REFS_DIR);
+    DIR *dir = opendir(heads_dir);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char *path = safe_asprintf("%s/%s", heads_dir, entry->d_name);
+        size_t size;
+        char *content = read_file(path, &size);
+        free(path);
+        if (!content) continue;
+
+        // The id is followed by a newline, which oid_from_hex accepts as the end
+        if (oid_from_hex(content, &oid) == 0) name_commit_history(list, &oid);
+        free(content);
+    }
+    closedir(dir);
+}
+
+// Delta candidates sit next to each other: same type, same name, larger first
+static pack_write_entry *sort_entries;
+
+static int compare_write_order(const void *a, const void *b) {
+    const pack_write_entry *x = &sort_entries[*(const size_t *)a];
+    const pack_write_entry *y = &sort_entries[*(const size_t *)b];
+    if (x->type != y->type) return x->type - y->type;
+    if (x->name_hash != y->name_hash) return x->name_hash < y->name_hash ? -1 : 1;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return oid_cmp(&x->oid, &y->oid);
+}
+
+// Recently written object kept around as a delta base
+typedef struct {
+    pack_write_entry *entry;
+    gitnano_object obj;
+    delta_index *index;
+} pack_window_slot;
+
+// Objects smaller than this are not worth a delta
+#define PACK_MIN_DELTA_SIZE 64
+
+static int pack_env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    if (!value || !*value) return fallback;
+    int parsed = atoi(value);
+    return parsed >= 0 ? parsed : fallback;
+}
+
+// Find the smallest delta for obj against the objects in the window
+static pack_window_slot *find_delta_base(pack_window_slot *window, int window_size, int max_depth,
+                                         pack_write_entry *entry, const gitnano_object *obj,
+                                         void **delta_out, size_t *delta_size_out) {
+    pack_window_slot *best = NULL;
+    if (entry->type == PACK_TYPE_COMMIT || obj->size < PACK_MIN_DELTA_SIZE) return NULL;
+
+    size_t max_size = obj->size / 2;
+    for (int i = 0; i < window_size; i++) {
+        pack_window_slot *slot = &window[i];
+        if (!slot->entry || slot->entry->type != entry->type || slot->entry->depth >= max_depth) continue;
+
+        // A large size difference alone would exceed the budget
+        size_t base_size = slot->obj.size;
+        size_t size_diff = base_size > obj->size ? base_size - obj->size : obj->size - base_size;
+        if (base_size < PACK_MIN_DELTA_SIZE || size_diff >= max_size) continue;
+
+        if (!slot->index) {
+            slot->index = delta_index_create(slot->obj.data, base_size);
+            if (!slot->index) continue;
+        }
+
+        void *delta;
+        size_t delta_size;
+        if (delta_create(slot->index, obj->data, obj->size, max_size, &delta, &delta_size) != 0) continue;
+
+        free(*delta_out);
+        *delta_out = delta;
+        *delta_size_out = delta_size;
+        max_size = delta_size;
+        best = slot;
+    }
+    return best;
+}
+
+static void window_slot_clear(pack_window_slot *slot) {
+    object_free(&slot->obj);
+    delta_index_free(slot->index);
+    memset(slot, 0, sizeof(pack_window_slot));
+}
+
+// Write bytes to the pack and fold them into the running checksum
+static int pack_write_bytes(FILE *fp, hash_ctx *ctx, const void *data, size_t size) {
+    if (size == 0) return 0;
+    if (fwrite(data, 1, size, fp) != size) {
+        fprintf(stderr, "ERROR: pack_write_bytes: short write\n");
+        return -1;
+    }
+    return hash_ctx_update(ctx, data, size);
+}
+
+// Write one entry, either whole or as a delta against an earlier entry
+static int write_pack_entry(FILE *fp, hash_ctx *ctx, pack_write_entry *entry, uint64_t offset,
+                            const gitnano_object *obj, const pack_write_entry *base,
+                            const void *delta, size_t delta_size, uint64_t *written_out) {
+    const void *payload = base ? delta : obj->data;
+    size_t payload_size = base ? delta_size : obj->size;
+    *written_out = 0;
+
+    void *compressed = NULL;
+    size_t compressed_size = 0;
+    if (compress_data(payload, payload_size, &compressed, &compressed_size) != 0) {
+        return -1;
+    }
+
+    unsigned char entry_header[32];
+    size_t header_len;
+    if (base) {
+        header_len = encode_entry_header(entry_header, PACK_TYPE_OFS_DELTA, delta_size);
+        header_len += encode_delta_offset(entry_header + header_len, offset - base->offset);
+    } else {
+        header_len = encode_entry_header(entry_header, entry->type, obj->size);
+    }
+
+    entry->offset = offset;
+    entry->crc = crc32(crc32(0L, Z_NULL, 0), entry_header, header_len);
+    entry->crc = crc32(entry->crc, compressed, compressed_size);
+
+    int err = pack_write_bytes(fp, ctx, entry_header, header_len);
+    if (err == 0) {
+        err = pack_write_bytes(fp, ctx, compressed, compressed_size);
+    }
+    free(compressed);
+
+    *written_out = header_len + compressed_size;
+    return err;
+}
+
+// Write the pack data, deltifying each object against a window of similar ones
+static int write_pack_file(FILE *fp, pack_entry_list *list, const size_t *order,
+                           unsigned char *checksum_out, size_t *delta_count_out) {
+    hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+    if (!ctx) return -1;
+
+    unsigned char header[12];
+    memcpy(header, PACK_SIGNATURE, 4);
+    put_be32(header + 4, PACK_VERSION);
+    put_be32(header + 8, (uint32_t)list->count);
+    if (pack_write_bytes(fp, ctx, header, sizeof(header)) != 0) {
+        hash_ctx_free(ctx);
+        return -1;
+    }
+
+    int window_size = pack_env_int("GITNANO_PACK_WINDOW", PACK_DEFAULT_WINDOW);
+    int max_depth = pack_env_int("GITNANO_PACK_DEPTH", PACK_DEFAULT_DEPTH);
+    pack_window_slot *window = calloc(window_size > 0 ? window_size : 1, sizeof(pack_window_slot));
+    if (!window) {
+        hash_ctx_free(ctx);
+        return -1;
+    }
+
+    int err = 0;
+    uint64_t offset = sizeof(header);
+    size_t delta_count = 0;
+    for (size_t i = 0; i < list->count && err == 0; i++) {
+        pack_write_entry *entry = &list->entries[order[i]];
+        gitnano_object obj;
+        if (object_read(&entry->oid, &obj) != 0) {
+            char hex[OID_MAX_HEX_SIZE];
+            fprintf(stderr, "ERROR: write_pack_file: cannot read object %s\n", oid_to_hex(&entry->oid, hex));
+            err = -1;
+            break;
+        }
+
+        void *delta = NULL;
+        size_t delta_size = 0;
+        pack_window_slot *base = window_size > 0 ?
+            find_delta_base(window, window_size, max_depth, entry, &obj, &delta, &delta_size) : NULL;
+
+        uint64_t written;
+        err = write_pack_entry(fp, ctx, entry, offset, &obj, base ? base->entry : NULL,
+                               delta, delta_size, &written);
+        free(delta);
+        offset += written;
+
+        if (base) {
+            entry->depth = base->entry->depth + 1;
+            delta_count++;
+        }
+
+        // The window keeps the most recent objects as future bases
+        if (window_size > 0) {
+            pack_window_slot *slot = &window[i % window_size];
+            window_slot_clear(slot);
+            slot->entry = entry;
+            slot->obj = obj;
+        } else {
+            object_free(&obj);
+        }
+    }
+
+    for (int i = 0; i < window_size; i++) {
+        window_slot_clear(&window[i]);
+    }
+    free(window);
+
+    if (err == 0) {
+        err = hash_ctx_final(ctx, checksum_out);
+    }
+    hash_ctx_free(ctx);
+    if (err != 0) return err;
+
+    if (fwrite(checksum_out, 1, SHA1_RAW_SIZE, fp) != SHA1_RAW_SIZE) {
+        fprintf(stderr, "ERROR: write_pack_file: short write\n");
+        return -1;
+    }
+
+    *delta_count_out = delta_count;
+    return 0;
+}
+
+// Build the index for a written pack (entries must be sorted by oid)
+static int build_pack_index(pack_entry_list *list, const unsigned char *pack_checksum,
+                            unsigned char **idx_out, size_t *idx_size_out) {
+    size_t large_count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->entries[i].offset >= 0x80000000u) large_count++;
+    }
+
+    size_t id_size = hash_algo_raw_size(repo_hash_algo());
+    size_t idx_size = 8 + 256 * 4 + list->count * (id_size + 4 + 4) +
+                      large_count * 8 + 2 * SHA1_RAW_SIZE;
+    unsigned char *idx = safe_malloc(idx_size);
+    unsigned char *fanout = idx + 8;
+    unsigned char *oids = fanout + 256 * 4;
+    unsigned char *crcs = oids + list->count * id_size;
+    unsigned char *offsets = crcs + list->count * 4;
+    unsigned char *large_offsets = offsets + list->count * 4;
+
+    memcpy(idx, PACK_IDX_SIGNATURE, 4);
+    put_be32(idx + 4, PACK_IDX_VERSION);
+
+    size_t next = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        while (next < list->count && list->entries[next].oid.hash[0] == byte) next++;
+        put_be32(fanout + byte * 4, (uint32_t)next);
+    }
+
+    size_t large_index = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        pack_write_entry *entry = &list->entries[i];
+        memcpy(oids + i * id_size, entry->oid.hash, id_size);
+        put_be32(crcs + i * 4, entry->crc);
+        if (entry->offset >= 0x80000000u) {
+            put_be32(offsets + i * 4, 0x80000000u | (uint32_t)large_index);
+            put_be64(large_offsets + large_index * 8, entry->offset);
+            large_index++;
+        } else {
+            put_be32(offsets + i * 4, (uint32_t)entry->offset);
+        }
+    }
+
+    unsigned char *trailer = large_offsets + large_count * 8;
+    memcpy(trailer, pack_checksum, SHA1_RAW_SIZE);
+
+    hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+    if (!ctx || hash_ctx_update(ctx, idx, idx_size - SHA1_RAW_SIZE) != 0 ||
+        hash_ctx_final(ctx, trailer + SHA1_RAW_SIZE) != 0) {
+        hash_ctx_free(ctx);
+        free(idx);
+        return -1;
+    }
+    hash_ctx_free(ctx);
+
+    *idx_out = idx;
+    *idx_size_out = idx_size;
+    return 0;
+}
+
+static void remove_loose_object(const object_id *oid) {
+    char path[MAX_PATH];
+    get_object_path(oid, path);
+    unlink(path);
+
+    // Drop the fanout directory once it is empty
+    char dir_path[MAX_PATH];
+    snprintf(dir_path, sizeof(dir_path), "%s/%02x", OBJECTS_DIR, oid->hash[0]);
+    rmdir(dir_path);
+}
+
+// Write the loose objects, and with all set the packed ones too, into a
+// new pack. Packing reads each object whole, so loose objects from
+// BLOB_STREAM_THRESHOLD on stay loose. Loose chunk manifests stay loose too:
+// Git has no manifest type, so a pack holding one fails git verify-pack.
+static int pack_objects(int all) {
+    pack_entry_list list = {0};
+
+    if (object_for_each_loose(collect_object, &list) != 0) {
+        free(list.entries);
+        return -1;
+    }
+
+    prepare_packs();
+    for (packed_git *pack = all ? packs : NULL; pack; pack = pack->next) {
+        for (uint32_t i = 0; i < pack->object_count; i++) {
+            object_id oid;
+            pack_oid_at(pack, i, &oid);
+            collect_object(&oid, &list);
+        }
+    }
+
+    if (list.count == 0) {
+        printf("Nothing to pack\n");
+        free(list.entries);
+        return 0;
+    }
+
+    // Objects may be both loose and packed, keep one copy
+    qsort(list.entries, list.count, sizeof(pack_write_entry), compare_entry_oids);
+    size_t unique = 1;
+    for (size_t i = 1; i < list.count; i++) {
+        if (!oid_equal(&list.entries[i].oid, &list.entries[unique - 1].oid)) {
+            list.entries[unique++] = list.entries[i];
+        }
+    }
+    list.count = unique;
+
+    // Type and size drive the delta search order
+    unique = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        pack_write_entry *entry = &list.entries[i];
+        char hex[OID_MAX_HEX_SIZE], type[16];
+        if (object_read_info(&entry->oid, type, &entry->size) != 0 ||
+            (entry->type = pack_type_from_name(type)) < 0) {
+            fprintf(stderr, "ERROR: pack_repack: cannot read object %s\n", oid_to_hex(&entry->oid, hex));
+            free(list.entries);
+            return -1;
+        }
+        if ((entry->type != PACK_TYPE_MANIFEST && entry->size < BLOB_STREAM_THRESHOLD) ||
+            !loose_set_contains(&entry->oid)) {
+            list.entries[unique++] = *entry;
+        }
+    }
+    list.count = unique;
+    if (list.count == 0) {
+        free(list.entries);
+        return 0;
+    }
+    name_reachable_objects(&list);
+
+    size_t *order = safe_malloc(list.count * sizeof(size_t));
+    for (size_t i = 0; i < list.count; i++) {
+        order[i] = i;
+    }
+    sort_entries = list.entries;
+    qsort(order, list.count, sizeof(size_t), compare_write_order);
+
+    if (mkdir_p(PACK_DIR) != 0) {
+        free(order);
+        free(list.entries);
+        return -1;
+    }
+
+    char tmp_pack[MAX_PATH];
+    snprintf(tmp_pack, sizeof(tmp_pack), "%s/tmp_pack_XXXXXX", PACK_DIR);
+    int fd = mkstemp(tmp_pack);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!fp) {
+        fprintf(stderr, "ERROR: pack_repack: cannot create temporary pack\n");
+        if (fd >= 0) close(fd);
+        free(order);
+        free(list.entries);
+        return -1;
+    }
+
+    unsigned char checksum[SHA1_RAW_SIZE];
+    size_t delta_count = 0;
+    int err = write_pack_file(fp, &list, order, checksum, &delta_count);
+    free(order);
+    // The loose copies are deleted below, so the pack must be on disk first
+    if (err == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0)) err = -1;
+    if (fclose(fp) != 0) err = -1;
+    if (err != 0) {
+        unlink(tmp_pack);
+        free(list.entries);
+        return err;
+    }
+
+    unsigned char *idx = NULL;
+    size_t idx_size = 0;
+    if ((err = build_pack_index(&list, checksum, &idx, &idx_size)) != 0) {
+        unlink(tmp_pack);
+        free(list.entries);
+        return err;
+    }
+
+    char checksum_hex[SHA1_HEX_SIZE];
+    binary_to_hex(checksum, checksum_hex);
+
+    char pack_name[64], pack_path[MAX_PATH], idx_path[MAX_PATH];
+    snprintf(pack_name, sizeof(pack_name), "pack-%s", checksum_hex);
+    snprintf(pack_path, sizeof(pack_path), "%s/%s.pack", PACK_DIR, pack_name);
+    snprintf(idx_path, sizeof(idx_path), "%s/%s.idx", PACK_DIR, pack_name);
+
+    // The index is published last: a pack only becomes visible once both files exist.
+    // Syncing the index also flushes the pack directory entry.
+    if (rename(tmp_pack, pack_path) != 0 ||
+        write_file_atomic(idx_path, idx, idx_size, 1) != 0) {
+        fprintf(stderr, "ERROR: pack_repack: failed to install %s\n", pack_name);
+        unlink(tmp_pack);
+        unlink(pack_path);
+        free(idx);
+        free(list.entries);
+        return -1;
+    }
+    free(idx);
+
+    // Everything now lives in the new pack: drop the old packs and loose copies
+    char *old_packs = NULL;
+    size_t old_packs_len = 0;
+    for (packed_git *pack = all ? packs : NULL; pack; pack = pack->next) {
+        if (strcmp(pack->pack_path, pack_path) == 0) continue;
+        size_t len = strlen(pack->pack_path);
+        old_packs = safe_realloc(old_packs, old_packs_len + len + 1);
+        memcpy(old_packs + old_packs_len, pack->pack_path, len + 1);
+        old_packs_len += len + 1;
+    }
+    pack_release_all();
+
+    for (size_t pos = 0; pos < old_packs_len; pos += strlen(old_packs + pos) + 1) {
+        char *old_pack = old_packs + pos;
+        char old_idx[MAX_PATH];
+        snprintf(old_idx, sizeof(old_idx), "%.*s.idx", (int)(strlen(old_pack) - strlen(".pack")), old_pack);
+        unlink(old_idx);
+        unlink(old_pack);
+    }
+    free(old_packs);
+
+    for (size_t i = 0; i < list.count; i++) {
+        remove_loose_object(&list.entries[i].oid);
+    }
+    object_store_reset();
+    loose_set_rebuild();
+
+    printf("Packed %zu objects (%zu deltas) into %s\n", list.count, delta_count, pack_name);
+    free(list.entries);
+    return 0;
+}
+
+// Pack every loose and packed object into a single new pack
+int pack_repack(void) {
+    return pack_objects(1);
+}
+
+// Pack the loose objects once their count passes GITNANO_AUTO_PACK (0
+// disables). Existing packs are left alone, so the work is bounded by the
+// loose objects rather than the repository.
+int pack_auto_repack(void) {
+    int threshold = pack_env_int("GITNANO_AUTO_PACK", PACK_DEFAULT_AUTO_THRESHOLD);
+    if (threshold == 0) return 0;
+
+    // Object names are uniformly spread, so one fanout directory is a fair sample
+    char sample_dir[MAX_PATH];
+    snprintf(sample_dir, sizeof(sample_dir), "%s/17", OBJECTS_DIR);
+    DIR *dir = opendir(sample_dir);
+    if (!dir) return 0;
+
+    size_t name_len = 2 * hash_algo_raw_size(repo_hash_algo()) - 2;
+    int sampled = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) == name_len) sampled++;
+    }
+    closedir(dir);
+
+    if ((long)sampled * 256 <= threshold) return 0;
+    return pack_objects(0);
+}
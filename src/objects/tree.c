@@ -1,59 +1,184 @@
 #define _GNU_SOURCE
 #include "gitnano.h"
 #include <dirent.h>
+#include <pthread.h>
+
+static int tree_serialize(const gitnano_tree *tree, char **data_out, size_t *size_out);
+
+// Allocate a tree with room for capacity entries and names_size bytes of
+// names (terminators included). Everything lives in one block, so freeing
+// a tree is a single free() however many entries it has.
+gitnano_tree *tree_new(size_t capacity, size_t names_size) {
+    gitnano_tree *tree = safe_malloc(sizeof(gitnano_tree) + capacity * sizeof(tree_entry) + names_size);
+    tree->entries = (tree_entry *)(tree + 1);
+    tree->count = 0;
+    tree->capacity = capacity;
+    tree->names = (char *)(tree->entries + capacity);
+    tree->names_used = 0;
+    tree->names_size = names_size;
+    return tree;
+}
+
+// Free a tree
+void tree_free(gitnano_tree *tree) {
+    free(tree);
+}
 
-static int tree_serialize(tree_entry *entries, char **data_out, size_t *size_out);
+// Append an entry; fails if the tree was sized too small
+int tree_add(gitnano_tree *tree, uint32_t mode, const object_id *oid, const char *name, size_t name_len) {
+    if (tree->count == tree->capacity || tree->names_size - tree->names_used < name_len + 1) {
+        fprintf(stderr, "ERROR: tree_add: tree is full\n");
+        return -1;
+    }
 
-// Create a new tree entry
-tree_entry *tree_entry_new(const char *mode, const char *type,
-                           const char *sha1, const char *name) {
-    tree_entry *entry = malloc(sizeof(tree_entry));
-    if (!entry) return NULL;
+    tree_entry *entry = &tree->entries[tree->count++];
+    oid_copy(&entry->oid, oid);
+    entry->mode = mode;
+    entry->type = TREE_MODE_IS_DIR(mode) ? TREE_ENTRY_TREE : TREE_ENTRY_BLOB;
+    entry->name_offset = (uint32_t)tree->names_used;
+    entry->name_len = (uint32_t)name_len;
 
-    strncpy(entry->mode, mode, sizeof(entry->mode) - 1);
-    entry->mode[sizeof(entry->mode) - 1] = '\0';
+    memcpy(tree->names + tree->names_used, name, name_len);
+    tree->names[tree->names_used + name_len] = '\0';
+    tree->names_used += name_len + 1;
+    return 0;
+}
 
-    strncpy(entry->type, type, sizeof(entry->type) - 1);
-    entry->type[sizeof(entry->type) - 1] = '\0';
+// Git tree order: names compare bytewise, with a subtree's name compared
+// as if it ended in '/'
+static int tree_name_compare(const char *name1, size_t len1, uint32_t mode1,
+                             const char *name2, size_t len2, uint32_t mode2) {
+    size_t len = len1 < len2 ? len1 : len2;
+    int cmp = memcmp(name1, name2, len);
+    if (cmp != 0) return cmp;
+
+    unsigned char c1 = len1 > len ? (unsigned char)name1[len] : (TREE_MODE_IS_DIR(mode1) ? '/' : '\0');
+    unsigned char c2 = len2 > len ? (unsigned char)name2[len] : (TREE_MODE_IS_DIR(mode2) ? '/' : '\0');
+    return (c1 > c2) - (c1 < c2);
+}
 
-    strncpy(entry->sha1, sha1, sizeof(entry->sha1) - 1);
-    entry->sha1[sizeof(entry->sha1) - 1] = '\0';
+static int tree_entry_compare(const gitnano_tree *tree, const tree_entry *a, const tree_entry *b) {
+    return tree_name_compare(tree_entry_name(tree, a), a->name_len, a->mode,
+                             tree_entry_name(tree, b), b->name_len, b->mode);
+}
 
-    strncpy(entry->name, name, sizeof(entry->name) - 1);
-    entry->name[sizeof(entry->name) - 1] = '\0';
+// qsort has no context argument, so the arena being sorted is kept per thread
+static __thread const gitnano_tree *sort_tree;
 
-    entry->next = NULL;
+static int compare_entries(const void *a, const void *b) {
+    return tree_entry_compare(sort_tree, a, b);
+}
 
-    return entry;
+// Sort entries in git tree order
+void tree_sort(gitnano_tree *tree) {
+    sort_tree = tree;
+    qsort(tree->entries, tree->count, sizeof(tree_entry), compare_entries);
 }
 
-// Free tree entries list
-void tree_free(tree_entry *entries) {
-    while (entries) {
-        tree_entry *next = entries->next;
-        free(entries);
-        entries = next;
-    }
+// Tree building runs in three phases: a single-threaded scan of the
+// directory, parallel blob writes for every file, and then one tree write
+// per directory, deepest level first, with the directories of a level
+// written in parallel. Entries are sorted per directory in git tree order,
+// so the resulting tree ids do not depend on the thread count.
+
+typedef struct build_item {
+    size_t name_offset;  // into the node's names arena
+    size_t name_len;
+    uint32_t mode;
+    size_t child;  // index of the subdirectory node, or BUILD_NO_CHILD for files
+    object_id oid;
+} build_item;
+
+#define BUILD_NO_CHILD ((size_t)-1)
+
+typedef struct build_node {
+    char *path;
+    int depth;
+    build_item *items;
+    size_t item_count;
+    size_t item_alloc;
+    char *names;  // NUL-terminated item names
+    size_t names_used;
+    size_t names_alloc;
+    object_id oid;
+} build_node;
+
+typedef struct build_state {
+    build_node *nodes;
+    size_t node_count;
+    size_t node_alloc;
+    int max_depth;
+
+    // Work lists for the parallel phases
+    size_t *file_nodes;   // node index of each file
+    size_t *file_items;   // item index of each file
+    size_t file_count;
+    size_t file_alloc;
+    size_t batch_size;    // files per phase 2 task
+    size_t *level_nodes;  // nodes of the level being written
+} build_state;
+
+static size_t build_add_node(build_state *state, const char *path, int depth) {
+    if (state->node_count == state->node_alloc) {
+        state->node_alloc = state->node_alloc ? state->node_alloc * 2 : 16;
+        state->nodes = safe_realloc(state->nodes, state->node_alloc * sizeof(build_node));
+    }
+    build_node *node = &state->nodes[state->node_count];
+    memset(node, 0, sizeof(build_node));
+    node->path = safe_strdup(path);
+    node->depth = depth;
+    if (depth > state->max_depth) state->max_depth = depth;
+    return state->node_count++;
 }
 
-// Add entry to tree list (in sorted order)
-void tree_entry_add(tree_entry **entries, tree_entry *new_entry) {
-    if (!*entries) {
-        *entries = new_entry;
-        return;
+static build_item *build_add_item(build_node *node, const char *name, uint32_t mode, size_t child) {
+    if (node->item_count == node->item_alloc) {
+        node->item_alloc = node->item_alloc ? node->item_alloc * 2 : 8;
+        node->items = safe_realloc(node->items, node->item_alloc * sizeof(build_item));
     }
+    size_t name_len = strlen(name);
+    if (node->names_alloc - node->names_used < name_len + 1) {
+        while (node->names_alloc - node->names_used < name_len + 1) {
+            node->names_alloc = node->names_alloc ? node->names_alloc * 2 : 256;
+        }
+        node->names = safe_realloc(node->names, node->names_alloc);
+    }
+    build_item *item = &node->items[node->item_count++];
+    item->name_offset = node->names_used;
+    item->name_len = name_len;
+    memcpy(node->names + node->names_used, name, name_len + 1);
+    node->names_used += name_len + 1;
+    item->mode = mode;
+    item->child = child;
+    oid_clear(&item->oid);
+    return item;
+}
 
-    tree_entry **current = entries;
-    while (*current && strcmp((*current)->name, new_entry->name) < 0) {
-        current = &(*current)->next;
+static void build_add_file(build_state *state, size_t node, size_t item) {
+    if (state->file_count == state->file_alloc) {
+        state->file_alloc = state->file_alloc ? state->file_alloc * 2 : 64;
+        state->file_nodes = safe_realloc(state->file_nodes, state->file_alloc * sizeof(size_t));
+        state->file_items = safe_realloc(state->file_items, state->file_alloc * sizeof(size_t));
     }
+    state->file_nodes[state->file_count] = node;
+    state->file_items[state->file_count] = item;
+    state->file_count++;
+}
 
-    new_entry->next = *current;
-    *current = new_entry;
+static void build_state_free(build_state *state) {
+    for (size_t i = 0; i < state->node_count; i++) {
+        free(state->nodes[i].path);
+        free(state->nodes[i].items);
+        free(state->nodes[i].names);
+    }
+    free(state->nodes);
+    free(state->file_nodes);
+    free(state->file_items);
+    free(state->level_nodes);
 }
 
-// Build tree from directory
-int tree_build(const char *path, char *sha1_out) {
+// Phase 1: record the directory layout below path
+static int tree_scan_dir(build_state *state, const char *path, int depth) {
     int err;
     DIR *dir = opendir(path);
     if (!dir) {
@@ -61,7 +186,7 @@ int tree_build(const char *path, char *sha1_out) {
         return -1;
     }
 
-    tree_entry *entries = NULL;
+    size_t node = build_add_node(state, path, depth);
     struct dirent *entry;
 
     while ((entry = readdir(dir)) != NULL) {
@@ -78,192 +203,256 @@ int tree_build(const char *path, char *sha1_out) {
         struct stat st;
         if (stat(full_path, &st) != 0) {
             printf("ERROR: stat: %d\n", -1);
-            tree_free(entries);
             closedir(dir);
             return -1;
         }
 
         if (S_ISDIR(st.st_mode)) {
-            // Build subtree
-            char subtree_sha1[SHA1_HEX_SIZE];
-            if ((err = tree_build(full_path, subtree_sha1)) != 0) {
+            size_t child = state->node_count;
+            if ((err = tree_scan_dir(state, full_path, depth + 1)) != 0) {
                 printf("ERROR: tree_build: %d\n", err);
-                tree_free(entries);
                 closedir(dir);
                 return err;
             }
-
-            tree_entry *dir_entry = tree_entry_new("040000", "tree",
-                                                   subtree_sha1, entry->d_name);
-            if (!dir_entry) {
-                printf("ERROR: tree_entry_new: %d\n", -1);
-                tree_free(entries);
-                closedir(dir);
-                return -1;
-            }
-
-            tree_entry_add(&entries, dir_entry);
+            build_add_item(&state->nodes[node], entry->d_name, TREE_MODE_DIR, child);
         } else {
-            // Create blob for file
-            char blob_sha1[SHA1_HEX_SIZE];
-            if ((err = blob_create_from_file(full_path, blob_sha1)) != 0) {
-                printf("ERROR: blob_create_from_file: %d\n", err);
-                tree_free(entries);
-                closedir(dir);
-                return err;
-            }
-
             // Determine file mode
-            char mode[8];
-            if (st.st_mode & S_IXUSR) {
-                strcpy(mode, "100755"); // executable
-            } else {
-                strcpy(mode, "100644"); // regular file
-            }
+            uint32_t mode = (st.st_mode & S_IXUSR) ? TREE_MODE_EXEC : TREE_MODE_FILE;
+            build_add_item(&state->nodes[node], entry->d_name, mode, BUILD_NO_CHILD);
+            build_add_file(state, node, state->nodes[node].item_count - 1);
+        }
+    }
 
-            tree_entry *file_entry = tree_entry_new(mode, "blob",
-                                                    blob_sha1, entry->d_name);
-            if (!file_entry) {
-                printf("ERROR: tree_entry_new: %d\n", -1);
-                tree_free(entries);
-                closedir(dir);
-                return -1;
-            }
+    closedir(dir);
+    return 0;
+}
+
+// Phase 2: create the blobs of one batch of files. Batching lets small files
+// share a hash_many call instead of being hashed one at a time.
+static int tree_build_blobs(size_t index, void *ctx) {
+    build_state *state = ctx;
+    size_t start = index * state->batch_size;
+    size_t count = state->file_count - start < state->batch_size ? state->file_count - start : state->batch_size;
+
+    char **paths = safe_malloc(count * sizeof(char *));
+    object_id *oids = safe_malloc(count * sizeof(object_id));
+    for (size_t i = 0; i < count; i++) {
+        build_node *node = &state->nodes[state->file_nodes[start + i]];
+        build_item *item = &node->items[state->file_items[start + i]];
+        paths[i] = safe_asprintf("%s/%s", node->path, node->names + item->name_offset);
+    }
 
-            tree_entry_add(&entries, file_entry);
+    int err;
+    if ((err = blob_create_from_files((const char *const *)paths, count, oids)) != 0) {
+        printf("ERROR: blob_create_from_files: %d\n", err);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (err == 0) {
+            build_node *node = &state->nodes[state->file_nodes[start + i]];
+            oid_copy(&node->items[state->file_items[start + i]].oid, &oids[i]);
         }
+        free(paths[i]);
     }
+    free(paths);
+    free(oids);
+    return err;
+}
 
-    closedir(dir);
+// Phase 3: write the tree of one directory whose children are all written
+static int tree_build_node(size_t index, void *ctx) {
+    build_state *state = ctx;
+    build_node *node = &state->nodes[state->level_nodes[index]];
 
-    // Build tree data using the new serialize function
-    char *tree_data;
-    size_t tree_size;
-    if ((err = tree_serialize(entries, &tree_data, &tree_size)) != 0) {
-        printf("ERROR: tree_serialize: %d\n", err);
-        tree_free(entries);
-        return err;
+    int err;
+    gitnano_tree *tree = tree_new(node->item_count, node->names_used);
+    for (size_t i = 0; i < node->item_count; i++) {
+        build_item *item = &node->items[i];
+        const object_id *oid = item->child == BUILD_NO_CHILD ? &item->oid : &state->nodes[item->child].oid;
+        tree_add(tree, item->mode, oid, node->names + item->name_offset, item->name_len);
     }
+    tree_sort(tree);
 
-    // Write tree object
-    if ((err = object_write("tree", tree_data, tree_size, sha1_out)) != 0) {
-        printf("ERROR: object_write: %d\n", err);
-        free(tree_data);
-        tree_free(entries);
+    if ((err = tree_write(tree, &node->oid)) != 0) {
+        printf("ERROR: tree_write: %d\n", err);
+    }
+    tree_free(tree);
+    return err;
+}
+
+static int tree_build_all(build_state *state, const char *path, object_id *oid_out) {
+    int err;
+    if ((err = tree_scan_dir(state, path, 0)) != 0) {
         return err;
     }
 
-    free(tree_data);
-    tree_free(entries);
+    int threads = thread_pool_default_size();
+    if ((size_t)threads > state->file_count) threads = state->file_count > 0 ? (int)state->file_count : 1;
+    thread_pool *pool = thread_pool_new(threads);
+
+    // Enough batches to keep every worker busy, at most 32 files each
+    state->batch_size = state->file_count / ((size_t)threads * 4);
+    if (state->batch_size < 1) state->batch_size = 1;
+    if (state->batch_size > 32) state->batch_size = 32;
+    size_t batch_count = (state->file_count + state->batch_size - 1) / state->batch_size;
+    err = thread_pool_run(pool, batch_count, tree_build_blobs, state);
 
+    state->level_nodes = safe_malloc((state->node_count + 1) * sizeof(size_t));
+    for (int depth = state->max_depth; err == 0 && depth >= 0; depth--) {
+        size_t level_count = 0;
+        for (size_t i = 0; i < state->node_count; i++) {
+            if (state->nodes[i].depth == depth) state->level_nodes[level_count++] = i;
+        }
+        err = thread_pool_run(pool, level_count, tree_build_node, state);
+    }
+
+    thread_pool_free(pool);
+    if (err != 0) return err;
+
+    oid_copy(oid_out, &state->nodes[0].oid);
     return 0;
 }
 
-// Parse tree object
-int tree_parse(const char *sha1, tree_entry **entries) {
+// Build tree from directory (bulk write: uses the fast integrity mode by default).
+// Blobs and trees are written by GITNANO_THREADS workers.
+int tree_build(const char *path, object_id *oid_out) {
+    build_state state;
+    memset(&state, 0, sizeof(state));
+
+    object_bulk_begin();
+    int err = tree_build_all(&state, path, oid_out);
+    object_bulk_end();
+
+    build_state_free(&state);
+    return err;
+}
+
+// Open a cursor over a tree object. Entries are views into the inflated
+// object, in on-disk order, valid until tree_iter_close.
+int tree_iter_open(tree_iter *iter, const object_id *oid) {
     int err;
-    gitnano_object obj;
+    memset(iter, 0, sizeof(*iter));
 
-    if ((err = object_read(sha1, &obj)) != 0) {
+    if ((err = object_read(oid, &iter->obj)) != 0) {
         printf("ERROR: object_read: %d\n", err);
         return err;
     }
 
-    if (strcmp(obj.type, "tree") != 0) {
-        object_free(&obj);
+    if (strcmp(iter->obj.type, "tree") != 0) {
+        object_free(&iter->obj);
         printf("ERROR: object type is not tree\n");
         return -1;
     }
 
-    char *ptr = obj.data;
-    char *end = ptr + obj.size;
-    *entries = NULL;
-
-    while (ptr < end) {
-        // Parse mode
-        char *space = memchr(ptr, ' ', end - ptr);
-        if (!space) break;
-
-        *space = '\0';
-        char mode[8];
-        strncpy(mode, ptr, sizeof(mode) - 1);
-        mode[sizeof(mode) - 1] = '\0';
+    iter->algo = repo_hash_algo();
+    iter->id_size = hash_algo_raw_size(iter->algo);
+    iter->ptr = iter->obj.data;
+    iter->end = iter->ptr + iter->obj.size;
+    return 0;
+}
 
-        ptr = space + 1;
+// Step to the next entry: returns 1 with the entry fields set, or 0 at the
+// end of the tree or at a malformed entry
+int tree_iter_next(tree_iter *iter) {
+    const char *ptr = iter->ptr, *end = iter->end;
+    const char *space = memchr(ptr, ' ', end - ptr);
+    if (!space || space == ptr || space - ptr > 7) return 0;
+
+    uint32_t mode = 0;
+    for (const char *p = ptr; p < space; p++) {
+        if (*p < '0' || *p > '7') return 0;
+        mode = mode * 8 + (uint32_t)(*p - '0');
+    }
+
+    const char *name = space + 1;
+    const char *null_pos = memchr(name, '\0', end - name);
+    if (!null_pos || (size_t)(end - null_pos - 1) < iter->id_size) return 0;
+
+    iter->mode = mode;
+    iter->type = TREE_MODE_IS_DIR(mode) ? TREE_ENTRY_TREE : TREE_ENTRY_BLOB;
+    iter->name = name;
+    iter->name_len = (size_t)(null_pos - name);
+    iter->id = (const unsigned char *)null_pos + 1;
+    iter->ptr = null_pos + 1 + iter->id_size;
+    return 1;
+}
 
-        // Parse name
-        char *null_pos = memchr(ptr, '\0', end - ptr);
-        if (!null_pos) break;
+// Id of the current entry
+void tree_iter_oid(const tree_iter *iter, object_id *oid_out) {
+    oid_from_raw(oid_out, iter->id, iter->algo);
+}
 
-        char *name = ptr;
-        ptr = null_pos + 1;
+// Go back to the first entry
+void tree_iter_rewind(tree_iter *iter) {
+    iter->ptr = iter->obj.data;
+}
 
-        if (ptr + 20 > end) break;
+void tree_iter_close(tree_iter *iter) {
+    object_free(&iter->obj);
+}
 
-        // Parse SHA1 (convert binary to hex)
-        char sha1_hex[SHA1_HEX_SIZE];
-        unsigned char *binary_sha1 = (unsigned char*)ptr;
-        for (int i = 0; i < 20; i++) {
-            sprintf(sha1_hex + (i * 2), "%02x", binary_sha1[i]);
-        }
-        sha1_hex[40] = '\0';
+// Parse tree object into one compact allocation
+int tree_parse(const object_id *oid, gitnano_tree **tree_out) {
+    int err;
+    tree_iter iter;
+    if ((err = tree_iter_open(&iter, oid)) != 0) {
+        return err;
+    }
 
-        ptr += 20;
+    // First pass sizes the allocation, second pass fills it
+    size_t count = 0, names_size = 0;
+    while (tree_iter_next(&iter)) {
+        count++;
+        names_size += iter.name_len + 1;
+    }
 
-        // Determine entry type from mode
-        const char *type = (strcmp(mode, "040000") == 0) ? "tree" : "blob";
+    gitnano_tree *tree = tree_new(count, names_size);
+    tree_iter_rewind(&iter);
+    while (tree_iter_next(&iter)) {
+        object_id entry_oid;
+        tree_iter_oid(&iter, &entry_oid);
+        tree_add(tree, iter.mode, &entry_oid, iter.name, iter.name_len);
+    }
 
-        // Create tree entry
-        tree_entry *entry = tree_entry_new(mode, type, sha1_hex, name);
-        if (!entry) {
-            printf("ERROR: tree_entry_new: %d\n", -1);
+    // Trees are written in order, so this is a single check; only trees
+    // from before git ordering need the sort
+    for (size_t i = 1; i < tree->count; i++) {
+        if (tree_entry_compare(tree, &tree->entries[i - 1], &tree->entries[i]) > 0) {
+            tree_sort(tree);
             break;
         }
-        tree_entry_add(entries, entry);
     }
 
-    object_free(&obj);
+    tree_iter_close(&iter);
+    *tree_out = tree;
     return 0;
 }
 
-// Helper function to convert hex SHA1 to binary
-static void hex_to_binary(const char *hex, unsigned char *binary) {
-    for (int i = 0; i < 20; i++) {
-        sscanf(hex + i * 2, "%2hhx", &binary[i]);
-    }
-}
-
-static int tree_serialize(tree_entry *entries, char **data_out, size_t *size_out) {
-    // Calculate total size needed
+static int tree_serialize(const gitnano_tree *tree, char **data_out, size_t *size_out) {
+    // Calculate total size needed: six octal mode digits, a space, the name and its NUL, the id
     size_t tree_size = 0;
-    for (tree_entry *current = entries; current; current = current->next) {
-        tree_size += strlen(current->mode) + 1 + strlen(current->name) + 1 + 20;
-    }
-
-    char *tree_data = safe_malloc(tree_size);
-    if (!tree_data) {
-        return -1;
+    for (size_t i = 0; i < tree->count; i++) {
+        tree_size += 6 + 1 + tree->entries[i].name_len + 1 + oid_raw_size(&tree->entries[i].oid);
     }
 
+    char *tree_data = safe_malloc(tree_size ? tree_size : 1);
     char *ptr = tree_data;
-    for (tree_entry *current = entries; current; current = current->next) {
-        // Copy mode
-        int mode_len = strlen(current->mode);
-        memcpy(ptr, current->mode, mode_len);
-        ptr += mode_len;
+    for (size_t i = 0; i < tree->count; i++) {
+        const tree_entry *entry = &tree->entries[i];
+
+        // Mode as six octal digits
+        for (int digit = 5; digit >= 0; digit--) {
+            ptr[digit] = (char)('0' + ((entry->mode >> (3 * (5 - digit))) & 7));
+        }
+        ptr += 6;
         *ptr++ = ' ';
 
-        // Copy name
-        int name_len = strlen(current->name);
-        memcpy(ptr, current->name, name_len);
-        ptr += name_len;
-        *ptr++ = '\0';
+        // Name with its terminator
+        memcpy(ptr, tree_entry_name(tree, entry), entry->name_len + 1);
+        ptr += entry->name_len + 1;
 
-        // Convert and copy SHA1
-        unsigned char binary_sha1[20];
-        hex_to_binary(current->sha1, binary_sha1);
-        memcpy(ptr, binary_sha1, 20);
-        ptr += 20;
+        // Copy raw id
+        memcpy(ptr, entry->oid.hash, oid_raw_size(&entry->oid));
+        ptr += oid_raw_size(&entry->oid);
     }
 
     *data_out = tree_data;
@@ -272,16 +461,16 @@ static int tree_serialize(tree_entry *entries, char **data_out, size_t *size_out
 }
 
 // Write tree from entries
-int tree_write(tree_entry *entries, char *sha1_out) {
+int tree_write(const gitnano_tree *tree, object_id *oid_out) {
     int err;
     char *tree_data;
     size_t tree_size;
-    if ((err = tree_serialize(entries, &tree_data, &tree_size)) != 0) {
+    if ((err = tree_serialize(tree, &tree_data, &tree_size)) != 0) {
         printf("ERROR: tree_serialize: %d\n", err);
         return err;
     }
 
-    if ((err = object_write("tree", tree_data, tree_size, sha1_out)) != 0) {
+    if ((err = object_write("tree", tree_data, tree_size, oid_out)) != 0) {
         printf("ERROR: object_write: %d\n", err);
         free(tree_data);
         return err;
@@ -290,110 +479,262 @@ int tree_write(tree_entry *entries, char *sha1_out) {
     return 0;
 }
 
-// Find entry in tree
-tree_entry *tree_find(tree_entry *entries, const char *name) {
-    while (entries) {
-        if (strcmp(entries->name, name) == 0) {
-            return entries;
+// Binary search for name as an entry of the given mode
+static const tree_entry *tree_search(const gitnano_tree *tree, const char *name, size_t name_len, uint32_t mode) {
+    size_t lo = 0, hi = tree->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const tree_entry *entry = &tree->entries[mid];
+        int cmp = tree_name_compare(name, name_len, mode, tree_entry_name(tree, entry), entry->name_len, entry->mode);
+        if (cmp == 0) return entry;
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
-        entries = entries->next;
     }
     return NULL;
 }
 
+// Find entry in tree. A name sorts differently as a file and as a
+// subtree, so both positions are searched.
+const tree_entry *tree_find(const gitnano_tree *tree, const char *name) {
+    size_t name_len = strlen(name);
+    const tree_entry *entry = tree_search(tree, name, name_len, TREE_MODE_FILE);
+    if (!entry) entry = tree_search(tree, name, name_len, TREE_MODE_DIR);
+    return entry;
+}
 
-// Find file entry by path in tree
-static tree_entry *find_entry_by_path(tree_entry *entries, const char *path) {
-    if (!path || strlen(path) == 0) {
-        return NULL;
+
+// Flat index of the paths below one root tree, sorted by full path. It is
+// filled one directory at a time along the paths looked up, so a lookup
+// reads only the trees on its way down, and later lookups in the same
+// directories read none; the most recently used roots stay cached.
+
+#define PATH_INDEX_SLOTS 4
+
+typedef struct {
+    object_id root;
+    unsigned long last_used;  // 0 for an empty slot
+    tree_entry *entries;      // name_offset and name_len address the full path
+    size_t count;
+    size_t alloc;
+    char *paths;
+    size_t paths_used;
+    size_t paths_alloc;
+} path_index;
+
+static path_index path_indexes[PATH_INDEX_SLOTS];
+static unsigned long path_index_clock = 0;
+static unsigned int path_index_generation = 0;
+static pthread_mutex_t path_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void path_index_free(path_index *index) {
+    free(index->entries);
+    free(index->paths);
+    memset(index, 0, sizeof(*index));
+}
+
+static void path_index_append(path_index *index, const char *path, size_t path_len,
+                              uint32_t mode, const object_id *oid) {
+    if (index->count == index->alloc) {
+        index->alloc = index->alloc ? index->alloc * 2 : 64;
+        index->entries = safe_realloc(index->entries, index->alloc * sizeof(tree_entry));
     }
+    if (index->paths_alloc - index->paths_used < path_len + 1) {
+        while (index->paths_alloc - index->paths_used < path_len + 1) {
+            index->paths_alloc = index->paths_alloc ? index->paths_alloc * 2 : 4096;
+        }
+        index->paths = safe_realloc(index->paths, index->paths_alloc);
+    }
+
+    tree_entry *entry = &index->entries[index->count++];
+    oid_copy(&entry->oid, oid);
+    entry->mode = mode;
+    entry->type = TREE_MODE_IS_DIR(mode) ? TREE_ENTRY_TREE : TREE_ENTRY_BLOB;
+    entry->name_offset = (uint32_t)index->paths_used;
+    entry->name_len = (uint32_t)path_len;
+    memcpy(index->paths + index->paths_used, path, path_len);
+    index->paths[index->paths_used + path_len] = '\0';
+    index->paths_used += path_len + 1;
+}
 
-    char *path_copy = safe_strdup(path);
-    char *save_ptr;
-    char *token = strtok_r(path_copy, "/", &save_ptr);
-    tree_entry *current = entries;
+// qsort has no context argument, so the arena being sorted is kept per thread
+static __thread const char *sort_paths;
 
-    while (token && current) {
-        // Find matching entry for current path component
-        tree_entry *found = NULL;
-        while (current) {
-            if (strcmp(current->name, token) == 0) {
-                found = current;
-                break;
-            }
-            current = current->next;
+static int compare_paths(const void *a, const void *b) {
+    const tree_entry *ea = a, *eb = b;
+    return strcmp(sort_paths + ea->name_offset, sort_paths + eb->name_offset);
+}
+
+// First entry whose path is not below key
+static size_t path_index_lower_bound(const path_index *index, const char *key) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index->paths + index->entries[mid].name_offset, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
+    }
+    return lo;
+}
+
+static const tree_entry *path_index_find(const path_index *index, const char *key) {
+    size_t pos = path_index_lower_bound(index, key);
+    if (pos < index->count && strcmp(index->paths + index->entries[pos].name_offset, key) == 0) {
+        return &index->entries[pos];
+    }
+    return NULL;
+}
+
+// Record the entries of the directory prefix ("" for the root), whose tree
+// is tree_oid, unless they already are. Trees never hold an empty
+// directory, so a directory is recorded iff some path starts with
+// "prefix/". Those paths are one contiguous run in path order, so the new
+// entries are sorted on their own and moved in at the start of the run.
+static int path_index_expand(path_index *index, const object_id *tree_oid, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    size_t pos = 0;
+    if (prefix_len == 0) {
+        if (index->count > 0) return 0;
+    } else {
+        char *key = safe_asprintf("%s/", prefix);
+        pos = path_index_lower_bound(index, key);
+        int present = pos < index->count &&
+                      strncmp(index->paths + index->entries[pos].name_offset, key, prefix_len + 1) == 0;
+        free(key);
+        if (present) return 0;
+    }
+
+    int err;
+    tree_iter iter;
+    if ((err = tree_iter_open(&iter, tree_oid)) != 0) {
+        return err;
+    }
+    size_t old_count = index->count;
+    while (tree_iter_next(&iter)) {
+        char *path = prefix_len ? safe_asprintf("%s/%s", prefix, iter.name) : safe_strdup(iter.name);
+        object_id entry_oid;
+        tree_iter_oid(&iter, &entry_oid);
+        path_index_append(index, path, strlen(path), iter.mode, &entry_oid);
+        free(path);
+    }
+    tree_iter_close(&iter);
+
+    size_t added = index->count - old_count;
+    sort_paths = index->paths;
+    qsort(index->entries + old_count, added, sizeof(tree_entry), compare_paths);
+    if (added > 0 && pos < old_count) {
+        tree_entry *moved = safe_malloc(added * sizeof(tree_entry));
+        memcpy(moved, index->entries + old_count, added * sizeof(tree_entry));
+        memmove(index->entries + pos + added, index->entries + pos, (old_count - pos) * sizeof(tree_entry));
+        memcpy(index->entries + pos, moved, added * sizeof(tree_entry));
+        free(moved);
+    }
+    return 0;
+}
+
+// Find or start the index of root; called with path_index_lock held
+static path_index *path_index_get(const object_id *root) {
+    unsigned int generation = object_store_generation();
+    if (generation != path_index_generation) {
+        for (int i = 0; i < PATH_INDEX_SLOTS; i++) path_index_free(&path_indexes[i]);
+        path_index_generation = generation;
+    }
 
-        if (!found) {
-            free(path_copy);
-            return NULL;
+    path_index *victim = &path_indexes[0];
+    for (int i = 0; i < PATH_INDEX_SLOTS; i++) {
+        path_index *index = &path_indexes[i];
+        if (index->last_used && oid_equal(&index->root, root)) {
+            index->last_used = ++path_index_clock;
+            return index;
         }
+        if (index->last_used < victim->last_used) victim = index;
+    }
 
-        token = strtok_r(NULL, "/", &save_ptr);
-        if (token) {
-            // Need to go deeper - parse the subtree
-            if (strcmp(found->type, "tree") != 0) {
-                free(path_copy);
-                return NULL;
-            }
+    path_index_free(victim);
+    oid_copy(&victim->root, root);
+    victim->last_used = ++path_index_clock;
+    return victim;
+}
 
-            tree_entry *subtree = NULL;
-            if (tree_parse(found->sha1, &subtree) != 0) {
-                free(path_copy);
-                return NULL;
-            }
+// Look up a path below a root tree; "a//b/" and "/a/b" both name a/b
+int tree_lookup_path(const object_id *tree_oid, const char *path, uint32_t *mode_out, object_id *oid_out) {
+    if (!tree_oid || !path) return -1;
+
+    // Drop empty path components
+    char *key = safe_malloc(strlen(path) + 1);
+    size_t key_len = 0;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' && (key_len == 0 || key[key_len - 1] == '/')) continue;
+        key[key_len++] = *p;
+    }
+    if (key_len > 0 && key[key_len - 1] == '/') key_len--;
+    key[key_len] = '\0';
+    if (key_len == 0) {
+        free(key);
+        return -1;
+    }
 
-            tree_free(entries);
-            entries = subtree;
-            current = subtree;
+    // Record each directory on the way down, then the path itself
+    int result = -1;
+    pthread_mutex_lock(&path_index_lock);
+    path_index *index = path_index_get(tree_oid);
+    int err = path_index_expand(index, tree_oid, "");
+    for (char *slash = strchr(key, '/'); err == 0 && slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        const tree_entry *dir = path_index_find(index, key);
+        object_id dir_oid;
+        if (dir && dir->type == TREE_ENTRY_TREE) {
+            oid_copy(&dir_oid, &dir->oid);
+            err = path_index_expand(index, &dir_oid, key);
         } else {
-            // Found the target entry
-            free(path_copy);
-            return found;
+            err = -1;
         }
+        *slash = '/';
     }
+    const tree_entry *entry = err == 0 ? path_index_find(index, key) : NULL;
+    if (entry) {
+        if (mode_out) *mode_out = entry->mode;
+        if (oid_out) oid_copy(oid_out, &entry->oid);
+        result = 0;
+    }
+    pthread_mutex_unlock(&path_index_lock);
 
-    free(path_copy);
-    return NULL;
+    free(key);
+    return result;
 }
 
 // Restore specific path from tree
-int tree_restore_path(const char *tree_sha1, const char *tree_path, const char *target_path) {
+int tree_restore_path(const object_id *tree_oid, const char *tree_path, const char *target_path) {
     int err;
-    if (!tree_sha1 || !tree_path || !target_path) {
+    if (!tree_oid || !tree_path || !target_path) {
         return -1;
     }
 
-    tree_entry *entries = NULL;
-    if ((err = tree_parse(tree_sha1, &entries)) != 0) {
-        printf("ERROR: tree_parse: %d\n", err);
-        return err;
-    }
-
-    tree_entry *target_entry = find_entry_by_path(entries, tree_path);
-    if (!target_entry) {
-        tree_free(entries);
+    uint32_t mode;
+    object_id target_oid;
+    if (tree_lookup_path(tree_oid, tree_path, &mode, &target_oid) != 0) {
         printf("Path not found in tree: %s\n", tree_path);
         return -1;
     }
 
-    if (strcmp(target_entry->type, "blob") == 0) {
+    if (!TREE_MODE_IS_DIR(mode)) {
         // Restore single file
-        if ((err = extract_blob(target_entry->sha1, target_path)) != 0) {
+        if ((err = extract_blob(&target_oid, target_path)) != 0) {
             printf("ERROR: extract_blob: %d\n", err);
-            tree_free(entries);
             return err;
         }
-    } else if (strcmp(target_entry->type, "tree") == 0) {
+    } else {
         // Restore directory recursively
-        if ((err = extract_tree_recursive(target_entry->sha1, target_path)) != 0) {
+        if ((err = extract_tree_recursive(&target_oid, target_path)) != 0) {
             printf("ERROR: extract_tree_recursive: %d\n", err);
-            tree_free(entries);
             return err;
         }
     }
 
-    tree_free(entries);
     return 0;
 }
 
@@ -457,26 +798,26 @@ void print_checkout_summary(const checkout_operation_stats *stats) {
 }
 
 // Enhanced tree restore with statistics
-int tree_restore(const char *tree_sha1, const char *target_dir) {
+int tree_restore(const object_id *tree_oid, const char *target_dir) {
     int err;
-    if (!tree_sha1 || !target_dir) {
+    if (!tree_oid || !target_dir) {
         return -1;
     }
 
     printf("Restoring tree ");
-    print_colored_hash(tree_sha1);
+    print_colored_oid(tree_oid);
     printf(" to %s...\n", target_dir);
 
     // First, collect target files for cleanup operations
     file_entry *target_files = NULL;
-    if ((err = collect_target_files(tree_sha1, "", &target_files)) != 0) {
+    if ((err = collect_target_files(tree_oid, "", &target_files)) != 0) {
         printf("ERROR: collect_target_files: %d\n", err);
         return err;
     }
 
     // Extract tree files (create/update files and directories)
     printf("Extracting files from tree...\n");
-    if ((err = extract_tree_recursive(tree_sha1, target_dir)) != 0) {
+    if ((err = extract_tree_recursive(tree_oid, target_dir)) != 0) {
         printf("ERROR: extract_tree_recursive: %d\n", err);
         free_file_list(target_files);
         return err;
@@ -0,0 +1,294 @@
+#include "gitnano.h"
+#include <pthread.h>
+
+// BLAKE3 (unkeyed, 32-byte output).
+//
+// The input is split into 1 KiB chunks that form a binary tree, so any
+// aligned power-of-two run of chunks hashes to a chaining value on its own.
+// The hasher keeps the usual stack of completed subtree values; when one
+// update brings in a large aligned run, that run is split into leaf subtrees
+// hashed on a shared thread pool and merged afterwards. If the pool is busy
+// (another thread is already using it) the run is hashed inline.
+
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+
+// Chunks per parallel task, and the smallest run worth splitting across threads
+#define BLAKE3_LEAF_CHUNKS 64
+#define BLAKE3_PARALLEL_MIN_CHUNKS (4 * BLAKE3_LEAF_CHUNKS)
+#define BLAKE3_PARALLEL_MAX_CHUNKS 8192
+
+enum {
+    CHUNK_START = 1 << 0,
+    CHUNK_END = 1 << 1,
+    PARENT = 1 << 2,
+    ROOT = 1 << 3,
+};
+
+static const uint32_t blake3_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint8_t msg_schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+struct blake3_hasher {
+    // Chunk being filled
+    uint32_t chunk_cv[8];
+    uint64_t chunk_counter;
+    unsigned char block[BLAKE3_BLOCK_LEN];
+    size_t block_len;
+    size_t blocks_compressed;
+
+    // Chaining values of completed subtrees, largest first
+    uint32_t cv_stack[BLAKE3_MAX_DEPTH][8];
+    size_t cv_stack_len;
+};
+
+static inline uint32_t rotr32(uint32_t w, int c) {
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline uint32_t load32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+#define G(a, b, c, d, x, y) \
+    do { \
+        s[a] = s[a] + s[b] + (x); \
+        s[d] = rotr32(s[d] ^ s[a], 16); \
+        s[c] = s[c] + s[d]; \
+        s[b] = rotr32(s[b] ^ s[c], 12); \
+        s[a] = s[a] + s[b] + (y); \
+        s[d] = rotr32(s[d] ^ s[a], 8); \
+        s[c] = s[c] + s[d]; \
+        s[b] = rotr32(s[b] ^ s[c], 7); \
+    } while (0)
+
+// Compression function; out gets the 8-word chaining value (or the first
+// half of the root output, which is all a 32-byte digest needs)
+static void compress(const uint32_t cv[8], const unsigned char block[BLAKE3_BLOCK_LEN], uint64_t counter,
+                     uint32_t block_len, uint32_t flags, uint32_t out[8]) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) m[i] = load32(block + 4 * i);
+
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        blake3_iv[0], blake3_iv[1], blake3_iv[2], blake3_iv[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags,
+    };
+    for (int r = 0; r < 7; r++) {
+        const uint8_t *k = msg_schedule[r];
+        G(0, 4, 8, 12, m[k[0]], m[k[1]]);
+        G(1, 5, 9, 13, m[k[2]], m[k[3]]);
+        G(2, 6, 10, 14, m[k[4]], m[k[5]]);
+        G(3, 7, 11, 15, m[k[6]], m[k[7]]);
+        G(0, 5, 10, 15, m[k[8]], m[k[9]]);
+        G(1, 6, 11, 12, m[k[10]], m[k[11]]);
+        G(2, 7, 8, 13, m[k[12]], m[k[13]]);
+        G(3, 4, 9, 14, m[k[14]], m[k[15]]);
+    }
+    for (int i = 0; i < 8; i++) out[i] = s[i] ^ s[i + 8];
+}
+
+static void store_cv(unsigned char *p, const uint32_t cv[8]) {
+    for (int i = 0; i < 8; i++) {
+        p[4 * i] = cv[i];
+        p[4 * i + 1] = cv[i] >> 8;
+        p[4 * i + 2] = cv[i] >> 16;
+        p[4 * i + 3] = cv[i] >> 24;
+    }
+}
+
+static void parent_cv(const uint32_t left[8], const uint32_t right[8], uint32_t flags, uint32_t out[8]) {
+    unsigned char block[BLAKE3_BLOCK_LEN];
+    store_cv(block, left);
+    store_cv(block + 32, right);
+    compress(blake3_iv, block, 0, BLAKE3_BLOCK_LEN, PARENT | flags, out);
+}
+
+// Chaining value of one full chunk
+static void chunk_cv(const unsigned char *chunk, uint64_t counter, uint32_t out[8]) {
+    memcpy(out, blake3_iv, sizeof(blake3_iv));
+    for (int i = 0; i < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; i++) {
+        uint32_t flags = (i == 0 ? CHUNK_START : 0) | (i == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? CHUNK_END : 0);
+        compress(out, chunk + i * BLAKE3_BLOCK_LEN, counter, BLAKE3_BLOCK_LEN, flags, out);
+    }
+}
+
+// Chaining value of an aligned run of full chunks (a power of two of them)
+static void subtree_cv(const unsigned char *data, uint64_t counter, size_t chunks, uint32_t out[8]) {
+    if (chunks == 1) {
+        chunk_cv(data, counter, out);
+        return;
+    }
+    uint32_t left[8], right[8];
+    size_t half = chunks / 2;
+    subtree_cv(data, counter, half, left);
+    subtree_cv(data + half * BLAKE3_CHUNK_LEN, counter + half, half, right);
+    parent_cv(left, right, 0, out);
+}
+
+// Shared pool for large runs; only one hasher uses it at a time
+static thread_pool *blake3_pool = NULL;
+static pthread_mutex_t blake3_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t blake3_pool_once = PTHREAD_ONCE_INIT;
+
+static void blake3_pool_init(void) {
+    int threads = thread_pool_default_size();
+    if (threads > 1) blake3_pool = thread_pool_new(threads);
+}
+
+typedef struct {
+    const unsigned char *data;
+    uint64_t counter;
+    uint32_t (*cvs)[8];
+} leaf_batch;
+
+static int hash_leaf(size_t index, void *ctx) {
+    leaf_batch *batch = ctx;
+    subtree_cv(batch->data + index * BLAKE3_LEAF_CHUNKS * BLAKE3_CHUNK_LEN,
+               batch->counter + index * BLAKE3_LEAF_CHUNKS, BLAKE3_LEAF_CHUNKS, batch->cvs[index]);
+    return 0;
+}
+
+// subtree_cv, with the leaves spread over the pool when it is free
+static void subtree_cv_parallel(const unsigned char *data, uint64_t counter, size_t chunks, uint32_t out[8]) {
+    pthread_once(&blake3_pool_once, blake3_pool_init);
+    if (!blake3_pool || chunks < BLAKE3_PARALLEL_MIN_CHUNKS || pthread_mutex_trylock(&blake3_pool_lock) != 0) {
+        subtree_cv(data, counter, chunks, out);
+        return;
+    }
+
+    size_t leaves = chunks / BLAKE3_LEAF_CHUNKS;
+    uint32_t (*cvs)[8] = safe_malloc(leaves * sizeof(*cvs));
+    leaf_batch batch = {data, counter, cvs};
+    thread_pool_run(blake3_pool, leaves, hash_leaf, &batch);
+    pthread_mutex_unlock(&blake3_pool_lock);
+
+    // Merge the leaf values level by level
+    for (size_t n = leaves; n > 1; n /= 2) {
+        for (size_t i = 0; i < n / 2; i++) {
+            parent_cv(cvs[2 * i], cvs[2 * i + 1], 0, cvs[i]);
+        }
+    }
+    memcpy(out, cvs[0], 8 * sizeof(uint32_t));
+    free(cvs);
+}
+
+// Push the value of a completed subtree of 2^level chunks that ends with
+// chunk total - 1, merging it with the completed subtrees on its left
+static void push_cv(blake3_hasher *self, uint32_t cv[8], uint64_t total, int level) {
+    total >>= level;
+    while ((total & 1) == 0) {
+        self->cv_stack_len--;
+        parent_cv(self->cv_stack[self->cv_stack_len], cv, 0, cv);
+        total >>= 1;
+    }
+    memcpy(self->cv_stack[self->cv_stack_len++], cv, 8 * sizeof(uint32_t));
+}
+
+static void chunk_reset(blake3_hasher *self, uint64_t counter) {
+    memcpy(self->chunk_cv, blake3_iv, sizeof(blake3_iv));
+    self->chunk_counter = counter;
+    self->block_len = 0;
+    self->blocks_compressed = 0;
+}
+
+static size_t chunk_len(const blake3_hasher *self) {
+    return self->blocks_compressed * BLAKE3_BLOCK_LEN + self->block_len;
+}
+
+static uint32_t chunk_start_flag(const blake3_hasher *self) {
+    return self->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+blake3_hasher *blake3_hasher_new(void) {
+    blake3_hasher *self = safe_malloc(sizeof(blake3_hasher));
+    blake3_hasher_reset(self);
+    return self;
+}
+
+void blake3_hasher_reset(blake3_hasher *self) {
+    chunk_reset(self, 0);
+    self->cv_stack_len = 0;
+}
+
+void blake3_hasher_update(blake3_hasher *self, const void *data, size_t size) {
+    const unsigned char *input = data;
+
+    while (size > 0) {
+        // A full chunk is only finished once more input shows it is not the last
+        if (chunk_len(self) == BLAKE3_CHUNK_LEN) {
+            uint32_t cv[8];
+            compress(self->chunk_cv, self->block, self->chunk_counter, BLAKE3_BLOCK_LEN,
+                     CHUNK_END | chunk_start_flag(self), cv);
+            push_cv(self, cv, self->chunk_counter + 1, 0);
+            chunk_reset(self, self->chunk_counter + 1);
+        }
+
+        // At a chunk boundary, take the largest aligned run that leaves input behind
+        if (chunk_len(self) == 0 && size > BLAKE3_CHUNK_LEN) {
+            size_t chunks = 1;
+            while (chunks * 2 < BLAKE3_PARALLEL_MAX_CHUNKS && chunks * 2 * BLAKE3_CHUNK_LEN < size &&
+                   (self->chunk_counter & (chunks * 2 - 1)) == 0) {
+                chunks *= 2;
+            }
+            uint32_t cv[8];
+            subtree_cv_parallel(input, self->chunk_counter, chunks, cv);
+            int level = 0;
+            while ((1ull << level) < chunks) level++;
+            push_cv(self, cv, self->chunk_counter + chunks, level);
+            self->chunk_counter += chunks;
+            input += chunks * BLAKE3_CHUNK_LEN;
+            size -= chunks * BLAKE3_CHUNK_LEN;
+            continue;
+        }
+
+        // Fill the block buffer, compressing it once more input follows
+        if (self->block_len == BLAKE3_BLOCK_LEN) {
+            compress(self->chunk_cv, self->block, self->chunk_counter, BLAKE3_BLOCK_LEN,
+                     chunk_start_flag(self), self->chunk_cv);
+            self->blocks_compressed++;
+            self->block_len = 0;
+        }
+        size_t take = BLAKE3_BLOCK_LEN - self->block_len;
+        if (take > size) take = size;
+        memcpy(self->block + self->block_len, input, take);
+        self->block_len += take;
+        input += take;
+        size -= take;
+    }
+}
+
+void blake3_hasher_final(const blake3_hasher *self, unsigned char digest_out[32]) {
+    unsigned char block[BLAKE3_BLOCK_LEN] = {0};
+    memcpy(block, self->block, self->block_len);
+
+    uint32_t flags = chunk_start_flag(self) | CHUNK_END;
+    if (self->cv_stack_len == 0) {
+        uint32_t out[8];
+        compress(self->chunk_cv, block, self->chunk_counter, self->block_len, flags | ROOT, out);
+        store_cv(digest_out, out);
+        return;
+    }
+
+    uint32_t cv[8];
+    compress(self->chunk_cv, block, self->chunk_counter, self->block_len, flags, cv);
+    for (size_t i = self->cv_stack_len; i-- > 0;) {
+        parent_cv(self->cv_stack[i], cv, i == 0 ? ROOT : 0, cv);
+    }
+    store_cv(digest_out, cv);
+}
+
+void blake3_hasher_free(blake3_hasher *self) {
+    free(self);
+}
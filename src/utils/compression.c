@@ -1,28 +1,115 @@
 #include "gitnano.h"
 #include <zlib.h>
 #include <errno.h>
+#include <stddef.h>
+#ifdef GITNANO_HAVE_ZSTD
+#include <zstd.h>
+#endif
 
+// Codec layer. Loose objects are zlib streams by default, or zstd frames when
+// built with GITNANO_HAVE_ZSTD and selected with GITNANO_CODEC / "compression.codec".
+// The codec is recorded by the stream itself: readers tell zstd frames from
+// zlib streams by their magic number. Store-only output is a zlib stream at
+// level 0, so every reader can open it.
+
+static const unsigned char zstd_magic[4] = {0x28, 0xb5, 0x2f, 0xfd};
+
+// Blobs at least this large favour speed over ratio
+#define COMPRESS_LARGE_BLOB (1024 * 1024)
+
+// Bytes examined when deciding whether data is worth compressing
+#define COMPRESS_SAMPLE_SIZE 4096
+
+// Heuristic entropy check: a byte histogram close to uniform means the data
+// is already compressed or encrypted. Uses a chi-square test against the
+// uniform distribution over a few spans spread through the sample.
+int compress_looks_incompressible(const void *data, size_t size) {
+    if (size < 512) return 0;
+
+    const unsigned char *bytes = data;
+    size_t counts[256] = {0};
+    size_t sampled = 0;
+    const size_t spans = 4;
+    size_t span_size = COMPRESS_SAMPLE_SIZE / spans;
+    if (span_size * spans > size) span_size = size / spans;
+
+    for (size_t i = 0; i < spans; i++) {
+        const unsigned char *p = bytes + (size - span_size) * i / (spans - 1);
+        for (size_t j = 0; j < span_size; j++) {
+            counts[p[j]]++;
+        }
+        sampled += span_size;
+    }
+
+    // For uniform random bytes the statistic stays near 255
+    double expected = sampled / 256.0;
+    double chi_square = 0;
+    for (int i = 0; i < 256; i++) {
+        double diff = counts[i] - expected;
+        chi_square += diff * diff / expected;
+    }
+    return chi_square < 400.0;
+}
+
+static int setting_int(const char *env_name, const char *key, int fallback) {
+    char value[32];
+    if (config_get_setting(env_name, key, value, sizeof(value)) != 0) return fallback;
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    return (end != value && parsed >= 0 && parsed <= 9) ? (int)parsed : fallback;
+}
+
+// Choose codec and level for an object; sample is the start of its data
+compress_policy compress_policy_for(const char *type, size_t size, const void *sample, size_t sample_size) {
+    compress_policy policy = {CODEC_ZLIB, Z_DEFAULT_COMPRESSION};
+
+    if (compress_looks_incompressible(sample, sample_size)) {
+        policy.level = Z_NO_COMPRESSION;
+        return policy;
+    }
+
+    // Commits and trees are small and read often; large blobs are where time goes
+    if (type && strcmp(type, "blob") == 0 && size >= COMPRESS_LARGE_BLOB) {
+        policy.level = Z_BEST_SPEED;
+    } else {
+        policy.level = 6;
+    }
+    policy.level = setting_int("GITNANO_COMPRESSION_LEVEL", "compression.level", policy.level);
+
+    char codec[16];
+    if (config_get_setting("GITNANO_CODEC", "compression.codec", codec, sizeof(codec)) == 0 &&
+        strcmp(codec, "zstd") == 0) {
+#ifdef GITNANO_HAVE_ZSTD
+        policy.codec = CODEC_ZSTD;
+#else
+        static int warned = 0;
+        if (!warned) {
+            fprintf(stderr, "WARNING: zstd requested but gitnano was built without it, using zlib\n");
+            warned = 1;
+        }
+#endif
+    }
+    return policy;
+}
+
+// Compress a buffer into a zlib stream (the format packs require)
 int compress_data(const void *input, size_t input_size,
                   void **output, size_t *output_size) {
-    if (!input || !output || !output_size) {
+    if ((!input && input_size > 0) || !output || !output_size) {
         fprintf(stderr, "ERROR: compress_data: invalid arguments\n");
         return -1;
     }
 
-    if (input_size == 0) {
-        *output = NULL;
-        *output_size = 0;
-        return 0;
-    }
+    static const unsigned char empty;
+    if (!input) input = &empty;
+
+    int level = compress_looks_incompressible(input, input_size) ? Z_NO_COMPRESSION :
+                setting_int("GITNANO_COMPRESSION_LEVEL", "compression.level", 6);
 
     uLongf compressed_size = compressBound(input_size);
     *output = safe_malloc(compressed_size);
-    if (!*output) {
-        fprintf(stderr, "ERROR: compress_data: failed to allocate compression buffer\n");
-        return -1;
-    }
 
-    int result = compress2(*output, &compressed_size, input, input_size, 9);
+    int result = compress2(*output, &compressed_size, input, input_size, level);
     if (result != Z_OK) {
         fprintf(stderr, "ERROR: compress_data: compression failed with code %d\n", result);
         free(*output);
@@ -31,16 +118,14 @@ int compress_data(const void *input, size_t input_size,
     }
 
     if (compressed_size < compressBound(input_size)) {
-        void *shrunk_output = safe_realloc(*output, compressed_size);
-        if (shrunk_output) {
-            *output = shrunk_output;
-        }
+        *output = safe_realloc(*output, compressed_size);
     }
 
     *output_size = compressed_size;
     return 0;
 }
 
+// Inflate a whole object stream of unknown output size into a growing buffer
 int decompress_data(const void *input, size_t input_size,
                     void **output, size_t *output_size) {
     if (!input || !output || !output_size) {
@@ -54,78 +139,406 @@ int decompress_data(const void *input, size_t input_size,
         return 0;
     }
 
-    if (input_size < 8) {
-        fprintf(stderr, "ERROR: decompress_data: input too small to be valid compressed data (%zu bytes)\n", input_size);
+    inflate_stream *stream = inflate_stream_new(input, input_size);
+    if (!stream) return -1;
+
+    size_t alloc = input_size * 4 < 1024 ? 1024 : input_size * 4;
+    size_t size = 0;
+    unsigned char *buffer = safe_malloc(alloc);
+    int err = 0;
+    for (;;) {
+        size_t produced;
+        if ((err = inflate_stream_read(stream, buffer + size, alloc - size, &produced)) != 0) break;
+        size += produced;
+        if (size < alloc) break;
+        alloc *= 2;
+        buffer = safe_realloc(buffer, alloc);
+    }
+    if (err == 0) err = inflate_stream_end(stream);
+    inflate_stream_free(stream);
+
+    if (err != 0) {
+        fprintf(stderr, "ERROR: decompress_data: data corrupted or incomplete\n");
+        free(buffer);
+        *output = NULL;
         return -1;
     }
 
-    uLongf buffer_size = input_size * 4;
-    if (buffer_size < 1024) buffer_size = 1024;
-    if (buffer_size > 50 * 1024 * 1024) buffer_size = 50 * 1024 * 1024;
+    *output = size > 0 ? safe_realloc(buffer, size) : buffer;
+    *output_size = size;
+    return 0;
+}
+
+// Incremental decompression over an in-memory object stream (zlib or zstd)
+struct inflate_stream {
+    compress_codec codec;
+    z_stream strm;
+#ifdef GITNANO_HAVE_ZSTD
+    ZSTD_DStream *zstd;
+    ZSTD_inBuffer zstd_in;
+#endif
+    const unsigned char *input_end;
+    int finished;
+};
+
+inflate_stream *inflate_stream_new(const void *input, size_t input_size) {
+    inflate_stream *stream = safe_malloc(sizeof(inflate_stream));
+    memset(stream, 0, sizeof(inflate_stream));
+    stream->input_end = (const unsigned char *)input + input_size;
+
+    if (input_size >= sizeof(zstd_magic) && memcmp(input, zstd_magic, sizeof(zstd_magic)) == 0) {
+#ifdef GITNANO_HAVE_ZSTD
+        stream->codec = CODEC_ZSTD;
+        stream->zstd = ZSTD_createDStream();
+        if (!stream->zstd || ZSTD_isError(ZSTD_initDStream(stream->zstd))) {
+            fprintf(stderr, "ERROR: inflate_stream_new: cannot create zstd stream\n");
+            ZSTD_freeDStream(stream->zstd);
+            free(stream);
+            return NULL;
+        }
+        stream->zstd_in.src = input;
+        stream->zstd_in.size = input_size;
+        return stream;
+#else
+        fprintf(stderr, "ERROR: inflate_stream_new: object is zstd-compressed but gitnano was built without zstd\n");
+        free(stream);
+        return NULL;
+#endif
+    }
+
+    stream->codec = CODEC_ZLIB;
+    if (inflateInit(&stream->strm) != Z_OK) {
+        fprintf(stderr, "ERROR: inflate_stream_new: inflateInit failed\n");
+        free(stream);
+        return NULL;
+    }
+    stream->strm.next_in = (Bytef *)input;
+    return stream;
+}
 
-    *output = safe_malloc(buffer_size);
-    if (!*output) {
-        fprintf(stderr, "ERROR: decompress_data: failed to allocate initial buffer (%zu bytes)\n", buffer_size);
+#ifdef GITNANO_HAVE_ZSTD
+static int zstd_stream_read(inflate_stream *stream, unsigned char *out, size_t size, size_t *produced_out) {
+    ZSTD_outBuffer output = {out, size, 0};
+    while (output.pos < output.size && !stream->finished) {
+        size_t in_before = stream->zstd_in.pos;
+        size_t result = ZSTD_decompressStream(stream->zstd, &output, &stream->zstd_in);
+        if (ZSTD_isError(result)) {
+            fprintf(stderr, "ERROR: inflate_stream_read: %s\n", ZSTD_getErrorName(result));
+            return -1;
+        }
+        if (result == 0) {
+            stream->finished = 1;
+        } else if (stream->zstd_in.pos == in_before && stream->zstd_in.pos == stream->zstd_in.size &&
+                   output.pos < output.size) {
+            fprintf(stderr, "ERROR: inflate_stream_read: truncated zstd frame\n");
+            return -1;
+        }
+    }
+    *produced_out = output.pos;
+    return 0;
+}
+#endif
+
+// Inflate up to size bytes; produced_out is short only at the end of the stream
+int inflate_stream_read(inflate_stream *stream, void *output, size_t size, size_t *produced_out) {
+#ifdef GITNANO_HAVE_ZSTD
+    if (stream->codec == CODEC_ZSTD) {
+        return zstd_stream_read(stream, output, size, produced_out);
+    }
+#endif
+
+    // zlib counts in uInt, so feed buffers larger than 1 GB in slices
+    const size_t max_chunk = 1u << 30;
+    unsigned char *out = output;
+    size_t produced = 0;
+
+    while (produced < size && !stream->finished) {
+        if (stream->strm.avail_in == 0) {
+            size_t in_left = stream->input_end - stream->strm.next_in;
+            stream->strm.avail_in = in_left > max_chunk ? max_chunk : (uInt)in_left;
+        }
+        size_t want = size - produced;
+        stream->strm.next_out = out + produced;
+        stream->strm.avail_out = want > max_chunk ? max_chunk : (uInt)want;
+        uInt avail_before = stream->strm.avail_out;
+
+        int result = inflate(&stream->strm, Z_NO_FLUSH);
+        produced += avail_before - stream->strm.avail_out;
+
+        if (result == Z_STREAM_END) {
+            stream->finished = 1;
+        } else if (result != Z_OK) {
+            fprintf(stderr, "ERROR: inflate_stream_read: inflate failed with code %d\n", result);
+            return -1;
+        }
+    }
+
+    *produced_out = produced;
+    return 0;
+}
+
+// Check that the stream ended exactly where the caller stopped reading
+int inflate_stream_end(inflate_stream *stream) {
+    if (!stream->finished) {
+        unsigned char extra;
+        size_t produced;
+        if (inflate_stream_read(stream, &extra, 1, &produced) != 0) return -1;
+        if (produced != 0 || !stream->finished) {
+            fprintf(stderr, "ERROR: inflate_stream_end: stream has more data than expected\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void inflate_stream_free(inflate_stream *stream) {
+    if (stream) {
+#ifdef GITNANO_HAVE_ZSTD
+        if (stream->codec == CODEC_ZSTD) ZSTD_freeDStream(stream->zstd);
+#endif
+        if (stream->codec == CODEC_ZLIB) inflateEnd(&stream->strm);
+        free(stream);
+    }
+}
+
+// Inflate a zlib stream into a buffer whose exact size is already known
+int inflate_exact(const void *input, size_t input_size, void *output, size_t output_size) {
+    if (!input || (!output && output_size > 0)) {
+        fprintf(stderr, "ERROR: inflate_exact: invalid arguments\n");
         return -1;
     }
 
-    int attempts = 0;
-    const int max_attempts = 10;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit(&strm) != Z_OK) {
+        fprintf(stderr, "ERROR: inflate_exact: inflateInit failed\n");
+        return -1;
+    }
 
-    while (attempts < max_attempts) {
-        uLongf dest_len = buffer_size;
-        int result = uncompress(*output, &dest_len, input, input_size);
+    // zlib counts in uInt, so feed buffers larger than 1 GB in slices
+    const uInt max_chunk = 1u << 30;
+    unsigned char dummy;
+    size_t in_left = input_size;
+    size_t out_left = output_size;
+    strm.next_in = (Bytef *)input;
+    strm.next_out = output_size > 0 ? (Bytef *)output : &dummy;
 
-        if (result == Z_OK) {
-            *output_size = dest_len;
-            if (*output_size < buffer_size && *output_size > 0) {
-                void *shrunk_output = safe_realloc(*output, *output_size);
-                if (shrunk_output) {
-                    *output = shrunk_output;
-                }
-            }
-            return 0;
+    int result = Z_OK;
+    while (result == Z_OK) {
+        if (strm.avail_in == 0 && in_left > 0) {
+            strm.avail_in = in_left > max_chunk ? max_chunk : (uInt)in_left;
+            in_left -= strm.avail_in;
+        }
+        if (strm.avail_out == 0 && out_left > 0) {
+            strm.avail_out = out_left > max_chunk ? max_chunk : (uInt)out_left;
+            out_left -= strm.avail_out;
+        }
+        result = inflate(&strm, Z_NO_FLUSH);
+    }
+
+    size_t produced = output_size - out_left - strm.avail_out;
+    inflateEnd(&strm);
+
+    if (result != Z_STREAM_END || produced != output_size) {
+        fprintf(stderr, "ERROR: inflate_exact: stream ended with code %d after %zu of %zu bytes\n",
+                result, produced, output_size);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Inflate at most output_size bytes from the start of a zlib stream
+int inflate_prefix(const void *input, size_t input_size, void *output, size_t output_size,
+                   size_t *produced_out) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit(&strm) != Z_OK) {
+        fprintf(stderr, "ERROR: inflate_prefix: inflateInit failed\n");
+        return -1;
+    }
+
+    strm.next_in = (Bytef *)input;
+    strm.avail_in = input_size > (1u << 30) ? (1u << 30) : (uInt)input_size;
+    strm.next_out = output;
+    strm.avail_out = (uInt)output_size;
+
+    int result = Z_OK;
+    while (result == Z_OK && strm.avail_out > 0) {
+        result = inflate(&strm, Z_NO_FLUSH);
+    }
+
+    *produced_out = output_size - strm.avail_out;
+    inflateEnd(&strm);
+
+    if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+        fprintf(stderr, "ERROR: inflate_prefix: inflate failed with code %d\n", result);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Longest object header a stream buffers ahead of its sample
+#define COMPRESS_HEADER_MAX 64
+
+// Incremental compression that hands output to a sink as it is produced.
+// Input is buffered until a sample of the payload is available, then the
+// policy picks the codec and level for the rest of the stream. The object
+// header is buffered in front of the sample but not judged with it.
+struct compress_stream {
+    compress_codec codec;
+    int started;
+    char type[10];
+    size_t size;
+    z_stream strm;
+#ifdef GITNANO_HAVE_ZSTD
+    ZSTD_CStream *zstd;
+#endif
+    compress_sink sink;
+    void *sink_data;
+    size_t header_len;
+    size_t pending;
+    unsigned char sample[COMPRESS_HEADER_MAX + COMPRESS_SAMPLE_SIZE];
+    unsigned char buffer[65536];
+};
+
+compress_stream *compress_stream_new(const char *type, size_t size, compress_sink sink, void *sink_data) {
+    compress_stream *stream = safe_malloc(sizeof(compress_stream));
+    memset(stream, 0, offsetof(compress_stream, sample));
+    snprintf(stream->type, sizeof(stream->type), "%s", type ? type : "");
+    stream->size = size;
+    stream->sink = sink;
+    stream->sink_data = sink_data;
+    return stream;
+}
+
+static int compress_stream_start(compress_stream *stream) {
+    compress_policy policy = compress_policy_for(stream->type, stream->size, stream->sample + stream->header_len,
+                                                 stream->pending - stream->header_len);
+    stream->codec = policy.codec;
+    stream->started = 1;
+
+#ifdef GITNANO_HAVE_ZSTD
+    if (stream->codec == CODEC_ZSTD) {
+        // zlib levels 1-9 map onto the fast end of zstd's range
+        int level = policy.level <= 1 ? 1 : policy.level <= 6 ? 3 : 9;
+        stream->zstd = ZSTD_createCStream();
+        if (!stream->zstd || ZSTD_isError(ZSTD_initCStream(stream->zstd, level))) {
+            fprintf(stderr, "ERROR: compress_stream: cannot create zstd stream\n");
+            return -1;
         }
+        return 0;
+    }
+#endif
+
+    if (deflateInit(&stream->strm, policy.level) != Z_OK) {
+        fprintf(stderr, "ERROR: compress_stream: deflateInit failed\n");
+        stream->codec = CODEC_NONE;
+        return -1;
+    }
+    return 0;
+}
 
-        if (result == Z_BUF_ERROR) {
-            attempts++;
-            buffer_size *= 2;
-            if (buffer_size > 100 * 1024 * 1024) {
-                fprintf(stderr, "ERROR: decompress_data: decompression buffer too large (%zu bytes), data may be corrupted\n", buffer_size);
-                free(*output);
-                *output = NULL;
+static int compress_stream_run(compress_stream *stream, const unsigned char *data, size_t size, int finish) {
+#ifdef GITNANO_HAVE_ZSTD
+    if (stream->codec == CODEC_ZSTD) {
+        ZSTD_inBuffer input = {data, size, 0};
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = {stream->buffer, sizeof(stream->buffer), 0};
+            remaining = ZSTD_compressStream2(stream->zstd, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                fprintf(stderr, "ERROR: compress_stream: %s\n", ZSTD_getErrorName(remaining));
                 return -1;
             }
+            if (output.pos > 0 && stream->sink(stream->buffer, output.pos, stream->sink_data) != 0) {
+                return -1;
+            }
+        } while (input.pos < input.size || (finish && remaining != 0));
+        return 0;
+    }
+#endif
+
+    // zlib counts in uInt, so feed buffers larger than 1 GB in slices
+    const size_t max_chunk = 1u << 30;
+    int flush;
+    do {
+        size_t chunk = size > max_chunk ? max_chunk : size;
+        stream->strm.next_in = (Bytef *)data;
+        stream->strm.avail_in = (uInt)chunk;
+        data += chunk;
+        size -= chunk;
+        flush = (finish && size == 0) ? Z_FINISH : Z_NO_FLUSH;
 
-            void *new_output = safe_realloc(*output, buffer_size);
-            if (!new_output) {
-                fprintf(stderr, "ERROR: decompress_data: failed to reallocate buffer to %zu bytes\n", buffer_size);
-                free(*output);
-                *output = NULL;
+        int result;
+        do {
+            stream->strm.next_out = stream->buffer;
+            stream->strm.avail_out = sizeof(stream->buffer);
+            result = deflate(&stream->strm, flush);
+            if (result == Z_STREAM_ERROR) {
+                fprintf(stderr, "ERROR: compress_stream: deflate failed\n");
                 return -1;
             }
-            *output = new_output;
-        } else {
-            fprintf(stderr, "ERROR: decompress_data: uncompress failed with code %d", result);
-            switch (result) {
-                case Z_MEM_ERROR:
-                    fprintf(stderr, " (memory error)\n");
-                    break;
-                case Z_DATA_ERROR:
-                    fprintf(stderr, " (data corrupted or incomplete)\n");
-                    break;
-                default:
-                    fprintf(stderr, " (unknown error)\n");
-                    break;
+
+            size_t produced = sizeof(stream->buffer) - stream->strm.avail_out;
+            if (produced > 0 && stream->sink(stream->buffer, produced, stream->sink_data) != 0) {
+                return -1;
             }
-            free(*output);
-            *output = NULL;
+        } while (stream->strm.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+    } while (size > 0);
+    return 0;
+}
+
+// Feed the object header; it must come before any payload
+int compress_stream_header(compress_stream *stream, const void *header, size_t size) {
+    if (stream->started || stream->pending > 0 || size > COMPRESS_HEADER_MAX) {
+        fprintf(stderr, "ERROR: compress_stream_header: header must come first and fit in %d bytes\n",
+                COMPRESS_HEADER_MAX);
+        return -1;
+    }
+    memcpy(stream->sample, header, size);
+    stream->header_len = size;
+    stream->pending = size;
+    return 0;
+}
+
+int compress_stream_update(compress_stream *stream, const void *data, size_t size) {
+    const unsigned char *p = data;
+
+    // Collect the sample the codec decision is based on
+    if (!stream->started) {
+        size_t take = stream->header_len + COMPRESS_SAMPLE_SIZE - stream->pending;
+        if (take > size) take = size;
+        memcpy(stream->sample + stream->pending, p, take);
+        stream->pending += take;
+        p += take;
+        size -= take;
+        if (stream->pending < stream->header_len + COMPRESS_SAMPLE_SIZE) return 0;
+
+        if (compress_stream_start(stream) != 0 ||
+            compress_stream_run(stream, stream->sample, stream->pending, 0) != 0) {
             return -1;
         }
     }
 
-    fprintf(stderr, "ERROR: decompress_data: maximum expansion attempts exceeded, data may be corrupted\n");
-    free(*output);
-    *output = NULL;
-    return -1;
-}
\ No newline at end of file
+    return size > 0 ? compress_stream_run(stream, p, size, 0) : 0;
+}
+
+int compress_stream_finish(compress_stream *stream) {
+    if (!stream->started) {
+        if (compress_stream_start(stream) != 0) return -1;
+        return compress_stream_run(stream, stream->sample, stream->pending, 1);
+    }
+    return compress_stream_run(stream, NULL, 0, 1);
+}
+
+void compress_stream_free(compress_stream *stream) {
+    if (stream) {
+#ifdef GITNANO_HAVE_ZSTD
+        if (stream->codec == CODEC_ZSTD) ZSTD_freeCStream(stream->zstd);
+#endif
+        if (stream->started && stream->codec == CODEC_ZLIB) deflateEnd(&stream->strm);
+        free(stream);
+    }
+}
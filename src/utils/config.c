@@ -0,0 +1,58 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include <ctype.h>
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+// Config file contents of the current repository, re-read when it changes
+static char *cached_config = NULL;
+static int config_loaded = 0;
+static unsigned int config_generation = 0;
+
+// Look up a "key = value" line in the repository config file
+int config_get(const char *key, char *value_out, size_t size) {
+    object_store_lock();
+    unsigned int generation = object_store_generation();
+    if (!config_loaded || generation != config_generation) {
+        size_t file_size;
+        free(cached_config);
+        cached_config = read_file(CONFIG_FILE, &file_size);
+        config_generation = generation;
+        config_loaded = 1;
+    }
+    char *content = cached_config ? safe_strdup(cached_config) : NULL;
+    object_store_unlock();
+    if (!content) return -1;
+
+    int found = -1;
+    char *saveptr = NULL;
+    for (char *line = strtok_r(content, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        char *eq = strchr(line, '=');
+        if (!eq || line[0] == '#') continue;
+
+        *eq = '\0';
+        if (strcmp(trim(line), key) == 0) {
+            snprintf(value_out, size, "%s", trim(eq + 1));
+            found = 0;
+        }
+    }
+
+    free(content);
+    return found;
+}
+
+// Resolve a setting: environment variable first, then the config file
+int config_get_setting(const char *env_name, const char *key, char *value_out, size_t size) {
+    const char *env = getenv(env_name);
+    if (env && *env) {
+        snprintf(value_out, size, "%s", env);
+        return 0;
+    }
+    return config_get(key, value_out, size);
+}
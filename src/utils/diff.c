@@ -249,9 +249,9 @@ void display_diff_summary(int added_count, int modified_count, int deleted_count
 }
 
 // Helper function to diff working directory with commit
-int diff_working_directory(const char *commit_sha1) {
+int diff_working_directory(const object_id *commit_oid) {
     int err;
-    char commit_tree_sha1[SHA1_HEX_SIZE];
+    object_id commit_tree_oid;
     char workspace_path[MAX_PATH];
     char original_cwd[MAX_PATH];
 
@@ -268,7 +268,7 @@ int diff_working_directory(const char *commit_sha1) {
         return -1;
     }
 
-    if ((err = commit_get_tree(commit_sha1, commit_tree_sha1)) != 0) {
+    if ((err = commit_get_tree(commit_oid, &commit_tree_oid)) != 0) {
         printf("ERROR: Failed to get tree from current commit: %d\n", err);
         chdir(original_cwd);
         return err;
@@ -278,7 +278,7 @@ int diff_working_directory(const char *commit_sha1) {
 
     // Get current commit tree files (still in workspace)
     file_entry *commit_files = NULL;
-    if (collect_tree_files(commit_tree_sha1, &commit_files) != 0) {
+    if (collect_tree_files(&commit_tree_oid, &commit_files) != 0) {
         printf("ERROR: Failed to get current commit files\n");
         chdir(original_cwd);
         return -1;
@@ -301,19 +301,20 @@ int diff_working_directory(const char *commit_sha1) {
 }
 
 // Helper function to compare two commits
-int compare_commits(const char *sha1, const char *sha2) {
+int compare_commits(const object_id *oid1, const object_id *oid2) {
     int err;
     gitnano_diff_result *diff;
 
-    if ((err = gitnano_compare_snapshots(sha1, sha2, &diff)) != 0) {
+    char hex1[OID_MAX_HEX_SIZE], hex2[OID_MAX_HEX_SIZE];
+    if ((err = gitnano_compare_snapshots(oid_to_hex(oid1, hex1), oid_to_hex(oid2, hex2), &diff)) != 0) {
         printf("ERROR: gitnano_compare_snapshots: %d\n", err);
         return err;
     }
 
     printf("Diff between ");
-    print_colored_hash(sha1);
+    print_colored_oid(oid1);
     printf(" and ");
-    print_colored_hash(sha2);
+    print_colored_oid(oid2);
     printf(":\n");
 
     if (diff->added_count > 0) {
@@ -352,42 +353,39 @@ int compare_commits(const char *sha1, const char *sha2) {
 }
 
 // Helper function to collect files from a tree
-int collect_tree_files(const char *tree_sha1, file_entry **files_out) {
+int collect_tree_files(const object_id *tree_oid, file_entry **files_out) {
     int err;
     *files_out = NULL;
-    tree_entry *entries = NULL;
+    tree_iter iter;
 
-    if ((err = tree_parse(tree_sha1, &entries)) != 0) {
+    if ((err = tree_iter_open(&iter, tree_oid)) != 0) {
         return err;
     }
 
-    tree_entry *current = entries;
-    while (current) {
-        if (strcmp(current->type, "blob") == 0) {
+    while (tree_iter_next(&iter)) {
+        if (iter.type == TREE_ENTRY_BLOB) {
             file_entry *entry = safe_malloc(sizeof(file_entry));
             if (!entry) {
-                tree_free(entries);
+                tree_iter_close(&iter);
                 free_file_list(*files_out);
                 return -1;
             }
 
-            entry->path = safe_strdup(current->name);
+            entry->path = safe_strdup(iter.name);
             if (!entry->path) {
                 free(entry);
-                tree_free(entries);
+                tree_iter_close(&iter);
                 free_file_list(*files_out);
                 return -1;
             }
 
-            strncpy(entry->sha1, current->sha1, sizeof(entry->sha1) - 1);
-            entry->sha1[sizeof(entry->sha1) - 1] = '\0';
+            tree_iter_oid(&iter, &entry->oid);
             entry->next = *files_out;
             *files_out = entry;
         }
-        current = current->next;
     }
 
-    tree_free(entries);
+    tree_iter_close(&iter);
     return 0;
 }
 
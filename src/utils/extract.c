@@ -1,19 +1,10 @@
 #include "gitnano.h"
 #include <dirent.h>
 
-int extract_blob(const char *sha1, const char *target_path) {
+int extract_blob(const object_id *oid, const char *target_path) {
     int err;
-    char *data = NULL;
-    size_t size = 0;
-
-    if ((err = blob_read(sha1, &data, &size)) != 0) {
-        printf("ERROR: blob_read: %d\n", err);
-        return err;
-    }
-
     char *dir_path = safe_strdup(target_path);
     if (!dir_path) {
-        free(data);
         return -1;
     }
 
@@ -23,70 +14,84 @@ int extract_blob(const char *sha1, const char *target_path) {
         if ((err = mkdir_p(dir_path)) != 0) {
             printf("ERROR: mkdir_p: %d\n", err);
             free(dir_path);
-            free(data);
             return err;
         }
     }
     free(dir_path);
 
-    if ((err = write_file(target_path, data, size)) != 0) {
-        printf("ERROR: write_file: %d\n", err);
-        free(data);
+    // Chunked blobs are written chunk by chunk instead of being assembled in memory
+    char type[10];
+    size_t info_size;
+    if (object_read_info(oid, type, &info_size) == 0 && strcmp(type, "manifest") == 0) {
+        gitnano_object manifest;
+        if ((err = object_read(oid, &manifest)) != 0) {
+            printf("ERROR: object_read: %d\n", err);
+            return err;
+        }
+        if ((err = manifest_extract(&manifest, target_path)) != 0) {
+            printf("ERROR: manifest_extract: %d\n", err);
+        }
+        object_free(&manifest);
+        return err;
+    }
+
+    // Other blobs are inflated straight into the file
+    if ((err = object_read_to_file(oid, "blob", target_path)) != 0) {
+        printf("ERROR: object_read_to_file: %d\n", err);
         return err;
     }
-    free(data);
 
     return 0;
 }
 
-int extract_tree_recursive(const char *tree_sha1, const char *base_path) {
+int extract_tree_recursive(const object_id *tree_oid, const char *base_path) {
     int err;
-    tree_entry *entries = NULL;
+    tree_iter iter;
 
-    if ((err = tree_parse(tree_sha1, &entries)) != 0) {
-        printf("ERROR: tree_parse: %d\n", err);
+    if ((err = tree_iter_open(&iter, tree_oid)) != 0) {
+        printf("ERROR: tree_iter_open: %d\n", err);
         return err;
     }
 
-    tree_entry *current = entries;
-    while (current) {
+    while (tree_iter_next(&iter)) {
+        const char *name = iter.name;
+        object_id entry_oid;
+        tree_iter_oid(&iter, &entry_oid);
         char full_path[MAX_PATH];
         if (strlen(base_path) > 0) {
-            if (strlen(base_path) + 1 + strlen(current->name) < MAX_PATH) {
+            if (strlen(base_path) + 1 + iter.name_len < MAX_PATH) {
                 strcpy(full_path, base_path);
                 strcat(full_path, "/");
-                strcat(full_path, current->name);
+                strcat(full_path, name);
             } else {
                 printf("ERROR: Path too long\n");
-                tree_free(entries);
+                tree_iter_close(&iter);
                 return -1;
             }
         } else {
-            strcpy(full_path, current->name);
+            strcpy(full_path, name);
         }
 
-        if (strcmp(current->type, "blob") == 0) {
-            if ((err = extract_blob(current->sha1, full_path)) != 0) {
+        if (iter.type == TREE_ENTRY_BLOB) {
+            if ((err = extract_blob(&entry_oid, full_path)) != 0) {
                 printf("ERROR: extract_blob: %d\n", err);
-                tree_free(entries);
+                tree_iter_close(&iter);
                 return err;
             }
-        } else if (strcmp(current->type, "tree") == 0) {
+        } else {
             if ((err = mkdir_p(full_path)) != 0) {
                 printf("ERROR: mkdir_p: %d\n", err);
-                tree_free(entries);
+                tree_iter_close(&iter);
                 return err;
             }
-            if ((err = extract_tree_recursive(current->sha1, full_path)) != 0) {
-                tree_free(entries);
+            if ((err = extract_tree_recursive(&entry_oid, full_path)) != 0) {
+                tree_iter_close(&iter);
                 return err;
             }
         }
-
-        current = current->next;
     }
 
-    tree_free(entries);
+    tree_iter_close(&iter);
     return 0;
 }
 
@@ -181,37 +186,38 @@ int cleanup_extra_files(const char *base_path, file_entry *target_files) {
     return 0;
 }
 
-int collect_target_files(const char *tree_sha1, const char *base_path, file_entry **files) {
-    tree_entry *entries = NULL;
-    if (tree_parse(tree_sha1, &entries) != 0) {
+int collect_target_files(const object_id *tree_oid, const char *base_path, file_entry **files) {
+    tree_iter iter;
+    if (tree_iter_open(&iter, tree_oid) != 0) {
         return -1;
     }
 
-    tree_entry *current = entries;
-    while (current) {
+    while (tree_iter_next(&iter)) {
+        const char *name = iter.name;
         file_entry *file = safe_malloc(sizeof(file_entry));
         if (!file) {
-            tree_free(entries);
+            tree_iter_close(&iter);
             return -1;
         }
 
         if (strlen(base_path) > 0) {
-            file->path = safe_asprintf("%s/%s", base_path, current->name);
+            file->path = safe_asprintf("%s/%s", base_path, name);
         } else {
-            file->path = safe_strdup(current->name);
+            file->path = safe_strdup(name);
         }
 
-        if (strcmp(current->type, "tree") == 0) {
-            collect_target_files(current->sha1, file->path, files);
+        if (iter.type == TREE_ENTRY_TREE) {
+            object_id subtree_oid;
+            tree_iter_oid(&iter, &subtree_oid);
+            collect_target_files(&subtree_oid, file->path, files);
+            free(file->path);
             free(file);
         } else {
             file->next = *files;
             *files = file;
         }
-
-        current = current->next;
     }
 
-    tree_free(entries);
+    tree_iter_close(&iter);
     return 0;
 }
\ No newline at end of file
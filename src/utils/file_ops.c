@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
 #include "gitnano.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 int mkdir_p(const char *path) {
     char tmp[MAX_PATH];
@@ -62,6 +65,70 @@ char *read_file(const char *path, size_t *size) {
     return data;
 }
 
+// Files below this size are read into the heap: a mapping costs more than it saves
+#define MAPPED_FILE_MIN_SIZE (64 * 1024)
+
+// Open a file for one sequential pass over its contents. Large files are
+// mapped read-only, so hashing and compression read from the page cache
+// instead of a heap copy. The data is not NUL-terminated.
+int mapped_file_open(const char *path, mapped_file *file) {
+    memset(file, 0, sizeof(mapped_file));
+    file->data = "";
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    file->size = st.st_size;
+
+    if (file->size >= MAPPED_FILE_MIN_SIZE) {
+        void *map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, file->size, MADV_SEQUENTIAL);
+            close(fd);
+            file->data = map;
+            file->mapped = 1;
+            return 0;
+        }
+    }
+
+    // Small file (or mmap refused): read it into the heap
+    if (file->size > 0) {
+        char *data = safe_malloc(file->size);
+        size_t done = 0;
+        while (done < file->size) {
+            ssize_t n = read(fd, data + done, file->size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        if (done != file->size) {
+            free(data);
+            close(fd);
+            file->data = "";
+            file->size = 0;
+            return -1;
+        }
+        file->data = data;
+        file->owned = 1;
+    }
+    close(fd);
+    return 0;
+}
+
+void mapped_file_close(mapped_file *file) {
+    if (file->mapped) {
+        munmap((void *)file->data, file->size);
+    } else if (file->owned) {
+        free((void *)file->data);
+    }
+    memset(file, 0, sizeof(mapped_file));
+}
+
 int write_file(const char *path, const void *data, size_t size) {
     FILE *fp = fopen(path, "wb");
     if (!fp) {
@@ -81,6 +148,114 @@ int write_file(const char *path, const void *data, size_t size) {
     return 0;
 }
 
+// Copy a file through a fixed-size buffer, dropping the source pages once
+// copied, so copying a huge file does not grow the process or the page cache
+int copy_file(const char *src_path, const char *dst_path) {
+    int in = open(src_path, O_RDONLY);
+    if (in < 0) return -1;
+
+    FILE *out = fopen(dst_path, "wb");
+    if (!out) {
+        fprintf(stderr, "ERROR: fopen failed for path '%s': %s\n", dst_path, strerror(errno));
+        close(in);
+        return -1;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    size_t buffer_size = 1024 * 1024;
+    char *buffer = safe_malloc(buffer_size);
+    off_t offset = 0;
+    int err = 0;
+    for (;;) {
+        ssize_t n = read(in, buffer, buffer_size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) err = -1;
+        if (n <= 0) break;
+
+        if (fwrite(buffer, 1, n, out) != (size_t)n) {
+            fprintf(stderr, "ERROR: fwrite incomplete for path '%s'\n", dst_path);
+            err = -1;
+            break;
+        }
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(in, offset, n, POSIX_FADV_DONTNEED);
+#endif
+        offset += n;
+    }
+
+    free(buffer);
+    close(in);
+    if (fclose(out) != 0) err = -1;
+    return err;
+}
+
+// Flush a file or directory to stable storage
+int fsync_path(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: fsync_path: cannot open '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    int err = fsync(fd) == 0 ? 0 : -1;
+    if (err != 0) {
+        fprintf(stderr, "ERROR: fsync_path: fsync failed for '%s': %s\n", path, strerror(errno));
+    }
+    close(fd);
+    return err;
+}
+
+// Replace path in one step: write a temporary file next to it, then rename it
+// over the old one. With sync set, the data and the directory entry are flushed
+// before returning, so a crash leaves either the old or the new content.
+int write_file_atomic(const char *path, const void *data, size_t size, int sync) {
+    char tmp_path[MAX_PATH];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp_XXXXXX", path) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "ERROR: write_file_atomic: path too long '%s'\n", path);
+        return -1;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: mkstemp failed for path '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int err = fchmod(fd, 0644) == 0 ? 0 : -1;
+    const char *ptr = data;
+    size_t remaining = size;
+    while (err == 0 && remaining > 0) {
+        ssize_t n = write(fd, ptr, remaining);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            err = -1;
+            break;
+        }
+        ptr += n;
+        remaining -= n;
+    }
+    if (err == 0 && sync && fsync(fd) != 0) err = -1;
+    if (close(fd) != 0) err = -1;
+    if (err == 0 && rename(tmp_path, path) != 0) err = -1;
+
+    if (err != 0) {
+        fprintf(stderr, "ERROR: write_file_atomic failed for path '%s': %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (sync) {
+        char dir_path[MAX_PATH];
+        snprintf(dir_path, sizeof(dir_path), "%s", path);
+        char *slash = strrchr(dir_path, '/');
+        if (slash) *slash = '\0';
+        return fsync_path(slash ? dir_path : ".");
+    }
+    return 0;
+}
+
 void get_git_timestamp(char *timestamp, size_t size) {
     time_t now = time(NULL);
     struct tm *tm_info = gmtime(&now);
@@ -104,17 +279,21 @@ void format_git_timestamp(const char *timestamp, char *formatted, size_t size) {
     }
 }
 
-void get_object_path(const char *sha1, char *path) {
-    snprintf(path, MAX_PATH, "%s/%.2s/%s", OBJECTS_DIR, sha1, sha1 + 2);
+void get_object_path(const object_id *oid, char *path) {
+    char hex[OID_MAX_HEX_SIZE];
+    oid_to_hex(oid, hex);
+    snprintf(path, MAX_PATH, "%s/%.2s/%s", OBJECTS_DIR, hex, hex + 2);
 }
 
 // Print commit hash with first 6 characters in orange
-void print_colored_hash(const char *sha1) {
-    if (!sha1 || strlen(sha1) < 6) {
-        printf("%s", sha1 ? sha1 : "(null)");
+void print_colored_oid(const object_id *oid) {
+    if (!oid) {
+        printf("(null)");
         return;
     }
 
     // Orange color ANSI escape code
-    printf("\x1b[38;5;208m%.6s\x1b[0m%s", sha1, sha1 + 6);
+    char hex[OID_MAX_HEX_SIZE];
+    oid_to_hex(oid, hex);
+    printf("\x1b[38;5;208m%.6s\x1b[0m%s", hex, hex + 6);
 }
\ No newline at end of file
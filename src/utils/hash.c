@@ -1,91 +1,562 @@
 #include "gitnano.h"
+#include <pthread.h>
 #include <openssl/evp.h>
 
-int sha1_file(const char *path, char *sha1_out) {
-    FILE *fp = fopen(path, "rb");
-    if (!fp) {
-        printf("ERROR: fopen: %d\n", -1);
-        return -1;
+// Object hashing.
+//
+// Each repository hashes its objects with one algorithm, recorded at init:
+// SHA-1 (the default, and what repositories without the setting use),
+// SHA-256 through OpenSSL, or BLAKE3 (blake3.c).
+//
+// SHA-1 backends:
+// On x86 CPUs with the SHA extensions the block function runs directly on
+// SHA-NI, with no OpenSSL call at all; hash_many() then interleaves two
+// messages so the round instructions of one hide the latency of the other.
+// Everywhere else OpenSSL does the work, with one EVP context kept per thread
+// and the digest fetched once. GITNANO_SHA1=openssl|shani forces a backend.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_HAVE_SHANI 1
+#include <immintrin.h>
+#endif
+
+#define SHA1_BLOCK_SIZE 64
+
+typedef enum {
+    HASH_BACKEND_OPENSSL,
+    HASH_BACKEND_SHANI,
+} hash_backend;
+
+static hash_backend active_backend = HASH_BACKEND_OPENSSL;
+static const EVP_MD *sha1_md = NULL;
+static const EVP_MD *sha256_md = NULL;
+static pthread_key_t thread_md_key;
+static pthread_key_t thread_blake3_key;
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+
+static const uint32_t sha1_initial_state[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+#ifdef HASH_HAVE_SHANI
+
+static int shani_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3") &&
+           __builtin_cpu_supports("sha");
+}
+
+// Four rounds once the message schedule is running: e_next takes the rounds,
+// e_save keeps ABCD for the next group, msg_a feeds the schedule of the others
+#define SHA1_ROUNDS4(abcd, e_next, e_save, msg_a, msg_b, msg_c, msg_d, f) \
+    do {                                                                \
+        e_next = _mm_sha1nexte_epu32(e_next, msg_a);                    \
+        e_save = abcd;                                                  \
+        msg_b = _mm_sha1msg2_epu32(msg_b, msg_a);                       \
+        abcd = _mm_sha1rnds4_epu32(abcd, e_next, f);                    \
+        msg_c = _mm_sha1msg1_epu32(msg_c, msg_a);                       \
+        msg_d = _mm_xor_si128(msg_d, msg_a);                            \
+    } while (0)
+
+// Declares the working registers of one message; L is the lane suffix
+#define SHA1_LANE_DECLARE(L) \
+    __m128i abcd##L, abcd_save##L, e0##L, e0_save##L, e1##L, m0##L, m1##L, m2##L, m3##L
+
+#define SHA1_LANE_LOAD(L, state) \
+    do { \
+        abcd##L = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state)), 0x1b); \
+        e0##L = _mm_set_epi32((int)(state)[4], 0, 0, 0); \
+    } while (0)
+
+#define SHA1_LANE_STORE(L, state) \
+    do { \
+        _mm_storeu_si128((__m128i *)(state), _mm_shuffle_epi32(abcd##L, 0x1b)); \
+        (state)[4] = (uint32_t)_mm_extract_epi32(e0##L, 3); \
+    } while (0)
+
+// 80 rounds over one 64-byte block
+#define SHA1_LANE_BLOCK(L, block, mask) \
+    do { \
+        abcd_save##L = abcd##L; \
+        e0_save##L = e0##L; \
+        m0##L = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)((block) + 0)), mask); \
+        m1##L = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)((block) + 16)), mask); \
+        m2##L = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)((block) + 32)), mask); \
+        m3##L = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)((block) + 48)), mask); \
+        /* Rounds 0-11 start the message schedule */ \
+        e0##L = _mm_add_epi32(e0##L, m0##L); \
+        e1##L = abcd##L; \
+        abcd##L = _mm_sha1rnds4_epu32(abcd##L, e0##L, 0); \
+        e1##L = _mm_sha1nexte_epu32(e1##L, m1##L); \
+        e0##L = abcd##L; \
+        abcd##L = _mm_sha1rnds4_epu32(abcd##L, e1##L, 0); \
+        m0##L = _mm_sha1msg1_epu32(m0##L, m1##L); \
+        e0##L = _mm_sha1nexte_epu32(e0##L, m2##L); \
+        e1##L = abcd##L; \
+        abcd##L = _mm_sha1rnds4_epu32(abcd##L, e0##L, 0); \
+        m1##L = _mm_sha1msg1_epu32(m1##L, m2##L); \
+        m0##L = _mm_xor_si128(m0##L, m2##L); \
+        /* Rounds 12-67 */ \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m3##L, m0##L, m2##L, m1##L, 0); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m0##L, m1##L, m3##L, m2##L, 0); \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m1##L, m2##L, m0##L, m3##L, 1); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m2##L, m3##L, m1##L, m0##L, 1); \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m3##L, m0##L, m2##L, m1##L, 1); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m0##L, m1##L, m3##L, m2##L, 1); \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m1##L, m2##L, m0##L, m3##L, 1); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m2##L, m3##L, m1##L, m0##L, 2); \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m3##L, m0##L, m2##L, m1##L, 2); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m0##L, m1##L, m3##L, m2##L, 2); \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m1##L, m2##L, m0##L, m3##L, 2); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m2##L, m3##L, m1##L, m0##L, 2); \
+        SHA1_ROUNDS4(abcd##L, e1##L, e0##L, m3##L, m0##L, m2##L, m1##L, 3); \
+        SHA1_ROUNDS4(abcd##L, e0##L, e1##L, m0##L, m1##L, m3##L, m2##L, 3); \
+        /* Rounds 68-79 drain the schedule */ \
+        e1##L = _mm_sha1nexte_epu32(e1##L, m1##L); \
+        e0##L = abcd##L; \
+        m2##L = _mm_sha1msg2_epu32(m2##L, m1##L); \
+        abcd##L = _mm_sha1rnds4_epu32(abcd##L, e1##L, 3); \
+        m3##L = _mm_xor_si128(m3##L, m1##L); \
+        e0##L = _mm_sha1nexte_epu32(e0##L, m2##L); \
+        e1##L = abcd##L; \
+        m3##L = _mm_sha1msg2_epu32(m3##L, m2##L); \
+        abcd##L = _mm_sha1rnds4_epu32(abcd##L, e0##L, 3); \
+        e1##L = _mm_sha1nexte_epu32(e1##L, m3##L); \
+        e0##L = abcd##L; \
+        abcd##L = _mm_sha1rnds4_epu32(abcd##L, e1##L, 3); \
+        e0##L = _mm_sha1nexte_epu32(e0##L, e0_save##L); \
+        abcd##L = _mm_add_epi32(abcd##L, abcd_save##L); \
+    } while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_blocks_shani(uint32_t state[5], const unsigned char *data, size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    SHA1_LANE_DECLARE(_a);
+
+    SHA1_LANE_LOAD(_a, state);
+    for (size_t i = 0; i < blocks; i++) {
+        SHA1_LANE_BLOCK(_a, data + i * SHA1_BLOCK_SIZE, mask);
     }
+    SHA1_LANE_STORE(_a, state);
+}
 
-    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
-    if (!md_ctx) {
-        printf("ERROR: EVP_MD_CTX_new: %d\n", -1);
-        fclose(fp);
-        return -1;
+// One block of each of two independent messages, interleaved
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_block_pair_shani(uint32_t state_a[5], const unsigned char *block_a,
+                                  uint32_t state_b[5], const unsigned char *block_b) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    SHA1_LANE_DECLARE(_a);
+    SHA1_LANE_DECLARE(_b);
+
+    SHA1_LANE_LOAD(_a, state_a);
+    SHA1_LANE_LOAD(_b, state_b);
+    SHA1_LANE_BLOCK(_a, block_a, mask);
+    SHA1_LANE_BLOCK(_b, block_b, mask);
+    SHA1_LANE_STORE(_a, state_a);
+    SHA1_LANE_STORE(_b, state_b);
+}
+
+#endif
+
+static void put_be32(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void free_thread_md(void *md_ctx) {
+    EVP_MD_CTX_free(md_ctx);
+}
+
+static void free_thread_blake3(void *hasher) {
+    blake3_hasher_free(hasher);
+}
+
+static void hash_init(void) {
+    pthread_key_create(&thread_md_key, free_thread_md);
+    pthread_key_create(&thread_blake3_key, free_thread_blake3);
+
+    // Fetch the digests once instead of on every EVP_DigestInit_ex
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    sha1_md = EVP_MD_fetch(NULL, "SHA1", NULL);
+    sha256_md = EVP_MD_fetch(NULL, "SHA256", NULL);
+#endif
+    if (!sha1_md) sha1_md = EVP_sha1();
+    if (!sha256_md) sha256_md = EVP_sha256();
+
+    const char *forced = getenv("GITNANO_SHA1");
+#ifdef HASH_HAVE_SHANI
+    if ((!forced || strcmp(forced, "openssl") != 0) && shani_supported()) {
+        active_backend = HASH_BACKEND_SHANI;
+        return;
     }
+#endif
+    if (forced && *forced && strcmp(forced, "openssl") != 0) {
+        fprintf(stderr, "WARNING: SHA-1 backend '%s' is not available, using openssl\n", forced);
+    }
+}
 
-    if (EVP_DigestInit_ex(md_ctx, EVP_sha1(), NULL) != 1) {
-        printf("ERROR: EVP_DigestInit_ex: %d\n", -1);
-        EVP_MD_CTX_free(md_ctx);
-        fclose(fp);
-        return -1;
+// Switch backend (for tests and benchmarks); -1 if the CPU lacks it
+int hash_select_backend(const char *name) {
+    pthread_once(&hash_once, hash_init);
+    if (strcmp(name, "openssl") == 0) {
+        active_backend = HASH_BACKEND_OPENSSL;
+        return 0;
+    }
+#ifdef HASH_HAVE_SHANI
+    if (strcmp(name, "shani") == 0 && shani_supported()) {
+        active_backend = HASH_BACKEND_SHANI;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+const char *hash_backend_name(void) {
+    pthread_once(&hash_once, hash_init);
+    return active_backend == HASH_BACKEND_SHANI ? "shani" : "openssl";
+}
+
+// Block-by-block view of one job's message (prefix, data and SHA-1 padding)
+typedef struct {
+    const hash_job *job;
+    uint32_t state[5];
+    int segment;           // 0: prefix, 1: data, 2: past the end
+    size_t offset;         // position in the current segment
+    int padded;            // the 0x80 marker has been emitted
+    int done;              // the length block has been emitted
+    unsigned char block[SHA1_BLOCK_SIZE];
+} sha1_stream;
+
+static void sha1_stream_init(sha1_stream *stream, const hash_job *job) {
+    memset(stream, 0, sizeof(*stream));
+    stream->job = job;
+    memcpy(stream->state, sha1_initial_state, sizeof(stream->state));
+    if (job->prefix_len == 0) stream->segment = 1;
+}
+
+// Pointer to the next block to compress, or NULL once the message is complete
+static const unsigned char *sha1_stream_next(sha1_stream *stream) {
+    if (stream->done) return NULL;
+
+    const unsigned char *segments[2] = {stream->job->prefix, stream->job->data};
+    size_t lengths[2] = {stream->job->prefix_len, stream->job->size};
+
+    // Whole blocks of a segment are compressed in place
+    if (stream->segment < 2 && lengths[stream->segment] - stream->offset >= SHA1_BLOCK_SIZE) {
+        const unsigned char *block = segments[stream->segment] + stream->offset;
+        stream->offset += SHA1_BLOCK_SIZE;
+        if (stream->offset == lengths[stream->segment]) {
+            stream->segment++;
+            stream->offset = 0;
+        }
+        return block;
     }
 
-    unsigned char buffer[8192];
-    size_t bytes_read;
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        if (EVP_DigestUpdate(md_ctx, buffer, bytes_read) != 1) {
-            printf("ERROR: EVP_DigestUpdate: %d\n", -1);
-            EVP_MD_CTX_free(md_ctx);
-            fclose(fp);
-            return -1;
+    size_t filled = 0;
+    while (stream->segment < 2 && filled < SHA1_BLOCK_SIZE) {
+        size_t take = lengths[stream->segment] - stream->offset;
+        if (take > SHA1_BLOCK_SIZE - filled) take = SHA1_BLOCK_SIZE - filled;
+        memcpy(stream->block + filled, segments[stream->segment] + stream->offset, take);
+        filled += take;
+        stream->offset += take;
+        if (stream->offset == lengths[stream->segment]) {
+            stream->segment++;
+            stream->offset = 0;
         }
     }
+    if (filled == SHA1_BLOCK_SIZE) return stream->block;
 
-    fclose(fp);
+    if (!stream->padded) {
+        stream->block[filled++] = 0x80;
+        stream->padded = 1;
+    }
+    memset(stream->block + filled, 0, SHA1_BLOCK_SIZE - filled);
+    if (filled <= SHA1_BLOCK_SIZE - 8) {
+        uint64_t bits = (uint64_t)(stream->job->prefix_len + stream->job->size) * 8;
+        put_be32(stream->block + 56, (uint32_t)(bits >> 32));
+        put_be32(stream->block + 60, (uint32_t)bits);
+        stream->done = 1;
+    }
+    return stream->block;
+}
+
+static void sha1_stream_digest(const sha1_stream *stream, unsigned char *digest_out) {
+    for (int i = 0; i < 5; i++) {
+        put_be32(digest_out + 4 * i, stream->state[i]);
+    }
+}
+
+// The calling thread's OpenSSL context, created on first use
+static EVP_MD_CTX *thread_md_ctx(void) {
+    EVP_MD_CTX *md_ctx = pthread_getspecific(thread_md_key);
+    if (!md_ctx) {
+        md_ctx = EVP_MD_CTX_new();
+        if (!md_ctx) {
+            printf("ERROR: EVP_MD_CTX_new: %d\n", -1);
+            return NULL;
+        }
+        pthread_setspecific(thread_md_key, md_ctx);
+    }
+    return md_ctx;
+}
+
+static int hash_job_openssl(const EVP_MD *md, const hash_job *job) {
+    EVP_MD_CTX *md_ctx = thread_md_ctx();
+    if (!md_ctx) return -1;
 
-    unsigned char digest[EVP_MAX_MD_SIZE];
     unsigned int digest_len;
-    if (EVP_DigestFinal_ex(md_ctx, digest, &digest_len) != 1) {
-        printf("ERROR: EVP_DigestFinal_ex: %d\n", -1);
-        EVP_MD_CTX_free(md_ctx);
+    if (EVP_DigestInit_ex(md_ctx, md, NULL) != 1 ||
+        (job->prefix_len > 0 && EVP_DigestUpdate(md_ctx, job->prefix, job->prefix_len) != 1) ||
+        (job->size > 0 && EVP_DigestUpdate(md_ctx, job->data, job->size) != 1) ||
+        EVP_DigestFinal_ex(md_ctx, job->digest_out, &digest_len) != 1) {
+        printf("ERROR: EVP_Digest: %d\n", -1);
         return -1;
     }
+    return 0;
+}
 
-    EVP_MD_CTX_free(md_ctx);
+static void hash_job_blake3(const hash_job *job) {
+    blake3_hasher *hasher = pthread_getspecific(thread_blake3_key);
+    if (!hasher) {
+        hasher = blake3_hasher_new();
+        pthread_setspecific(thread_blake3_key, hasher);
+    }
+    blake3_hasher_reset(hasher);
+    blake3_hasher_update(hasher, job->prefix, job->prefix_len);
+    blake3_hasher_update(hasher, job->data, job->size);
+    blake3_hasher_final(hasher, job->digest_out);
+}
+
+// Digest each job's prefix followed by its data, in one call
+int hash_many(hash_algo algo, const hash_job *jobs, size_t count) {
+    pthread_once(&hash_once, hash_init);
+
+    if (algo == HASH_BLAKE3) {
+        for (size_t i = 0; i < count; i++) hash_job_blake3(&jobs[i]);
+        return 0;
+    }
+    if (algo == HASH_SHA256) {
+        for (size_t i = 0; i < count; i++) {
+            if (hash_job_openssl(sha256_md, &jobs[i]) != 0) return -1;
+        }
+        return 0;
+    }
+
+#ifdef HASH_HAVE_SHANI
+    if (active_backend == HASH_BACKEND_SHANI) {
+        size_t i = 0;
+        for (; i + 1 < count; i += 2) {
+            sha1_stream a, b;
+            sha1_stream_init(&a, &jobs[i]);
+            sha1_stream_init(&b, &jobs[i + 1]);
+
+            const unsigned char *block_a = sha1_stream_next(&a);
+            const unsigned char *block_b = sha1_stream_next(&b);
+            while (block_a && block_b) {
+                sha1_block_pair_shani(a.state, block_a, b.state, block_b);
+                block_a = sha1_stream_next(&a);
+                block_b = sha1_stream_next(&b);
+            }
+            for (; block_a; block_a = sha1_stream_next(&a)) sha1_blocks_shani(a.state, block_a, 1);
+            for (; block_b; block_b = sha1_stream_next(&b)) sha1_blocks_shani(b.state, block_b, 1);
 
-    for (unsigned int i = 0; i < digest_len; i++) {
-        sprintf(sha1_out + (i * 2), "%02x", digest[i]);
+            sha1_stream_digest(&a, jobs[i].digest_out);
+            sha1_stream_digest(&b, jobs[i + 1].digest_out);
+        }
+        if (i < count) {
+            sha1_stream s;
+            sha1_stream_init(&s, &jobs[i]);
+            for (const unsigned char *block; (block = sha1_stream_next(&s)) != NULL;) {
+                sha1_blocks_shani(s.state, block, 1);
+            }
+            sha1_stream_digest(&s, jobs[i].digest_out);
+        }
+        return 0;
     }
-    sha1_out[SHA1_HEX_SIZE - 1] = '\0';
+#endif
 
+    for (size_t i = 0; i < count; i++) {
+        if (hash_job_openssl(sha1_md, &jobs[i]) != 0) return -1;
+    }
     return 0;
 }
 
+// Digest of prefix followed by data (either may be empty)
+int hash_data(hash_algo algo, const void *prefix, size_t prefix_len, const void *data, size_t size,
+              unsigned char *digest_out) {
+    hash_job job = {prefix, prefix_len, data, size, digest_out};
+    return hash_many(algo, &job, 1);
+}
+
+int sha1_file(const char *path, char *sha1_out) {
+    mapped_file file;
+    if (mapped_file_open(path, &file) != 0) {
+        printf("ERROR: mapped_file_open: %d\n", -1);
+        return -1;
+    }
+
+    int err = sha1_data(file.data, file.size, sha1_out);
+    mapped_file_close(&file);
+    return err;
+}
+
 int sha1_data(const void *data, size_t size, char *sha1_out) {
-    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
-    if (!md_ctx) {
+    unsigned char digest[SHA1_RAW_SIZE];
+    if (hash_data(HASH_SHA1, NULL, 0, data, size, digest) != 0) return -1;
+
+    binary_to_hex(digest, sha1_out);
+    return 0;
+}
+
+// Incremental hashing for data produced in pieces (pack files, streamed objects)
+struct hash_ctx {
+    hash_algo algo;
+    int native;            // SHA-NI state below, else md_ctx or blake3
+    EVP_MD_CTX *md_ctx;
+    blake3_hasher *blake3;
+    uint32_t state[5];
+    uint64_t length;
+    unsigned char buffer[SHA1_BLOCK_SIZE];
+    size_t buffered;
+};
+
+// Start a new digest, keeping the context's allocations
+int hash_ctx_reset(hash_ctx *ctx) {
+    pthread_once(&hash_once, hash_init);
+
+    if (ctx->algo == HASH_BLAKE3) {
+        if (!ctx->blake3) ctx->blake3 = blake3_hasher_new();
+        blake3_hasher_reset(ctx->blake3);
+        return 0;
+    }
+
+    ctx->native = ctx->algo == HASH_SHA1 && active_backend == HASH_BACKEND_SHANI;
+    if (ctx->native) {
+        memcpy(ctx->state, sha1_initial_state, sizeof(ctx->state));
+        ctx->length = 0;
+        ctx->buffered = 0;
+        return 0;
+    }
+
+    if (!ctx->md_ctx && !(ctx->md_ctx = EVP_MD_CTX_new())) {
         printf("ERROR: EVP_MD_CTX_new: %d\n", -1);
         return -1;
     }
-
-    if (EVP_DigestInit_ex(md_ctx, EVP_sha1(), NULL) != 1) {
+    if (EVP_DigestInit_ex(ctx->md_ctx, ctx->algo == HASH_SHA256 ? sha256_md : sha1_md, NULL) != 1) {
         printf("ERROR: EVP_DigestInit_ex: %d\n", -1);
-        EVP_MD_CTX_free(md_ctx);
         return -1;
     }
+    return 0;
+}
+
+hash_ctx *hash_ctx_new(hash_algo algo) {
+    hash_ctx *ctx = safe_malloc(sizeof(hash_ctx));
+    memset(ctx, 0, sizeof(hash_ctx));
+    ctx->algo = algo;
+    if (hash_ctx_reset(ctx) != 0) {
+        hash_ctx_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int hash_ctx_update(hash_ctx *ctx, const void *data, size_t size) {
+    if (ctx->algo == HASH_BLAKE3) {
+        blake3_hasher_update(ctx->blake3, data, size);
+        return 0;
+    }
+#ifdef HASH_HAVE_SHANI
+    if (ctx->native) {
+        const unsigned char *bytes = data;
+        ctx->length += size;
+
+        if (ctx->buffered > 0) {
+            size_t take = SHA1_BLOCK_SIZE - ctx->buffered;
+            if (take > size) take = size;
+            memcpy(ctx->buffer + ctx->buffered, bytes, take);
+            ctx->buffered += take;
+            bytes += take;
+            size -= take;
+            if (ctx->buffered < SHA1_BLOCK_SIZE) return 0;
+            sha1_blocks_shani(ctx->state, ctx->buffer, 1);
+            ctx->buffered = 0;
+        }
+
+        size_t blocks = size / SHA1_BLOCK_SIZE;
+        if (blocks > 0) sha1_blocks_shani(ctx->state, bytes, blocks);
+        memcpy(ctx->buffer, bytes + blocks * SHA1_BLOCK_SIZE, size % SHA1_BLOCK_SIZE);
+        ctx->buffered = size % SHA1_BLOCK_SIZE;
+        return 0;
+    }
+#endif
 
-    if (EVP_DigestUpdate(md_ctx, data, size) != 1) {
+    if (EVP_DigestUpdate(ctx->md_ctx, data, size) != 1) {
         printf("ERROR: EVP_DigestUpdate: %d\n", -1);
-        EVP_MD_CTX_free(md_ctx);
         return -1;
     }
+    return 0;
+}
+
+// Write the raw digest (hash_algo_raw_size bytes)
+int hash_ctx_final(hash_ctx *ctx, unsigned char *digest_out) {
+    if (ctx->algo == HASH_BLAKE3) {
+        blake3_hasher_final(ctx->blake3, digest_out);
+        return 0;
+    }
+    if (ctx->native) {
+        // The buffered tail goes through the one-shot padding logic
+        hash_job tail = {NULL, 0, ctx->buffer, ctx->buffered, digest_out};
+        sha1_stream stream;
+        sha1_stream_init(&stream, &tail);
+        memcpy(stream.state, ctx->state, sizeof(stream.state));
+
+        const unsigned char *block;
+        uint64_t bits = ctx->length * 8;
+        while ((block = sha1_stream_next(&stream)) != NULL) {
+            if (stream.done) {
+                // The stream only counted the tail: patch in the full length
+                put_be32(stream.block + 56, (uint32_t)(bits >> 32));
+                put_be32(stream.block + 60, (uint32_t)bits);
+            }
+#ifdef HASH_HAVE_SHANI
+            sha1_blocks_shani(stream.state, block, 1);
+#endif
+        }
+        sha1_stream_digest(&stream, digest_out);
+        return 0;
+    }
 
     unsigned char digest[EVP_MAX_MD_SIZE];
     unsigned int digest_len;
-    if (EVP_DigestFinal_ex(md_ctx, digest, &digest_len) != 1) {
+    if (EVP_DigestFinal_ex(ctx->md_ctx, digest, &digest_len) != 1) {
         printf("ERROR: EVP_DigestFinal_ex: %d\n", -1);
-        EVP_MD_CTX_free(md_ctx);
         return -1;
     }
 
-    EVP_MD_CTX_free(md_ctx);
+    memcpy(digest_out, digest, hash_algo_raw_size(ctx->algo));
+    return 0;
+}
 
-    for (unsigned int i = 0; i < digest_len; i++) {
-        sprintf(sha1_out + (i * 2), "%02x", digest[i]);
+void hash_ctx_free(hash_ctx *ctx) {
+    if (ctx) {
+        EVP_MD_CTX_free(ctx->md_ctx);
+        blake3_hasher_free(ctx->blake3);
+        free(ctx);
     }
-    sha1_out[SHA1_HEX_SIZE - 1] = '\0';
+}
 
-    return 0;
-}
\ No newline at end of file
+static const char *const hash_algo_names[] = {"sha1", "sha256", "blake3"};
+
+const char *hash_algo_name(hash_algo algo) {
+    return hash_algo_names[algo];
+}
+
+// Algorithm for an object_format name, -1 if unknown
+int hash_algo_by_name(const char *name) {
+    for (int i = 0; i < HASH_ALGO_COUNT; i++) {
+        if (strcmp(name, hash_algo_names[i]) == 0) return i;
+    }
+    return -1;
+}
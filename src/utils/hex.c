@@ -0,0 +1,261 @@
+#include "gitnano.h"
+#include <pthread.h>
+
+// Hex encoding and decoding of object ids.
+//
+// The portable kernels are table driven: one lookup per byte to encode, one
+// per digit to decode and validate. On x86 the SSSE3 and AVX2 kernels handle
+// 16 bytes (32 digits) per step and the scalar code finishes the tail; the
+// kernel is picked once from the CPU features, or forced with
+// GITNANO_HEX_KERNEL=scalar|ssse3|avx2.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEX_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Both digits of every byte, so encoding is one 16-bit copy per byte
+static char hex_pairs[256][2];
+
+// Value of each hex digit (either case), -1 for anything else
+static signed char hex_values[256];
+
+typedef void (*hex_encode_fn)(const unsigned char *binary, size_t size, char *hex_out);
+typedef int (*hex_decode_fn)(const char *hex, size_t size, unsigned char *binary_out);
+
+typedef struct {
+    const char *name;
+    hex_encode_fn encode;
+    hex_decode_fn decode;
+    int (*supported)(void);
+} hex_kernel;
+
+static const hex_kernel *active_kernel;
+static pthread_once_t hex_once = PTHREAD_ONCE_INIT;
+
+static void hex_encode_scalar(const unsigned char *binary, size_t size, char *hex_out) {
+    for (size_t i = 0; i < size; i++) {
+        memcpy(hex_out + 2 * i, hex_pairs[binary[i]], 2);
+    }
+}
+
+static int hex_decode_scalar(const char *hex, size_t size, unsigned char *binary_out) {
+    for (size_t i = 0; i < size; i++) {
+        int hi = hex_values[(unsigned char)hex[2 * i]];
+        int lo = hex_values[(unsigned char)hex[2 * i + 1]];
+        if ((hi | lo) < 0) return -1;
+        binary_out[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return 0;
+}
+
+static int hex_always_supported(void) {
+    return 1;
+}
+
+#ifdef HEX_HAVE_X86
+
+static int hex_ssse3_supported(void) {
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int hex_avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("ssse3")))
+static void hex_encode_ssse3(const unsigned char *binary, size_t size, char *hex_out) {
+    const __m128i digits = _mm_loadu_si128((const __m128i *)hex_digits);
+    const __m128i low_nibble = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(binary + i));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, low_nibble));
+        _mm_storeu_si128((__m128i *)(hex_out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(hex_out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    hex_encode_scalar(binary + i, size - i, hex_out + 2 * i);
+}
+
+// Digit values of 16 characters; *valid gets a mask with a bit per hex digit
+__attribute__((target("ssse3")))
+static inline __m128i hex_values_ssse3(__m128i chars, int *valid) {
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+    *valid = _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter));
+    return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                        _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("ssse3")))
+static int hex_decode_ssse3(const char *hex, size_t size, unsigned char *binary_out) {
+    // Multiply the high digit of each pair by 16 and add the low one
+    const __m128i weights = _mm_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        int valid_a, valid_b;
+        __m128i a = hex_values_ssse3(_mm_loadu_si128((const __m128i *)(hex + 2 * i)), &valid_a);
+        __m128i b = hex_values_ssse3(_mm_loadu_si128((const __m128i *)(hex + 2 * i + 16)), &valid_b);
+        if ((valid_a & valid_b) != 0xffff) return -1;
+
+        __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights));
+        _mm_storeu_si128((__m128i *)(binary_out + i), bytes);
+    }
+    return hex_decode_scalar(hex + 2 * i, size - i, binary_out + i);
+}
+
+__attribute__((target("avx2")))
+static void hex_encode_avx2(const unsigned char *binary, size_t size, char *hex_out) {
+    const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hex_digits));
+    const __m256i low_nibble = _mm256_set1_epi16(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        // Widen each byte to 16 bits holding the high digit index below the low one
+        __m256i words = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(binary + i)));
+        __m256i indexes = _mm256_or_si256(_mm256_srli_epi16(words, 4),
+                                          _mm256_slli_epi16(_mm256_and_si256(words, low_nibble), 8));
+        _mm256_storeu_si256((__m256i *)(hex_out + 2 * i), _mm256_shuffle_epi8(digits, indexes));
+    }
+    hex_encode_scalar(binary + i, size - i, hex_out + 2 * i);
+}
+
+__attribute__((target("avx2")))
+static int hex_decode_avx2(const char *hex, size_t size, unsigned char *binary_out) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m256i chars = _mm256_loadu_si256((const __m256i *)(hex + 2 * i));
+        __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+        __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+        __m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != 0xffffffffu) return -1;
+
+        __m256i values = _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                                         _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+        __m256i words = _mm256_maddubs_epi16(values, weights);
+
+        // Packing works per 128-bit lane: gather the two useful quarters
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+        _mm_storeu_si128((__m128i *)(binary_out + i), _mm256_castsi256_si128(packed));
+    }
+    return hex_decode_scalar(hex + 2 * i, size - i, binary_out + i);
+}
+
+#endif
+
+// Fastest first
+static const hex_kernel hex_kernels[] = {
+#ifdef HEX_HAVE_X86
+    {"avx2", hex_encode_avx2, hex_decode_avx2, hex_avx2_supported},
+    {"ssse3", hex_encode_ssse3, hex_decode_ssse3, hex_ssse3_supported},
+#endif
+    {"scalar", hex_encode_scalar, hex_decode_scalar, hex_always_supported},
+};
+
+#define HEX_KERNEL_COUNT (sizeof(hex_kernels) / sizeof(hex_kernels[0]))
+
+static void hex_init(void) {
+    for (int i = 0; i < 256; i++) {
+        hex_pairs[i][0] = hex_digits[i >> 4];
+        hex_pairs[i][1] = hex_digits[i & 0x0f];
+        hex_values[i] = -1;
+    }
+    for (int i = 0; i < 16; i++) {
+        hex_values[(unsigned char)hex_digits[i]] = i;
+        if (i >= 10) hex_values[(unsigned char)(hex_digits[i] - 'a' + 'A')] = i;
+    }
+
+    const char *forced = getenv("GITNANO_HEX_KERNEL");
+    for (size_t i = 0; i < HEX_KERNEL_COUNT; i++) {
+        if (!hex_kernels[i].supported()) continue;
+        if (forced && *forced && strcmp(forced, hex_kernels[i].name) != 0) continue;
+        active_kernel = &hex_kernels[i];
+        break;
+    }
+    if (!active_kernel) {
+        fprintf(stderr, "WARNING: hex kernel '%s' is not available, using scalar\n", forced);
+        active_kernel = &hex_kernels[HEX_KERNEL_COUNT - 1];
+    }
+}
+
+static const hex_kernel *hex_kernel_get(void) {
+    pthread_once(&hex_once, hex_init);
+    return active_kernel;
+}
+
+// Switch to the named kernel (for tests and benchmarks); -1 if the CPU lacks it
+int hex_select_kernel(const char *name) {
+    hex_kernel_get();
+    for (size_t i = 0; i < HEX_KERNEL_COUNT; i++) {
+        if (strcmp(hex_kernels[i].name, name) == 0) {
+            if (!hex_kernels[i].supported()) return -1;
+            active_kernel = &hex_kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *hex_kernel_name(void) {
+    return hex_kernel_get()->name;
+}
+
+// Write 2 * size lowercase digits (no terminator)
+void hex_encode(const unsigned char *binary, size_t size, char *hex_out) {
+    hex_kernel_get()->encode(binary, size, hex_out);
+}
+
+// Read 2 * size digits of either case; -1 on anything that is not a hex digit
+int hex_decode(const char *hex, size_t size, unsigned char *binary_out) {
+    return hex_kernel_get()->decode(hex, size, binary_out);
+}
+
+// Number of leading hex digits in str
+size_t hex_span(const char *str) {
+    hex_kernel_get();
+    size_t len = 0;
+    while (hex_values[(unsigned char)str[len]] >= 0) len++;
+    return len;
+}
+
+// Convert hex SHA1 to its 20-byte binary form (the input must be valid hex)
+void hex_to_binary(const char *hex, unsigned char *binary) {
+    hex_decode(hex, SHA1_RAW_SIZE, binary);
+}
+
+// Convert a 20-byte binary SHA1 to a NUL-terminated hex string
+void binary_to_hex(const unsigned char *binary, char *hex) {
+    hex_encode(binary, SHA1_RAW_SIZE, hex);
+    hex[SHA1_HEX_SIZE - 1] = '\0';
+}
+
+char *oid_to_hex(const object_id *oid, char *hex_out) {
+    size_t size = oid_raw_size(oid);
+    hex_encode(oid->hash, size, hex_out);
+    hex_out[2 * size] = '\0';
+    return hex_out;
+}
+
+// Parse a full hex name in the repository's object format; anything else is rejected
+int oid_from_hex(const char *hex, object_id *oid_out) {
+    hash_algo algo = repo_hash_algo();
+    size_t size = hash_algo_raw_size(algo);
+
+    // Checking the length first keeps the vector loads inside the string
+    if (memchr(hex, '\0', 2 * size)) return -1;
+    oid_clear(oid_out);
+    oid_out->algo = algo;
+    if (hex_decode(hex, size, oid_out->hash) != 0) return -1;
+    return hex_values[(unsigned char)hex[2 * size]] < 0 ? 0 : -1;
+}
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "gitnano.h"
+#include <pthread.h>
+
+// Fixed set of worker threads that run batches of indexed tasks.
+// thread_pool_run blocks until every task of the batch has finished.
+
+struct thread_pool {
+    pthread_t *threads;
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    // Current batch
+    int (*fn)(size_t index, void *ctx);
+    void *ctx;
+    size_t count;
+    size_t next;
+    size_t finished;
+    int error;
+    int shutdown;
+};
+
+// Worker count from GITNANO_THREADS, defaulting to the online CPUs
+int thread_pool_default_size(void) {
+    const char *value = getenv("GITNANO_THREADS");
+    if (value && *value) {
+        int threads = atoi(value);
+        if (threads > 0) return threads;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Claim and run tasks of the current batch until none are left
+static void run_tasks(thread_pool *pool) {
+    while (pool->next < pool->count) {
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        int err = pool->fn(index, pool->ctx);
+        pthread_mutex_lock(&pool->lock);
+
+        if (err != 0 && pool->error == 0) pool->error = err;
+        if (++pool->finished == pool->count) {
+            pthread_cond_broadcast(&pool->work_done);
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    thread_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->next >= pool->count) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        run_tasks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Create a pool; with one thread, tasks run inline on the caller
+thread_pool *thread_pool_new(int threads) {
+    thread_pool *pool = safe_malloc(sizeof(thread_pool));
+    memset(pool, 0, sizeof(thread_pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    // The calling thread also runs tasks, so it counts as one worker
+    if (threads > 1) {
+        pool->threads = safe_malloc((threads - 1) * sizeof(pthread_t));
+        for (int i = 0; i < threads - 1; i++) {
+            if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+                fprintf(stderr, "WARNING: thread_pool_new: started %d of %d threads\n", i + 1, threads);
+                break;
+            }
+            pool->thread_count++;
+        }
+    }
+    return pool;
+}
+
+// Run fn(0..count-1) across the pool; returns the first error reported
+int thread_pool_run(thread_pool *pool, size_t count, int (*fn)(size_t index, void *ctx), void *ctx) {
+    if (count == 0) return 0;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->count = count;
+    pool->next = 0;
+    pool->finished = 0;
+    pool->error = 0;
+    pthread_cond_broadcast(&pool->work_ready);
+
+    run_tasks(pool);
+    while (pool->finished < pool->count) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+
+    int err = pool->error;
+    pool->count = 0;
+    pool->next = 0;
+    pthread_mutex_unlock(&pool->lock);
+    return err;
+}
+
+int thread_pool_size(const thread_pool *pool) {
+    return pool->thread_count + 1;
+}
+
+void thread_pool_free(thread_pool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool);
+}
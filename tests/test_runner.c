@@ -1,11 +1,17 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include "../include/gitnano.h"
 #include "../include/memory.h"
+#include "../include/index.h"
+#include "../include/commit_graph.h"
 
 // Global test configuration
 static char original_cwd[MAX_PATH];
@@ -80,6 +86,463 @@ int test_blob_operations() {
     // Commit
     TEST_ASSERT(gitnano_commit("Test commit") == 0, "Create commit");
 
+    // Every integrity level accepts a good write
+    const char *levels[] = {"none", "checksum", "full"};
+    for (int i = 0; i < 3; i++) {
+        object_id oid;
+        char content[64];
+        snprintf(content, sizeof(content), "Integrity level %s", levels[i]);
+        setenv("GITNANO_INTEGRITY", levels[i], 1);
+        TEST_ASSERT(object_integrity_level() == (integrity_level)i, "Integrity level read from environment");
+        TEST_ASSERT(blob_write(content, strlen(content), &oid) == 0, "Write blob with integrity level");
+        TEST_ASSERT(blob_exists(&oid), "Blob written with integrity level exists");
+    }
+    unsetenv("GITNANO_INTEGRITY");
+
+    // Streaming writes in pieces produce the same object as a single write
+    const char *pieces[] = {"Streamed ", "object ", "content"};
+    object_id streamed_oid, whole_oid;
+    object_writer *writer = object_writer_begin("blob", strlen("Streamed object content"));
+    TEST_ASSERT(writer != NULL, "Begin streaming object write");
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT(object_writer_update(writer, pieces[i], strlen(pieces[i])) == 0, "Stream object piece");
+    }
+    TEST_ASSERT(object_writer_finish(writer, &streamed_oid) == 0, "Finish streaming object write");
+    TEST_ASSERT(object_hash("blob", "Streamed object content", strlen("Streamed object content"), &whole_oid) == 0,
+                "Hash object in one piece");
+    TEST_ASSERT(oid_equal(&streamed_oid, &whole_oid), "Streamed object id matches");
+
+    // Object ids round-trip through hex and reject malformed names
+    char oid_hex[OID_MAX_HEX_SIZE];
+    object_id parsed_oid;
+    TEST_ASSERT(oid_from_hex(oid_to_hex(&whole_oid, oid_hex), &parsed_oid) == 0 && oid_equal(&parsed_oid, &whole_oid),
+                "Object id round-trips through hex");
+    TEST_ASSERT(oid_from_hex("1234", &parsed_oid) != 0, "Short hex id is rejected");
+    oid_hex[7] = 'g';
+    TEST_ASSERT(oid_from_hex(oid_hex, &parsed_oid) != 0, "Non-hex id is rejected");
+    oid_clear(&parsed_oid);
+    TEST_ASSERT(oid_is_null(&parsed_oid) && !oid_is_null(&whole_oid), "Null object id");
+
+    // Every hex kernel the CPU offers agrees with the table-driven one
+    const char *default_kernel = hex_kernel_name();
+    const char *kernels[] = {"scalar", "ssse3", "avx2"};
+    unsigned char hex_in[37], hex_back[37];
+    char hex_ref[2 * sizeof(hex_in)], hex_out[2 * sizeof(hex_in)];
+    for (size_t i = 0; i < sizeof(hex_in); i++) hex_in[i] = (unsigned char)(i * 73 + 11);
+    TEST_ASSERT(hex_select_kernel("scalar") == 0, "Select scalar hex kernel");
+    hex_encode(hex_in, sizeof(hex_in), hex_ref);
+    for (int k = 0; k < 3; k++) {
+        if (hex_select_kernel(kernels[k]) != 0) continue;
+        printf("  INFO: checking %s hex kernel\n", kernels[k]);
+        hex_encode(hex_in, sizeof(hex_in), hex_out);
+        TEST_ASSERT(memcmp(hex_out, hex_ref, sizeof(hex_out)) == 0, "Hex kernel encodes like the table");
+        hex_out[4] = 'A';
+        hex_out[5] = 'f';
+        TEST_ASSERT(hex_decode(hex_out, sizeof(hex_in), hex_back) == 0 && hex_back[2] == 0xaf &&
+                    memcmp(hex_back, hex_in, 2) == 0 && memcmp(hex_back + 3, hex_in + 3, sizeof(hex_in) - 3) == 0,
+                    "Hex kernel decodes either case");
+        hex_out[40] = 'x';
+        TEST_ASSERT(hex_decode(hex_out, sizeof(hex_in), hex_back) != 0, "Hex kernel rejects a bad digit");
+        memcpy(hex_out, hex_ref, sizeof(hex_out));
+        hex_out[70] = '/';
+        TEST_ASSERT(hex_decode(hex_out, sizeof(hex_in), hex_back) != 0, "Hex kernel rejects a bad tail digit");
+    }
+    hex_select_kernel(default_kernel);
+
+    // Native SHA-1 agrees with OpenSSL around every padding boundary, one-shot,
+    // incremental and batched
+    const char *default_backend = hash_backend_name();
+    unsigned char hash_in[200];
+    for (size_t i = 0; i < sizeof(hash_in); i++) hash_in[i] = (unsigned char)(i * 31 + 7);
+    size_t hash_sizes[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 200};
+    size_t hash_count = sizeof(hash_sizes) / sizeof(hash_sizes[0]);
+    unsigned char hash_ref[11][SHA1_RAW_SIZE], hash_out[11][SHA1_RAW_SIZE];
+    TEST_ASSERT(hash_select_backend("openssl") == 0, "Select OpenSSL SHA-1 backend");
+    for (size_t i = 0; i < hash_count; i++) {
+        hash_data(HASH_SHA1, "blob 9", 6, hash_in, hash_sizes[i], hash_ref[i]);
+    }
+    if (hash_select_backend("shani") == 0) {
+        printf("  INFO: checking shani SHA-1 backend\n");
+        int agree = 1;
+        for (size_t i = 0; i < hash_count; i++) {
+            hash_data(HASH_SHA1, "blob 9", 6, hash_in, hash_sizes[i], hash_out[i]);
+            agree &= memcmp(hash_out[i], hash_ref[i], SHA1_RAW_SIZE) == 0;
+
+            hash_ctx *ctx = hash_ctx_new(HASH_SHA1);
+            hash_ctx_update(ctx, "blob 9", 6);
+            for (size_t pos = 0; pos < hash_sizes[i]; pos += 17) {
+                hash_ctx_update(ctx, hash_in + pos, hash_sizes[i] - pos < 17 ? hash_sizes[i] - pos : 17);
+            }
+            hash_ctx_final(ctx, hash_out[i]);
+            hash_ctx_free(ctx);
+            agree &= memcmp(hash_out[i], hash_ref[i], SHA1_RAW_SIZE) == 0;
+        }
+        TEST_ASSERT(agree, "SHA-NI digests match OpenSSL");
+    }
+    for (int b = 0; b < 2; b++) {
+        if (hash_select_backend(b == 0 ? "openssl" : "shani") != 0) continue;
+        hash_job jobs[11];
+        memset(hash_out, 0, sizeof(hash_out));
+        for (size_t i = 0; i < hash_count; i++) {
+            jobs[i] = (hash_job){"blob 9", 6, hash_in, hash_sizes[i], hash_out[i]};
+        }
+        TEST_ASSERT(hash_many(HASH_SHA1, jobs, hash_count) == 0 && memcmp(hash_out, hash_ref, sizeof(hash_out)) == 0,
+                    "Batched digests match one-shot ones");
+    }
+    hash_select_backend(default_backend);
+
+    // BLAKE3 matches the reference vectors, and large incremental updates match one-shot hashing
+    unsigned char b3_out[32], b3_ref[32];
+    char b3_hex[64];
+    hash_data(HASH_BLAKE3, NULL, 0, "", 0, b3_out);
+    hex_encode(b3_out, 32, b3_hex);
+    TEST_ASSERT(memcmp(b3_hex, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262", 64) == 0,
+                "BLAKE3 of empty input");
+    hash_data(HASH_BLAKE3, NULL, 0, "abc", 3, b3_out);
+    hex_encode(b3_out, 32, b3_hex);
+    TEST_ASSERT(memcmp(b3_hex, "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85", 64) == 0,
+                "BLAKE3 of \"abc\"");
+    size_t b3_size = 3 * 1024 * 1024 + 123;
+    unsigned char *b3_in = safe_malloc(b3_size);
+    for (size_t i = 0; i < b3_size; i++) b3_in[i] = (unsigned char)(i % 251);
+
+    // Official vectors (input bytes i % 251) covering chunk and subtree boundaries
+    static const struct {
+        size_t size;
+        const char *hex;
+    } b3_vectors[] = {
+        {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+        {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+        {3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+        {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+    };
+    int b3_vectors_ok = 1;
+    for (size_t i = 0; i < sizeof(b3_vectors) / sizeof(b3_vectors[0]); i++) {
+        hash_data(HASH_BLAKE3, NULL, 0, b3_in, b3_vectors[i].size, b3_out);
+        hex_encode(b3_out, 32, b3_hex);
+        if (memcmp(b3_hex, b3_vectors[i].hex, 64) != 0) {
+            printf("  INFO: BLAKE3 mismatch at %zu bytes\n", b3_vectors[i].size);
+            b3_vectors_ok = 0;
+        }
+    }
+    TEST_ASSERT(b3_vectors_ok, "BLAKE3 of multi-chunk reference inputs");
+
+    hash_data(HASH_BLAKE3, NULL, 0, b3_in, b3_size, b3_ref);
+    hash_ctx *b3_ctx = hash_ctx_new(HASH_BLAKE3);
+    for (size_t pos = 0; pos < b3_size; pos += 777) {
+        hash_ctx_update(b3_ctx, b3_in + pos, b3_size - pos < 777 ? b3_size - pos : 777);
+    }
+    hash_ctx_final(b3_ctx, b3_out);
+    hash_ctx_free(b3_ctx);
+    free(b3_in);
+    TEST_ASSERT(memcmp(b3_out, b3_ref, 32) == 0, "Incremental BLAKE3 matches one-shot");
+
+    char *read_back = NULL;
+    size_t read_size = 0;
+    TEST_ASSERT(blob_read(&streamed_oid, &read_back, &read_size) == 0 &&
+                read_size == strlen("Streamed object content") &&
+                memcmp(read_back, "Streamed object content", read_size) == 0, "Streamed object reads back");
+    free(read_back);
+
+    // Only header lines are parsed; a message mentioning "parent " stays a root commit
+    char root_text[256], root_hex[OID_MAX_HEX_SIZE];
+    object_id root_tree, root_commit;
+    gitnano_commit_info root_info;
+    TEST_ASSERT(blob_write("Root tree stand-in", strlen("Root tree stand-in"), &root_tree) == 0,
+                "Write object for commit tree");
+    int root_len = snprintf(root_text, sizeof(root_text), "tree %s\nauthor tester 1700000000\n\n"
+                            "fix the parent directory handling\n", oid_to_hex(&root_tree, root_hex));
+    TEST_ASSERT(object_write("commit", root_text, root_len, &root_commit) == 0 &&
+                commit_parse(&root_commit, &root_info) == 0 && oid_is_null(&root_info.parent_oid) &&
+                oid_equal(&root_info.tree_oid, &root_tree) &&
+                strcmp(root_info.message, "fix the parent directory handling") == 0,
+                "Commit message is not parsed as a header");
+
+    // Incompressible data is stored as-is and still reads back
+    unsigned char noise[16384];
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = seed >> 24;
+    }
+    const char *text = "GitNano compresses text like this sentence, repeated. GitNano compresses text like this sentence, repeated. "
+                       "GitNano compresses text like this sentence, repeated. GitNano compresses text like this sentence, repeated. "
+                       "GitNano compresses text like this sentence, repeated. GitNano compresses text like this sentence, repeated.";
+    TEST_ASSERT(compress_looks_incompressible(noise, sizeof(noise)), "Random bytes look incompressible");
+    TEST_ASSERT(!compress_looks_incompressible(text, strlen(text)), "Text looks compressible");
+    object_id noise_oid;
+    TEST_ASSERT(blob_write((const char *)noise, sizeof(noise), &noise_oid) == 0, "Write incompressible blob");
+    TEST_ASSERT(blob_read(&noise_oid, &read_back, &read_size) == 0 && read_size == sizeof(noise) &&
+                memcmp(read_back, noise, sizeof(noise)) == 0, "Stored blob reads back");
+    free(read_back);
+    char noise_path[MAX_PATH];
+    struct stat noise_st;
+    get_object_path(&noise_oid, noise_path);
+    TEST_ASSERT(stat(noise_path, &noise_st) == 0 && (size_t)noise_st.st_size > sizeof(noise),
+                "Incompressible blob is stored uncompressed");
+
+    // The loose set answers existence checks and notices objects removed behind its back
+    object_id set_oid;
+    char set_path[MAX_PATH];
+    TEST_ASSERT(blob_write("Loose set entry", strlen("Loose set entry"), &set_oid) == 0, "Write blob for loose set");
+    TEST_ASSERT(loose_set_contains(&set_oid) == 1, "Loose set knows the new object");
+    get_object_path(&set_oid, set_path);
+    usleep(50000);  // let coarse file timestamps move past the last set update
+    TEST_ASSERT(unlink(set_path) == 0, "Remove object file outside gitnano");
+    object_store_reset();
+    TEST_ASSERT(loose_set_contains(&set_oid) == 0, "Stale loose set is rebuilt");
+    TEST_ASSERT(!blob_exists(&set_oid), "Removed object no longer exists");
+
+    // An object the set never recorded, in the same timestamp tick as the set
+    // file (a writer that died between rename and append), is still found
+    const char *set_file = OBJECTS_DIR "/info/loose-set";
+    struct stat set_st;
+    TEST_ASSERT(blob_write("Unrecorded entry", strlen("Unrecorded entry"), &set_oid) == 0 &&
+                stat(set_file, &set_st) == 0 && truncate(set_file, set_st.st_size - oid_raw_size(&set_oid)) == 0,
+                "Drop the last loose set record");
+    get_object_path(&set_oid, set_path);
+    *strrchr(set_path, '/') = '\0';
+    struct timespec same_tick[2] = {{time(NULL) + 1000, 0}, {time(NULL) + 1000, 0}};
+    TEST_ASSERT(utimensat(AT_FDCWD, set_file, same_tick, 0) == 0 &&
+                utimensat(AT_FDCWD, set_path, same_tick, 0) == 0, "Give the set and the fanout the same mtime");
+    object_store_reset();
+    TEST_ASSERT(loose_set_contains(&set_oid) == 1 && blob_exists(&set_oid), "Same-tick change marks the set stale");
+
+    // A plain chdir into another repository switches the object store
+    TEST_ASSERT(blob_exists(&streamed_oid) && mkdir_p("other_repo/" OBJECTS_DIR) == 0 && chdir("other_repo") == 0 &&
+                !blob_exists(&streamed_oid), "Objects of the previous repository are not seen");
+    TEST_ASSERT(chdir("..") == 0 && blob_exists(&streamed_oid), "Objects are seen again after returning");
+
+    // Parallel tree builds give the same tree as a single-threaded one
+    mkdir("tree_src", 0755);
+    mkdir("tree_src/sub", 0755);
+    mkdir("tree_src/sub/deeper", 0755);
+    mkdir("tree_src/other", 0755);
+    for (int i = 0; i < 24; i++) {
+        char name[MAX_PATH], content[64];
+        const char *dirs[] = {"tree_src", "tree_src/sub", "tree_src/sub/deeper", "tree_src/other"};
+        snprintf(name, sizeof(name), "%s/file_%02d.txt", dirs[i % 4], i);
+        snprintf(content, sizeof(content), "Tree build content %d", i);
+        create_test_file(name, content);
+    }
+    char long_name[256], long_path[MAX_PATH];
+    memset(long_name, 'n', 255);
+    long_name[255] = '\0';
+    snprintf(long_path, sizeof(long_path), "tree_src/other/%s", long_name);
+    create_test_file(long_path, "Long name");
+    object_id parallel_tree, serial_tree;
+    setenv("GITNANO_THREADS", "4", 1);
+    TEST_ASSERT(tree_build("tree_src", &parallel_tree) == 0, "Build tree with 4 threads");
+    setenv("GITNANO_THREADS", "1", 1);
+    TEST_ASSERT(tree_build("tree_src", &serial_tree) == 0, "Build tree with 1 thread");
+    unsetenv("GITNANO_THREADS");
+    TEST_ASSERT(oid_equal(&parallel_tree, &serial_tree), "Tree id does not depend on thread count");
+
+    // Path lookups go through the flat index of the root tree
+    uint32_t lookup_mode;
+    object_id lookup_oid, expected_oid;
+    object_hash("blob", "Tree build content 6", strlen("Tree build content 6"), &expected_oid);
+    TEST_ASSERT(tree_lookup_path(&serial_tree, "sub/deeper/file_06.txt", &lookup_mode, &lookup_oid) == 0 &&
+                lookup_mode == TREE_MODE_FILE && oid_equal(&lookup_oid, &expected_oid), "Look up nested file by path");
+    snprintf(long_path, sizeof(long_path), "other/%s", long_name);
+    object_hash("blob", "Long name", strlen("Long name"), &expected_oid);
+    TEST_ASSERT(tree_lookup_path(&serial_tree, long_path, &lookup_mode, &lookup_oid) == 0 &&
+                oid_equal(&lookup_oid, &expected_oid), "Look up file with a maximum-length name");
+    TEST_ASSERT(tree_lookup_path(&serial_tree, "/sub//deeper/", &lookup_mode, &lookup_oid) == 0 &&
+                TREE_MODE_IS_DIR(lookup_mode), "Look up directory with stray slashes");
+    // Directories filled out of path order are merged in place
+    int all_found = 1;
+    for (int i = 23; i >= 0; i--) {
+        char name[MAX_PATH], content[64];
+        const char *dirs[] = {"", "sub/", "sub/deeper/", "other/"};
+        snprintf(name, sizeof(name), "%sfile_%02d.txt", dirs[i % 4], i);
+        snprintf(content, sizeof(content), "Tree build content %d", i);
+        object_hash("blob", content, strlen(content), &expected_oid);
+        if (tree_lookup_path(&serial_tree, name, &lookup_mode, &lookup_oid) != 0 ||
+            !oid_equal(&lookup_oid, &expected_oid)) {
+            all_found = 0;
+        }
+    }
+    TEST_ASSERT(all_found, "Every file is found after directories are filled out of order");
+    TEST_ASSERT(tree_lookup_path(&serial_tree, "sub/missing.txt", &lookup_mode, &lookup_oid) != 0 &&
+                tree_lookup_path(&serial_tree, "/", &lookup_mode, &lookup_oid) != 0, "Missing paths are not found");
+
+    // A lookup reads only the trees on its way down, and only once
+    size_t reads_hits, reads_misses, reads_hits_after, reads_misses_after;
+    object_store_reset();
+    object_cache_stats(&reads_hits, &reads_misses);
+    TEST_ASSERT(tree_lookup_path(&serial_tree, "sub/deeper/file_06.txt", NULL, NULL) == 0 &&
+                tree_lookup_path(&serial_tree, "sub/deeper/file_02.txt", NULL, NULL) == 0, "Look up two nested files");
+    object_cache_stats(&reads_hits_after, &reads_misses_after);
+    TEST_ASSERT(reads_hits_after + reads_misses_after - reads_hits - reads_misses == 3,
+                "Lookups read only the trees along the path");
+
+    // Trees round-trip through their compact form with binary modes and arena names
+    gitnano_tree *built = tree_new(3, 32), *parsed = NULL;
+    object_id built_oid;
+    TEST_ASSERT(tree_add(built, TREE_MODE_EXEC, &set_oid, "run.sh", 6) == 0 &&
+                tree_add(built, TREE_MODE_DIR, &serial_tree, "dir", 3) == 0 &&
+                tree_add(built, TREE_MODE_FILE, &parallel_tree, "a.txt", 5) == 0, "Add tree entries");
+    TEST_ASSERT(tree_add(built, TREE_MODE_FILE, &set_oid, "full", 4) != 0, "Full tree refuses more entries");
+    tree_sort(built);
+    TEST_ASSERT(tree_write(built, &built_oid) == 0 && tree_parse(&built_oid, &parsed) == 0 && parsed->count == 3,
+                "Write and parse compact tree");
+    const tree_entry *found = tree_find(parsed, "dir");
+    TEST_ASSERT(found && found->type == TREE_ENTRY_TREE && found->mode == TREE_MODE_DIR &&
+                oid_equal(&found->oid, &serial_tree), "Find subtree entry");
+    found = tree_find(parsed, "run.sh");
+    TEST_ASSERT(found && found->type == TREE_ENTRY_BLOB && found->mode == TREE_MODE_EXEC && found->name_len == 6 &&
+                strcmp(tree_entry_name(parsed, found), "run.sh") == 0, "Find executable entry");
+    TEST_ASSERT(strcmp(tree_entry_name(parsed, &parsed->entries[0]), "a.txt") == 0 && !tree_find(parsed, "missing"),
+                "Parsed entries are sorted by name");
+    tree_free(built);
+    tree_free(parsed);
+
+    // Subtrees sort as if their names ended in '/', and lookups find either kind
+    gitnano_tree *ordered = tree_new(3, 32);
+    tree_add(ordered, TREE_MODE_DIR, &serial_tree, "a", 1);
+    tree_add(ordered, TREE_MODE_FILE, &set_oid, "a.txt", 5);
+    tree_add(ordered, TREE_MODE_FILE, &set_oid, "a-b", 3);
+    tree_sort(ordered);
+    TEST_ASSERT(strcmp(tree_entry_name(ordered, &ordered->entries[0]), "a-b") == 0 &&
+                strcmp(tree_entry_name(ordered, &ordered->entries[1]), "a.txt") == 0 &&
+                strcmp(tree_entry_name(ordered, &ordered->entries[2]), "a") == 0, "Entries sort in git tree order");
+    TEST_ASSERT(tree_find(ordered, "a") == &ordered->entries[2] && tree_find(ordered, "a-b") == &ordered->entries[0] &&
+                !tree_find(ordered, "a.tx"), "Binary search finds files and subtrees");
+    tree_free(ordered);
+
+    // Trees written in plain name order are re-sorted when parsed
+    char legacy[2 * (6 + 1 + 5 + 1 + SHA1_RAW_SIZE)];
+    size_t legacy_len = 0;
+    legacy_len += (size_t)sprintf(legacy + legacy_len, "040000 a") + 1;
+    memcpy(legacy + legacy_len, serial_tree.hash, SHA1_RAW_SIZE);
+    legacy_len += SHA1_RAW_SIZE;
+    legacy_len += (size_t)sprintf(legacy + legacy_len, "100644 a.txt") + 1;
+    memcpy(legacy + legacy_len, set_oid.hash, SHA1_RAW_SIZE);
+    legacy_len += SHA1_RAW_SIZE;
+    object_id legacy_oid;
+    TEST_ASSERT(object_write("tree", legacy, legacy_len, &legacy_oid) == 0 && tree_parse(&legacy_oid, &parsed) == 0 &&
+                parsed->count == 2 && strcmp(tree_entry_name(parsed, &parsed->entries[0]), "a.txt") == 0 &&
+                tree_find(parsed, "a") && tree_find(parsed, "a")->type == TREE_ENTRY_TREE, "Legacy tree order is repaired");
+    tree_free(parsed);
+
+    // The iterator views entries in place, in on-disk order
+    tree_iter iter;
+    size_t iter_count = 0;
+    int iter_in_place = 1;
+    TEST_ASSERT(tree_iter_open(&iter, &legacy_oid) == 0, "Open tree iterator");
+    while (tree_iter_next(&iter)) {
+        object_id iter_oid;
+        tree_iter_oid(&iter, &iter_oid);
+        iter_in_place &= iter.name >= (const char *)iter.obj.data && iter.name < iter.end &&
+                         oid_equal(&iter_oid, iter_count == 0 ? &serial_tree : &set_oid);
+        iter_count++;
+    }
+    tree_iter_close(&iter);
+    TEST_ASSERT(iter_count == 2 && iter_in_place, "Iterator yields every entry from the object buffer");
+
+    // Atomic writes replace the whole file and leave no temporary behind
+    TEST_ASSERT(write_file_atomic("atomic.txt", "first version", 13, 1) == 0, "Atomic write of new file");
+    TEST_ASSERT(write_file_atomic("atomic.txt", "second", 6, 0) == 0, "Atomic overwrite");
+    char *atomic_data = read_file("atomic.txt", &read_size);
+    TEST_ASSERT(atomic_data && read_size == 6 && memcmp(atomic_data, "second", 6) == 0, "Atomic write replaced content");
+    free(atomic_data);
+    TEST_ASSERT(system("ls atomic.txt.tmp_* >/dev/null 2>&1") != 0, "No temporary file left behind");
+
+    // Objects written in a sync batch are flushed together
+    object_id synced_oid;
+    object_sync_begin();
+    TEST_ASSERT(blob_write("Synced blob", strlen("Synced blob"), &synced_oid) == 0, "Write blob in sync batch");
+    TEST_ASSERT(object_sync_end() == 0, "Flush sync batch");
+    TEST_ASSERT(blob_exists(&synced_oid), "Synced blob exists");
+
+    // Large files are mapped, small ones read; both give the same blob as an in-memory write
+    size_t big_size = 256 * 1024;
+    char *big = safe_malloc(big_size);
+    for (size_t i = 0; i < big_size; i++) big[i] = 'a' + i % 23;
+    TEST_ASSERT(write_file("big.bin", big, big_size) == 0, "Write large file");
+    mapped_file mapped;
+    TEST_ASSERT(mapped_file_open("big.bin", &mapped) == 0 && mapped.mapped && mapped.size == big_size &&
+                memcmp(mapped.data, big, big_size) == 0, "Large file is mapped");
+    mapped_file_close(&mapped);
+    TEST_ASSERT(mapped_file_open("atomic.txt", &mapped) == 0 && !mapped.mapped && mapped.size == 6,
+                "Small file is read into memory");
+    mapped_file_close(&mapped);
+    object_id file_oid, memory_oid;
+    char file_sha1[SHA1_HEX_SIZE], memory_sha1[SHA1_HEX_SIZE];
+    TEST_ASSERT(blob_create_from_file("big.bin", &file_oid) == 0, "Create blob from mapped file");
+    TEST_ASSERT(object_hash("blob", big, big_size, &memory_oid) == 0 && oid_equal(&file_oid, &memory_oid),
+                "Mapped blob matches in-memory blob");
+    TEST_ASSERT(sha1_file("big.bin", file_sha1) == 0 && sha1_data(big, big_size, memory_sha1) == 0 &&
+                strcmp(file_sha1, memory_sha1) == 0, "sha1_file matches sha1_data");
+    free(big);
+
+    // Files past the streaming threshold are ingested in chunks with the same result
+    size_t huge_size = 64 * 1024 * 1024 + 4097;
+    FILE *huge_fp = fopen("huge.bin", "wb");
+    TEST_ASSERT(huge_fp && fputs("streamed header", huge_fp) >= 0 &&
+                ftruncate(fileno(huge_fp), huge_size) == 0 && fclose(huge_fp) == 0, "Create huge sparse file");
+    char *huge = calloc(1, huge_size);
+    memcpy(huge, "streamed header", strlen("streamed header"));
+    TEST_ASSERT(blob_create_from_file("huge.bin", &file_oid) == 0, "Stream huge file into a blob");
+    TEST_ASSERT(object_hash("blob", huge, huge_size, &memory_oid) == 0 && oid_equal(&file_oid, &memory_oid),
+                "Streamed blob matches in-memory blob");
+    free(huge);
+    struct stat huge_st;
+    char huge_head[16];
+    FILE *extracted_fp = NULL;
+    TEST_ASSERT(extract_blob(&file_oid, "extracted/huge.bin") == 0 && stat("extracted/huge.bin", &huge_st) == 0 &&
+                (size_t)huge_st.st_size == huge_size && (extracted_fp = fopen("extracted/huge.bin", "rb")) != NULL &&
+                fread(huge_head, 1, sizeof(huge_head), extracted_fp) == sizeof(huge_head) &&
+                memcmp(huge_head, "streamed header", strlen("streamed header")) == 0,
+                "Huge blob is inflated straight to its file");
+    if (extracted_fp) fclose(extracted_fp);
+    unlink("extracted/huge.bin");
+    unlink("huge.bin");
+
+    // Chunked blobs reassemble transparently and share unchanged chunks across versions
+    size_t chunked_size = 6 * 1024 * 1024;
+    unsigned char *chunked = safe_malloc(chunked_size);
+    for (size_t i = 0; i < chunked_size; i++) {
+        seed = seed * 1103515245 + 12345;
+        chunked[i] = seed >> 24;
+    }
+    setenv("GITNANO_CHUNK_THRESHOLD", "1M", 1);
+    object_id v1_oid, v2_oid;
+    TEST_ASSERT(write_file("chunked.bin", chunked, chunked_size) == 0 &&
+                blob_create_from_file("chunked.bin", &v1_oid) == 0, "Create chunked blob");
+    memcpy(chunked + chunked_size / 2, "small edit", 10);
+    TEST_ASSERT(write_file("chunked.bin", chunked, chunked_size) == 0 &&
+                blob_create_from_file("chunked.bin", &v2_oid) == 0, "Create edited chunked blob");
+    unsetenv("GITNANO_CHUNK_THRESHOLD");
+
+    gitnano_object v1_manifest, v2_manifest;
+    TEST_ASSERT(object_read(&v1_oid, &v1_manifest) == 0 && strcmp(v1_manifest.type, "manifest") == 0,
+                "Large file is stored as a manifest");
+    TEST_ASSERT(object_read(&v2_oid, &v2_manifest) == 0, "Read edited manifest");
+    size_t v1_chunks = 0, shared_chunks = 0;
+    for (char *line = v1_manifest.data; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        v1_chunks++;
+        if (memmem(v2_manifest.data, v2_manifest.size, line, SHA1_HEX_SIZE - 1)) {
+            shared_chunks++;
+        }
+    }
+    printf("  INFO: %zu chunks, %zu shared after a small edit\n", v1_chunks, shared_chunks);
+    TEST_ASSERT(v1_chunks > 2 && shared_chunks >= v1_chunks - 2, "Only chunks around the edit change");
+    object_free(&v1_manifest);
+    object_free(&v2_manifest);
+
+    TEST_ASSERT(blob_read(&v2_oid, &read_back, &read_size) == 0 && read_size == chunked_size &&
+                memcmp(read_back, chunked, chunked_size) == 0, "Chunked blob reads back");
+    free(read_back);
+    TEST_ASSERT(extract_blob(&v2_oid, "extracted/chunked.bin") == 0, "Extract chunked blob");
+    read_back = read_file("extracted/chunked.bin", &read_size);
+    TEST_ASSERT(read_back && read_size == chunked_size && memcmp(read_back, chunked, chunked_size) == 0,
+                "Extracted chunked blob matches");
+    free(read_back);
+    free(chunked);
+
     TEST_TEARDOWN();
     return 1;
 }
@@ -115,6 +578,187 @@ int test_auto_sync_commits() {
     printf("  Making third commit (with auto-sync)...\n");
     TEST_ASSERT(gitnano_commit("Third commit with new file") == 0, "Third commit successful");
 
+    // Commits are written from the index; unchanged directories keep their cached trees
+    char test_cwd[MAX_PATH], workspace_path[MAX_PATH];
+    TEST_ASSERT(mkdir("nested", 0755) == 0 && mkdir("nested/deep", 0755) == 0 &&
+                create_test_file("nested/deep/file.txt", "Nested file"), "Create nested file");
+    TEST_ASSERT(gitnano_add("nested/deep/file.txt") == 0 && gitnano_commit("Nested commit") == 0, "Commit nested file");
+    TEST_ASSERT(getcwd(test_cwd, sizeof(test_cwd)) && get_workspace_path(workspace_path, sizeof(workspace_path)) == 0,
+                "Get workspace path");
+
+    object_id head_oid, head_tree, built_tree, nested_before, nested_after;
+    gitnano_index index;
+    TEST_ASSERT(chdir(workspace_path) == 0 && get_current_commit(&head_oid) == 0 &&
+                commit_get_tree(&head_oid, &head_tree) == 0 && tree_build(".", &built_tree) == 0 &&
+                oid_equal(&head_tree, &built_tree), "Index tree matches the workspace");
+    TEST_ASSERT(index_read(&index) == 0 && index_find(&index, "nested/deep/file.txt") &&
+                index.tree_count > 0 && strcmp(index.trees[0].path, "") == 0 &&
+                oid_equal(&index.trees[0].oid, &head_tree), "Index stages files and caches the root tree");
+    for (size_t i = 0; i < index.tree_count; i++) {
+        if (strcmp(index.trees[i].path, "nested") == 0) oid_copy(&nested_before, &index.trees[i].oid);
+    }
+    index_free(&index);
+    TEST_ASSERT(chdir(test_cwd) == 0, "Leave workspace");
+
+    TEST_ASSERT(create_test_file("test.txt", "Third version") && gitnano_commit("Top-level change") == 0,
+                "Commit a top-level change");
+    TEST_ASSERT(chdir(workspace_path) == 0 && index_read(&index) == 0, "Read index after commit");
+    oid_clear(&nested_after);
+    for (size_t i = 0; i < index.tree_count; i++) {
+        if (strcmp(index.trees[i].path, "nested") == 0) oid_copy(&nested_after, &index.trees[i].oid);
+    }
+    index_free(&index);
+    TEST_ASSERT(oid_equal(&nested_before, &nested_after), "Untouched directory keeps its cached tree");
+
+    // An index in the old append-only format is rebuilt from the workspace
+    TEST_ASSERT(write_file(INDEX_FILE, "0123 old-style line\n", 20) == 0, "Write old-style index");
+    TEST_ASSERT(chdir(test_cwd) == 0 && gitnano_commit("After legacy index") == 0, "Commit with old-style index");
+    TEST_ASSERT(chdir(workspace_path) == 0 && get_current_commit(&head_oid) == 0 &&
+                commit_get_tree(&head_oid, &head_tree) == 0 && tree_build(".", &built_tree) == 0 &&
+                oid_equal(&head_tree, &built_tree) && index_read(&index) == 0, "Old-style index is reseeded");
+    index_free(&index);
+
+    // The index is binary, checksummed and written through a lock file
+    size_t index_size;
+    char *index_data = read_file(INDEX_FILE, &index_size);
+    TEST_ASSERT(index_data && index_size > 12 && memcmp(index_data, INDEX_SIGNATURE, 4) == 0, "Index has binary header");
+    index_data[index_size / 2] ^= 0x40;
+    TEST_ASSERT(write_file(INDEX_FILE, index_data, index_size) == 0 && index_read(&index) == -1,
+                "Corrupt index is rejected");
+    index_data[index_size / 2] ^= 0x40;
+    TEST_ASSERT(write_file(INDEX_FILE, index_data, index_size) == 0 && index_read(&index) == 0, "Restored index reads");
+    TEST_ASSERT(write_file(INDEX_LOCK_FILE, "", 0) == 0 && index_write(&index) != 0 && unlink(INDEX_LOCK_FILE) == 0 &&
+                index_write(&index) == 0, "Index write fails while locked");
+    index_free(&index);
+
+    // The lock is held from read to write, so a second read-modify-write
+    // fails instead of overwriting the first one's changes
+    gitnano_index second;
+    TEST_ASSERT(index_read_locked(&index) == 0 && index_read_locked(&second) == -1, "Second locked read fails");
+    TEST_ASSERT(chdir(test_cwd) == 0 && gitnano_add("test.txt") != 0 &&
+                chdir(workspace_path) == 0, "Add fails while the index is locked");
+    TEST_ASSERT(index_write(&index) == 0 && !file_exists(INDEX_LOCK_FILE), "Write releases the lock");
+    index_free(&index);
+    index_free(&second);
+    TEST_ASSERT(index_read_locked(&index) == 0, "Lock is free again");
+    index_free(&index);
+    TEST_ASSERT(!file_exists(INDEX_LOCK_FILE), "Freeing an unwritten index releases the lock");
+    free(index_data);
+    TEST_ASSERT(chdir(test_cwd) == 0, "Leave workspace");
+
+    // A file whose stat data matches its index entry is not synced or hashed
+    struct timespec past[2] = {{1000000000, 0}, {1000000000, 0}};
+    TEST_ASSERT(utimensat(AT_FDCWD, "test.txt", past, 0) == 0 && gitnano_commit("Restamp") == 0, "Commit restamped file");
+    char *workspace_file = safe_asprintf("%s/test.txt", workspace_path);
+    TEST_ASSERT(write_file(workspace_file, "stale", 5) == 0 && gitnano_commit("Unchanged stat") == 0, "Commit unchanged file");
+    size_t stale_size;
+    char *stale = read_file(workspace_file, &stale_size);
+    TEST_ASSERT(stale && stale_size == 5 && memcmp(stale, "stale", 5) == 0, "Unchanged file is skipped");
+    free(stale);
+    TEST_ASSERT(write_file(workspace_file, "Third version", 13) == 0, "Restore workspace file");
+    free(workspace_file);
+
+    // Status counts staged files that differ from HEAD
+    gitnano_status_info status;
+    TEST_ASSERT(chdir(workspace_path) == 0 && gitnano_get_status(&status) == 0 && status.staged_files == 0 &&
+                chdir(test_cwd) == 0, "Nothing staged after commit");
+    TEST_ASSERT(create_test_file("staged.txt", "staged") && gitnano_add("staged.txt") == 0 &&
+                chdir(workspace_path) == 0 && gitnano_get_status(&status) == 0 && status.staged_files == 1 &&
+                chdir(test_cwd) == 0, "Added file counts as staged");
+
+    // A split index writes only the entries changed since its shared index
+    char shared_hex[OID_MAX_HEX_SIZE];
+    object_id shared_oid;
+    size_t total;
+    setenv("GITNANO_SPLIT_INDEX", "true", 1);
+    setenv("GITNANO_SPLIT_INDEX_MAX_PERCENT", "50", 1);
+    TEST_ASSERT(chdir(workspace_path) == 0 && index_read(&index) == 0 && index_write(&index) == 0 &&
+                !oid_is_null(&index.base_oid), "Split index writes a shared index");
+    oid_copy(&shared_oid, &index.base_oid);
+    total = index.count;
+    index_free(&index);
+    char *shared_path = safe_asprintf("%s.%s", INDEX_SHARED_FILE, oid_to_hex(&shared_oid, shared_hex));
+    TEST_ASSERT(file_exists(shared_path), "Shared index exists");
+    TEST_ASSERT(chdir(test_cwd) == 0 && create_test_file("split.txt", "split") && gitnano_add("split.txt") == 0 &&
+                chdir(workspace_path) == 0 && index_read(&index) == 0 && oid_equal(&index.base_oid, &shared_oid) &&
+                index.count == total + 1 && index_find(&index, "split.txt"), "Delta is merged with the shared index");
+    index_free(&index);
+    index_data = read_file(INDEX_FILE, &index_size);
+    TEST_ASSERT(index_data && index_size > 12 && index_data[11] == 1, "Index holds only the delta");
+    free(index_data);
+
+    // Past the size limit the delta is folded into a new shared index; the
+    // old one stays for readers still linked to it until it expires
+    setenv("GITNANO_SPLIT_INDEX_MAX_PERCENT", "0", 1);
+    TEST_ASSERT(index_read(&index) == 0 && index_write(&index) == 0 && !oid_is_null(&index.base_oid) &&
+                !oid_equal(&index.base_oid, &shared_oid), "Delta is folded");
+    char *folded_path = safe_asprintf("%s.%s", INDEX_SHARED_FILE, oid_to_hex(&index.base_oid, shared_hex));
+    index_free(&index);
+    TEST_ASSERT(file_exists(shared_path) && file_exists(folded_path), "Superseded shared index is kept");
+    unsetenv("GITNANO_SPLIT_INDEX_MAX_PERCENT");
+    unsetenv("GITNANO_SPLIT_INDEX");
+    setenv("GITNANO_SHARED_INDEX_EXPIRE", "now", 1);
+    TEST_ASSERT(index_read(&index) == 0 && index_write(&index) == 0 && oid_is_null(&index.base_oid) &&
+                index.count == total + 1, "Index is unsplit");
+    unsetenv("GITNANO_SHARED_INDEX_EXPIRE");
+    index_free(&index);
+    TEST_ASSERT(!file_exists(shared_path) && !file_exists(folded_path), "Expired shared indexes are removed");
+    free(folded_path);
+    free(shared_path);
+
+    // Commits are recorded in a commit-graph chain with generation numbers
+    commit_graph_entry graph_entry;
+    object_id root_oid, parent_oid;
+    TEST_ASSERT(get_current_commit(&head_oid) == 0 && commit_graph_lookup(&head_oid, &graph_entry) == 0 &&
+                commit_get_tree(&head_oid, &head_tree) == 0 && oid_equal(&graph_entry.tree_oid, &head_tree),
+                "Head commit is in the commit-graph");
+    uint32_t head_generation = graph_entry.generation;
+    oid_copy(&root_oid, &head_oid);
+    while (commit_get_parent(&root_oid, &parent_oid) == 0) oid_copy(&root_oid, &parent_oid);
+    TEST_ASSERT(commit_graph_lookup(&root_oid, &graph_entry) == 0 && graph_entry.generation == 1 &&
+                oid_is_null(&graph_entry.parent_oid) && head_generation > 1, "Root commit has generation 1");
+    TEST_ASSERT(commit_is_ancestor(&root_oid, &head_oid) == 1 && commit_is_ancestor(&head_oid, &root_oid) == 0 &&
+                commit_is_ancestor(&head_oid, &head_oid) == 1, "Ancestry queries");
+    char *chain = read_file(COMMIT_GRAPH_CHAIN, &index_size);
+    size_t layers = 0;
+    for (size_t i = 0; chain && i < index_size; i++) layers += chain[i] == '\n';
+    TEST_ASSERT(chain && layers > 0 && layers < head_generation, "Commit-graph layers are merged");
+
+    // A layer whose checksum does not match is ignored
+    const char *top = strrchr(chain, '\n');
+    while (top > chain && top[-1] != '\n') top--;
+    char *layer_file = safe_asprintf("%s/graph-%.*s.graph", COMMIT_GRAPH_DIR, (int)strcspn(top, "\n"), top);
+    size_t layer_size = 0;
+    unsigned char *layer_data = (unsigned char *)read_file(layer_file, &layer_size);
+    TEST_ASSERT(layer_data && layer_size > SHA1_RAW_SIZE, "Read top commit-graph layer");
+    unsigned char original = layer_data[layer_size - SHA1_RAW_SIZE - 1];
+    layer_data[layer_size - SHA1_RAW_SIZE - 1] ^= 0xff;
+    TEST_ASSERT(unlink(layer_file) == 0 && write_file(layer_file, layer_data, layer_size) == 0,
+                "Corrupt top commit-graph layer");
+    commit_graph_release();
+    TEST_ASSERT(commit_graph_lookup(&head_oid, &graph_entry) != 0 && commit_is_ancestor(&root_oid, &head_oid) == 1,
+                "Corrupt commit-graph layer is ignored");
+    layer_data[layer_size - SHA1_RAW_SIZE - 1] = original;
+    TEST_ASSERT(unlink(layer_file) == 0 && write_file(layer_file, layer_data, layer_size) == 0,
+                "Restore top commit-graph layer");
+    commit_graph_release();
+    TEST_ASSERT(commit_graph_lookup(&head_oid, &graph_entry) == 0, "Restored commit-graph layer is used");
+    free(layer_data);
+    free(layer_file);
+    free(chain);
+
+    // Without the chain, history is read from the commit objects and the
+    // next commit records all of it again
+    TEST_ASSERT(unlink(COMMIT_GRAPH_CHAIN) == 0, "Remove commit-graph chain");
+    commit_graph_release();
+    TEST_ASSERT(commit_graph_lookup(&head_oid, &graph_entry) != 0 && commit_is_ancestor(&root_oid, &head_oid) == 1,
+                "History is walked without the commit-graph");
+    TEST_ASSERT(chdir(test_cwd) == 0 && create_test_file("graph.txt", "graph") && gitnano_commit("Graph") == 0 &&
+                chdir(workspace_path) == 0 && get_current_commit(&head_oid) == 0 &&
+                commit_graph_lookup(&head_oid, &graph_entry) == 0 && graph_entry.generation == head_generation + 1,
+                "Commit-graph is rebuilt");
+    TEST_ASSERT(chdir(test_cwd) == 0, "Leave workspace");
+
     TEST_TEARDOWN();
     return 1;
 }
@@ -179,6 +823,14 @@ int test_complete_workflow() {
     printf("  Commit history (should show 3 commits):\n");
     TEST_ASSERT(gitnano_log() == 0, "Log functionality works");
 
+    // Walking the same history again is served from the object cache
+    size_t hits_before, hits_after, misses_before, misses_after;
+    object_cache_stats(&hits_before, &misses_before);
+    TEST_ASSERT(gitnano_log() == 0, "Log runs again");
+    object_cache_stats(&hits_after, &misses_after);
+    TEST_ASSERT(hits_after > hits_before, "Repeated commit reads hit the object cache");
+    TEST_ASSERT(misses_after == misses_before, "Repeated log does not miss the object cache");
+
     TEST_TEARDOWN();
     return 1;
 }
@@ -256,6 +908,190 @@ int test_checkout_functionality() {
     return 1;
 }
 
+// Test 7: Pack storage
+int test_pack_storage() {
+    TEST_SETUP("Testing Pack Storage");
+
+    TEST_ASSERT(gitnano_init() == 0, "Repository initialization");
+
+    TEST_ASSERT(create_test_file("pack_test.txt", "Packed first version"), "Create first file");
+    TEST_ASSERT(create_test_file("empty.txt", ""), "Create empty file");
+    TEST_ASSERT(gitnano_commit("First commit") == 0, "Create first commit");
+
+    TEST_ASSERT(create_test_file("pack_test.txt", "Packed second version"), "Modify file");
+    TEST_ASSERT(gitnano_commit("Second commit") == 0, "Create second commit");
+
+    TEST_ASSERT(gitnano_repack() == 0, "Repack objects");
+
+    // All loose objects should have moved into the pack
+    char workspace_path[MAX_PATH];
+    TEST_ASSERT(get_workspace_path(workspace_path, sizeof(workspace_path)) == 0, "Get workspace path");
+    char *objects_dir = safe_asprintf("%s/%s", workspace_path, OBJECTS_DIR);
+    int loose_dirs = 0;
+    DIR *dir = opendir(objects_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strlen(entry->d_name) == 2 && entry->d_name[0] != '.') loose_dirs++;
+        }
+        closedir(dir);
+    }
+    free(objects_dir);
+    TEST_ASSERT(loose_dirs == 0, "No loose objects left after repack");
+
+    TEST_ASSERT(gitnano_log() == 0, "Log reads packed commits");
+    TEST_ASSERT(gitnano_checkout("HEAD~1", "pack_test.txt") == 0, "Path checkout from packed objects");
+
+    FILE *f = fopen("pack_test.txt", "r");
+    char content[256] = {0};
+    if (f) {
+        fread(content, 1, sizeof(content) - 1, f);
+        fclose(f);
+    }
+    TEST_ASSERT(strstr(content, "Packed first version") != NULL, "Restored content comes from the pack");
+
+    // New loose objects coexist with the pack and fold into it on the next repack
+    TEST_ASSERT(create_test_file("pack_test.txt", "Packed third version"), "Modify file again");
+    TEST_ASSERT(gitnano_commit("Third commit") == 0, "Commit on top of packed history");
+    TEST_ASSERT(gitnano_repack() == 0, "Repack again");
+    TEST_ASSERT(gitnano_checkout("HEAD~2", "pack_test.txt") == 0, "Path checkout after second repack");
+
+    // Partial ids resolve against packed commits in either case; malformed references are refused
+    char test_cwd[MAX_PATH];
+    object_id head_oid, resolved_oid;
+    char head_hex[OID_MAX_HEX_SIZE];
+    TEST_ASSERT(getcwd(test_cwd, sizeof(test_cwd)) && chdir(workspace_path) == 0, "Enter workspace");
+    TEST_ASSERT(get_current_commit(&head_oid) == 0, "Read HEAD commit");
+    oid_to_hex(&head_oid, head_hex);
+    head_hex[7] = '\0';
+    for (char *p = head_hex; *p; p++) *p = toupper((unsigned char)*p);
+    TEST_ASSERT(resolve_reference(head_hex, &resolved_oid) == 0 && oid_equal(&resolved_oid, &head_oid),
+                "Resolve odd-length uppercase partial id from a pack");
+    TEST_ASSERT(resolve_reference("../../HEAD", &resolved_oid) != 0, "Reference outside refs is rejected");
+    TEST_ASSERT(resolve_reference("HEAD~1x", &resolved_oid) != 0, "Malformed HEAD~N is rejected");
+    TEST_ASSERT(chdir(test_cwd) == 0, "Leave workspace");
+
+    // Similar versions of a larger file are stored as deltas and read back intact
+    char *large = safe_malloc(8192);
+    size_t len = 0;
+    for (int i = 0; i < 200; i++) {
+        len += snprintf(large + len, 8192 - len, "line %d of the delta test file\n", i);
+    }
+    TEST_ASSERT(create_test_file("delta_test.txt", large), "Create large file");
+    TEST_ASSERT(gitnano_commit("Large file") == 0, "Commit large file");
+    memcpy(large + 100, "EDITED", 6);
+    TEST_ASSERT(create_test_file("delta_test.txt", large), "Edit large file");
+    TEST_ASSERT(gitnano_commit("Edit large file") == 0, "Commit edited file");
+    TEST_ASSERT(gitnano_repack() == 0, "Repack with deltas");
+    TEST_ASSERT(gitnano_checkout("HEAD~1", "delta_test.txt") == 0, "Checkout delta base version");
+
+    f = fopen("delta_test.txt", "r");
+    char *restored = safe_malloc(8192);
+    size_t restored_len = 0;
+    if (f) {
+        restored_len = fread(restored, 1, 8191, f);
+        fclose(f);
+    }
+    restored[restored_len] = '\0';
+    TEST_ASSERT(strstr(restored, "EDITED") == NULL && restored_len == len, "Older version restored from delta pack");
+    free(restored);
+    free(large);
+
+    // Chunk manifests stay loose so packs remain readable by Git
+    size_t chunked_size = 3 * 1024 * 1024;
+    unsigned char *chunked = safe_malloc(chunked_size);
+    for (size_t i = 0; i < chunked_size; i++) {
+        chunked[i] = (i * 2654435761u) >> 13;
+    }
+    setenv("GITNANO_CHUNK_THRESHOLD", "1M", 1);
+    TEST_ASSERT(write_file("chunked_pack.bin", chunked, chunked_size) == 0 &&
+                gitnano_commit("Chunked file") == 0, "Commit chunked file");
+    unsetenv("GITNANO_CHUNK_THRESHOLD");
+    free(chunked);
+    TEST_ASSERT(gitnano_repack() == 0, "Repack with a chunked blob");
+    char manifest_path[MAX_PATH], manifest_type[16];
+    size_t manifest_size;
+    gitnano_index manifest_index;
+    const index_entry *manifest_entry;
+    TEST_ASSERT(chdir(workspace_path) == 0 && index_read(&manifest_index) == 0 &&
+                (manifest_entry = index_find(&manifest_index, "chunked_pack.bin")) != NULL,
+                "Chunked blob is staged");
+    get_object_path(&manifest_entry->oid, manifest_path);
+    TEST_ASSERT(object_read_info(&manifest_entry->oid, manifest_type, &manifest_size) == 0 &&
+                strcmp(manifest_type, "manifest") == 0 && file_exists(manifest_path),
+                "Manifest stays loose");
+    index_free(&manifest_index);
+    TEST_ASSERT(chdir(test_cwd) == 0, "Leave workspace");
+    unlink("chunked_pack.bin");
+
+    // Objects too large to pack in memory stay loose
+    FILE *huge_fp = fopen("huge_pack.bin", "wb");
+    TEST_ASSERT(huge_fp && fputs("huge pack", huge_fp) >= 0 &&
+                ftruncate(fileno(huge_fp), BLOB_STREAM_THRESHOLD + 1) == 0 && fclose(huge_fp) == 0,
+                "Create huge sparse file");
+    TEST_ASSERT(gitnano_commit("Huge file") == 0 && gitnano_repack() == 0, "Repack with a huge blob");
+    char huge_path[MAX_PATH];
+    gitnano_index index;
+    const index_entry *huge_entry;
+    TEST_ASSERT(chdir(workspace_path) == 0 &&
+                index_read(&index) == 0 && (huge_entry = index_find(&index, "huge_pack.bin")) != NULL,
+                "Huge blob is staged");
+    get_object_path(&huge_entry->oid, huge_path);
+    TEST_ASSERT(file_exists(huge_path) && blob_exists(&huge_entry->oid), "Huge blob stays loose");
+    index_free(&index);
+    TEST_ASSERT(chdir(test_cwd) == 0, "Leave workspace");
+    unlink("huge_pack.bin");
+
+    TEST_TEARDOWN();
+    return 1;
+}
+
+// Test 8: Repositories using SHA-256 and BLAKE3 object names
+int test_object_formats() {
+    TEST_SETUP("Testing Object Formats");
+
+    const char *formats[] = {"sha256", "blake3"};
+    for (int i = 0; i < 2; i++) {
+        char *repo_dir = safe_asprintf("%s/%s_repo", test_base_dir, formats[i]);
+        mkdir(repo_dir, 0755);
+        TEST_ASSERT(chdir(repo_dir) == 0, "Enter repository directory");
+        TEST_ASSERT(gitnano_init_with_format(formats[i]) == 0, "Initialize repository with object format");
+
+        TEST_ASSERT(create_test_file("format.txt", "First version"), "Create file");
+        TEST_ASSERT(gitnano_commit("First commit") == 0, "Create first commit");
+        TEST_ASSERT(create_test_file("format.txt", "Second version"), "Modify file");
+        TEST_ASSERT(gitnano_commit("Second commit") == 0, "Create second commit");
+
+        char workspace_path[MAX_PATH], head_hex[OID_MAX_HEX_SIZE];
+        object_id head_oid, parsed_oid;
+        TEST_ASSERT(get_workspace_path(workspace_path, sizeof(workspace_path)) == 0 && chdir(workspace_path) == 0,
+                    "Enter workspace");
+        TEST_ASSERT((int)repo_hash_algo() == hash_algo_by_name(formats[i]), "Repository reports its object format");
+        TEST_ASSERT(get_current_commit(&head_oid) == 0 && strlen(oid_to_hex(&head_oid, head_hex)) == 64,
+                    "Commit ids are 64 hex digits");
+        TEST_ASSERT(oid_from_hex(head_hex, &parsed_oid) == 0 && oid_equal(&parsed_oid, &head_oid),
+                    "Long id round-trips through hex");
+        TEST_ASSERT(chdir(repo_dir) == 0, "Leave workspace");
+
+        TEST_ASSERT(gitnano_log() == 0, "Log walks long ids");
+        TEST_ASSERT(gitnano_repack() == 0, "Repack long ids");
+        TEST_ASSERT(gitnano_checkout("HEAD~1", "format.txt") == 0, "Path checkout from packed objects");
+        FILE *f = fopen("format.txt", "r");
+        char content[64] = {0};
+        if (f) {
+            fread(content, 1, sizeof(content) - 1, f);
+            fclose(f);
+        }
+        TEST_ASSERT(strcmp(content, "First version") == 0, "Older version restored");
+        TEST_ASSERT(chdir(test_base_dir) == 0, "Leave repository directory");
+        free(repo_dir);
+    }
+    TEST_ASSERT(gitnano_init_with_format("md5") != 0, "Unknown object format is rejected");
+
+    TEST_TEARDOWN();
+    return 1;
+}
+
 // Array of all test functions
 typedef int (*test_func_t)();
 test_func_t all_tests[] = {
@@ -265,6 +1101,8 @@ test_func_t all_tests[] = {
     test_complete_workflow,
     test_diff_functionality,
     test_checkout_functionality,
+    test_pack_storage,
+    test_object_formats,
     NULL
 };
 
@@ -275,6 +1113,8 @@ const char* test_names[] = {
     "Complete Workflow",
     "Diff Functionality",
     "Checkout Functionality",
+    "Pack Storage",
+    "Object Formats",
     NULL
 };
 
@@ -291,11 +1131,13 @@ int main() {
     int passed = 0;
     int total = 0;
     int failed_tests = 0;
+    int test_count = 0;
+    while (all_tests[test_count] != NULL) test_count++;
 
     // Run all tests
     for (int i = 0; all_tests[i] != NULL; i++) {
         total++;
-        printf("\n--- Running Test %d/%d: %s ---\n", total, 6, test_names[i]);
+        printf("\n--- Running Test %d/%d: %s ---\n", total, test_count, test_names[i]);
 
         if (all_tests[i]()) {
             passed++;